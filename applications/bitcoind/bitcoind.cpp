@@ -17,11 +17,13 @@
 
 #include <coinChain/Node.h>
 #include <coinChain/NodeRPC.h>
+#include <coinChain/NodeREST.h>
 
 #include <coinHTTP/Server.h>
 #include <coinHTTP/Client.h>
 
 #include <coinWallet/Wallet.h>
+#include <coinWallet/WalletManager.h>
 #include <coinWallet/WalletRPC.h>
 
 #include <coinMine/Miner.h>
@@ -40,17 +42,27 @@ using namespace boost;
 using namespace boost::program_options;
 using namespace json_spirit;
 
+static method_ptr newWalletPassphrase(Wallet& wallet, asio::io_service& io_service) {
+    return method_ptr(new WalletPassphrase(wallet, io_service));
+}
+
 int main(int argc, char* argv[])
 {
     try {
         string config_file, data_dir;
         unsigned short port, rpc_port;
+        unsigned int rpc_threads;
+        unsigned int rpc_cache;
+        unsigned int rpc_max_connections, rpc_max_pipelined;
+        double rpc_rate, rpc_burst;
         string rpc_bind, rpc_connect, rpc_user, rpc_pass;
         typedef vector<string> strings;
         strings rpc_params;
-        string proxy;
+        string proxy, storage;
+        string coin_selection;
         strings connect_peers;
         strings add_peers;
+        strings wallet_names;
         bool portmap, gen, ssl;
         unsigned int timeout;
         string certchain, privkey;
@@ -73,6 +85,7 @@ int main(int argc, char* argv[])
             ("testnet", "Use the test network")
             ("proxy", value<string>(&proxy), "Connect through socks4 proxy")
             ("timeout", value<unsigned int>(&timeout)->default_value(5000), "Specify connection timeout (in milliseconds)")
+            ("storage", value<string>(&storage)->default_value("bdb"), "Block index storage backend: bdb (Berkeley DB) or log (append only log)")
             ("addnode", value<strings>(&add_peers), "Add a node to connect to")
             ("connect", value<strings>(&connect_peers), "Connect only to the specified node")
             ("port", value<unsigned short>(&port)->default_value(8333), "Listen on specified port for the p2p protocol")
@@ -80,8 +93,16 @@ int main(int argc, char* argv[])
             ("rpcpassword", value<string>(&rpc_pass), "Password for JSON-RPC connections")
             ("rpcport", value<unsigned short>(&rpc_port)->default_value(8332), "Listen for JSON-RPC connections on <arg>")
             ("rpcallowip", value<string>(&rpc_bind)->default_value(asio::ip::address_v4::loopback().to_string()), "Allow JSON-RPC connections from specified IP address")
+            ("rpcthreads", value<unsigned int>(&rpc_threads)->default_value(4), "Number of threads serving JSON-RPC connections")
+            ("rpccache", value<unsigned int>(&rpc_cache)->default_value(32), "Megabytes of immutable JSON-RPC results to cache, 0 to disable")
+            ("rpcmaxconnections", value<unsigned int>(&rpc_max_connections)->default_value(0), "Maximum JSON-RPC connections pr client address, 0 for no limit")
+            ("rpcmaxpipelined", value<unsigned int>(&rpc_max_pipelined)->default_value(Connection::max_pipelined), "Maximum JSON-RPC requests in flight pr connection")
+            ("rpcrate", value<double>(&rpc_rate)->default_value(0), "Maximum JSON-RPC requests pr second pr user, 0 for no limit")
+            ("rpcburst", value<double>(&rpc_burst)->default_value(20), "Maximum burst of JSON-RPC requests pr user under the rate limit")
             ("rpcconnect", value<string>(&rpc_connect)->default_value(asio::ip::address_v4::loopback().to_string()), "Send commands to node running on <arg>")
             ("keypool", value<unsigned short>(), "Set key pool size to <arg>")
+            ("wallet", value<strings>(&wallet_names), "Load the wallet <arg>.dat besides wallet.dat - its methods are called on /wallet/<arg>")
+            ("coinselection", value<string>(&coin_selection)->default_value("bnb"), "Coin selection strategy: bnb (branch and bound), knapsack, largest (largest first) or consolidate")
             ("rescan", "Rescan the block chain for missing wallet transactions")
             ("gen", value<bool>(&gen)->default_value(false), "Generate coins")
             ("rpcssl", value<bool>(&ssl)->default_value(false), "Use OpenSSL (https) for JSON-RPC connections")
@@ -186,7 +207,7 @@ int main(int argc, char* argv[])
             if(host_port.size() < 2) host_port.push_back("1080"); 
             proxy_server = asio::ip::tcp::endpoint(asio::ip::address_v4::from_string(host_port[0]), lexical_cast<short>(host_port[1]));
         }
-        Node node(chain, data_dir, args.count("nolisten") ? "" : "0.0.0.0", lexical_cast<string>(port), proxy_server, timeout); // it is also here we specify the use of a proxy!
+        Node node(chain, data_dir, args.count("nolisten") ? "" : "0.0.0.0", lexical_cast<string>(port), proxy_server, timeout, "92.243.23.21", storage); // it is also here we specify the use of a proxy!
         node.setClientVersion("libcoin/bitcoind", vector<string>(), 59100); 
         PortMapper mapper(node.get_io_service(), port); // this will use the Node call
         if(portmap) mapper.start();
@@ -195,13 +216,36 @@ int main(int argc, char* argv[])
         for(strings::iterator ep = add_peers.begin(); ep != add_peers.end(); ++ep) node.addPeer(*ep);
         for(strings::iterator ep = connect_peers.begin(); ep != connect_peers.end(); ++ep) node.connectPeer(*ep);
         
-        Wallet wallet(node); // this will also register the needed callbacks
+        // the wallets share the transactions and blocks of the node through the manager - wallet.dat is the default
+        WalletManager wallets(node);
+        Wallet& wallet = *wallets.load("wallet");
+        for(strings::iterator name = wallet_names.begin(); name != wallet_names.end(); ++name) wallets.load(*name);
+        
+        selector_ptr selector = createCoinSelector(coin_selection);
+        if (!selector)
+            throw runtime_error("Unknown coin selection strategy: " + coin_selection);
+        wallet.setCoinSelector(selector);
+        if (args.count("keypool"))
+            wallet.setKeyPoolSize(args["keypool"].as<unsigned short>());
         
         if(args.count("rescan")) {
             wallet.ScanForWalletTransactions();
             printf("Scanned for wallet transactions");
         }
         
+        // block and transaction events for the long-poll methods and the event streams
+        Notifier blocks(node.get_io_service());
+        Notifier txs(node.get_io_service());
+        node.subscribe(BlockFilter::listener_ptr(new BlockNotifier(node, blocks)));
+        node.subscribe(TransactionFilter::listener_ptr(new TransactionNotifier(node, txs)));
+        
+        Server server(rpc_bind, lexical_cast<string>(rpc_port), filesystem::initial_path().string(), "", rpc_threads);
+        if(ssl) server.setCredentials(data_dir, certchain, privkey);
+        server.setResponseCacheSize(rpc_cache*1024*1024);
+        server.setClientLimits(rpc_max_connections, rpc_max_pipelined);
+        server.setRateLimit(rpc_rate, rpc_burst);
+        node.subscribe(BlockFilter::listener_ptr(new ResponseCacheInvalidator(node, server)));
+        
         thread nodeThread(&Node::run, &node); // run this as a background thread
 
         CReserveKey reservekey(&wallet);
@@ -210,11 +254,9 @@ int main(int argc, char* argv[])
         miner.setGenerate(gen);
         thread miningThread(&Miner::run, &miner);
         
-        Server server(rpc_bind, lexical_cast<string>(rpc_port), filesystem::initial_path().string());
-        if(ssl) server.setCredentials(data_dir, certchain, privkey);
-        
         // Register Server methods.
         server.registerMethod(method_ptr(new Stop(server)), auth);
+        server.registerMethod(method_ptr(new ConnectionStats(server)), auth);
         
         // Register Node methods.
         server.registerMethod(method_ptr(new GetBlockHash(node)));
@@ -223,34 +265,43 @@ int main(int argc, char* argv[])
         server.registerMethod(method_ptr(new GetConnectionCount(node)));
         server.registerMethod(method_ptr(new GetDifficulty(node)));
         server.registerMethod(method_ptr(new GetInfo(node)));
+        server.registerMethod(method_ptr(new WaitForBlock(node, blocks)));
+        server.registerMethod(method_ptr(new WaitForTx(node, txs)));
+        server.registerEvents("blocks", blocks);
+        server.registerEvents("txs", txs);
+        server.registerResource("rest", resource_ptr(new NodeREST(node)));
         
-        // Register Wallet methods.
-        server.registerMethod(method_ptr(new GetBalance(wallet)), auth);
-        server.registerMethod(method_ptr(new GetNewAddress(wallet)), auth);
-        server.registerMethod(method_ptr(new SendToAddress(wallet)), auth);
-        server.registerMethod(method_ptr(new GetAccountAddress(wallet)), auth);
-        server.registerMethod(method_ptr(new GetAccount(wallet)), auth);
-        server.registerMethod(method_ptr(new SetAccount(wallet)), auth);
-        server.registerMethod(method_ptr(new GetAddressesByAccount(wallet)), auth);
-        server.registerMethod(method_ptr(new SetTxFee(wallet)), auth);
-        server.registerMethod(method_ptr(new GetReceivedByAddress(wallet)), auth);
-        server.registerMethod(method_ptr(new GetReceivedByAccount(wallet)), auth);
-        server.registerMethod(method_ptr(new MoveCmd(wallet)), auth);
-        server.registerMethod(method_ptr(new SendFrom(wallet)), auth);
-        server.registerMethod(method_ptr(new SendMany(wallet)), auth);
-        server.registerMethod(method_ptr(new ListReceivedByAddress(wallet)), auth);
-        server.registerMethod(method_ptr(new ListReceivedByAccount(wallet)), auth);
-        server.registerMethod(method_ptr(new ListTransactions(wallet)), auth);
-        server.registerMethod(method_ptr(new ListAccounts(wallet)), auth);
-        server.registerMethod(method_ptr(new GetWalletTransaction(wallet)), auth);
-        server.registerMethod(method_ptr(new BackupWallet(wallet)), auth);
-        server.registerMethod(method_ptr(new KeypoolRefill(wallet)), auth);
-        server.registerMethod(method_ptr(new WalletPassphraseChange(wallet)), auth);
-        server.registerMethod(method_ptr(new WalletLock(wallet)), auth);
-        server.registerMethod(method_ptr(new EncryptWallet(wallet)), auth);
-        server.registerMethod(method_ptr(new ValidateAddress(wallet)), auth);
+        // Register Wallet methods - routed to the wallet named by the request path.
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetBalance>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetNewAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<SendToAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetAccountAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetAccount>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<SetAccount>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetAddressesByAccount>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<SetTxFee>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetReceivedByAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetReceivedByAccount>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<MoveCmd>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<SendFrom>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<SendMany>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<ListReceivedByAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<ListReceivedByAccount>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<ListTransactions>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<ListAccounts>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<GetWalletTransaction>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<BackupWallet>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<KeypoolRefill>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<WalletPassphraseChange>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<WalletLock>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<EncryptWallet>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<ValidateAddress>)), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, &newWalletMethod<WalletQueueStats>)), auth);
         // this method also takes the io_service from the server to start a deadline timer locking the wallet again.
-        server.registerMethod(method_ptr(new WalletPassphrase(wallet, server.get_io_service())), auth);
+        server.registerMethod(method_ptr(new WalletRoute(wallets, bind(&newWalletPassphrase, _1, boost::ref(server.get_io_service())))), auth);
+        server.registerMethod(method_ptr(new ListWallets(wallets)), auth);
+        server.registerMethod(method_ptr(new WalletLoad(wallets)), auth);
+        server.registerMethod(method_ptr(new WalletUnload(wallets)), auth);
         
         // Register Mining methods.
         server.registerMethod(method_ptr(new SetGenerate(miner)), auth);    
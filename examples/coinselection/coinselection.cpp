@@ -0,0 +1,103 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/CoinSelector.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+using namespace boost;
+
+/// coinselection benchmarks the coin selection strategies on synthetic sets of coins:
+///     ./coinselection [selections [size ...]]
+/// For each size, pr default 10k, 100k and 1M coins, a wallet of coins with values spread log-uniformly from 0.0001
+/// to 100 BTC is generated, and each strategy selects coins for the same random targets. The time pr selection, the
+/// number of inputs, the change and the share of selections needing no change are reported.
+
+/// A value spread log-uniformly between 10^lo and 10^hi satoshi.
+static int64 randomValue(double lo, double hi) {
+    return (int64)pow(10.0, lo + (hi - lo) * rand() / RAND_MAX);
+}
+
+int main(int argc, char* argv[])
+{
+    size_t selections = argc > 1 ? lexical_cast<size_t>(argv[1]) : 10;
+    vector<size_t> sizes;
+    for (int i = 2; i < argc; ++i)
+        sizes.push_back(lexical_cast<size_t>(argv[i]));
+    if (sizes.empty()) {
+        sizes.push_back(10000);
+        sizes.push_back(100000);
+        sizes.push_back(1000000);
+    }
+    
+    const char* names[] = { "bnb", "knapsack", "largest", "consolidate" };
+    
+    for (vector<size_t>::const_iterator size = sizes.begin(); size != sizes.end(); ++size) {
+        srand(*size);
+        CoinIndex::ByValue coins;
+        for (size_t i = 0; i < *size; ++i) {
+            CoinIndex::Entry entry;
+            entry.coin = Coin(0, (unsigned int)i);
+            entry.tx = NULL;
+            entry.height = 1;
+            entry.from_me = false;
+            entry.coinbase = false;
+            coins.insert(make_pair(randomValue(4, 10), entry));
+        }
+        CoinCandidates candidates(coins);
+        
+        vector<int64> targets;
+        for (size_t i = 0; i < selections; ++i)
+            targets.push_back(randomValue(6, 10));
+        
+        cout << *size << " coins, " << selections << " selections:\n";
+        for (size_t n = 0; n < sizeof(names)/sizeof(names[0]); ++n) {
+            selector_ptr selector = createCoinSelector(names[n]);
+            size_t selected = 0;
+            size_t inputs = 0;
+            size_t changeless = 0;
+            int64 change = 0;
+            posix_time::ptime start = posix_time::microsec_clock::universal_time();
+            for (vector<int64>::const_iterator target = targets.begin(); target != targets.end(); ++target) {
+                CoinSelection selection;
+                int64 value;
+                if (!(*selector)(candidates, *target, selection, value))
+                    continue;
+                selected++;
+                inputs += selection.size();
+                change += value - *target;
+                if (value - *target <= MIN_TX_FEE)
+                    changeless++;
+            }
+            posix_time::time_duration elapsed = posix_time::microsec_clock::universal_time() - start;
+            
+            cout << "  " << names[n] << ": "
+                 << elapsed.total_microseconds() / max(selections, (size_t)1) << "us pr selection, "
+                 << selected << " selected, "
+                 << (selected ? (double)inputs / selected : 0) << " inputs, "
+                 << (selected ? FormatMoney(change / (int64)selected) : "0") << " change, "
+                 << (selected ? 100 * changeless / selected : 0) << "% changeless\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/JSONReader.h>
+#include <coinHTTP/JSONWriter.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+
+using namespace std;
+using namespace boost;
+using namespace json_spirit;
+
+/// jsonbench benchmarks JSON parsing and serialization over corpora of JSON texts:
+///     ./jsonbench [file ...]
+/// Each file is a corpus - without files, synthetic corpora are generated: an RPC request, a verbose block with
+/// 2000 transactions, an array of 100k numbers and an array of 10k strings with escapes. Each corpus is parsed by
+/// json_spirit::read and by JSONReader, and serialized by json_spirit::write and by JSONWriter, and the throughput in
+/// MB/s is reported along with whether the two agree.
+
+typedef vector<pair<string, string> > Corpora;
+
+static Corpora synthetic() {
+    Corpora corpora;
+    
+    corpora.push_back(make_pair("request", string("{\"jsonrpc\":\"2.0\",\"method\":\"getblock\",\"params\":[\"000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f\",true],\"id\":1}")));
+    
+    Array txs;
+    for (int i = 0; i < 2000; ++i) {
+        Array vin, vout;
+        for (int j = 0; j < 2; ++j) {
+            Object in;
+            in.push_back(Pair("txid", "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+            in.push_back(Pair("vout", j));
+            in.push_back(Pair("scriptSig", "3045022100b6a2c6c5d4b0f5e1c2b8f0d5a3e4c7b6a5d4c3b2a1908f7e6d5c4b3a29180706f502204b2b"));
+            vin.push_back(in);
+            Object out;
+            out.push_back(Pair("value", 0.5 * (i + j)));
+            out.push_back(Pair("n", j));
+            out.push_back(Pair("address", "1A1zP1eP5QGefi2DMPTfTL5SLmv7DivfNa"));
+            vout.push_back(out);
+        }
+        Object tx;
+        tx.push_back(Pair("hash", "4a5e1e4baab89f3a32518a88c31bc87f618f76673e2cc77ab2127b7afdeda33b"));
+        tx.push_back(Pair("version", 1));
+        tx.push_back(Pair("locktime", 0));
+        tx.push_back(Pair("vin", vin));
+        tx.push_back(Pair("vout", vout));
+        txs.push_back(tx);
+    }
+    Object block;
+    block.push_back(Pair("hash", "000000000019d6689c085ae165831e934ff763ae46a2a6c172b3f1b60a8ce26f"));
+    block.push_back(Pair("height", 200000));
+    block.push_back(Pair("tx", txs));
+    corpora.push_back(make_pair("block", write(Value(block))));
+    
+    Array numbers;
+    for (int i = 0; i < 100000; ++i)
+        numbers.push_back(i % 3 ? Value((boost::int64_t)i * 7919) : Value(i / 7.0));
+    corpora.push_back(make_pair("numbers", write(Value(numbers))));
+    
+    Array strings;
+    for (int i = 0; i < 10000; ++i)
+        strings.push_back("line " + lexical_cast<string>(i) + "\n\t\"quoted\" \\ path/" + string(i % 64, 'x'));
+    corpora.push_back(make_pair("strings", write(Value(strings))));
+    
+    return corpora;
+}
+
+/// Write a value as JSONWriter writes a result, containers element by element.
+static void serialize(JSONWriter& writer, const Value& value) {
+    if (value.type() == obj_type) {
+        writer.beginObject();
+        const Object& obj = value.get_obj();
+        for (Object::const_iterator pair = obj.begin(); pair != obj.end(); ++pair) {
+            writer.key(pair->name_);
+            serialize(writer, pair->value_);
+        }
+        writer.endObject();
+    }
+    else if (value.type() == array_type) {
+        writer.beginArray();
+        const Array& arr = value.get_array();
+        for (Array::const_iterator element = arr.begin(); element != arr.end(); ++element)
+            serialize(writer, *element);
+        writer.endArray();
+    }
+    else
+        writer.write(value);
+}
+
+/// The seconds it takes to run f - repeated until it has taken at least half a second, and averaged.
+template <typename F>
+static double timed(F f) {
+    posix_time::ptime start = posix_time::microsec_clock::universal_time();
+    size_t runs = 0;
+    double seconds = 0;
+    do {
+        f();
+        ++runs;
+        seconds = (posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    } while (seconds < 0.5);
+    return seconds / runs;
+}
+
+struct SpiritRead {
+    const string& text;
+    SpiritRead(const string& t) : text(t) {}
+    void operator()() { Value value; read(text, value); }
+};
+
+struct ReaderRead {
+    const string& text;
+    ReaderRead(const string& t) : text(t) {}
+    void operator()() { Value value; JSONReader::read(text, value); }
+};
+
+struct SpiritWrite {
+    const Value& value;
+    SpiritWrite(const Value& v) : value(v) {}
+    void operator()() { write(value); }
+};
+
+struct WriterWrite {
+    const Value& value;
+    WriterWrite(const Value& v) : value(v) {}
+    void operator()() { JSONWriter writer; serialize(writer, value); }
+};
+
+int main(int argc, char* argv[])
+{
+    Corpora corpora;
+    for (int i = 1; i < argc; ++i) {
+        ifstream file(argv[i], ios::binary);
+        if (!file) {
+            cerr << "could not open " << argv[i] << endl;
+            return 1;
+        }
+        corpora.push_back(make_pair(string(argv[i]), string(istreambuf_iterator<char>(file), istreambuf_iterator<char>())));
+    }
+    if (corpora.empty())
+        corpora = synthetic();
+    
+    cout << "corpus: bytes, parse MB/s json_spirit / JSONReader, serialize MB/s json_spirit / JSONWriter" << endl;
+    for (Corpora::const_iterator corpus = corpora.begin(); corpus != corpora.end(); ++corpus) {
+        const string& text = corpus->second;
+        Value spirit, reader;
+        bool spirit_ok = read(text, spirit);
+        bool reader_ok = JSONReader::read(text, reader);
+        if (!spirit_ok || !reader_ok) {
+            cout << corpus->first << ": not valid JSON (json_spirit " << spirit_ok << ", JSONReader " << reader_ok << ")" << endl;
+            continue;
+        }
+        JSONWriter writer;
+        serialize(writer, reader);
+        bool agree = write(spirit) == write(reader) && writer.content() == write(reader);
+        
+        double mb = text.size() / 1e6;
+        double out = write(reader).size() / 1e6;
+        cout << corpus->first << ": " << text.size() << " bytes, parse " << mb / timed(SpiritRead(text)) << " / " << mb / timed(ReaderRead(text)) << ", serialize " << out / timed(SpiritWrite(reader)) << " / " << out / timed(WriterWrite(reader)) << (agree ? "" : " - the results differ!") << endl;
+    }
+    
+    return 0;
+}
@@ -0,0 +1,194 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/BlockChain.h>
+#include <coinChain/Chain.h>
+
+#include <coin/util.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+
+using namespace std;
+using namespace boost;
+
+/// reorg benchmarks reorganizations of a local forked chain:
+///     ./reorg [length [depth ...]]
+/// A chain of length blocks, pr default 400, is built in ./reorg-bench on a chain definition with trivial proof of
+/// work. From block 101 on each block spends a matured coinbase into 20 outputs and spends the 20 outputs of the
+/// previous block. Then, for each depth, pr default 1, 10, 50, 100, 150 and 250, a branch forking depth blocks below
+/// the tip and one block longer is accepted, and the time of the reorganization it triggers is reported. Undo records
+/// are kept for the last 100 blocks, so deeper reorganizations read the rest of the disconnected blocks' inputs.
+/// The transactions of a block only depend on its height, so every branch is valid.
+
+static const unsigned int BASE_TIME = 1340000000;
+static const unsigned int FANOUT = 20;
+
+static CBigNum workLimit() {
+    return CBigNum(~uint256(0) >> 1);
+}
+
+static Script anyone() {
+    return Script() << OP_TRUE;
+}
+
+static Transaction coinbase(int height) {
+    Transaction tx;
+    tx.addInput(Input(Coin(), Script() << height << CBigNum(1)));
+    tx.addOutput(Output(50 * COIN, anyone()));
+    return tx;
+}
+
+/// Spend the coinbase that matured at this height into FANOUT outputs.
+static Transaction fanout(int height) {
+    Transaction tx;
+    tx.addInput(Input(coinbase(height - COINBASE_MATURITY).getHash(), 0));
+    for (unsigned int i = 0; i < FANOUT; ++i)
+        tx.addOutput(Output(50 * COIN / FANOUT, anyone()));
+    return tx;
+}
+
+/// Mine the block at height on top of prev - the branch is part of the time, so each branch has its own blocks.
+static Block mine(int height, const uint256& prev, unsigned int branch) {
+    CBigNum limit = workLimit();
+    Block block(1, prev, 0, BASE_TIME + 600 * height + branch, limit.GetCompact(), 0);
+    block.addTransaction(coinbase(height));
+    if (height > COINBASE_MATURITY)
+        block.addTransaction(fanout(height));
+    if (height > COINBASE_MATURITY + 1) {
+        uint256 hash = fanout(height - 1).getHash();
+        for (unsigned int i = 0; i < FANOUT; ++i) {
+            Transaction tx;
+            tx.addInput(Input(hash, i));
+            tx.addOutput(Output(50 * COIN / FANOUT, anyone()));
+            block.addTransaction(tx);
+        }
+    }
+    block.updateMerkleTree();
+    
+    CBigNum target;
+    target.SetCompact(block.getBits());
+    uint256 bound = target.getuint256();
+    while (block.getHash() > bound)
+        block.setNonce(block.getNonce() + 1);
+    return block;
+}
+
+/// A chain definition with trivial proof of work for the fixture.
+class ForkChain : public Chain
+{
+public:
+    ForkChain() {
+        _messageStart[0] = 0xfa; _messageStart[1] = 0xbf; _messageStart[2] = 0xb5; _messageStart[3] = 0xda;
+        _genesisBlock = mine(0, 0, 0);
+        _genesis = _genesisBlock.getHash();
+    }
+    virtual const Block& genesisBlock() const { return _genesisBlock; }
+    virtual const uint256& genesisHash() const { return _genesis; }
+    virtual const int64 subsidy(unsigned int height) const { return 50 * COIN; }
+    virtual bool isStandard(const Transaction& tx) const { return true; }
+    virtual unsigned int nextWorkRequired(const CBlockIndex* pindexLast) const { return workLimit().GetCompact(); }
+    virtual const CBigNum proofOfWorkLimit() const { return workLimit(); }
+    
+    virtual const std::string dataDirSuffix() const { return "reorg-bench"; }
+    
+    virtual ChainAddress getAddress(PubKeyHash hash) const { return ChainAddress(0x00, hash); }
+    virtual ChainAddress getAddress(ScriptHash hash) const { return ChainAddress(0x05, hash); }
+    virtual ChainAddress getAddress(std::string str) const { return ChainAddress(str); }
+    
+    virtual const MessageStart& messageStart() const { return _messageStart; };
+    virtual short defaultPort() const { return 18444; }
+    
+    virtual std::string ircChannel() const { return ""; }
+    virtual unsigned int ircChannels() const { return 0; }
+    
+private:
+    Block _genesisBlock;
+    uint256 _genesis;
+    MessageStart _messageStart;
+};
+
+int main(int argc, char* argv[])
+{
+    int length = argc > 1 ? lexical_cast<int>(argv[1]) : 400;
+    vector<int> depths;
+    for (int i = 2; i < argc; ++i)
+        depths.push_back(lexical_cast<int>(argv[i]));
+    if (depths.empty()) {
+        depths.push_back(1);
+        depths.push_back(10);
+        depths.push_back(50);
+        depths.push_back(100);
+        depths.push_back(150);
+        depths.push_back(250);
+    }
+    
+    string dataDir = "reorg-bench";
+    filesystem::remove_all(dataDir);
+    filesystem::create_directory(dataDir);
+    logfile = dataDir + "/debug.log";
+    
+    try {
+        ForkChain chain;
+        BlockChain blockChain(chain, dataDir);
+        
+        // the hashes of the main chain by height
+        vector<uint256> main;
+        main.push_back(chain.genesisHash());
+        int64 t0 = GetTimeMillis();
+        for (int height = 1; height <= length; ++height) {
+            Block block = mine(height, main.back(), 0);
+            if (!blockChain.acceptBlock(block))
+                throw runtime_error("block " + lexical_cast<string>(height) + " not accepted");
+            main.push_back(block.getHash());
+        }
+        cout << "built " << length << " blocks in " << GetTimeMillis() - t0 << "ms" << endl;
+        
+        unsigned int branch = 1;
+        for (vector<int>::const_iterator depth = depths.begin(); depth != depths.end(); ++depth, ++branch) {
+            int tip = main.size() - 1;
+            if (*depth < 1 || *depth >= tip) {
+                cout << "depth " << *depth << ": skipped, the chain is " << tip << " blocks" << endl;
+                continue;
+            }
+            int fork = tip - *depth;
+            main.resize(fork + 1);
+            int64 elapsed = 0;
+            for (int height = fork + 1; height <= tip + 1; ++height) {
+                Block block = mine(height, main.back(), branch);
+                int64 t1 = GetTimeMicros();
+                if (!blockChain.acceptBlock(block))
+                    throw runtime_error("fork block " + lexical_cast<string>(height) + " not accepted");
+                // the last block makes the branch the longest, and triggers the reorganization
+                if (height == tip + 1)
+                    elapsed = GetTimeMicros() - t1;
+                main.push_back(block.getHash());
+            }
+            if (blockChain.getBestChain() != main.back())
+                throw runtime_error("the branch of depth " + lexical_cast<string>(*depth) + " did not become the best chain");
+            
+            cout << "depth " << *depth << ": " << elapsed/1000. << "ms, " << elapsed/1000./ *depth << "ms pr disconnected block, "
+                 << min(*depth, COINBASE_MATURITY) << " undo records" << endl;
+        }
+    }
+    catch (std::exception& e) {
+        cerr << "reorg: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,122 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/Server.h>
+#include <coinHTTP/Client.h>
+#include <coinHTTP/Method.h>
+#include <coinHTTP/RPC.h>
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <vector>
+
+using namespace std;
+using namespace boost;
+using namespace json_spirit;
+
+/// rpcload generates load on a coinHTTP Server using the coinHTTP Client:
+///     ./rpcload [clients [requests [millis [threads [workers]]]]]
+/// A server is started on 127.0.0.1:9339 with three methods: "walletwork" and "chainwork", that are not read-only and
+/// hence serialized within the wallet and chain groups, and spend millis (default 20) ms each, and the read-only
+/// "ping". Each of the clients (default 12) sends requests (default 50) requests over a fresh connection each, cycling
+/// through the three methods. The latency of each method is reported - cheap calls should not queue behind expensive
+/// ones, and the two groups should not queue behind each other.
+
+class Work : public Method {
+public:
+    Work(const string& name, const string& group, int millis) : _group(group), _millis(millis) { setName(name); }
+    Value operator()(const Array& params, bool fHelp) {
+        this_thread::sleep(posix_time::milliseconds(_millis));
+        return _millis;
+    }
+    virtual const string group() const { return _group; }
+private:
+    string _group;
+    int _millis;
+};
+
+class Ping : public Method {
+public:
+    Ping() { setName("ping"); }
+    Value operator()(const Array& params, bool fHelp) { return "pong"; }
+    virtual bool isReadOnly() const { return true; }
+};
+
+typedef map<string, vector<double> > Latencies;
+
+static const char* methods[] = { "walletwork", "chainwork", "ping" };
+
+static void load(size_t client, size_t requests, Latencies& latencies, mutex& access, size_t& failures) {
+    for (size_t i = 0; i < requests; ++i) {
+        string method = methods[(client + i) % 3];
+        string content = "{\"method\":\"" + method + "\",\"params\":[],\"id\":" + lexical_cast<string>(i) + "}";
+        posix_time::ptime start = posix_time::microsec_clock::universal_time();
+        Client c;
+        Reply reply = c.post("http://127.0.0.1:9339/", content);
+        double millis = (posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000.;
+        mutex::scoped_lock lock(access);
+        if (reply.status != Reply::ok)
+            failures++;
+        else
+            latencies[method].push_back(millis);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    size_t clients = argc > 1 ? lexical_cast<size_t>(argv[1]) : 12;
+    size_t requests = argc > 2 ? lexical_cast<size_t>(argv[2]) : 50;
+    int millis = argc > 3 ? lexical_cast<int>(argv[3]) : 20;
+    size_t threads = argc > 4 ? lexical_cast<size_t>(argv[4]) : 4;
+    size_t workers = argc > 5 ? lexical_cast<size_t>(argv[5]) : 0;
+    
+    Server server("127.0.0.1", "9339", "", ".", threads, workers);
+    server.registerMethod(method_ptr(new Work("walletwork", "wallet", millis)));
+    server.registerMethod(method_ptr(new Work("chainwork", "chain", millis)));
+    server.registerMethod(method_ptr(new Ping));
+    thread serving(bind(&Server::run, &server));
+    
+    Latencies latencies;
+    mutex access;
+    size_t failures = 0;
+    posix_time::ptime start = posix_time::microsec_clock::universal_time();
+    thread_group loaders;
+    for (size_t client = 0; client < clients; ++client)
+        loaders.create_thread(bind(&load, client, requests, boost::ref(latencies), boost::ref(access), boost::ref(failures)));
+    loaders.join_all();
+    double seconds = (posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1e6;
+    
+    server.shutdown();
+    serving.join();
+    
+    cout << clients << " clients, " << clients * requests << " requests in " << seconds << " s: " << clients * requests / seconds << " requests/s, " << failures << " failed" << endl;
+    for (Latencies::iterator l = latencies.begin(); l != latencies.end(); ++l) {
+        vector<double>& ms = l->second;
+        sort(ms.begin(), ms.end());
+        double sum = 0;
+        for (size_t i = 0; i < ms.size(); ++i)
+            sum += ms[i];
+        cout << l->first << ": " << ms.size() << " calls, mean " << sum / ms.size() << " ms, median " << ms[ms.size() / 2] << " ms, 99% " << ms[ms.size() * 99 / 100] << " ms, max " << ms.back() << " ms" << endl;
+    }
+    
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/BlockChain.h>
+#include <coinChain/Chain.h>
+
+#include <coin/util.h>
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <iostream>
+
+using namespace std;
+using namespace boost;
+
+/// storesync benchmarks the sync throughput of the block index storage backends on the same block file:
+///     ./storesync blockfile [blocks [backend ...]]
+/// The blocks of the block file, e.g. the blk0001.dat of a synced node, are accepted into a fresh block chain in
+/// ./storesync-<backend> for each backend, pr default bdb and log. The time, the blocks and the transactions pr
+/// second are reported. Berkeley DB keeps one environment pr process, so bdb can only be given once.
+
+/// Accept up to max blocks from the block file, returns the number of blocks accepted and counts their transactions.
+static size_t syncBlocks(BlockChain& blockChain, const string& blockfile, size_t max, size_t& txes) {
+    FILE* file = fopen(blockfile.c_str(), "rb");
+    if (!file)
+        throw runtime_error("can't open " + blockfile);
+    CAutoFile in(file, SER_DISK);
+    
+    size_t blocks = 0;
+    txes = 0;
+    while (blocks < max) {
+        unsigned char start[4];
+        unsigned int size;
+        if (fread(start, 1, sizeof(start), file) != sizeof(start) || fread(&size, 1, sizeof(size), file) != sizeof(size))
+            break;
+        // a preallocated tail reads as zeros
+        if (memcmp(start, bitcoin.messageStart().elems, sizeof(start)) != 0)
+            break;
+        Block block;
+        try {
+            in >> block;
+        }
+        catch (std::exception& e) {
+            break;
+        }
+        if (!blockChain.acceptBlock(block))
+            continue;
+        blocks++;
+        txes += block.getNumTransactions();
+    }
+    return blocks;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2) {
+        cerr << "usage: " << argv[0] << " blockfile [blocks [backend ...]]" << endl;
+        return 1;
+    }
+    string blockfile = argv[1];
+    size_t max = argc > 2 ? lexical_cast<size_t>(argv[2]) : (size_t)-1;
+    vector<string> backends;
+    for (int i = 3; i < argc; ++i)
+        backends.push_back(argv[i]);
+    if (backends.empty()) {
+        backends.push_back("bdb");
+        backends.push_back("log");
+    }
+    
+    try {
+        for (vector<string>::const_iterator backend = backends.begin(); backend != backends.end(); ++backend) {
+            string dataDir = "storesync-" + *backend;
+            filesystem::remove_all(dataDir);
+            filesystem::create_directory(dataDir);
+            
+            BlockChain blockChain(bitcoin, dataDir, "cr+", *backend);
+            
+            size_t txes;
+            int64 t0 = GetTimeMillis();
+            size_t blocks = syncBlocks(blockChain, blockfile, max, txes);
+            double seconds = (GetTimeMillis() - t0)/1000.;
+            
+            cout << *backend << ": " << blocks << " blocks, " << txes << " transactions in " << seconds << "s, "
+                 << blocks/seconds << " blocks/s, " << txes/seconds << " tx/s" << endl;
+        }
+    }
+    catch (std::exception& e) {
+        cerr << "storesync: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
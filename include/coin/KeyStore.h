@@ -78,6 +78,8 @@ public:
     virtual bool addScript(const Script& redeemScript);
     virtual bool haveScript(const ScriptHash& hash) const;
     virtual bool getScript(const ScriptHash& hash, Script& redeemScriptOut) const;
+    
+    void getScripts(std::set<ScriptHash> &hashes) const;
 };
 
 #endif
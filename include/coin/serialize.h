@@ -278,6 +278,47 @@ uint64 ReadCompactSize(Stream& is)
     return nSizeRet;
 }
 
+//
+// Variable length integer
+//  7 bits per byte, least significant group first, the high bit is set on
+//  all but the last byte - values < 128 take 1 byte, a uint64 at most 10 bytes
+//
+inline unsigned int GetSizeOfVarInt(uint64 n)
+{
+    unsigned int nSize = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        nSize++;
+    }
+    return nSize;
+}
+
+template<typename Stream>
+void WriteVarInt(Stream& os, uint64 n)
+{
+    while (n >= 0x80) {
+        unsigned char ch = (n & 0x7f) | 0x80;
+        WRITEDATA(os, ch);
+        n >>= 7;
+    }
+    unsigned char ch = n;
+    WRITEDATA(os, ch);
+}
+
+template<typename Stream>
+uint64 ReadVarInt(Stream& is)
+{
+    uint64 n = 0;
+    for (unsigned int shift = 0; shift < 64; shift += 7) {
+        unsigned char ch;
+        READDATA(is, ch);
+        n |= (uint64)(ch & 0x7f) << shift;
+        if (!(ch & 0x80))
+            return n;
+    }
+    throw std::ios_base::failure("ReadVarInt() : varint too long");
+}
+
 
 
 //
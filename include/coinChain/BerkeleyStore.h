@@ -0,0 +1,42 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BERKELEYSTORE_H
+#define BERKELEYSTORE_H
+
+#include <coinChain/Export.h>
+#include <coinChain/KeyValueStore.h>
+#include <coinChain/db.h>
+
+/// BerkeleyStore is the KeyValueStore on top of the Berkeley DB environment shared with the wallet (CDB).
+
+class COINCHAIN_EXPORT BerkeleyStore : public KeyValueStore, private CDB
+{
+public:
+    BerkeleyStore(const std::string dataDir, const std::string& file, const char* pszMode = "cr+") : CDB(dataDir, file.c_str(), pszMode) {}
+    
+    virtual bool read(const Data& key, Data& value) const;
+    virtual bool write(const Data& key, const Data& value);
+    virtual bool erase(const Data& key);
+    virtual bool exists(const Data& key) const;
+    virtual bool scan(const Data& prefix, Visitor& visitor) const;
+    
+    virtual bool begin() { return TxnBegin(); }
+    virtual bool commit() { return TxnCommit(); }
+    virtual bool abort() { return TxnAbort(); }
+};
+
+#endif // BERKELEYSTORE_H
@@ -24,15 +24,19 @@
 
 #include <coinChain/Export.h>
 #include <coinChain/db.h>
+#include <coinChain/KeyValueStore.h>
 
 #include <coinChain/BlockIndex.h>
 #include <coinChain/BlockFile.h>
 #include <coinChain/Chain.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread/shared_mutex.hpp>
 #include <boost/thread/locks.hpp>
+#include <algorithm>
 #include <list>
+#include <map>
 
 class Transaction;
 
@@ -86,36 +90,96 @@ private:
     unsigned int _txPos;
 };
 
-/// A txdb record that contains the disk location of a transaction and the
-/// locations of transactions that spend its outputs.  vSpent is really only
-/// used as a flag, but having the location is very helpful for debugging.
+/// A txdb record that contains the disk location of a transaction and a bitmap
+/// flagging which of its outputs are spent. On disk the record is a marker,
+/// the location as varints, the number of outputs and the bitmap. Records in the
+/// old format, with a full DiskTxPos per output, are still read and are written
+/// back in the compact format. The location of the spending transactions is not
+/// part of the record, only the changes made since the record was read are kept,
+/// for the optional spent-by index (see LIBCOIN_SPENT_INDEX).
 
 class COINCHAIN_EXPORT TxIndex
 {
 public:
+    /// Spending positions set (or cleared, a null DiskTxPos) since the record was read.
+    typedef std::map<unsigned int, DiskTxPos> Spenders;
+    
+    /// Marker starting a compact record - old records start with the (positive) client version.
+    enum { COMPACT = -1 };
     
     TxIndex()
     {
     setNull();
     }
     
-    TxIndex(const DiskTxPos& pos, unsigned int outputs) : _pos(pos)
+    TxIndex(const DiskTxPos& pos, unsigned int outputs) : _pos(pos), _spents(outputs, false)
     {
-    _spents.resize(outputs);
     }
     
-    IMPLEMENT_SERIALIZE
-    (
-     if (!(nType & SER_GETHASH))
-     READWRITE(nVersion);
-     READWRITE(_pos);
-     READWRITE(_spents);
-     )
+    unsigned int GetSerializeSize(int nType=0, int nVersion=PROTOCOL_VERSION) const
+    {
+    return sizeof(int) + GetSizeOfVarInt(_pos.getFile() + 1) + GetSizeOfVarInt(_pos.getBlockPos()) + GetSizeOfVarInt(_pos.getTxPos()) + GetSizeOfVarInt(_spents.size()) + (_spents.size() + 7)/8;
+    }
+    
+    template<typename Stream>
+    void Serialize(Stream& s, int nType=0, int nVersion=PROTOCOL_VERSION) const
+    {
+    int marker = COMPACT;
+    WRITEDATA(s, marker);
+    // the file of a null position is -1, hence the offset by one
+    WriteVarInt(s, (unsigned int)(_pos.getFile() + 1));
+    WriteVarInt(s, _pos.getBlockPos());
+    WriteVarInt(s, _pos.getTxPos());
+    WriteVarInt(s, _spents.size());
+    for (size_t i = 0; i < _spents.size(); i += 8) {
+        unsigned char bits = 0;
+        for (size_t j = 0; j < 8 && i + j < _spents.size(); ++j)
+            if (_spents[i + j])
+                bits |= (1 << j);
+        WRITEDATA(s, bits);
+    }
+    }
+    
+    template<typename Stream>
+    void Unserialize(Stream& s, int nType=0, int nVersion=PROTOCOL_VERSION)
+    {
+    _spenders.clear();
+    int marker;
+    READDATA(s, marker);
+    if (marker == COMPACT) {
+        unsigned int file = ReadVarInt(s) - 1;
+        unsigned int blockPos = ReadVarInt(s);
+        unsigned int txPos = ReadVarInt(s);
+        _pos = DiskTxPos(file, blockPos, txPos);
+        uint64 outputs = ReadVarInt(s);
+        if (outputs > (uint64)MAX_SIZE)
+            throw std::ios_base::failure("TxIndex::Unserialize() : size too large");
+        _spents.assign(outputs, false);
+        for (size_t i = 0; i < _spents.size(); i += 8) {
+            unsigned char bits;
+            READDATA(s, bits);
+            for (size_t j = 0; j < 8 && i + j < _spents.size(); ++j)
+                _spents[i + j] = (bits >> j) & 1;
+        }
+    }
+    else { // the old format: version, position and a position per output
+        std::vector<DiskTxPos> spents;
+        s >> _pos >> spents;
+        _spents.assign(spents.size(), false);
+        for (size_t i = 0; i < spents.size(); ++i) {
+            if (spents[i].isNull())
+                continue;
+            _spents[i] = true;
+            _spenders[i] = spents[i];
+        }
+    }
+    }
     
     void setNull()
     {
     _pos.setNull();
     _spents.clear();
+    _spenders.clear();
     }
     
     bool isNull()
@@ -125,12 +189,15 @@ public:
     
     const DiskTxPos& getPos() const { return _pos; }
     
+    /// The number of outputs tracked.
     const size_t getNumSpents() const { return _spents.size(); }
-    const DiskTxPos& getSpent(unsigned int n) { return _spents[n]; }
-    const std::vector<DiskTxPos> getSpents() const { return _spents; }
-    void resizeSpents(size_t size) { _spents.resize(size); }
-    void setSpent(const unsigned int n, const DiskTxPos& pos) { _spents[n] = pos; };
-    void setNotSpent(const unsigned int n) { _spents[n].setNull(); }
+    bool isSpent(unsigned int n) const { return n < _spents.size() && _spents[n]; }
+    bool allSpent() const { return std::find(_spents.begin(), _spents.end(), false) == _spents.end(); }
+    void resizeSpents(size_t size) { _spents.resize(size, false); }
+    void setSpent(const unsigned int n, const DiskTxPos& pos) { _spents[n] = true; _spenders[n] = pos; }
+    void setNotSpent(const unsigned int n) { _spents[n] = false; _spenders[n] = DiskTxPos(); }
+    
+    const Spenders& getSpenders() const { return _spenders; }
     
     friend bool operator==(const TxIndex& a, const TxIndex& b)
     {
@@ -144,14 +211,45 @@ public:
     }
 private:
     DiskTxPos _pos;
-    std::vector<DiskTxPos> _spents;
+    std::vector<bool> _spents;
+    Spenders _spenders;
+};
+
+/// The undo record of a connected block: the txindex records of the previous
+/// transactions as they were before the block spent from them, and the hashes of
+/// the transactions of the block. Disconnecting a block with an undo record is a
+/// replay of the record - no txindex reads are needed. The block itself is still
+/// read, sequentially, to return its transactions to the memory pool.
+
+class COINCHAIN_EXPORT BlockUndo
+{
+public:
+    typedef std::vector<std::pair<uint256, TxIndex> > TxIndices;
+    
+    BlockUndo() {}
+    
+    IMPLEMENT_SERIALIZE
+    (
+     READWRITE(_prevouts);
+     READWRITE(_txes);
+     )
+    
+    void addPrevout(const uint256& hash, const TxIndex& txindex) { _prevouts.push_back(std::make_pair(hash, txindex)); }
+    void addTx(const uint256& hash) { _txes.push_back(hash); }
+    
+    const TxIndices& getPrevouts() const { return _prevouts; }
+    const std::vector<uint256>& getTxes() const { return _txes; }
+    
+private:
+    TxIndices _prevouts;
+    std::vector<uint256> _txes;
 };
 
 /// BlockChain encapsulates the BlockChain and provides a const interface for querying properties for blocks and transactions. 
 /// BlockChain also provides an interface for adding new blocks and transactions. (non-const)
 /// BlockChain automatically handles adding new transactions to a memorypool and erasing them again when a block containing the transaction is added.
 
-/// BlockChain inhierits from CDB, has a Chain definition reference and has a BlockFile. In fact BlockChain is the only class to access the block index db and the block file. BlockChain is hence thread safe for all const querying and for adding blocks and transactions, the user is responsible for not calling these methods at the same time from multiple threads.
+/// BlockChain has a KeyValueStore for the block index, a Chain definition reference and a BlockFile. In fact BlockChain is the only class to access the block index db and the block file. BlockChain is hence thread safe for all const querying and for adding blocks and transactions, the user is responsible for not calling these methods at the same time from multiple threads.
 
 typedef std::map<uint256, CBlockIndex*> BlockChainIndex;
 typedef std::map<uint256, Transaction> TransactionIndex;
@@ -159,7 +257,7 @@ typedef std::map<uint160, Coins> AssetIndex;
 typedef std::vector<Transaction> Transactions;
 typedef std::vector<Block> Blocks;
 
-class COINCHAIN_EXPORT BlockChain : private CDB, private Database
+class COINCHAIN_EXPORT BlockChain : private Database
 {
 private: // noncopyable
     BlockChain(const BlockChain&);
@@ -167,7 +265,8 @@ private: // noncopyable
 
 public:
     /// The constructor - reference to a Chain definition i obligatory, if no dataDir is provided, the location for the db and the file is chosen from the Chain definition and the CDB::defaultDir method 
-    BlockChain(const Chain& chain = bitcoin, const std::string dataDir = "", const char* pszMode="cr+");
+    /// The storage argument selects the KeyValueStore backend for the block index: "bdb" (default) or "log".
+    BlockChain(const Chain& chain = bitcoin, const std::string dataDir = "", const char* pszMode="cr+", const std::string storage = "bdb");
     
     /// T R A N S A C T I O N S    
     
@@ -216,7 +315,11 @@ public:
     /// This rather strange name refers to this coin included in a transaction in the memorypool
     bool beingSpent(Coin coin) const { return _transactionConnections.find(coin) != _transactionConnections.end(); }
     int getNumSpent(uint256 hash) const ;
+#ifdef LIBCOIN_SPENT_INDEX
+    /// The hash of the main chain transaction spending the coin, 0 if it is unspent. The txindex only flags spent
+    /// outputs, so the lookup is only there with the spent-by index.
     uint256 spentIn(Coin coin) const;
+#endif
 
     int64 value(Coin coin) const;
     
@@ -249,6 +352,13 @@ public:
     void getBlock(const uint256 hash, Block& block) const;
     
     void getBlock(const CBlockIndex* index, Block& block) const;
+    
+    /// Get the serialized block by its hash as stored in the block file - returns false if the block is unknown.
+    bool getRawBlock(const uint256 hash, std::string& data) const;
+
+    /// Get the headers of up to count main chain blocks starting from the block hash - returns false if the block
+    /// is not in the main chain. The chain is walked under the chain lock, so a reorganization cannot interfere.
+    bool getBlockHeaders(const uint256 hash, unsigned int count, Blocks& headers) const;
 
     CBlockIndex* getHashStopIndex(uint256 hashStop) const;
 
@@ -315,6 +425,8 @@ protected:
     
     /// Block stuff
     bool disconnectBlock(const Block& block, CBlockIndex* pindex);
+    /// Disconnect a block by replaying its undo record - the block is only read for the spent-by index.
+    bool disconnectBlock(const Block& block, const BlockUndo& undo, CBlockIndex* pindex);
     bool connectBlock(const Block& block, CBlockIndex* pindex);
     bool setBestChain(const Block& block, CBlockIndex* pindexNew);
     bool addToBlockIndex(const Block& block, unsigned int nFile, unsigned int nBlockPos);
@@ -323,6 +435,8 @@ protected:
     bool UpdateTxIndex(uint256 hash, const TxIndex& txindex);
     bool AddTxIndex(const Transaction& tx, const DiskTxPos& pos, int nHeight);
     bool EraseTxIndex(const Transaction& tx);
+    /// Rewrite txindex records in the old format to the compact format, done once on load.
+    bool MigrateTxIndex();
 
     bool ReadOwnerTxes(uint160 hash160, int nHeight, std::vector<Transaction>& vtx);
     bool ReadDiskTx(uint256 hash, Transaction& tx, TxIndex& txindex) const;
@@ -330,6 +444,9 @@ protected:
     bool ReadDiskTx(Coin outpoint, Transaction& tx) const;
     bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
     bool EraseBlockIndex(uint256 hash);
+    bool ReadBlockUndo(uint256 hash, BlockUndo& undo) const;
+    bool WriteBlockUndo(uint256 hash, const BlockUndo& undo);
+    bool EraseBlockUndo(uint256 hash);
     bool ReadHashBestChain();
     bool WriteHashBestChain(const uint256 hash);
     bool ReadBestInvalidWork();
@@ -360,6 +477,7 @@ protected:
 
 private:
     const Chain& _chain;
+    boost::scoped_ptr<KeyValueStore> _store; // the txindex and block index
     BlockFile _blockFile; // this is ONLY interface to the block file!
 
     CBlockIndex* _genesisBlockIndex;
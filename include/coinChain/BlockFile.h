@@ -25,9 +25,17 @@
 #include <coinChain/Export.h>
 
 #include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
 #include <list>
 
 /// BlockFile encapsulates the Block file on the disk. It supports different queries to the block file.
+/// Blocks are appended through a single open file that is preallocated in chunks of CHUNK_SIZE bytes,
+/// the preallocated tail is truncated again when the BlockFile is closed. While a file has a preallocated
+/// tail, a blkNNNN.alloc marker next to it holds the offset the preallocation started from, so after a crash
+/// only the blocks appended since then are walked to find the end, and nothing before it is ever truncated.
+/// Appended blocks are flushed to the OS right away, so they can be read back, but only synced to disk on a
+/// group commit: when at least a number of blocks have been written, or, by a background timer, when a number
+/// of milliseconds have passed since the first unsynced block was written.
 
 class Chain;
 class Block;
@@ -38,8 +46,14 @@ class DiskTxPos;
 class COINCHAIN_EXPORT BlockFile : private boost::noncopyable
 {
 public:
-    BlockFile(const std::string dataDir) : _dataDir(dataDir), _currentBlockFile(1) {} /// load the block chain index from file
-
+    /// Block files are preallocated in chunks of 16MB.
+    enum { CHUNK_SIZE = 0x1000000 };
+    
+    BlockFile(const std::string dataDir); /// load the block chain index from file
+    
+    ~BlockFile();
+    
+    /// Write a block, if commit is true the block file is synced before returning, otherwise on the next group commit.
     bool writeToDisk(const Chain& chain, const Block& block, unsigned int& nFileRet, unsigned int& nBlockPosRet, bool commit = false);
     bool readFromDisk(Transaction& tx, DiskTxPos pos, FILE** pfileRet);
     
@@ -47,20 +61,58 @@ public:
     bool readFromDisk(Block& block, const CBlockIndex* pindex, bool fReadTransactions=true) const;
     bool readFromDisk(Block& block, unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true) const;
     
+    /// Read the serialized block as it is stored on disk, without deserializing it.
+    bool readRawFromDisk(std::string& data, unsigned int nFile, unsigned int nBlockPos) const;
+    
     bool eraseBlockFromDisk(CBlockIndex bindex);
 
     bool checkDiskSpace(uint64 nAdditionalBytes=0);
 
+    /// Set the group commit triggers - the number of written blocks and the milliseconds since the last sync, 0 disables a trigger.
+    void setGroupCommit(unsigned int blocks, unsigned int millis);
+    
+    /// Sync the written blocks to disk.
+    bool sync();
+    
 protected:
     FILE* openBlockFile(unsigned int nFile, unsigned int nBlockPos) const;
     FILE* openBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode);
-    FILE* appendBlockFile(unsigned int& nFileRet);
+    FILE* appendBlockFile(const Chain& chain, unsigned int& nFileRet);
     //    bool loadBlockIndex(bool fAllowNew=true);
     
+    /// Sync, truncate the preallocated tail and close the file appended to.
+    void closeBlockFile();
+    
+    /// Preallocate at least size bytes after the current position.
+    bool allocate(unsigned int size);
+    
+    /// The name of the marker of a preallocated tail of a block file.
+    std::string allocMarker(unsigned int nFile) const;
+    
+private:
+    /// Sync the file appended to - expects the lock to be held.
+    bool syncFile();
+    
+    /// Sync the unsynced blocks when their commit deadline passes.
+    void syncer();
+    
 private:
     std::string _dataDir;
     FILE* _blockFile;    
     unsigned int _currentBlockFile;
+    unsigned int _currentPos; // the end of the blocks in _blockFile
+    unsigned int _allocatedPos; // the end of the preallocated space in _blockFile
+    unsigned int _preallocatedFrom; // the start of the preallocated tail, the blocks before it are never truncated
+    unsigned int _unsynced;
+    int64 _firstUnsynced; // the time the first unsynced block was written
+    unsigned int _syncBlocks;
+    unsigned int _syncMillis;
+    
+    /// Guards the file appended to, and wakes the syncer.
+    boost::mutex _access;
+    boost::condition_variable _wake;
+    bool _stop;
+    boost::thread _syncThread;
 };
 
 
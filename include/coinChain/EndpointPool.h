@@ -72,7 +72,7 @@ private:
     Statement<> update_endpoint;
     Statement<> update_time;
     Statement<> update_lasttry;
-    StatementVec<Endpoint, 4, unsigned int, unsigned short, unsigned int, unsigned int> candidates;
+    StatementRows<Endpoint, 4, unsigned int, unsigned short, unsigned int, unsigned int> candidates;
 
 private:
     EndpointPool(const EndpointPool&);
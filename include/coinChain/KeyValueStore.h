@@ -0,0 +1,99 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef KEYVALUESTORE_H
+#define KEYVALUESTORE_H
+
+#include <coin/serialize.h>
+
+#include <coinChain/Export.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <vector>
+
+/// KeyValueStore is the storage interface behind the block chain index, i.e. the txindex and the block index.
+/// Keys and values are stored as serialized byte strings, the Read/Write/Erase/Exists templates handle the
+/// serialization in the same way as CDB. Backends are created by name using KeyValueStore::create:
+///   "bdb" - Berkeley DB (blkindex.dat), the default and the format used by earlier versions.
+///   "log" - an append only log with an in-memory hash index (blkindex.log).
+
+class COINCHAIN_EXPORT KeyValueStore : private boost::noncopyable
+{
+public:
+    typedef std::vector<unsigned char> Data;
+
+    /// Visitor for scanning records - return false to stop the scan.
+    class Visitor {
+    public:
+        virtual ~Visitor() {}
+        virtual bool operator()(const Data& key, const Data& value) = 0;
+    };
+
+    virtual ~KeyValueStore() {}
+
+    virtual bool read(const Data& key, Data& value) const = 0;
+    virtual bool write(const Data& key, const Data& value) = 0;
+    virtual bool erase(const Data& key) = 0;
+    virtual bool exists(const Data& key) const = 0;
+
+    /// Visit all records with a key starting with prefix. The visiting order is backend specific.
+    virtual bool scan(const Data& prefix, Visitor& visitor) const = 0;
+
+    /// Transactions - these nest, and only the outermost commit makes the changes durable.
+    virtual bool begin() = 0;
+    virtual bool commit() = 0;
+    virtual bool abort() = 0;
+
+    /// Create a store using the named backend, the file is named from the name and a backend specific extension.
+    static KeyValueStore* create(const std::string& backend, const std::string& dataDir, const std::string& name, const char* pszMode = "cr+");
+
+    template<typename K, typename T>
+    bool Read(const K& key, T& value) const {
+        Data data;
+        if (!read(serialize(key), data))
+            return false;
+        CDataStream ssValue(data, SER_DISK);
+        ssValue >> value;
+        return true;
+    }
+
+    template<typename K, typename T>
+    bool Write(const K& key, const T& value) {
+        return write(serialize(key), serialize(value));
+    }
+
+    template<typename K>
+    bool Erase(const K& key) {
+        return erase(serialize(key));
+    }
+
+    template<typename K>
+    bool Exists(const K& key) const {
+        return exists(serialize(key));
+    }
+
+    template<typename T>
+    static Data serialize(const T& t) {
+        CDataStream ss(SER_DISK);
+        ss.reserve(1000);
+        ss << t;
+        return Data(ss.begin(), ss.end());
+    }
+};
+
+#endif // KEYVALUESTORE_H
@@ -0,0 +1,112 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOGSTORE_H
+#define LOGSTORE_H
+
+#include <coinChain/Export.h>
+#include <coinChain/KeyValueStore.h>
+
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+
+/// LogStore is an append only KeyValueStore. Every write and erase is appended to the log file and an in-memory
+/// hash index maps each key to the position of its latest value. The index is rebuilt by replaying the log on
+/// open, and the log is compacted on open once more than half of it is stale records.
+/// The log is a sequence of frames, one per committed transaction (or single write), each carrying its length,
+/// a checksum and a commit marker. Replay stops at the first incomplete or damaged frame and truncates the log
+/// there, so a crash during a commit leaves none of the transaction behind. Commits are synced to disk.
+/// Keys of the block chain index are serialized (type, 32 byte hash) pairs, so the hash function simply picks
+/// the last 8 bytes of the key, which are uniformly distributed.
+/// All access is serialized by one lock - scan visitors must not call back into the store.
+
+class COINCHAIN_EXPORT LogStore : public KeyValueStore
+{
+public:
+    LogStore(const std::string& filename, const char* pszMode = "cr+");
+    virtual ~LogStore();
+    
+    virtual bool read(const Data& key, Data& value) const;
+    virtual bool write(const Data& key, const Data& value);
+    virtual bool erase(const Data& key);
+    virtual bool exists(const Data& key) const;
+    virtual bool scan(const Data& prefix, Visitor& visitor) const;
+    
+    virtual bool begin();
+    virtual bool commit();
+    virtual bool abort();
+    
+    /// Rewrite the log keeping only the live records.
+    bool compact();
+    
+    /// Flush the log to disk.
+    bool flush(bool sync = false);
+    
+    size_t size() const;
+    
+private:
+    struct Location {
+        Location(int64 o = 0, unsigned int s = 0) : offset(o), size(s) {}
+        int64 offset; // of the value
+        unsigned int size;
+    };
+    
+    struct KeyHash {
+        size_t operator()(const Data& key) const;
+    };
+    
+    typedef boost::unordered_map<Data, Location, KeyHash> Index;
+    
+    /// A pending change - erased or the new value
+    typedef std::pair<bool, Data> Change;
+    typedef std::map<Data, Change> Batch;
+    typedef std::vector<Batch> Batches;
+    
+    /// The members below expect the lock to be held.
+    bool replay();
+    bool readAt(const Location& loc, Data& value) const;
+    bool flushFile(bool sync);
+    
+    /// Point the index at the latest value of a key, or drop the key if loc is NULL, and account for stale bytes.
+    void update(const Data& key, const Location* loc);
+    
+    /// Append the batch as one frame, sync it and update the index.
+    bool apply(const Batch& batch);
+    
+    /// Look in the pending batches, returns true if the key has been changed and sets found accordingly
+    bool pending(const Data& key, const Change*& change) const;
+    
+private:
+    std::string _filename;
+    bool _readOnly;
+    mutable FILE* _file;
+    /// Guards the file, the index and the pending batches.
+    mutable boost::mutex _access;
+    
+    Index _index;
+    Batches _batches;
+    
+    int64 _end; // end of the last complete frame
+    int64 _stale; // bytes occupied by overwritten and erased records
+};
+
+#endif // LOGSTORE_H
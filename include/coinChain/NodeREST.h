@@ -0,0 +1,70 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NODEREST_H_
+#define _NODEREST_H_
+
+#include <coinChain/Export.h>
+#include <coinChain/Node.h>
+
+#include <coinHTTP/Method.h>
+#include <coinHTTP/Header.h>
+
+#include <string>
+#include <vector>
+
+/// Binary access to the block chain - blocks, transactions and headers are served in their wire format, blocks
+/// straight from the block file, without the hex encoding and JSON framing of the RPC methods:
+///   GET /rest/block/<hash>.bin           the serialized block
+///   GET /rest/tx/<hash>.bin              the serialized transaction
+///   GET /rest/headers/<count>/<hash>.bin up to count 80 byte headers of the main chain, starting at hash
+class COINCHAIN_EXPORT NodeREST : public Resource {
+public:
+    /// The maximum number of headers in a reply.
+    enum { max_headers = 2000 };
+    
+    NodeREST(Node& node) : _node(node) {}
+    
+    virtual void operator()(const Request& request, const std::string& path, Reply& reply);
+    
+private:
+    Node& _node;
+};
+
+/// Client of the binary endpoints of NodeREST. The url is that of the resource, e.g. http://127.0.0.1:8332/rest.
+/// The methods are blocking and return false if the object could not be retrieved.
+class COINCHAIN_EXPORT NodeRESTClient {
+public:
+    NodeRESTClient(const std::string& url, Headers headers = Headers()) : _url(url), _headers(headers) {}
+    
+    bool getBlock(const uint256& hash, Block& block);
+    
+    bool getTransaction(const uint256& hash, Transaction& tx);
+    
+    /// Get up to count headers of the main chain, starting at the block with the hash.
+    bool getHeaders(const uint256& hash, unsigned int count, std::vector<Block>& headers);
+    
+    /// Get the serialized block, e.g. to store it as is.
+    bool getRawBlock(const uint256& hash, std::string& data);
+    
+private:
+    bool get(const std::string& path, std::string& data);
+    
+    std::string _url;
+    Headers _headers;
+};
+
+#endif // _NODEREST_H_
@@ -21,26 +21,47 @@
 #include <coinChain/Node.h>
 
 #include <coinHTTP/Method.h>
+#include <coinHTTP/Notifier.h>
+#include <coinHTTP/Server.h>
 
 /// Base class for all Node rpc methods - they all need a handle to the node.
 class COINCHAIN_EXPORT NodeMethod : public Method {
 public:
     NodeMethod(Node& node) : _node(node) {}
+    virtual const std::string group() const { return "chain"; }
 protected:
     Node& _node;
 };
 
 
+/// Results concerning blocks this deep in the main chain are considered immutable, and are cached.
+const int immutable_depth = 6;
+
 class COINCHAIN_EXPORT GetBlockHash : public NodeMethod {
 public:
     GetBlockHash(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    virtual bool isReadOnly() const { return true; }
+    virtual bool isCacheable() const { return true; }
+    virtual bool isImmutable(const json_spirit::Array& params, const json_spirit::Value& result) const;
 };
 
+/// Get a block - the transactions are written as they are converted, as a verbose block can be large.
 class COINCHAIN_EXPORT GetBlock : public NodeMethod {
 public:
     GetBlock(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    void operator()(const json_spirit::Array& params, bool fHelp, const Request& request, JSONWriter& writer);
+    virtual bool isReadOnly() const { return true; }
+    virtual bool isStreaming() const { return true; }
+    virtual bool isCacheable() const { return true; }
+    virtual bool isImmutable(const json_spirit::Array& params, const json_spirit::Value& result) const;
+private:
+    /// Look up the block and its index, returns true for verbose transactions.
+    bool lookup(const json_spirit::Array& params, bool fHelp, Block& block, const CBlockIndex*& blockindex);
+    json_spirit::Object summary(const Block& block, const CBlockIndex* blockindex);
+    json_spirit::Value tx(const Transaction& tx, const Block& block, const CBlockIndex* blockindex, bool verbose);
+    json_spirit::Object links(const CBlockIndex* blockindex);
 };
 
 extern COINCHAIN_EXPORT json_spirit::Object tx2json(Transaction &tx, int64 timestamp = 0, int64 blockheight = 0);
@@ -49,36 +70,101 @@ class COINCHAIN_EXPORT GetTransaction : public NodeMethod {
 public:
     GetTransaction(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    virtual bool isReadOnly() const { return true; }
+    virtual bool isCacheable() const { return true; }
+    virtual bool isImmutable(const json_spirit::Array& params, const json_spirit::Value& result) const;
 };
 
 class COINCHAIN_EXPORT GetPenetration : public NodeMethod {
 public:
     GetPenetration(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 class COINCHAIN_EXPORT GetBlockCount : public NodeMethod {
 public:
     GetBlockCount(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 class COINCHAIN_EXPORT GetConnectionCount : public NodeMethod {
 public:
     GetConnectionCount(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 class COINCHAIN_EXPORT GetDifficulty : public NodeMethod {
 public:
     GetDifficulty(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 class COINCHAIN_EXPORT GetInfo : public NodeMethod {
 public:
     GetInfo(Node& node) : NodeMethod(node) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
+};
+
+/// Notifies the blocks accepted by the node as {"hash", "blockcount", "time", "tx", "best"}, "tx" being the number of
+/// transactions and "best" true if the block is the new head of the best chain.
+class COINCHAIN_EXPORT BlockNotifier : public BlockFilter::Listener {
+public:
+    BlockNotifier(Node& node, Notifier& notifier) : _node(node), _notifier(notifier) {}
+    virtual void operator()(const Block& block);
+    
+    static json_spirit::Object event(Node& node, const Block& block);
+private:
+    Node& _node;
+    Notifier& _notifier;
+};
+
+/// Notifies the transactions accepted by the node as {"hash", "addresses"}, the addresses being those paid.
+class COINCHAIN_EXPORT TransactionNotifier : public TransactionFilter::Listener {
+public:
+    TransactionNotifier(Node& node, Notifier& notifier) : _node(node), _notifier(notifier) {}
+    virtual void operator()(const Transaction& tx);
+private:
+    Node& _node;
+    Notifier& _notifier;
+};
+
+/// Clears the response cache of the server on a reorganization deeper than immutable_depth, as the cached
+/// results of the blocks disconnected are then no longer valid.
+class COINCHAIN_EXPORT ResponseCacheInvalidator : public BlockFilter::Listener {
+public:
+    ResponseCacheInvalidator(Node& node, Server& server) : _node(node), _server(server), _best(node.blockChain().getBestIndex()) {}
+    virtual void operator()(const Block& block);
+private:
+    Node& _node;
+    Server& _server;
+    const CBlockIndex* _best;
+};
+
+/// Long-poll for the next block of the best chain - returns at once if the best block is not the known one.
+class COINCHAIN_EXPORT WaitForBlock : public AsyncMethod {
+public:
+    WaitForBlock(Node& node, Notifier& blocks) : _node(node), _blocks(blocks) {}
+    void operator()(const json_spirit::Array& params, bool fHelp, MethodDone onDone);
+    virtual bool isReadOnly() const { return true; }
+private:
+    Node& _node;
+    Notifier& _blocks;
+};
+
+/// Long-poll for the next transaction paying one of the addresses.
+class COINCHAIN_EXPORT WaitForTx : public AsyncMethod {
+public:
+    WaitForTx(Node& node, Notifier& txs) : _node(node), _txs(txs) {}
+    void operator()(const json_spirit::Array& params, bool fHelp, MethodDone onDone);
+    virtual bool isReadOnly() const { return true; }
+private:
+    Node& _node;
+    Notifier& _txs;
 };
 
 #endif // _NODERPC_H_
\ No newline at end of file
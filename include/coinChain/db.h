@@ -19,14 +19,19 @@
 
 #include <sqlite3.h>
 
+#include <boost/shared_ptr.hpp>
+
 typedef std::vector<unsigned char> blob;
 
 class Database;
 
 struct undefined {};
 
+/// StatementBase wraps a prepared statement. Copies share the statement, which is finalized with the last copy.
 class StatementBase {
     friend class Database;
+public:
+    StatementBase() : _stmt(NULL) {}
 protected:
     void bind(int64 arg, int col);
     void bind(int arg, int col) { bind((int64)arg, col); }
@@ -44,7 +49,11 @@ protected:
     void get(blob& arg, int col);
     
     void get(undefined, int) {}
+    
+    /// Throws with the sqlite error message if the step result is not SQLITE_DONE.
+    void check(int ret);
 protected:
+    boost::shared_ptr<sqlite3_stmt> _handle;
     sqlite3_stmt *_stmt;
 };
 
@@ -168,6 +177,74 @@ public:
     FUNCTION_CALL_DEFINITIONS(std::vector<R>)
 };
 
+#define VISITOR_CALL_DEFINITIONS \
+template <typename V> \
+size_t each(V& visitor) { \
+return visit(visitor); \
+} \
+template <typename V, typename T1> \
+size_t each(V& visitor, T1 v1) { \
+bind(v1, 1); \
+return each(visitor); \
+} \
+template <typename V, typename T1, typename T2> \
+size_t each(V& visitor, T1 v1, T2 v2) { \
+bind(v2, 2); \
+return each(visitor, v1); \
+} \
+template <typename V, typename T1, typename T2, typename T3> \
+size_t each(V& visitor, T1 v1, T2 v2, T3 v3) { \
+bind(v3, 3); \
+return each(visitor, v1, v2); \
+} \
+template <typename V, typename T1, typename T2, typename T3, typename T4> \
+size_t each(V& visitor, T1 v1, T2 v2, T3 v3, T4 v4) { \
+bind(v4, 4); \
+return each(visitor, v1, v2, v3); \
+} \
+template <typename V, typename T1, typename T2, typename T3, typename T4, typename T5> \
+size_t each(V& visitor, T1 v1, T2 v2, T3 v3, T4 v4, T5 v5) { \
+bind(v5, 5); \
+return each(visitor, v1, v2, v3, v4); \
+} \
+template <typename V, typename T1, typename T2, typename T3, typename T4, typename T5, typename T6> \
+size_t each(V& visitor, T1 v1, T2 v2, T3 v3, T4 v4, T5 v5, T6 v6) { \
+bind(v6, 6); \
+return each(visitor, v1, v2, v3, v4, v5); \
+} \
+
+/// StatementRows streams the result rows into a visitor instead of materializing a vector of them.
+/// The visitor is called as bool visitor(const R&) for each row, returning false stops the iteration.
+/// Invoke it as: rows.each(visitor, param1, param2, ...);
+template <class R, int N, class P0, class P1 = undefined, class P2 = undefined, class P3 = undefined, class P4 = undefined, class P5 = undefined, class P6 = undefined, class P7 = undefined>
+class StatementRows : public StatementBase {
+public:
+    StatementRows() : StatementBase() {}
+    StatementRows(StatementBase stmt) : StatementBase(stmt) {}
+    
+    template <class V>
+    size_t visit(V& visitor) {
+        size_t rows = 0;
+        try {
+            while(sqlite3_step(_stmt) == SQLITE_ROW) {
+                P0 p0; P1 p1; P2 p2; P3 p3; P4 p4; P5 p5; P6 p6; P7 p7;
+                get(p0, 0); get(p1, 1); get(p2, 2); get(p3, 3); get(p4, 4); get(p5, 5); get(p6, 6); get(p7, 7);
+                ++rows;
+                if (!visitor(Construct<R, N, P0, P1, P2, P3, P4, P5, P6, P7>::construct(p0, p1, p2, p3, p4, p5, p6, p7)))
+                    break;
+            }
+        }
+        catch (...) {
+            sqlite3_reset(_stmt);
+            throw;
+        }
+        sqlite3_reset(_stmt);
+        return rows;
+    }
+    
+    VISITOR_CALL_DEFINITIONS
+};
+
 template <class R = undefined>
 class Statement : public StatementBase {
 public:
@@ -192,8 +269,10 @@ public:
     Statement(StatementBase stmt) : StatementBase(stmt) {}
     
     undefined eval() {
-        while(sqlite3_step(_stmt) == SQLITE_ROW);
+        int result;
+        while((result = sqlite3_step(_stmt)) == SQLITE_ROW);
         sqlite3_reset(_stmt);
+        check(result);
         return undefined();
     }
     
@@ -204,23 +283,89 @@ typedef Statement<undefined> StatementVoid;
 
 class Database {
 public:
-	Database(const std::string filename);
+    /// Pragmas collects the sqlite settings applied to a connection. Use one of the presets and adjust as needed.
+    struct Pragmas {
+        enum Synchronous {
+            OFF = 0,
+            NORMAL = 1,
+            FULL = 2
+        };
+        
+        Pragmas(bool w = false, Synchronous s = FULL, int64 m = 0, int c = 0) : wal(w), synchronous(s), mmap_size(m), cache_size(c) {}
+        
+        /// sqlite defaults - rollback journal, full sync and no memory mapping.
+        static Pragmas defaults() { return Pragmas(); }
+        /// Write ahead log with normal sync - safe against application crashes and much cheaper per commit.
+        static Pragmas wal_normal() { return Pragmas(true, NORMAL, 256*1024*1024, -64*1024); }
+        /// Bulk import - write ahead log, no sync and a large map, for data that can be rebuilt.
+        static Pragmas bulk() { return Pragmas(true, OFF, 1024*1024*1024, -256*1024); }
+        
+        bool wal;
+        Synchronous synchronous;
+        int64 mmap_size; // bytes, 0 means no memory mapping
+        int cache_size; // as the sqlite pragma: positive in pages, negative in KiB, 0 keeps the default
+    };
+    
+    /// Savepoint is a RAII scope for batching writes. The scope is rolled back unless release() is called.
+    /// Savepoints nest, and the outermost savepoint acts as a transaction.
+    class Savepoint {
+    public:
+        Savepoint(Database& db);
+        ~Savepoint();
+        
+        /// Commit the work done in the scope (to the enclosing savepoint if any).
+        void release();
+        
+        /// Undo the work done in the scope.
+        void rollback();
+        
+    private:
+        Savepoint(const Savepoint&);
+        void operator=(const Savepoint&);
+        
+    private:
+        Database& _db;
+        std::string _name;
+        bool _active;
+    };
+    
+public:
+	Database(const std::string filename, const Pragmas& pragmas = Pragmas::defaults());
 	~Database();
 	
+    /// Prepare a statement - statements are cached by their sql text, so preparing the same statement twice is cheap.
+    /// A cached statement is only handed out while no one else holds it, otherwise a private statement is prepared.
+    /// Use it for static sql only - sql built from values belongs in execute or in bound parameters.
     StatementBase prepare(std::string stmt);
+    
+    /// Execute a statement once, without caching it - throws if it fails.
     void execute(std::string stmt);
     
+    /// Apply the pragmas to the connection.
+    void pragma(const Pragmas& pragmas);
+    
     void begin();
     void commit();
+    void rollback();
     
     const int64 last_id() const;
     
     const std::string error_text() const { return sqlite3_errmsg(_db); }
     
+    /// Number of statements currently in the statement cache.
+    const size_t cached_statements() const { return _statements.size(); }
+    
 private:
+    Database(const Database&);
+    void operator=(const Database&);
+    
+    /// Prepare a statement owned by the returned wrapper.
+    StatementBase compile(const std::string& stmt);
+    
 	sqlite3 *_db;
-    typedef std::vector<StatementBase> Statements;
+    typedef std::map<std::string, StatementBase> Statements;
     Statements _statements;
+    unsigned int _savepoints;
 };
 
 
@@ -17,6 +17,10 @@
 #ifndef HTTP_CONNECTION_HPP
 #define HTTP_CONNECTION_HPP
 
+#include <cstdio>
+#include <deque>
+#include <vector>
+
 #include <boost/asio.hpp>
 #include <boost/array.hpp>
 #include <boost/noncopyable.hpp>
@@ -35,10 +39,15 @@ class ConnectionManager;
 
 typedef boost::asio::ssl::stream<boost::asio::ip::tcp::socket> ssl_socket;
 
-/// Represents a single connection from a client.
+/// Represents a single connection from a client. Requests are read ahead (HTTP/1.1 pipelining), up to the
+/// ConnectionManager limit of requests in flight (pr default max_pipelined), and the replies are sent in order. A
+/// read-only request is executed while the requests before it are still executing if they are all read-only, any
+/// other request waits for the requests before it, hence the requests see the state as if executed one by one.
 class COINHTTP_EXPORT Connection : public boost::enable_shared_from_this<Connection>, private boost::noncopyable
 {
 public:
+    enum { max_pipelined = 16 };
+    
     /// Construct a connection with the given io_service.
     explicit Connection(boost::asio::io_service& io_service, ConnectionManager& manager, RequestHandler& handler, std::ostream& access_log);
     
@@ -52,16 +61,89 @@ public:
     const boost::asio::ip::tcp::socket& socket() const;
 
     
-    /// Start the first asynchronous operation for the connection.
-    void start();
+    /// Get the address of the client.
+    const boost::asio::ip::address& remote();
+    
+    /// Start the first asynchronous operation for the connection. A connection started with a retry_after is
+    /// refused - its first request is replied 503 Service Unavailable and the connection is closed.
+    void start(unsigned int retry_after = 0);
     
     /// Stop all asynchronous operations associated with the connection.
     void stop();
     
 private:
+    /// A request and its reply. Exchanges are recycled through a pool of the connection, and are kept alive
+    /// by the handlers bound to them while the request is executed.
+    struct Exchange : private boost::noncopyable {
+        Exchange(boost::asio::io_service& io_service) : postpone(io_service), parsed(false), read_only(boost::indeterminate), started(false), done(false), close(false) {}
+        
+        void reset() {
+            request.reset();
+            reply.reset();
+            parsed = false;
+            method.clear();
+            payload.reset();
+            read_only = boost::indeterminate;
+            started = false;
+            done = false;
+            close = false;
+        }
+        
+        Request request;
+        Reply reply;
+        
+        /// Timeout timer for postponing execution
+        boost::asio::deadline_timer postpone;
+        
+        /// The method called by the request and its JSON RPC payload - parsed once, for the read-only check and the
+        /// execution.
+        bool parsed;
+        std::string method;
+        boost::shared_ptr<json_spirit::Value> payload;
+        
+        /// The request is read-only - determined only when requests are pipelined.
+        boost::tribool read_only;
+        
+        /// The request has been started.
+        bool started;
+        
+        /// The reply is ready to be sent.
+        bool done;
+        
+        /// The connection is closed after the reply.
+        bool close;
+    };
+    typedef boost::shared_ptr<Exchange> exchange_ptr;
+    typedef std::deque<exchange_ptr> Exchanges;
+    
+    /// Get an exchange from the pool.
+    exchange_ptr acquire();
+    
+    /// Return a replied exchange to the pool.
+    void release(exchange_ptr exchange);
+    
     /// log 
-    void log_request() const;
+    void log_request(const Request& request, const Reply& reply) const;
 
+    /// Read more data - unless the buffered data is not yet parsed, a read is pending or the connection is closing.
+    void read();
+    
+    /// Parse the buffered data into requests until the buffer is consumed or max_pipelined requests are in flight.
+    void parse();
+    
+    /// Start the requests that can be executed - in order, and read-only requests while only read-only requests
+    /// before them are executing.
+    void execute();
+    
+    /// Parse the method of the request of the exchange, unless it is parsed already.
+    void parseMethod(Exchange& exchange);
+    
+    /// True if the request of the exchange is read-only.
+    bool isReadOnly(Exchange& exchange);
+    
+    /// Write the next reply, if it is ready and no write is in progress.
+    void write();
+    
     /// Secure connectiontions need to perform a handshake first.
     virtual void handle_handshake(const boost::system::error_code& error);
     
@@ -69,7 +151,22 @@ private:
     void handle_read(const boost::system::error_code& e, std::size_t bytes_transferred);
     
     /// Handle completion of a wait operation - some rpc methods support waiting for a certain state
-    void handle_wait(const boost::system::error_code& e);
+    void handle_wait(exchange_ptr exchange, const boost::system::error_code& e);
+    
+    /// Handle completion of the request execution on a worker thread.
+    void handle_exec(exchange_ptr exchange);
+    
+    /// Send the next chunk of a streamed reply, or wait for it to be produced.
+    void handle_chunk(const boost::system::error_code& e);
+    
+    /// Send the next part of a file reply - with sendfile on plain connections where supported.
+    void handle_file(const boost::system::error_code& e);
+    
+    /// Read the next part of a file reply into the chunk - on a worker thread, as reading can block.
+    void read_file(boost::shared_ptr<std::FILE> file);
+    
+    /// Send the part of a file reply read.
+    void handle_file_read(const boost::system::error_code& e);
     
     /// Handle completion of a write operation.
     void handle_write(const boost::system::error_code& e, std::size_t bytes_transferred);
@@ -77,6 +174,9 @@ private:
     /// Handle keep alive timeouts
     void handle_timeout(const boost::system::error_code& e);
     
+    /// The io_service of the connection
+    boost::asio::io_service& _io_service;
+    
     /// Dummy context to enable initialization of ghost ssl socket
     boost::asio::ssl::context _ctx;
     
@@ -92,8 +192,8 @@ private:
     /// Timeout timer for Keep-Alive connections (as opposed to Close)
     boost::asio::deadline_timer _keep_alive;
     
-    /// Timeout timer for postponing execution
-    boost::asio::deadline_timer _exec_postpone;
+    /// The server runs on several threads, the handlers of a connection are serialized by its strand.
+    boost::asio::io_service::strand _strand;
     
     /// The manager for this connection.
     ConnectionManager& _connectionManager;
@@ -105,18 +205,40 @@ private:
     typedef boost::array<char, 8192> Buffer;
     Buffer _buffer;
     
-    /// Buffer iterator to store the buffer state between two keep_alive reads.
+    /// The part of the buffer not yet parsed.
     Buffer::iterator _buffer_iterator;
-    std::size_t _bytes_read;
-    
-    /// The incoming request.
-    Request _request;
+    Buffer::iterator _buffer_end;
     
     /// The parser for the incoming request.
     RequestParser _requestParser;
     
-    /// The reply to be sent back to the client.
-    Reply _reply;
+    /// The request being parsed.
+    exchange_ptr _parsing;
+    
+    /// The requests in flight, in the order they were received.
+    Exchanges _exchanges;
+    
+    /// Exchanges for reuse.
+    std::vector<exchange_ptr> _pool;
+    
+    /// The address of the client.
+    boost::asio::ip::address _remote;
+    
+    /// Set for a refused connection - the seconds the client should wait before retrying.
+    unsigned int _retry_after;
+    
+    /// State of the connection - a read is pending, a reply is being written, no more requests are read.
+    bool _reading;
+    bool _writing;
+    bool _closing;
+    
+    /// The chunk of a streamed reply being sent, and its size line.
+    std::string _chunk;
+    std::string _chunk_size;
+    
+    /// The file of a file reply being sent, and the bytes sent of it.
+    boost::shared_ptr<std::FILE> _file;
+    size_t _file_sent;
     
     /// The ostream to log to
     std::ostream& _access_log;
@@ -20,15 +20,25 @@
 #include <coinHTTP/Export.h>
 #include <coinHTTP/Connection.h>
 
-#include <set>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "json/json_spirit.h"
 
 /// Manages open connections so that they may be cleanly stopped when the server
-/// needs to shut down.
+/// needs to shut down. It also limits the load a single client can put on the server: the connections pr client
+/// address, the requests queued pr connection and, by a token bucket, the request rate of each user - identified
+/// by the credentials of its Authorization header if they are valid, otherwise by the client address. Requests over the
+/// limits are replied 503 Service Unavailable with a Retry-After header, without being executed.
 class COINHTTP_EXPORT ConnectionManager : private boost::noncopyable
 {
 public:
-    /// Add the specified connection to the manager and start it.
+    ConnectionManager();
+    
+    /// Add the specified connection to the manager and start it - refused if its client is at the connection limit.
     void start(connection_ptr c);
     
     /// Stop the specified connection.
@@ -37,9 +47,75 @@ public:
     /// Stop all connections.
     void stop_all();
     
+    /// Limit the open connections pr client address - 0 removes the limit.
+    void setMaxConnectionsPerClient(size_t connections);
+    
+    /// Limit the requests in flight pr connection - further requests are not read until earlier ones are replied.
+    void setMaxPipelined(size_t requests);
+    
+    size_t maxPipelined() const { return _max_pipelined; }
+    
+    /// Limit the request rate of each user to rate requests pr second, with bursts of up to burst requests - a
+    /// rate of 0 removes the limit.
+    void setRateLimit(double rate, double burst);
+    
+    /// Admit a request under the rate limit of its user - returns 0 if admitted, otherwise the seconds to retry after.
+    /// Only authenticated requests are accounted to the user of their credentials, others to their client address.
+    unsigned int admit(const Request& request, bool authenticated);
+    
+    /// Account bytes received from a client.
+    void received(const boost::asio::ip::address& client, size_t bytes);
+    
+    /// Account a replied request - its reply size and the time spent executing it.
+    void replied(const Request& request, const Reply& reply);
+    
+    /// Get the counters pr client and pr user, level 0 only sums them up.
+    json_spirit::Value getStats(int level = 1);
+    
 private:
-    /// The managed connections.
-    std::set<connection_ptr> _connections;
+    /// The counters of a client address.
+    struct Client {
+        Client() : connections(0), accepted(0), refused(0), requests(0), limited(0), bytes_in(0), bytes_out(0), busy(0) {}
+        size_t connections;
+        size_t accepted;
+        size_t refused;
+        size_t requests;
+        size_t limited;
+        boost::uint64_t bytes_in;
+        boost::uint64_t bytes_out;
+        boost::uint64_t busy; // microseconds of request execution
+    };
+    typedef std::map<boost::asio::ip::address, Client> Clients;
+    
+    /// The token bucket of a user.
+    struct Bucket {
+        Bucket() : tokens(0), requests(0), limited(0) {}
+        std::string user;
+        double tokens;
+        boost::posix_time::ptime updated;
+        size_t requests;
+        size_t limited;
+    };
+    typedef std::map<std::string, Bucket> Buckets;
+    
+    /// Clients without connections and full buckets are forgotten when there are more than max_idle, and the least
+    /// recently used buckets when there are max_buckets.
+    enum { max_idle = 1024, max_buckets = 4096 };
+    
+    /// The managed connections and their client addresses.
+    typedef std::map<connection_ptr, boost::asio::ip::address> Connections;
+    Connections _connections;
+    
+    Clients _clients;
+    Buckets _buckets;
+    
+    size_t _max_connections;
+    size_t _max_pipelined;
+    double _rate;
+    double _burst;
+    
+    /// Connections are started and stopped from all the Server threads.
+    boost::mutex _connections_mutex;
 };
 
 #endif // HTTP_CONNECTION_MANAGER_H
@@ -0,0 +1,81 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_CONTENTSTREAM_H
+#define HTTP_CONTENTSTREAM_H
+
+#include <coinHTTP/Export.h>
+
+#include <deque>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/// ContentStream carries the content of a reply from the worker thread producing it to the connection
+/// sending it, as a sequence of chunks. The producer blocks when more than capacity bytes are pending,
+/// hence the memory used by a streamed reply is bounded independently of its size.
+class COINHTTP_EXPORT ContentStream : private boost::noncopyable
+{
+public:
+    typedef boost::function<void ()> Notify;
+    
+    /// The state of the stream as seen from the consumer.
+    enum State {
+        data,
+        waiting,
+        closed,
+        aborted
+    };
+    
+    /// ready is called on the first write - from then on the reply belongs to the connection.
+    ContentStream(Notify ready, size_t capacity = 0x40000);
+    
+    /// Write a chunk, blocks while the stream is full. Returns false if the consumer has cancelled the stream.
+    /// Without block, false is also returned, and nothing written, if the stream is full, e.g. for event streams.
+    bool write(const std::string& chunk, bool block = true);
+    
+    /// End of content.
+    void close();
+    
+    /// The content is incomplete, e.g. the method threw after it started writing.
+    void abort();
+    
+    /// Read the next chunk. If none is pending the listener is called once one is, or the stream is ended.
+    State read(std::string& chunk, Notify listener);
+    
+    /// The consumer is gone - pending and future writes fail.
+    void cancel();
+    
+    /// The number of bytes written to the stream.
+    size_t size() const;
+    
+private:
+    mutable boost::mutex _mutex;
+    boost::condition_variable _drained;
+    Notify _ready;
+    Notify _listener;
+    std::deque<std::string> _chunks;
+    size_t _capacity;
+    size_t _pending;
+    size_t _size;
+    State _end;
+    bool _cancelled;
+};
+
+#endif // HTTP_CONTENTSTREAM_H
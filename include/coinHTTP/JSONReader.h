@@ -0,0 +1,64 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_JSONREADER_H
+#define HTTP_JSONREADER_H
+
+#include <coinHTTP/Export.h>
+
+#include "json/json_spirit.h"
+
+#include <string>
+#include <vector>
+
+/// JSONReader is a single pass recursive descent JSON parser producing json_spirit Values. It replaces the
+/// Boost.Spirit based json_spirit::read for the RPC payloads, as that is slow and allocates heavily.
+/// Differences from json_spirit::read: the whole text must be a single value (surrounding whitespace
+/// allowed), \u escapes are decoded to UTF-8, and nesting is limited to max_depth.
+class COINHTTP_EXPORT JSONReader
+{
+public:
+    enum { max_depth = 512 };
+    
+    /// Parse text into value, returns false if text is not valid JSON - value is then partially parsed.
+    static bool read(const std::string& text, json_spirit::Value& value);
+    
+private:
+    JSONReader(const char* begin, const char* end) : _pos(begin), _end(end), _depth(0), _next(0) {}
+    
+    /// Count the elements of the objects and arrays, for reserving them - returns false if the structure is malformed.
+    bool count();
+    
+    /// The number of elements of the next object or array.
+    size_t size();
+    
+    bool value(json_spirit::Value& value);
+    bool object(json_spirit::Value& value);
+    bool array(json_spirit::Value& value);
+    bool string(std::string& str);
+    bool number(json_spirit::Value& value);
+    bool literal(const char* text);
+    bool hex(unsigned int& code);
+    void whitespace();
+    
+    const char* _pos;
+    const char* _end;
+    unsigned int _depth;
+    std::vector<size_t> _counts;
+    size_t _next;
+};
+
+#endif // HTTP_JSONREADER_H
@@ -0,0 +1,82 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_JSONWRITER_H
+#define HTTP_JSONWRITER_H
+
+#include <coinHTTP/Export.h>
+
+#include "json/json_spirit.h"
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+class ContentStream;
+
+/// JSONWriter emits JSON incrementally, e.g. the elements of a large array one by one, instead of building
+/// a json_spirit::Value tree of the full result. The text is flushed to the stream, if any, every flush_size
+/// bytes - without a stream the text is kept and can be taken with content(). The output is formatted as
+/// json_spirit::write formats it.
+class COINHTTP_EXPORT JSONWriter : private boost::noncopyable
+{
+public:
+    JSONWriter(ContentStream* stream = NULL, size_t flush_size = 0x10000);
+    
+    void beginObject();
+    void endObject();
+    
+    void beginArray();
+    void endArray();
+    
+    /// Write the name of the next member of an object.
+    void key(const std::string& name);
+    
+    /// Write a value - either an element of an array or, following a key, a member of an object.
+    void write(const json_spirit::Value& value);
+    
+    /// Write a member of an object.
+    void write(const std::string& name, const json_spirit::Value& value) {
+        key(name);
+        write(value);
+    }
+    
+    /// Write text as is, e.g. a trailing newline.
+    void raw(const std::string& text);
+    
+    /// Flush the text written so far to the stream - throws if the stream has been cancelled.
+    void flush();
+    
+    /// True if any text has been flushed to the stream, i.e. the output can no longer be replaced.
+    bool flushed() const { return _flushed; }
+    
+    /// The text not yet flushed.
+    std::string& content() { return _buffer; }
+    
+private:
+    void separate();
+    void written();
+    
+    ContentStream* _stream;
+    size_t _flush_size;
+    std::string _buffer;
+    std::vector<bool> _first;
+    bool _member;
+    bool _flushed;
+};
+
+#endif // HTTP_JSONWRITER_H
@@ -0,0 +1,136 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_LRU_CACHE_H
+#define HTTP_LRU_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/// A thread safe cache of values keyed by strings, bounded by a byte budget - the least recently used values are
+/// evicted first. The size of a value is given when it is inserted, the key counts too. Hits and misses are
+/// counted for the statistics. Each clear starts a new generation - a value computed before a clear can be inserted
+/// tagged with the generation it was computed in, and is then rejected as stale.
+template <typename T>
+class LRUCache : private boost::noncopyable
+{
+public:
+    /// A single value may not take more than a fraction of the budget, as it would flush the cache.
+    LRUCache(size_t budget, size_t fraction = 4) : _budget(budget), _fraction(fraction), _size(0), _hits(0), _misses(0), _generation(0) {}
+    
+    /// Look up a value - a hit makes it the most recently used.
+    bool find(const std::string& key, T& value) {
+        boost::mutex::scoped_lock lock(_mutex);
+        typename Entries::iterator entry = _entries.find(key);
+        if (entry == _entries.end()) {
+            _misses++;
+            return false;
+        }
+        _hits++;
+        _order.splice(_order.begin(), _order, entry->second.order);
+        value = entry->second.value;
+        return true;
+    }
+    
+    /// Insert a value, unless it is too large or already cached. Returns true if it was inserted.
+    bool insert(const std::string& key, const T& value, size_t size) {
+        return insert(key, value, size, generation());
+    }
+    
+    /// Insert a value computed in a generation - it is rejected if the cache has been cleared since.
+    bool insert(const std::string& key, const T& value, size_t size, size_t generation) {
+        size += key.size();
+        boost::mutex::scoped_lock lock(_mutex);
+        if (generation != _generation || size > _budget / _fraction || _entries.count(key))
+            return false;
+        _order.push_front(key);
+        Entry& entry = _entries[key];
+        entry.value = value;
+        entry.size = size;
+        entry.order = _order.begin();
+        _size += size;
+        evict();
+        return true;
+    }
+    
+    void clear() {
+        boost::mutex::scoped_lock lock(_mutex);
+        _entries.clear();
+        _order.clear();
+        _size = 0;
+        _generation++;
+    }
+    
+    /// Set the byte budget - 0 disables the cache.
+    void budget(size_t budget) {
+        boost::mutex::scoped_lock lock(_mutex);
+        _budget = budget;
+        evict();
+    }
+    
+    size_t budget() const { boost::mutex::scoped_lock lock(_mutex); return _budget; }
+    size_t size() const { boost::mutex::scoped_lock lock(_mutex); return _size; }
+    size_t entries() const { boost::mutex::scoped_lock lock(_mutex); return _entries.size(); }
+    size_t hits() const { boost::mutex::scoped_lock lock(_mutex); return _hits; }
+    size_t misses() const { boost::mutex::scoped_lock lock(_mutex); return _misses; }
+    size_t generation() const { boost::mutex::scoped_lock lock(_mutex); return _generation; }
+    
+    /// The keys and sizes, the most recently used first.
+    std::vector<std::pair<std::string, size_t> > keys() const {
+        boost::mutex::scoped_lock lock(_mutex);
+        std::vector<std::pair<std::string, size_t> > keys;
+        for (typename Order::const_iterator key = _order.begin(); key != _order.end(); ++key)
+            keys.push_back(std::make_pair(*key, _entries.find(*key)->second.size));
+        return keys;
+    }
+    
+private:
+    typedef std::list<std::string> Order;
+    struct Entry {
+        T value;
+        size_t size;
+        typename Order::iterator order;
+    };
+    typedef std::map<std::string, Entry> Entries;
+    
+    /// Evict the least recently used values until the cache is within the budget - the lock is held.
+    void evict() {
+        while (_size > _budget) {
+            typename Entries::iterator oldest = _entries.find(_order.back());
+            _size -= oldest->second.size;
+            _entries.erase(oldest);
+            _order.pop_back();
+        }
+    }
+    
+    mutable boost::mutex _mutex;
+    Entries _entries;
+    Order _order;
+    size_t _budget;
+    size_t _fraction;
+    size_t _size;
+    size_t _hits;
+    size_t _misses;
+    size_t _generation;
+};
+
+#endif // HTTP_LRU_CACHE_H
@@ -18,6 +18,7 @@
 #define METHOD_H
 
 #include <coinHTTP/Export.h>
+#include <coinHTTP/JSONWriter.h>
 
 #include <string>
 #include <map>
@@ -27,6 +28,7 @@
 #include "json/json_spirit.h"
 
 class Request;
+struct Reply;
 
 /// The base class for Method functors - The definitions follow the JSON_RPC 2.0 definition and strives at introspection support.
 class COINHTTP_EXPORT Method
@@ -45,6 +47,18 @@ public:
         onDone(operator()(params, fHelp));
     }
     
+    /// Streaming version - the result is written to the writer instead of being returned. Methods with large
+    /// results, e.g. long lists, override this to write the result piecewise and return true from isStreaming.
+    virtual void operator()(const json_spirit::Array& params, bool fHelp, const Request& request, JSONWriter& writer) {
+        writer.write(operator()(params, fHelp, request));
+    }
+    
+    /// Streaming methods have their result sent to the client while it is written. - OPTIONAL
+    virtual bool isStreaming() const { return false; }
+    
+    /// Asynchronous methods are executed by the non blocking version, and reply when onDone is called. - OPTIONAL
+    virtual bool isAsync() const { return false; }
+    
     /// Get the name of the method. Default implemented by lowercase typeid name. - REQUIRED
     virtual const std::string name() const { 
         if (_name.empty())
@@ -58,6 +72,23 @@ public:
     virtual const std::string params() const  { return ""; } // OPTIONAL
     virtual const std::string ret() const { return ""; } // OPTIONAL
     
+    /// Read-only methods do not change any state and can be executed concurrently, e.g. the calls of a batch request. - OPTIONAL
+    virtual bool isReadOnly() const { return false; }
+    
+    /// Methods that are not read-only are executed one at a time within their group, e.g. "chain" or "wallet", while
+    /// methods of different groups run concurrently. - OPTIONAL
+    virtual const std::string group() const { return ""; }
+    
+    /// The group of a call - pr default that of the method, methods routing their calls, e.g. to a wallet named by
+    /// the request path, refine it pr call. - OPTIONAL
+    virtual const std::string group(const Request& request) const { return group(); }
+    
+    /// Cacheable methods have their immutable results served from the response cache. - OPTIONAL
+    virtual bool isCacheable() const { return false; }
+    
+    /// Called for cacheable methods after a successful call - return true if the result for these params will never change.
+    virtual bool isImmutable(const json_spirit::Array& params, const json_spirit::Value& result) const { return false; }
+    
     /// setName is to be able easily to overwrite the name of a Method.
     /// Nice for registering several of the same RPC calls in the same Server.
     virtual void setName(std::string name) { _name = name; }
@@ -68,9 +99,34 @@ private:
     std::string _name;
 };
 
+/// Base class for asynchronous methods, e.g. long-poll methods waiting for an event. The request is replied when
+/// onDone is called, without blocking a worker thread meanwhile - if the method is called synchronously, e.g. in a
+/// batch, the calling thread waits for onDone. Errors must be thrown before the method has passed on onDone.
+class COINHTTP_EXPORT AsyncMethod : public Method
+{
+public:
+    virtual json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual void operator()(const json_spirit::Array& params, bool fHelp, MethodDone onDone) = 0;
+    virtual bool isAsync() const { return true; }
+};
+
 typedef boost::shared_ptr<Method> method_ptr;
 typedef std::map<std::string, method_ptr> Methods;
 
+/// The base class for Resources - binary content served on GET requests for the paths below the prefix it is
+/// registered at, e.g. raw blocks. Errors are thrown as a stock Reply.
+class COINHTTP_EXPORT Resource
+{
+public:
+    /// Produce the reply for the path relative to the prefix, without the leading slash.
+    virtual void operator()(const Request& request, const std::string& path, Reply& reply) = 0;
+    
+    virtual ~Resource() {}
+};
+
+typedef boost::shared_ptr<Resource> resource_ptr;
+typedef std::map<std::string, resource_ptr> Resources;
+
 class Server;
 class COINHTTP_EXPORT Stop : public Method {
 public:
@@ -80,4 +136,15 @@ protected:
     Server& _server;
 };
 
+/// This method, "connectionstats", reports the connections, requests, bytes and execution time pr client, and the
+/// requests pr user under the rate limit - register it with the credentials of the other administrative methods.
+class COINHTTP_EXPORT ConnectionStats : public Method {
+public:
+    ConnectionStats(Server& server) : _server(server) {}
+    json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
+protected:
+    Server& _server;
+};
+
 #endif // METHOD_H
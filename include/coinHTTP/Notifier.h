@@ -0,0 +1,91 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HTTP_NOTIFIER_H
+#define HTTP_NOTIFIER_H
+
+#include <coinHTTP/Export.h>
+#include <coinHTTP/ContentStream.h>
+
+#include "json/json_spirit.h"
+
+#include <set>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+/// A Notifier delivers events, e.g. new blocks, to the clients waiting for them: long-poll methods wait for the
+/// next matching event, and event streams (server-sent events) receive every event. Events are JSON values,
+/// notified from the thread producing them, e.g. by a block or transaction listener of the node.
+class COINHTTP_EXPORT Notifier : private boost::noncopyable
+{
+public:
+    /// Select the events of a wait or a subscription - an empty Match selects all.
+    typedef boost::function<bool (const json_spirit::Value&)> Match;
+    
+    /// Called with the event, or null on timeout.
+    typedef boost::function<void (json_spirit::Value)> Waiter;
+    
+    /// A pending wait - it is completed once: by an event, by the timeout or by the waiting method itself.
+    class Wait : private boost::noncopyable {
+    public:
+        Wait(boost::asio::io_service& io_service, Waiter waiter, Match match) : timer(io_service), waiter(waiter), match(match), done(false) {}
+        boost::asio::deadline_timer timer;
+        Waiter waiter;
+        Match match;
+        bool done;
+    };
+    typedef boost::shared_ptr<Wait> wait_ptr;
+    
+    /// The io_service runs the timeouts, e.g. that of the Server.
+    Notifier(boost::asio::io_service& io_service) : _io_service(io_service) {}
+    
+    /// Wait for the next matching event, at most timeout.
+    wait_ptr wait(Waiter waiter, Match match, boost::posix_time::time_duration timeout);
+    
+    /// Complete the wait with a result, unless it is completed already - returns true if it was completed now.
+    bool complete(wait_ptr wait, const json_spirit::Value& result);
+    
+    /// Subscribe a stream to the matching events, formatted as server-sent events. The stream is ended if it
+    /// falls behind, as notify never blocks.
+    void subscribe(boost::shared_ptr<ContentStream> stream, Match match = Match());
+    
+    /// Notify the waits and the subscribers of an event.
+    void notify(const json_spirit::Value& event);
+    
+    /// The number of pending waits and subscribers.
+    size_t waiting() const;
+    size_t subscribed() const;
+    
+private:
+    void handle_timeout(wait_ptr wait, const boost::system::error_code& e);
+    
+    boost::asio::io_service& _io_service;
+    
+    mutable boost::mutex _mutex;
+    
+    typedef std::set<wait_ptr> Waits;
+    Waits _waits;
+    
+    typedef std::vector<std::pair<boost::shared_ptr<ContentStream>, Match> > Subscribers;
+    Subscribers _subscribers;
+};
+
+#endif // HTTP_NOTIFIER_H
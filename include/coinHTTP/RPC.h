@@ -50,15 +50,24 @@ public:
     /// parse the content from a application/json - it is assumed that it is formatted according to the JSOC RPC 2.0 spec
     void parse(std::string payload);
 
+    /// parse a single JSON RPC 2.0 request object, e.g. a call from a batch request
+    void parse(const json_spirit::Object& request);
+
     /// parse the content from a text/plain html form post - it is assumed that action = method, and payload is params=<params>
     void parse(std::string action, std::string payload);
     
     /// parse a get request with a query string
     void parse(std::string action, std::vector<std::string> args);
 
+    /// Get the JSON RPC 2.0 reply object
+    json_spirit::Object getReply();
+    
     /// Get content envelope in application/json formmatted for JSON RPC 2.0
     std::string& getContent();
     
+    /// Get content envelope for an already serialized result, e.g. from the response cache.
+    std::string& getContent(const std::string& result);
+    
     /// Get content envelope for text/plain.
     std::string& getPlainContent();
     
@@ -68,12 +77,28 @@ public:
     
     const std::string& method();
     
+    const json_spirit::Array& params() const { return _params; }
+    
+    const json_spirit::Value& result() const { return _result; }
+    
+    /// True for a parsed request without an id - notifications are executed, but not replied.
+    bool isNotification() const { return _notification; }
+    
     void execute(Method& method);
     
+    /// Execute a streaming method writing the JSON RPC 2.0 reply, result included, to the writer
+    void execute(Method& method, JSONWriter& writer);
+    
+    /// Execute an asynchronous method - onDone is called with the result.
+    void execute(Method& method, Method::MethodDone onDone);
+    
+    void setResult(const json_spirit::Value& result);
+    
 private:
     std::string _method;
     std::string _content;
     json_spirit::Value _id;
+    bool _notification;
     json_spirit::Value _error;
     json_spirit::Array _params;
     json_spirit::Value _result;
@@ -19,9 +19,12 @@
 
 #include <coinHTTP/Export.h>
 #include <coinHTTP/Header.h>
+#include <coinHTTP/ContentStream.h>
 
+#include <cstdio>
 #include <string>
 #include <boost/asio.hpp>
+#include <boost/shared_ptr.hpp>
 
 /// A reply to be sent to a client.
 struct Reply
@@ -53,10 +56,34 @@ struct Reply
     /// The content to be sent in the reply.
     std::string content;
     
+    /// The content of a streamed reply, sent in chunks as it is produced. The content above is empty.
+    boost::shared_ptr<ContentStream> stream;
+    
+    /// Content shared with a cache, e.g. a static document, sent without copying it. The content above is empty.
+    boost::shared_ptr<const std::string> shared_content;
+    
+    /// A file sent as the content, e.g. a large static document - with sendfile if possible. The content above is empty.
+    /// The file is opened by the worker producing the reply, so the connection does not block on opening it.
+    boost::shared_ptr<std::FILE> file;
+    size_t file_size;
+    
     /// reset the reply (used for keep_alive)
     void reset() {
         headers.clear();
         content.clear();
+        stream.reset();
+        shared_content.reset();
+        file.reset();
+        file_size = 0;
+    }
+    
+    /// The size of the content - for a streamed reply the size sent so far.
+    size_t size() const {
+        if (stream)
+            return stream->size();
+        if (file)
+            return file_size;
+        return shared_content ? shared_content->size() : content.size();
     }
     
     /// Convert the reply into a vector of buffers. The buffers do not own the
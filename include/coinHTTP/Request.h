@@ -27,7 +27,7 @@
 
 /// A request received from a client.
 struct Request {
-    Request() : pending(false) {}
+    Request() : pending(false), busy(0, 0, 0) {}
     
     std::string method;
     std::string uri;
@@ -45,9 +45,13 @@ struct Request {
     /// Extra info - pending: indicates that the procesing of the request have been postponed pending yet unresolved information
     mutable bool pending;
     
+    /// Extra info - the time spent executing the request, for accounting
+    mutable boost::posix_time::time_duration busy;
+    
     /// reset the request (used for keep_alive)
     void reset() {
         pending = false; // requests are per default not pending.
+        busy = boost::posix_time::time_duration(0, 0, 0);
         method.clear();
         uri.clear();
         headers.clear();
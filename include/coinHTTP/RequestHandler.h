@@ -20,12 +20,25 @@
 #include <coinHTTP/Export.h>
 #include <coinHTTP/Method.h>
 #include <coinHTTP/Header.h>
+#include <coinHTTP/LRUCache.h>
 
+#include <deque>
+#include <vector>
 #include <string>
 
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
 struct Reply;
 struct Request;
 
+class RPC;
+class Notifier;
+class ContentStream;
+
 class COINHTTP_EXPORT Auth
 {
 public:
@@ -35,10 +48,10 @@ public:
         _base64auth = encode64(username + ":" + password);
     }
     
-    bool isNone() { return _base64auth.size() == 0; }
+    bool isNone() const { return _base64auth.size() == 0; }
     void setNone() { _base64auth.clear(); }
 
-    bool valid(std::string auth) {
+    bool valid(std::string auth) const {
         if(isNone())
             return true;
         else if (_base64auth == encode64(":"))
@@ -70,11 +83,14 @@ typedef std::map<std::string, Auth> Auths;
 class COINHTTP_EXPORT RequestHandler : private boost::noncopyable
 {
 public:
-    /// Construct with a directory containing files to be served.
-    explicit RequestHandler(const std::string& doc_root);
+    /// Construct with a directory containing files to be served. Read-only methods of batch requests are executed
+    /// on a pool of workers threads, pr default one per hardware thread.
+    explicit RequestHandler(const std::string& doc_root, size_t workers = 0);
+    
+    ~RequestHandler();
     
 	/// Set the doc root after initialization.
-	void setDocRoot(const std::string& doc_root) { _doc_root = doc_root; }
+	void setDocRoot(const std::string& doc_root) { _doc_root = doc_root; clearDocCache(); }
 
     /// Register an application handler, e.g. for RPC or CGI
     void registerMethod(method_ptr method) {
@@ -91,30 +107,173 @@ public:
     /// Const list of methods
     const Methods& getMethods() const { return _methods; }
     
-    /// Handle a GET request and produce a reply.
-    void handleGET(const Request& req, Reply& rep);
+    typedef boost::function<void ()> Completion;
+    
+    /// Handle a GET request and produce a reply. If done is set, the reply of an event stream takes it over.
+    void handleGET(const Request& req, Reply& rep, Completion* done = NULL);
     
     /// Handle a POST request and produce a reply.
     void handlePOST(const Request& req, Reply& rep);
     
+    /// Dispatch a GET or POST request to the request worker pool. The reply is produced by a worker
+    /// thread, that calls done when it is ready. Method executions are queued if the method is at its limit.
+    void dispatch(const Request& req, Reply& rep, Completion done);
+    
+    /// Dispatch a request already parsed by methodName.
+    void dispatch(const Request& req, Reply& rep, Completion done, const std::string& method, boost::shared_ptr<json_spirit::Value> payload);
+    
+    /// The method name of a request - the JSON RPC payload, if any, is parsed into payload. Parse a request once, and
+    /// pass the result on to isReadOnly and dispatch.
+    std::string methodName(const Request& req, boost::shared_ptr<json_spirit::Value>& payload) const;
+    
+    /// True if the request parsed by methodName does not change any state, i.e. it calls read-only methods only or
+    /// gets a document. It can then be executed concurrently with other read-only requests of the same connection.
+    bool isReadOnly(const std::string& method, const boost::shared_ptr<json_spirit::Value>& payload) const;
+    
+    /// True if the request carries the valid credentials of a registered method, i.e. its user is known.
+    bool isAuthenticated(const Request& req) const;
+    
+    /// Limit the number of concurrent executions of a method - further calls are queued. A limit of 0 removes the limit.
+    void setMethodLimit(const std::string& method, size_t limit);
+    
+    /// Run a blocking job, e.g. reading the next part of a file reply, on a worker thread instead of an io_service thread.
+    void post(Completion job);
+    
+    /// Serve the events of the notifier as a server-sent event stream on GET /name.
+    void registerEvents(const std::string& name, Notifier& notifier);
+    
+    /// Serve the resource on GET requests for paths below /prefix/.
+    void registerResource(const std::string& prefix, resource_ptr resource);
+    
+    /// Set the byte budget of the document cache - larger documents are sent from their files.
+    void setDocCacheSize(size_t bytes);
+    
     /// Clear the document cache.
     void clearDocCache();
     
     /// Get document cache statistics.
     std::string getDocCacheStats(int level = 0);
     
+    /// Set the byte budget of the response cache - 0 disables it.
+    void setResponseCacheSize(size_t bytes);
+    
+    /// Clear the response cache, e.g. when the results it holds could have changed.
+    void clearResponseCache();
+    
+    /// Get response cache statistics, including the hit rate.
+    std::string getResponseCacheStats(int level = 0);
+    
 private:
     /// The directory containing the files to be served.
     std::string _doc_root;
     
-    /// The document cache. Not for huge data amounts!
-    typedef std::map<std::string, std::string> DocCache;
-    DocCache _doc_cache;
+    /// A static document with its headers precomputed, and a gzip variant if it compresses well.
+    struct Document {
+        boost::shared_ptr<const std::string> content;
+        boost::shared_ptr<const std::string> gzipped;
+        Headers headers;
+        Headers gzip_headers;
+        std::string etag;
+        std::string gzip_etag;
+    };
+    typedef boost::shared_ptr<const Document> document_ptr;
+    
+    /// Build a document from its content.
+    static document_ptr document(const std::string& content, const std::string& extension);
+    
+    /// True if the request has an If-None-Match matching the ETag.
+    static bool notModified(const Request& req, const std::string& etag);
+    
+    /// Reply a document, or 304 Not Modified if the client has it.
+    static void replyDocument(const Request& req, const Document& doc, Reply& rep);
+    
+    /// The document cache, by request path. Documents not fitting it are sent from their files.
+    LRUCache<document_ptr> _doc_cache;
     
     Methods _methods;
     
     Auths _auths;
     
+    /// The response cache - serialized immutable results keyed by method and params.
+    LRUCache<std::string> _response_cache;
+    
+    /// The worker pool for the read-only calls of batch requests.
+    boost::asio::io_service _workers;
+    boost::scoped_ptr<boost::asio::io_service::work> _work;
+    boost::thread_group _worker_threads;
+    
+    /// The worker pool for dispatched requests.
+    boost::asio::io_service _request_workers;
+    boost::scoped_ptr<boost::asio::io_service::work> _request_work;
+    boost::thread_group _request_threads;
+    
+    /// The worker pool producing streamed replies and reading files - a producer waiting for a slow client waits here,
+    /// without holding a request worker or the slots of the request.
+    boost::asio::io_service _stream_workers;
+    boost::scoped_ptr<boost::asio::io_service::work> _stream_work;
+    boost::thread_group _stream_threads;
+    
+    /// The slots of an execution - a method name, or the serialized slot of a method group. The slots of a request
+    /// are acquired in sorted order, so requests holding several slots, e.g. batches, do not deadlock.
+    typedef std::vector<std::string> Slots;
+    
+    /// The per slot limits, running and queued executions. A queued execution holds the slots before the one it
+    /// waits for.
+    typedef boost::function<void ()> Job;
+    struct Waiting {
+        Slots slots;
+        size_t next;
+        Job job;
+    };
+    typedef std::map<std::string, size_t> Limits;
+    typedef std::map<std::string, std::deque<Waiting> > Queued;
+    boost::mutex _dispatch_mutex;
+    Limits _limits;
+    Limits _running;
+    Queued _queued;
+    
+    /// Execute a dispatched request on a worker thread.
+    void execute(const Request& req, Reply& rep, boost::shared_ptr<json_spirit::Value> payload, Completion done, Slots slots);
+    
+    /// Acquire the slots and post the job to the request workers, or queue it at the first slot that is at its limit.
+    void schedule(const Slots& slots, Job job);
+    
+    /// Acquire the slots from next on - the dispatch mutex is held.
+    void acquire(const Slots& slots, size_t next, Job job);
+    
+    /// Release the slots of an execution, and hand each over to the next queued execution waiting for it.
+    void finished(const Slots& slots);
+    
+    /// Handle a parsed JSON RPC request - a single call or a batch. If done is set, streamed and asynchronous
+    /// replies take it over and complete the request themselves - it is then cleared.
+    void handleJSON(const Request& req, const json_spirit::Value& payload, Reply& rep, Completion* done = NULL);
+    
+    /// Execute a streaming method - chunked if possible, otherwise the written reply becomes the content. A chunked
+    /// read-only method takes over the completion and is produced on the stream workers.
+    void handleStreaming(const Request& req, RPC& rpc, method_ptr method, Reply& rep, Completion* done);
+    
+    /// Produce a streamed reply - returns false if nothing was streamed and the reply is formed in rep instead.
+    bool produce(RPC& rpc, Method& method, boost::shared_ptr<ContentStream> stream, Reply& rep);
+    
+    /// Produce a streamed reply on a stream worker, and complete the request if it was not streamed after all.
+    void produceAsync(boost::shared_ptr<RPC> rpc, method_ptr method, boost::shared_ptr<ContentStream> stream, Reply* rep, Completion done);
+    
+    /// Subscribe a request to an event stream.
+    void handleEvents(const Request& req, const std::string& name, Notifier& notifier, Reply& rep, Completion* done);
+    
+    /// The event streams.
+    typedef std::map<std::string, Notifier*> Events;
+    Events _events;
+    
+    /// The resources, by their path prefix.
+    Resources _resources;
+    
+    /// Handle a JSON RPC 2.0 batch request - the calls are replied in order.
+    void handleBatch(const Request& req, const json_spirit::Array& calls, Reply& rep);
+    
+    /// Throws an unauthorized Reply if the method requires authorization that the request does not carry.
+    void checkAuthorization(const Request& req, const std::string& method);
+    
     /// Perform URL-decoding on a string. Returns false if the encoding was
     /// invalid.
     static bool urlDecode(const std::string& in, std::string& out);
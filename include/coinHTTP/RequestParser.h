@@ -18,13 +18,13 @@
 #define HTTP_REQUEST_PARSER_H
 
 #include <coinHTTP/Export.h>
+#include <coinHTTP/Request.h>
 
+#include <algorithm>
 #include <string>
 #include <boost/logic/tribool.hpp>
 #include <boost/tuple/tuple.hpp>
 
-struct Request;
-
 /// Parser for incoming requests.
 class COINHTTP_EXPORT RequestParser
 {
@@ -42,6 +42,15 @@ public:
     template <typename InputIterator>
     boost::tuple<boost::tribool, InputIterator> parse(Request& req, InputIterator begin, InputIterator end) {
         while (begin != end) {
+            if (_state == payload) { // copy the payload in one go
+                size_t size = std::min<size_t>(end - begin, (size_t)_length - req.payload.size());
+                req.payload.append(begin, begin + size);
+                begin += size;
+                if (req.payload.size() < (size_t)_length)
+                    break;
+                reset();
+                return boost::make_tuple(boost::tribool(true), begin);
+            }
             boost::tribool result = consume(req, *begin++);
             if (result || !result)
                 return boost::make_tuple(result, begin);
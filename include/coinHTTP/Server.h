@@ -105,7 +105,8 @@ public:
     /// Construct the server to listen on the specified TCP address and port, and
     /// serve up files from the given directory.
     /// doc_root can alternatively be set to an in memory html document, then this is the only document that will be returned.
-    explicit Server(const std::string address = boost::asio::ip::address_v4::loopback().to_string(), const std::string port = "8333", const std::string doc_root = "", const std::string log_dir = "");
+    /// The io_service is run by threads threads, and methods are executed by a pool of workers threads (0: one per hardware thread).
+    explicit Server(const std::string address = boost::asio::ip::address_v4::loopback().to_string(), const std::string port = "8333", const std::string doc_root = "", const std::string log_dir = "", const size_t threads = 1, const size_t workers = 0);
 
     /// Set the server credentials - this will also make the server secure.
     void setCredentials(const std::string dataDir, const std::string cert = "hostcert.pem", const std::string key = "hostkey.pem");
@@ -134,6 +135,47 @@ public:
         _requestHandler.unregisterMethod(name);
     }
 
+    /// Limit the number of concurrent executions of a method, e.g. of expensive wallet or explorer calls. 0 removes the limit.
+    void setMethodLimit(const std::string name, size_t limit) {
+        _requestHandler.setMethodLimit(name, limit);
+    }
+
+    /// Limit the connections pr client address, and the requests in flight pr connection - 0 connections removes the limit.
+    void setClientLimits(size_t connections, size_t pipelined = Connection::max_pipelined) {
+        _connectionManager.setMaxConnectionsPerClient(connections);
+        _connectionManager.setMaxPipelined(pipelined);
+    }
+    
+    /// Limit the requests pr second of each user, allowing bursts - requests over the limit are replied 503 with a Retry-After.
+    void setRateLimit(double rate, double burst) {
+        _connectionManager.setRateLimit(rate, burst);
+    }
+    
+    /// Get the connection and request counters pr client and pr user, level 0 only sums them up.
+    json_spirit::Value getConnectionStats(int level = 1) {
+        return _connectionManager.getStats(level);
+    }
+    
+    /// Set the byte budget of the cache of immutable method results - 0 disables it.
+    void setResponseCacheSize(size_t bytes) {
+        _requestHandler.setResponseCacheSize(bytes);
+    }
+    
+    /// Clear the cache of immutable method results, e.g. on a deep reorganization of the block chain.
+    void clearResponseCache() {
+        _requestHandler.clearResponseCache();
+    }
+    
+    /// Serve the events of a notifier, e.g. new blocks, as a server-sent event stream on GET /name.
+    void registerEvents(const std::string name, Notifier& notifier) {
+        _requestHandler.registerEvents(name, notifier);
+    }
+    
+    /// Serve the resource on GET /prefix/...
+    void registerResource(const std::string prefix, resource_ptr resource) {
+        _requestHandler.registerResource(prefix, resource);
+    }
+
     /// Get a handle to the io_service used by the Server
     boost::asio::io_service& get_io_service() { return _io_service; }
     
@@ -150,6 +192,9 @@ protected:
     /// The io_service used to perform asynchronous operations.
     boost::asio::io_service _io_service;
     
+    /// The number of threads running the io_service.
+    size_t _threads;
+    
     /// The TLS context. - we only use this if we run the server using ssl.
     boost::asio::ssl::context _context;
     
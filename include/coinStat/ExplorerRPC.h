@@ -33,25 +33,41 @@ protected:
     Explorer& _explorer;
 };
 
-/// Get debit coins belonging to an PubKeyHash 
-class COINSTAT_EXPORT GetDebit : public ExplorerMethod {
+/// Base class for the methods listing the coins of an address - the list is written coin by coin.
+class COINSTAT_EXPORT CoinListMethod : public ExplorerMethod {
 public:
-    GetDebit(Explorer& explorer) : ExplorerMethod(explorer) {}
+    CoinListMethod(Explorer& explorer) : ExplorerMethod(explorer) {}
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    void operator()(const json_spirit::Array& params, bool fHelp, const Request& request, JSONWriter& writer);
+    virtual bool isReadOnly() const { return true; }
+    virtual bool isStreaming() const { return true; }
+protected:
+    /// Get the coins listed.
+    virtual void listCoins(const json_spirit::Array& params, bool fHelp, Coins& coins) = 0;
+};
+
+/// Get debit coins belonging to an PubKeyHash 
+class COINSTAT_EXPORT GetDebit : public CoinListMethod {
+public:
+    GetDebit(Explorer& explorer) : CoinListMethod(explorer) {}
+protected:
+    virtual void listCoins(const json_spirit::Array& params, bool fHelp, Coins& coins);
 };
 
 /// Get credit coins belonging to an PubKeyHash 
-class COINSTAT_EXPORT GetCredit : public ExplorerMethod {
+class COINSTAT_EXPORT GetCredit : public CoinListMethod {
 public:
-    GetCredit(Explorer& explorer) : ExplorerMethod(explorer) {}
-    json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    GetCredit(Explorer& explorer) : CoinListMethod(explorer) {}
+protected:
+    virtual void listCoins(const json_spirit::Array& params, bool fHelp, Coins& coins);
 };
 
 /// Get unspent coins belonging to an PubKeyHash 
-class COINSTAT_EXPORT GetCoins : public ExplorerMethod {
+class COINSTAT_EXPORT GetCoins : public CoinListMethod {
 public:
-    GetCoins(Explorer& explorer) : ExplorerMethod(explorer) {}
-    json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    GetCoins(Explorer& explorer) : CoinListMethod(explorer) {}
+protected:
+    virtual void listCoins(const json_spirit::Array& params, bool fHelp, Coins& coins);
 };
 
 /// Get the balance based on the unspent coins of an PubKeyHash 
@@ -59,6 +75,7 @@ class COINSTAT_EXPORT GetAddressBalance : public ExplorerMethod {
 public:
     GetAddressBalance(Explorer& explorer) : ExplorerMethod(explorer) { setName("getbalance"); }
     json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);    
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Do a search in the blockchain and in the explorer database.
@@ -0,0 +1,216 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CHUNKED_H_
+#define _CHUNKED_H_
+
+#include <cstddef>
+#include <iterator>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+/// The key of an element of a std::set or a std::map, and the type of the values of a map.
+template <typename Container>
+struct ChunkedTraits {
+    typedef typename Container::key_type mapped_type;
+    static const typename Container::key_type& key(const typename Container::value_type& value) { return value; }
+};
+
+template <typename K, typename V, typename C, typename A>
+struct ChunkedTraits<std::map<K, V, C, A> > {
+    typedef V mapped_type;
+    static const K& key(const typename std::map<K, V, C, A>::value_type& value) { return value.first; }
+};
+
+/// Chunked is a sorted std::set or std::map split in chunks of consecutive elements, each shared by the copies of the
+/// container until one of them changes it - copy on write. Copying the container costs in the number of chunks, and
+/// a change in the size of a chunk, so an immutable snapshot of a large container can be taken and changed cheaply.
+/// A chunk is changed in place if no other container shares it - the copies must be changed by the same thread.
+template <typename Container>
+class Chunked {
+public:
+    typedef typename Container::key_type key_type;
+    typedef typename Container::value_type value_type;
+    typedef typename ChunkedTraits<Container>::mapped_type mapped_type;
+    
+    /// Chunks are split in two when they grow beyond twice the chunk size.
+    enum { chunk_size = 128 };
+    
+private:
+    typedef boost::shared_ptr<Container> chunk_ptr;
+    typedef std::vector<chunk_ptr> Chunks;
+    
+public:
+    /// Iterates the elements in order, across the chunks - the end is the end of the last chunk.
+    class const_iterator {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef typename Container::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+        
+        const_iterator() : _chunks(NULL), _chunk(0) {}
+        
+        reference operator*() const { return *_it; }
+        pointer operator->() const { return &*_it; }
+        
+        const_iterator& operator++() {
+            if (++_it == (*_chunks)[_chunk]->end() && _chunk + 1 < _chunks->size())
+                _it = (*_chunks)[++_chunk]->begin();
+            return *this;
+        }
+        const_iterator operator++(int) { const_iterator i = *this; ++*this; return i; }
+        
+        const_iterator& operator--() {
+            if (_it == (*_chunks)[_chunk]->begin())
+                _it = (*_chunks)[--_chunk]->end();
+            --_it;
+            return *this;
+        }
+        const_iterator operator--(int) { const_iterator i = *this; --*this; return i; }
+        
+        bool operator==(const const_iterator& i) const { return _chunk == i._chunk && (!_chunks || _chunks->empty() || _it == i._it); }
+        bool operator!=(const const_iterator& i) const { return !(*this == i); }
+        
+    private:
+        friend class Chunked;
+        const_iterator(const Chunks* chunks, size_t chunk, typename Container::const_iterator it) : _chunks(chunks), _chunk(chunk), _it(it) {}
+        
+        const Chunks* _chunks;
+        size_t _chunk;
+        typename Container::const_iterator _it;
+    };
+    typedef const_iterator iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef const_reverse_iterator reverse_iterator;
+    
+    Chunked() : _size(0) {}
+    
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    
+    const_iterator begin() const { return _chunks.empty() ? end() : const_iterator(&_chunks, 0, _chunks.front()->begin()); }
+    const_iterator end() const { return _chunks.empty() ? const_iterator(&_chunks, 0, typename Container::const_iterator()) : const_iterator(&_chunks, _chunks.size() - 1, _chunks.back()->end()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    
+    const_iterator find(const key_type& key) const {
+        if (_chunks.empty())
+            return end();
+        size_t chunk = chunkOf(key);
+        typename Container::const_iterator it = static_cast<const Container&>(*_chunks[chunk]).find(key);
+        if (it == _chunks[chunk]->end())
+            return end();
+        return const_iterator(&_chunks, chunk, it);
+    }
+    
+    size_t count(const key_type& key) const { return _chunks.empty() ? 0 : _chunks[chunkOf(key)]->count(key); }
+    
+    /// Insert the element unless its key is there already - returns true if inserted.
+    bool insert(const value_type& value) {
+        const key_type& key = ChunkedTraits<Container>::key(value);
+        if (_chunks.empty())
+            _chunks.push_back(chunk_ptr(new Container));
+        size_t chunk = chunkOf(key);
+        if (_chunks[chunk]->count(key))
+            return false;
+        mutableChunk(chunk).insert(value);
+        ++_size;
+        split(chunk);
+        return true;
+    }
+    
+    /// The value of a key of a map to change, inserted if it is not there - valid until the container is changed again.
+    mapped_type& operator[](const key_type& key) {
+        if (_chunks.empty())
+            _chunks.push_back(chunk_ptr(new Container));
+        size_t chunk = chunkOf(key);
+        typename Container::iterator it = mutableChunk(chunk).find(key);
+        if (it == _chunks[chunk]->end()) {
+            _chunks[chunk]->insert(value_type(key, mapped_type()));
+            ++_size;
+            split(chunk);
+            chunk = chunkOf(key);
+            it = _chunks[chunk]->find(key);
+        }
+        return it->second;
+    }
+    
+    /// Erase the element of the key - returns the number of elements erased.
+    size_t erase(const key_type& key) {
+        if (_chunks.empty())
+            return 0;
+        size_t chunk = chunkOf(key);
+        if (!_chunks[chunk]->count(key))
+            return 0;
+        if (_chunks[chunk]->size() == 1)
+            _chunks.erase(_chunks.begin() + chunk);
+        else
+            mutableChunk(chunk).erase(key);
+        --_size;
+        return 1;
+    }
+    
+    void clear() {
+        _chunks.clear();
+        _size = 0;
+    }
+    
+private:
+    /// The chunk of a key: the last chunk starting at or before it - there must be a chunk.
+    size_t chunkOf(const key_type& key) const {
+        typename Container::key_compare less;
+        size_t lo = 0;
+        size_t hi = _chunks.size();
+        while (hi - lo > 1) {
+            size_t mid = (lo + hi) / 2;
+            if (less(key, ChunkedTraits<Container>::key(*_chunks[mid]->begin())))
+                hi = mid;
+            else
+                lo = mid;
+        }
+        return lo;
+    }
+    
+    /// The chunk to change - copied first if it is shared with another container.
+    Container& mutableChunk(size_t chunk) {
+        if (_chunks[chunk].use_count() > 1)
+            _chunks[chunk].reset(new Container(*_chunks[chunk]));
+        return *_chunks[chunk];
+    }
+    
+    /// Split a chunk, owned by this container, in two halves if it has grown too large.
+    void split(size_t chunk) {
+        Container& full = *_chunks[chunk];
+        if (full.size() <= 2 * chunk_size)
+            return;
+        typename Container::iterator middle = full.begin();
+        std::advance(middle, full.size() / 2);
+        chunk_ptr upper(new Container(middle, full.end()));
+        full.erase(middle, full.end());
+        _chunks.insert(_chunks.begin() + chunk + 1, upper);
+    }
+    
+    Chunks _chunks;
+    size_t _size;
+};
+
+#endif // _CHUNKED_H_
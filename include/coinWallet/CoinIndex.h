@@ -0,0 +1,95 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COININDEX_H_
+#define _COININDEX_H_
+
+#include <coin/Transaction.h>
+
+#include <coinWallet/Export.h>
+
+#include <map>
+#include <set>
+
+class CWalletTx;
+
+/// CoinIndex is the index of the coins of a wallet - its unspent outputs. The coins are ordered by value, and the
+/// confirmed ones carry the height of the block confirming them, so their depth follows from the best height alone.
+/// The balances are kept as running totals, and the index is updated a transaction at a time, so neither a balance nor
+/// the candidates for a coin selection require a walk of the wallet.
+class COINWALLET_EXPORT CoinIndex {
+public:
+    /// A coin - unconfirmed coins have a height of -1.
+    struct Entry {
+        Coin coin;
+        const CWalletTx* tx;
+        int height;
+        bool from_me;
+        bool coinbase;
+    };
+    typedef std::multimap<int64, Entry> ByValue;
+    
+    /// The credit of the unconfirmed transactions.
+    typedef std::map<const CWalletTx*, int64> Unconfirmed;
+
+    CoinIndex() : _confirmed(0), _unconfirmed(0) {}
+    
+    /// Add an output of a transaction as a coin.
+    void insert(const CWalletTx& tx, unsigned int n, int64 value, int height, bool from_me);
+    
+    /// Remove the coins of a transaction.
+    void erase(const uint256& hash);
+    
+    void clear();
+    
+    size_t size() const { return _coins.size(); }
+
+    /// Move the coinbase coins that have matured at the best height into the confirmed balance.
+    void mature(int best);
+    
+    /// The depth of a coin, 0 if unconfirmed.
+    static int depth(const Entry& entry, int best) { return entry.height < 0 ? 0 : best - entry.height + 1; }
+    
+    /// True if the coin is not an immature coinbase, and is deep enough - confirmed coins only.
+    static bool spendable(const Entry& entry, int best, int conf_mine, int conf_theirs);
+    
+    /// The balance of the confirmed and mature coins.
+    int64 balance(int best) const;
+    
+    /// The balance of the unconfirmed coins.
+    int64 unconfirmed() const { return _unconfirmed; }
+    
+    const Unconfirmed& unconfirmedTxes() const { return _unconfirmed_txes; }
+    
+    const ByValue& byValue() const { return _by_value; }
+    
+private:
+    ByValue _by_value;
+    
+    typedef std::map<Coin, ByValue::iterator> Coins;
+    Coins _coins;
+    
+    /// The confirmed coinbase coins not yet added to the confirmed balance, by height.
+    typedef std::set<std::pair<int, Coin> > Immature;
+    Immature _immature;
+    
+    Unconfirmed _unconfirmed_txes;
+    
+    int64 _confirmed;
+    int64 _unconfirmed;
+};
+
+#endif // _COININDEX_H_
@@ -0,0 +1,144 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _COINSELECTOR_H_
+#define _COINSELECTOR_H_
+
+#include <coin/Transaction.h>
+
+#include <coinWallet/Export.h>
+#include <coinWallet/CoinIndex.h>
+
+#include <set>
+#include <string>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+
+class CWalletTx;
+
+typedef std::set<std::pair<const CWalletTx*, unsigned int> > CoinSelection;
+
+/// The candidates of a coin selection - the coins of a CoinIndex, ordered by increasing value, that the filter accepts.
+/// The coins are not copied: a strategy walks the value ranges it needs, and skips the coins that are not accepted.
+class COINWALLET_EXPORT CoinCandidates {
+public:
+    typedef CoinIndex::ByValue::const_iterator const_iterator;
+    typedef CoinIndex::ByValue::const_reverse_iterator const_reverse_iterator;
+    typedef boost::function<bool (const CoinIndex::Entry&)> Filter;
+    
+    CoinCandidates(const CoinIndex::ByValue& coins, Filter filter = Filter()) : _coins(coins), _filter(filter) {}
+    
+    const_iterator begin() const { return _coins.begin(); }
+    const_iterator end() const { return _coins.end(); }
+    const_reverse_iterator rbegin() const { return _coins.rbegin(); }
+    const_reverse_iterator rend() const { return _coins.rend(); }
+    
+    /// The first coin worth at least value, and the first worth more.
+    const_iterator lower_bound(int64 value) const { return _coins.lower_bound(value); }
+    const_iterator upper_bound(int64 value) const { return _coins.upper_bound(value); }
+    
+    /// True if the coin can be selected.
+    bool accepts(const CoinIndex::Entry& entry) const { return !_filter || _filter(entry); }
+    
+    /// Add the coin to the selection.
+    static void select(const CoinIndex::ByValue::value_type& coin, CoinSelection& selection, int64& value) {
+        selection.insert(std::make_pair(coin.second.tx, coin.second.coin.index));
+        value += coin.first;
+    }
+    
+private:
+    const CoinIndex::ByValue& _coins;
+    Filter _filter;
+};
+
+/// CoinSelector is the interface of the coin selection strategies. A strategy selects coins worth at least the target
+/// from the candidates and returns false if it finds no selection.
+class COINWALLET_EXPORT CoinSelector {
+public:
+    virtual bool operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const = 0;
+    
+    virtual std::string name() const = 0;
+    
+    /// A change up to the window is the surplus of a selection meant to need no change - it is added to the fee.
+    virtual int64 window() const { return 0; }
+    
+    virtual ~CoinSelector() {}
+};
+
+typedef boost::shared_ptr<CoinSelector> selector_ptr;
+
+/// Create a strategy by its name: bnb, knapsack, largest or consolidate - returns an empty pointer for unknown names.
+COINWALLET_EXPORT selector_ptr createCoinSelector(const std::string& name, int64 fee_rate = MIN_TX_FEE);
+
+/// Branch and bound search for a selection that needs no change - worth between the target and the target plus the
+/// window, the surplus going to the fee. The selection with the least surplus found in max_tries steps is chosen. If
+/// there is none, the fallback strategy, if any, selects.
+class COINWALLET_EXPORT BranchAndBound : public CoinSelector {
+public:
+    enum { max_tries = 100000 };
+    
+    BranchAndBound(selector_ptr fallback = selector_ptr(), int64 window = MIN_TX_FEE) : _fallback(fallback), _window(window) {}
+    
+    virtual bool operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const;
+    
+    virtual std::string name() const { return "bnb"; }
+    
+    virtual int64 window() const { return _window; }
+    
+private:
+    selector_ptr _fallback;
+    int64 _window;
+};
+
+/// The classic selection: an exact match, all smaller coins if they add up to the target, or the best subset of them
+/// by stochastic approximation unless the lowest larger coin is closer.
+class COINWALLET_EXPORT Knapsack : public CoinSelector {
+public:
+    enum { iterations = 1000 };
+    
+    virtual bool operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const;
+    
+    virtual std::string name() const { return "knapsack"; }
+};
+
+/// Select the largest coins until the target is reached - the fewest inputs, but rarely without change.
+class COINWALLET_EXPORT LargestFirst : public CoinSelector {
+public:
+    virtual bool operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const;
+    
+    virtual std::string name() const { return "largest"; }
+};
+
+/// Consolidate the wallet by spending max_inputs of the smallest coins worth more than the fee of spending them at the
+/// fee rate (pr 1000 bytes). If they do not reach the target, the window of coins is moved up to larger ones.
+class COINWALLET_EXPORT Consolidation : public CoinSelector {
+public:
+    /// The approximate size of a signed input.
+    enum { input_size = 148 };
+    
+    Consolidation(size_t max_inputs = 50, int64 fee_rate = MIN_TX_FEE) : _max_inputs(max_inputs), _fee_rate(fee_rate) {}
+    
+    virtual bool operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const;
+    
+    virtual std::string name() const { return "consolidate"; }
+    
+private:
+    size_t _max_inputs;
+    int64 _fee_rate;
+};
+
+#endif // _COINSELECTOR_H_
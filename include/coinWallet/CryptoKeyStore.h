@@ -58,6 +58,16 @@ public:
     
     virtual bool addCryptedKey(const std::vector<unsigned char> &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool addKey(const CKey& key);
+    /// Add a batch of keys, with their secrets encrypted by encryptKey in the order of the keys if the store is crypted,
+    /// or with no crypted secrets if it is not. Fails if the store was encrypted since the secrets were.
+    bool addKeys(const std::vector<CKey>& keys, const std::vector<std::vector<unsigned char> >& cryptedSecrets);
+    
+    /// Copy the master key, to encrypt keys without the store locked - false if the store is not crypted, or is locked.
+    bool getMasterKey(CKeyingMaterial& vMasterKeyOut) const;
+    
+    /// Encrypt the secret of a key with a master key - it does not touch the store, so batches can be encrypted in
+    /// parallel, e.g. by the workers generating them.
+    static bool encryptKey(const CKeyingMaterial& vMasterKey, const CKey& key, std::vector<unsigned char>& vchCryptedSecret);
     bool haveKey(const PubKeyHash &hash) const
     {
         if (!IsCrypted())
@@ -0,0 +1,97 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _KEYPOOLGENERATOR_H_
+#define _KEYPOOLGENERATOR_H_
+
+#include <coin/Key.h>
+
+#include <coinWallet/Export.h>
+
+#include <set>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+/// KeyPoolGenerator generates the keys of a key pool top up in parallel, on a pool of worker threads, pr default one
+/// pr hardware thread. It also runs refills of the key pool in the background, so reserving a key never waits for the
+/// keys to be generated, unless the pool has run dry. The generator can be shared by several wallets - the refills are
+/// scheduled pr owner.
+class COINWALLET_EXPORT KeyPoolGenerator : private boost::noncopyable {
+public:
+    typedef boost::function<void ()> Refill;
+    
+    KeyPoolGenerator(size_t workers = 0);
+    
+    /// Waits for a running refill, and stops the threads.
+    ~KeyPoolGenerator();
+    
+    /// Encrypts the secret of a key, e.g. with the master key of a crypted wallet.
+    typedef boost::function<bool (const CKey&, std::vector<unsigned char>&)> Encrypt;
+    
+    /// Generate n new keys, split among the workers - blocks until they are all generated. Throws key_error if the
+    /// generation of a key failed.
+    void generate(size_t n, std::vector<CKey>& keys);
+    
+    /// Generate n new keys, and encrypt their secrets on the workers as well. Throws key_error if the generation or
+    /// the encryption of a key failed.
+    void generate(size_t n, std::vector<CKey>& keys, Encrypt encrypt, std::vector<std::vector<unsigned char> >& cryptedSecrets);
+    
+    /// Run the refill on the refill thread - a refill already scheduled for the owner is not repeated.
+    void refill(Refill refill, const void* owner);
+    
+    /// Drop the scheduled refill of the owner, and wait for it if it is running - call it before the owner is destroyed.
+    void cancel(const void* owner);
+    
+    /// The number of keys generated since the start.
+    size_t generated() const { return _generated; }
+    
+private:
+    void generateRange(std::vector<CKey>& keys, Encrypt encrypt, std::vector<std::vector<unsigned char> >& cryptedSecrets, size_t begin, size_t end);
+    
+    void scheduled(Refill refill, const void* owner);
+    
+    size_t _workers;
+    
+    boost::mutex _generate;
+    
+    boost::mutex _mutex;
+    boost::condition_variable _done;
+    size_t _pending;
+    bool _failed;
+    
+    /// The owners with a refill scheduled, and the owner of the running refill.
+    std::set<const void*> _scheduled;
+    const void* _refilling;
+    boost::condition_variable _refilled;
+    size_t _generated;
+    
+    /// The workers generating keys.
+    boost::asio::io_service _generators;
+    boost::scoped_ptr<boost::asio::io_service::work> _generators_work;
+    boost::thread_group _generator_threads;
+    
+    /// The thread running the background refills.
+    boost::asio::io_service _refills;
+    boost::scoped_ptr<boost::asio::io_service::work> _refills_work;
+    boost::thread_group _refill_threads;
+};
+
+#endif // _KEYPOOLGENERATOR_H_
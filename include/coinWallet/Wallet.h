@@ -13,10 +13,17 @@
 #include <coinChain/Node.h>
 
 #include <coinWallet/Export.h>
+#include <coinWallet/CoinIndex.h>
+#include <coinWallet/CoinSelector.h>
 #include <coinWallet/CryptoKeyStore.h>
 #include <coinWallet/WalletTx.h>
+#include <coinWallet/WalletQueue.h>
+#include <coinWallet/WalletSnapshot.h>
+#include <coinWallet/WalletWriter.h>
+#include <coinWallet/WalletWorkers.h>
 
 #include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
 
 class CWalletDB;
 
@@ -41,12 +48,102 @@ private:
 
 class COINWALLET_EXPORT Wallet : public CCryptoKeyStore
 {
+public:
+    /// The wallet as reached by the handlers that could outlive it, e.g. of timers - the destructor clears it under the
+    /// mutex, so a handler holding the mutex has the wallet until it returns, and a later one finds it gone.
+    struct Guard : private boost::noncopyable {
+        Guard(Wallet* w) : wallet(w) {}
+        boost::mutex mutex;
+        Wallet* wallet;
+    };
+    typedef boost::shared_ptr<Guard> guard_ptr;
+    
+    guard_ptr guard() const { return _guard; }
+    
 private:
     bool SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const;
     bool SelectCoins(int64 nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const;
+    /// True if a coin can be selected: deep enough, or unconfirmed but ours and trusted if no confirmations are required.
+    bool IsCandidate(const CoinIndex::Entry& entry, int nBestHeight, int nConfMine, int nConfTheirs) const;
 
     CWalletDB *pwalletdbEncryption;
 
+    /// The unspent outputs of the wallet, and the best block they are indexed at.
+    CoinIndex _coins;
+    uint256 _coinsBest;
+    
+    /// The height of the block confirming a transaction, -1 if it is not in the main chain.
+    int GetHeight(const CWalletTx& wtx) const;
+    
+    /// Index the unspent outputs of a transaction as coins, replacing its previous coins, and keep the resend
+    /// schedule of the transaction if it is unconfirmed.
+    void IndexCoins(const CWalletTx& wtx);
+    
+    /// Rebuild the coin index from the transactions of the wallet.
+    void ReindexCoins();
+    
+    /// Keep the coin index in step with the block chain - it is rebuilt if the block reorganized it.
+    void UpdateCoins(const Block& block);
+    
+    /// Keep the coin index in step with a block passed by a WalletManager - the wallet is not passed every block, so the
+    /// manager tells the best block replaced if the block reorganized the chain, 0 if it did not.
+    void UpdateCoins(const Block& block, const uint256& replaced);
+    
+    /// Reconcile the spent flags with a reorganization from the best block replaced to the block: the coins spent in
+    /// the blocks disconnected by a transaction not in the wallet are unspent again, and the spends of the blocks
+    /// connected are marked - only the blocks of the reorganization are read, not the coins checked against the chain.
+    void ReconcileSpent(const Block& block, const uint256& replaced);
+    
+    /// The unconfirmed transactions of the wallet, with the time of their next resend and the number of resends so far,
+    /// and the schedule of the resends - the resends only touch these, not the whole wallet.
+    struct Resend {
+        int64 next;
+        unsigned int count;
+    };
+    typedef std::map<uint256, Resend> Unconfirmed;
+    Unconfirmed _unconfirmed;
+    std::set<std::pair<int64, uint256> > _resends;
+    
+    /// Schedule an unconfirmed transaction for resends, or remove a confirmed transaction from the schedule.
+    void ScheduleResend(const CWalletTx& wtx, int height);
+    
+    /// Remove a transaction from the resend schedule.
+    void UnscheduleResend(const uint256& hash);
+    
+    /// Resend on the timer, unless it was cancelled or the wallet is gone.
+    static void resendTimeout(guard_ptr guard, const boost::system::error_code& error);
+    
+    /// The coin selection strategy.
+    selector_ptr _coinSelector;
+    
+    /// The threads running the events, the writes and the key generation of the wallet - shared by the wallets of a
+    /// WalletManager. Declared before the writer and the event queue, which run on them.
+    workers_ptr _workers;
+    
+    /// The group commit of the transaction and key pool records.
+    boost::scoped_ptr<WalletWriter> _writer;
+    
+    /// The key pool target size, the size below which it is refilled in the background, and the next pool index.
+    size_t _keyPoolSize;
+    size_t _keyPoolLowWater;
+    int64 _keyPoolNext;
+    
+    /// Add a batch of generated keys, with their secrets encrypted if the wallet is crypted, queueing their records for
+    /// the next flush.
+    bool addKeys(const std::vector<CKey>& keys, const std::vector<std::vector<unsigned char> >& cryptedSecrets);
+    
+    /// The listeners of the keys and scripts added, and of the transactions held or turned down.
+    boost::function<void (const PubKeyHash&)> _keyAdded;
+    boost::function<void (const ScriptHash&)> _scriptAdded;
+    boost::function<void (const uint256&, bool)> _txChecked;
+    void keyAdded(const PubKeyHash& hash);
+    
+    /// The snapshot for the read only queries, and the transactions and address book entries changed since it was published.
+    snapshot_ptr _snapshot;
+    mutable boost::mutex _snapshotMutex;
+    std::set<uint256> _snapshotTxes;
+    std::set<ChainAddress> _snapshotAddresses;
+
 public:
     mutable CCriticalSection cs_wallet;
     int64 nTransactionFee;
@@ -71,20 +168,31 @@ public:
         Node& _node; 
     };
 
-    Wallet(Node& node, std::string walletFile = "", std::string dataDir = "") : CCryptoKeyStore(), _blockChain(node.blockChain()), nTransactionFee(0), _emit(node), _resend_timer(node.get_io_service()) {
+    /// Load the wallet from walletFile, pr default wallet.dat. Unless subscribe is false, e.g. for a wallet of a
+    /// WalletManager, the wallet subscribes to the transactions and blocks accepted by the node itself. The wallet runs
+    /// on the workers, or on workers of its own if none are given.
+    Wallet(Node& node, std::string walletFile = "", std::string dataDir = "", bool subscribe = true, workers_ptr workers = workers_ptr()) : CCryptoKeyStore(), _workers(workers ? workers : workers_ptr(new WalletWorkers(1))), _blockChain(node.blockChain()), nTransactionFee(0), _emit(node), _resend_timer(node.get_io_service()), _guard(new Guard(this)), _events(_workers->events()) {
         if(walletFile == "NOTFILEBACKED")
             fFileBacked = false;
         else {
             _dataDir = (dataDir == "") ? CDB::dataDir(_blockChain.chain().dataDirSuffix()) : dataDir;
             strWalletFile = (walletFile == "") ? strWalletFile = "wallet.dat" : walletFile;
             fFileBacked = true;
+            _writer.reset(new WalletWriter(_dataDir, strWalletFile, _workers->writes()));
         }
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        _keyPoolSize = 100;
+        _keyPoolLowWater = _keyPoolSize/2;
+        _keyPoolNext = 1;
+        _snapshot = snapshot_ptr(new WalletSnapshot);
+        _coinSelector = selector_ptr(new BranchAndBound(selector_ptr(new Knapsack)));
         
         // install callbacks to get notified about new tx'es and blocks
-        node.subscribe(TransactionFilter::listener_ptr(new TransactionListener(*this)));
-        node.subscribe(BlockFilter::listener_ptr(new BlockListener(*this)));
+        if (subscribe) {
+            node.subscribe(TransactionFilter::listener_ptr(new TransactionListener(*this)));
+            node.subscribe(BlockFilter::listener_ptr(new BlockListener(*this)));
+        }
         
         bool firstRun = false;
         LoadWallet(firstRun);
@@ -93,11 +201,29 @@ public:
         // Do this infrequently and randomly to avoid giving away
         // that these are our transactions.
         _resend_timer.expires_from_now(boost::posix_time::seconds(GetRand(30 * 60)));
-        _resend_timer.async_wait(boost::bind(&Wallet::resend, this));
+        _resend_timer.async_wait(boost::bind(&Wallet::resendTimeout, _guard, boost::asio::placeholders::error));
+    }
+    
+    /// Detaches the handlers of the timers, waiting for one running, processes the queued events, and stops the key
+    /// pool refills, before the wallet is torn down - the io_services and the workers could outlive it.
+    ~Wallet() {
+        {
+            boost::mutex::scoped_lock lock(_guard->mutex);
+            _guard->wallet = NULL;
+        }
+        _resend_timer.cancel();
+        _events.barrier();
+        _workers->keyGenerator().cancel(this);
     }
 
     const Chain& chain() const { return _blockChain.chain(); }
     
+    /// Set the coin selection strategy used by CreateTransaction - pr default branch and bound, falling back to knapsack.
+    void setCoinSelector(selector_ptr selector) {
+        CRITICAL_BLOCK(cs_wallet)
+            _coinSelector = selector;
+    }
+    
     /// acceptTransaction is a thread safe way to post transaction to the chain network. It first checks the transaction, if it can be send and then it emits it through the TransactionEmitter that connects to the Node to run a acceptTransaction in the proper thread.
     bool acceptTransaction(const Transaction& tx) {
         if(_blockChain.checkTransaction(tx)) {
@@ -110,12 +236,84 @@ public:
     
     void transactionAccepted(const Transaction& tx) {
         AddToWalletIfInvolvingMe(tx, NULL, true);
+        FlushAsync();
+        PublishSnapshot();
     }
     void blockAccepted(const Block& b) {
         TransactionList txes = b.getTransactions();
         for(TransactionList::const_iterator tx = txes.begin(); tx != txes.end(); ++tx)
             AddToWalletIfInvolvingMe(*tx, &b, true);
+        UpdateCoins(b);
+        FlushAsync();
+        PublishSnapshot();
+    }
+    
+    /// Queue the transaction to be synced with the wallet on the wallet thread.
+    void postTransaction(const Transaction& tx) {
+        _events.post(boost::bind(&Wallet::transactionAccepted, this, tx));
+    }
+    
+    /// Queue the block to be synced with the wallet on the wallet thread - the queued event shares the block.
+    void postBlock(boost::shared_ptr<const Block> block) {
+        _events.post(boost::bind(&Wallet::blockPosted, this, block));
+    }
+    
+    void blockPosted(boost::shared_ptr<const Block> block) {
+        blockAccepted(*block);
+    }
+    
+    /// Sync only the transactions of the block at the indices, as matched against the wallet by a WalletManager. The
+    /// manager passes a wallet the blocks matching it, and every block reorganizing the chain, with the best block it
+    /// replaced.
+    void blockMatched(boost::shared_ptr<const Block> block, const std::vector<unsigned int>& txes, const uint256& replaced) {
+        const TransactionList& list = block->getTransactions();
+        for (std::vector<unsigned int>::const_iterator idx = txes.begin(); idx != txes.end(); ++idx)
+            AddToWalletIfInvolvingMe(list[*idx], block.get(), true);
+        UpdateCoins(*block, replaced);
+        FlushAsync();
+        PublishSnapshot();
+    }
+    
+    /// Queue the matched transactions of the block to be synced with the wallet on the wallet thread - the block is
+    /// shared by the wallets of a WalletManager.
+    void postBlock(boost::shared_ptr<const Block> block, const std::vector<unsigned int>& txes, const uint256& replaced) {
+        _events.post(boost::bind(&Wallet::blockMatched, this, block, txes, replaced));
+    }
+    
+    /// Called with the hash of each key, or script, added to the wallet - a WalletManager keeps its index up to date.
+    typedef boost::function<void (const PubKeyHash&)> KeyAdded;
+    typedef boost::function<void (const ScriptHash&)> ScriptAdded;
+    /// Called with the hash of each transaction added to the wallet, with true, and of each transaction checked and
+    /// found not to involve it, with false - the manager only keeps the transactions of a wallet in its index.
+    typedef boost::function<void (const uint256&, bool)> TxChecked;
+    void setPatternListeners(KeyAdded keyAdded, ScriptAdded scriptAdded, TxChecked txChecked = TxChecked()) {
+        CRITICAL_BLOCK(cs_wallet) {
+            _keyAdded = keyAdded;
+            _scriptAdded = scriptAdded;
+            _txChecked = txChecked;
+        }
+    }
+    
+    /// Wait for the transactions and blocks accepted so far to be synced with the wallet - call it before reading
+    /// balances or transactions to see the effect of everything the node has accepted. Returns false on timeout.
+    bool Barrier(boost::posix_time::time_duration timeout = boost::posix_time::seconds(30)) {
+        return _events.barrier(timeout);
+    }
+    
+    /// The current snapshot of the transactions and the address book - query it without taking the wallet lock.
+    snapshot_ptr snapshot() const {
+        boost::mutex::scoped_lock lock(_snapshotMutex);
+        return _snapshot;
     }
+    
+    /// Publish a snapshot of the transactions and the address book, if they have changed since the last.
+    void PublishSnapshot();
+    
+    /// Statistics of the wallet event queue.
+    WalletQueue::Stats queueStats() const {
+        return _events.stats();
+    }
+    
     /*
     void commit(const Transaction tx) {
         _node.post(this, Commit, tx); // call this on Node thread...
@@ -127,7 +325,22 @@ public:
     
     std::string getDataDir() const { return _dataDir; }
     
-    bool WriteToDisk(const CWalletTx& wtx);
+    /// Queue the transaction to be written with the next flush - a failed commit is reported by the flush.
+    void WriteToDisk(const CWalletTx& wtx);
+    
+    /// Commit the queued transaction and key pool records in one database transaction.
+    bool Flush();
+    
+    /// True if the last commit failed, also one on the writer thread - the records are retried by the next flush.
+    bool WriteFailed() const {
+        return _writer && _writer->failed();
+    }
+    
+    /// Commit the queued records on the writer thread.
+    void FlushAsync() {
+        if (_writer)
+            _writer->flushAsync();
+    }
     
     std::map<uint256, CWalletTx> mapWallet;
     std::vector<uint256> vWalletUpdated;
@@ -143,6 +356,7 @@ public:
     bool LoadKey(const CKey& key) { return CCryptoKeyStore::addKey(key); }
     bool addCryptedKey(const std::vector<unsigned char> &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool LoadCryptedKey(const std::vector<unsigned char> &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret) { return CCryptoKeyStore::addCryptedKey(vchPubKey, vchCryptedSecret); }
+    bool addScript(const Script& redeemScript);
 
     bool Unlock(const SecureString& strWalletPassphrase);
     bool ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase, const SecureString& strNewWalletPassphrase);
@@ -153,7 +367,7 @@ public:
     bool EraseFromWallet(uint256 hash);
     void WalletUpdateSpent(const Transaction& prevout);
     int ScanForWalletTransactions(const CBlockIndex* pindexStart = NULL, bool fUpdate = false);
-    void ReacceptWalletTransactions();
+    /// Resend the unconfirmed transactions due by their schedule - each is resent at doubling intervals until confirmed.
     void resend();
     int64 GetBalance(bool confirmed = true) const;
     bool CreateTransaction(const std::vector<std::pair<Script, int64> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet);
@@ -163,7 +377,23 @@ public:
     std::string SendMoney(Script scriptPubKey, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
     std::string SendMoneyToBitcoinAddress(const ChainAddress& address, int64 nValue, CWalletTx& wtxNew, bool fAskFee=false);
 
+    /// Fill the key pool up to its target size. The keys are generated in parallel batches, each committed in one
+    /// database transaction. The wallet lock is not held while generating, unless the caller holds it.
     bool TopUpKeyPool();
+    
+    /// Top up the key pool in the background.
+    void RefillKeyPool() {
+        _workers->keyGenerator().refill(boost::bind(&Wallet::TopUpKeyPool, this), this);
+    }
+    
+    /// Set the key pool target size, and the size below which it is refilled in the background - pr default half of it.
+    void setKeyPoolSize(size_t size, size_t low_water = 0) {
+        CRITICAL_BLOCK(cs_wallet) {
+            _keyPoolSize = size;
+            _keyPoolLowWater = low_water ? std::min(low_water, size) : size/2;
+        }
+    }
+    
     void ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool);
     void KeepKey(int64 nIndex);
     void ReturnKey(int64 nIndex);
@@ -305,6 +535,11 @@ private:
     const BlockChain& _blockChain;
     TransactionEmitter _emit;
     boost::asio::deadline_timer _resend_timer;
+    guard_ptr _guard;
+    
+    /// The transactions and blocks accepted by the node, queued for the wallet workers. Declared last, to be drained
+    /// before the rest of the wallet is destroyed.
+    WalletQueue _events;
 };
 
 class COINWALLET_EXPORT CReserveKey
@@ -11,6 +11,7 @@
 #include <coinChain/db.h>
 
 #include <coinWallet/WalletTx.h>
+#include <coinWallet/WalletWriter.h>
 
 extern unsigned int nWalletDBUpdated;
 
@@ -188,6 +189,9 @@ public:
     void ListAccountCreditDebit(const std::string& strAccount, std::list<CAccountingEntry>& acentries);
 
     int LoadWallet(Wallet* pwallet);
+
+    /// Write and erase the serialized records in one transaction.
+    bool WriteRecords(const WalletRecords& records);
 };
 
 //void ThreadFlushWalletDB(void* parg);
@@ -0,0 +1,123 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETMANAGER_H_
+#define _WALLETMANAGER_H_
+
+#include <coin/Address.h>
+#include <coin/Block.h>
+
+#include <coinChain/Node.h>
+
+#include <coinWallet/Export.h>
+#include <coinWallet/WalletScanner.h>
+#include <coinWallet/WalletWorkers.h>
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+class Wallet;
+
+/// WalletManager hosts a number of wallets against one node. The manager is the only subscriber to the transactions and
+/// blocks of the node: they are matched against a combined index of the key and script hashes of all the wallets, and
+/// of their transactions, and each wallet is only passed the transactions that could involve it - the cost of a
+/// transaction is that of matching its scripts once, not a pass pr wallet. Like the ScriptMatcher of a rescan, the
+/// match is conservative, the wallets still check the transactions passed to them. The wallets share one set of
+/// workers, for their events, writes and key generation.
+class COINWALLET_EXPORT WalletManager : private boost::noncopyable {
+public:
+    typedef boost::shared_ptr<Wallet> wallet_ptr;
+    
+    /// Construct a manager of the wallets in the data directory, pr default that of the chain of the node. The events of
+    /// the wallets are processed on a pool of threads, pr default one pr hardware thread.
+    WalletManager(Node& node, const std::string& dataDir = "", size_t threads = 0);
+    
+    /// Unloads the wallets.
+    ~WalletManager();
+    
+    /// Load the wallet <name>.dat, or create it. The first wallet loaded is the default wallet. Throws runtime_error if
+    /// the name is not made of letters, digits, '-', '_' and '.', or if the wallet is already loaded.
+    wallet_ptr load(const std::string& name);
+    
+    /// Unload a wallet - it is destroyed as the last call using it returns. Returns false if it is not loaded, or is
+    /// the default wallet.
+    bool unload(const std::string& name);
+    
+    /// The wallet of a name, or the default wallet if the name is empty - NULL if no such wallet is loaded.
+    wallet_ptr wallet(const std::string& name = "") const;
+    
+    /// The names of the wallets loaded.
+    std::vector<std::string> names() const;
+    
+    /// The name of the default wallet.
+    std::string defaultName() const;
+    
+    /// Pass a transaction accepted by the node to the wallets it could involve.
+    void transactionAccepted(const Transaction& tx);
+    
+    /// Pass a block accepted by the node to the wallets it could involve - each with the transactions that could involve
+    /// it - or to every wallet, if it reorganized the chain.
+    void blockAccepted(const Block& block);
+    
+private:
+    typedef std::vector<Wallet*> WalletList;
+    
+    /// Add the wallets the transaction could involve, and record them as the wallets of the transaction, for its spends
+    /// - until the wallets have checked it.
+    void match(const Transaction& tx, std::set<Wallet*>& wallets);
+    
+    void addKey(Wallet* wallet, const PubKeyHash& hash);
+    void addScript(Wallet* wallet, const ScriptHash& hash);
+    
+    /// Keep a transaction added to a wallet as a transaction of the wallet, and drop one the wallet turned down.
+    void checkTx(Wallet* wallet, const uint256& hash, bool held);
+    
+    Node& _node;
+    std::string _dataDir;
+    workers_ptr _workers;
+    
+    /// Loads are done one at a time, without the index locked.
+    boost::mutex _loading;
+    
+    mutable boost::mutex _mutex;
+    
+    typedef std::map<std::string, wallet_ptr> Wallets;
+    Wallets _wallets;
+    std::map<Wallet*, wallet_ptr> _loaded;
+    std::string _default;
+    
+    /// The best block as of the last block passed to the wallets - a best block not extending it reorganized the chain.
+    uint256 _best;
+    
+    /// The combined index - the wallets pr key hash and script hash, and pr transaction of theirs, as the spends of pay
+    /// to pubkey outputs do not reveal the key. A transaction is recorded for the wallets matching it as it is passed
+    /// on, so its spends match them before they have checked it, and dropped for those turning it down. The entries of
+    /// a wallet are pruned as it is unloaded.
+    typedef boost::unordered_map<uint160, WalletList, ScriptMatcher::Hash> Patterns;
+    typedef boost::unordered_map<uint256, WalletList, ScriptMatcher::Hash> Txes;
+    Patterns _keys;
+    Patterns _scripts;
+    Txes _txes;
+};
+
+#endif // _WALLETMANAGER_H_
@@ -0,0 +1,97 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETQUEUE_H_
+#define _WALLETQUEUE_H_
+
+#include <coin/util.h>
+
+#include <coinWallet/Export.h>
+
+#include <deque>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+/// WalletQueue feeds the events of the block chain to a wallet, in the order they are posted. The events are processed
+/// on a pool shared by the queues of several wallets - a queue has at most one job in the pool, processing a batch of
+/// its events, so the events of a wallet are still processed one at a time, in order. The queue is bounded: if the wallet falls behind, posting blocks until there is room again - the time posters are
+/// held back is accounted for. A barrier waits for the events posted before it to be processed.
+class COINWALLET_EXPORT WalletQueue : private boost::noncopyable {
+public:
+    typedef boost::function<void ()> Event;
+    
+    struct Stats {
+        size_t capacity;
+        size_t queued;
+        /// The most events queued at once.
+        size_t high_water;
+        int64 posted;
+        int64 processed;
+        /// The posts blocked by a full queue, and the microseconds they were blocked.
+        int64 blocked;
+        int64 blocked_us;
+        /// The microseconds from post to processed - in total, for an average, and at most.
+        int64 latency_us;
+        int64 max_latency_us;
+    };
+    
+    /// Construct a queue processed on the pool.
+    WalletQueue(boost::asio::io_service& pool, size_t capacity = 1024);
+    
+    /// Waits for the events queued to be processed.
+    ~WalletQueue();
+    
+    /// Queue an event - blocks while the queue is full.
+    void post(Event event);
+    
+    /// Wait for the events posted before the call to be processed - returns false on timeout. Returns at once if called
+    /// from an event.
+    bool barrier(boost::posix_time::time_duration timeout = boost::posix_time::pos_infin);
+    
+    Stats stats() const;
+    
+private:
+    /// Process a batch of the queued events, and post the job again if there are more.
+    void process();
+    
+    /// True if called from an event of the queue.
+    bool processing() const { return _processor == boost::this_thread::get_id(); }
+    
+    boost::asio::io_service& _pool;
+    size_t _capacity;
+    
+    struct Queued {
+        Event event;
+        boost::posix_time::ptime posted;
+    };
+    std::deque<Queued> _queue;
+    
+    /// True while a job of the queue is in the pool, and the thread running it, while one is.
+    bool _scheduled;
+    boost::thread::id _processor;
+    
+    mutable boost::mutex _mutex;
+    boost::condition_variable _not_full;
+    boost::condition_variable _processed;
+    
+    Stats _stats;
+};
+
+#endif // _WALLETQUEUE_H_
@@ -6,26 +6,41 @@
 #define _WALLETRPC_H_
 
 #include <coinWallet/Export.h>
+#include <coinWallet/WalletSnapshot.h>
 
 #include <coinHTTP/RPC.h>
 #include <coin/util.h>
 
+#include <list>
+#include <map>
+
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+
 class Wallet;
+class WalletManager;
 class CWalletDB;
 
 /// Base class for all wallet rpc methods - they all need a handle to the wallet.
 class COINWALLET_EXPORT WalletMethod : public Method {
 public:
     WalletMethod(Wallet& wallet) : _wallet(wallet) {}
+    virtual const std::string group() const { return "wallet"; }
 protected:
+    /// Wait for the wallet to sync what the node has accepted so far - throws an RPC error if it does not in time, or
+    /// if the last commit of the wallet file failed.
+    void barrier() const;
+    
     Wallet& _wallet;
 };
 
-/// Return the balance of the wallet.
+/// Return the balance of the wallet - from the snapshot, so balance queries run concurrently.
 class COINWALLET_EXPORT GetBalance : public WalletMethod {
 public:
     GetBalance(Wallet& wallet) : WalletMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 protected:
     int64 GetAccountBalance(CWalletDB& walletdb, const std::string& strAccount, int nMinDepth);
     int64 GetAccountBalance(const std::string& strAccount, int nMinDepth);
@@ -94,6 +109,7 @@ class COINWALLET_EXPORT GetReceivedByAddress : public WalletMethod {
 public:
     GetReceivedByAddress(Wallet& wallet) : WalletMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Get money received by account.
@@ -101,6 +117,7 @@ class COINWALLET_EXPORT GetReceivedByAccount : public WalletMethod {
 public:
     GetReceivedByAccount(Wallet& wallet) : WalletMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Move money from one account to the other.
@@ -115,6 +132,7 @@ class COINWALLET_EXPORT SendFrom : public GetBalance {
 public:
     SendFrom(Wallet& wallet) : GetBalance(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return false; }
 };
 
 /// Send to many bitcoin addresses at once.
@@ -124,6 +142,7 @@ class COINWALLET_EXPORT SendMany : public GetBalance {
 public:
     SendMany(Wallet& wallet) : GetBalance(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return false; }
 };
 
 /// List account related info base class.
@@ -132,9 +151,9 @@ public:
     ListMethod(Wallet& wallet) : WalletMethod(wallet) {}
 protected:
     json_spirit::Value listReceived(const json_spirit::Array& params, bool fByAccounts);
-    void listTransactions(const CWalletTx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, json_spirit::Array& ret);    
+    void listTransactions(const WalletSnapshot& snapshot, const WalletSnapshot::Tx& wtx, const std::string& strAccount, int nMinDepth, bool fLong, json_spirit::Array& ret);
     void acEntryToJSON(const CAccountingEntry& acentry, const std::string& strAccount, json_spirit::Array& ret);
-    void walletTxToJSON(const CWalletTx& wtx, json_spirit::Object& entry);
+    void walletTxToJSON(const WalletSnapshot::Tx& wtx, json_spirit::Object& entry);
 };
 
 /// Get money received by account.
@@ -142,6 +161,7 @@ class COINWALLET_EXPORT ListReceivedByAddress : public ListMethod {
 public:
     ListReceivedByAddress(Wallet& wallet) : ListMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Get money received by account.
@@ -149,13 +169,26 @@ class COINWALLET_EXPORT ListReceivedByAccount : public ListMethod {
 public:
     ListReceivedByAccount(Wallet& wallet) : ListMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
-/// Get money received by account.
+/// List the transactions of an account - the entries are written one transaction at a time.
 class COINWALLET_EXPORT ListTransactions : public ListMethod {
 public:
     ListTransactions(Wallet& wallet) : ListMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual void operator()(const json_spirit::Array& params, bool fHelp, const Request& request, JSONWriter& writer);
+    virtual bool isStreaming() const { return true; }
+    virtual bool isReadOnly() const { return true; }
+private:
+    typedef std::pair<const WalletSnapshot::Tx*, CAccountingEntry*> TxPair;
+    typedef std::multimap<int64, TxPair> TxItems;
+    
+    /// Parse the params and sort the transactions of a wallet snapshot and the accounting entries by time.
+    void listItems(const json_spirit::Array& params, bool fHelp, std::string& strAccount, int& nCount, int& nFrom, snapshot_ptr& snapshot, std::list<CAccountingEntry>& acentries, TxItems& txByTime);
+    
+    /// The entries of a transaction or an accounting entry.
+    void itemToJSON(const WalletSnapshot& snapshot, const TxPair& item, const std::string& strAccount, json_spirit::Array& ret);
 };
 
 /// Get money received by account.
@@ -163,6 +196,7 @@ class COINWALLET_EXPORT ListAccounts : public ListMethod {
 public:
     ListAccounts(Wallet& wallet) : ListMethod(wallet) {}
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Get wallet transactions.
@@ -170,6 +204,7 @@ class COINWALLET_EXPORT GetWalletTransaction : public ListMethod {
 public:
     GetWalletTransaction(Wallet& wallet) : ListMethod(wallet) { setName("gettransaction"); }
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+    virtual bool isReadOnly() const { return true; }
 };
 
 /// Backup the wallet.
@@ -186,6 +221,14 @@ public:
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
 };
 
+/// Report the wallet event queue - events posted and processed, its backlog, the time the node was held back by a
+/// full queue and the latency from an event being posted to being processed.
+class COINWALLET_EXPORT WalletQueueStats : public WalletMethod {
+public:
+    WalletQueueStats(Wallet& wallet) : WalletMethod(wallet) {}
+    virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+};
+
 /// Enter the wallet passphrase and supply a timeout for when the wallet is locked again.
 class COINWALLET_EXPORT WalletPassphrase : public WalletMethod {
 public:
@@ -223,4 +266,84 @@ public:
     virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
 };
 
+/// Construct a wallet method for a wallet - the default factory of a WalletRoute.
+template <class M>
+method_ptr newWalletMethod(Wallet& wallet) {
+    return method_ptr(new M(wallet));
+}
+
+/// WalletRoute routes the calls of a wallet method to the wallet of a WalletManager named by the request path,
+/// /wallet/<name>, or to the default wallet if the path names none. The method is constructed by the factory, once
+/// for each wallet called, and takes its name and properties from the method of the default wallet.
+class COINWALLET_EXPORT WalletRoute : public Method {
+public:
+    typedef boost::function<method_ptr (Wallet&)> Factory;
+    
+    /// Construct the route - throws runtime_error if the manager has no default wallet.
+    WalletRoute(WalletManager& manager, Factory factory);
+    
+    virtual json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp);
+    virtual json_spirit::Value operator()(const json_spirit::Array& params, bool fHelp, const Request& request);
+    virtual void operator()(const json_spirit::Array& params, bool fHelp, const Request& request, JSONWriter& writer);
+    
+    virtual bool isStreaming() const { return _default->isStreaming(); }
+    virtual bool isReadOnly() const { return _default->isReadOnly(); }
+    virtual const std::string group() const { return _default->group(); }
+    
+    /// The group of a call is that of the wallet called, "wallet/<name>" - the wallets do not serialize each other.
+    virtual const std::string group(const Request& request) const;
+    virtual const std::string summary() const { return _default->summary(); }
+    virtual const std::string help() const { return _default->help(); }
+    
+    /// The wallet name of a request path - empty if it names none.
+    static std::string walletName(const std::string& uri);
+    
+private:
+    /// The method of the named wallet, and the wallet, kept alive for the call - throws if it is not loaded.
+    method_ptr method(const std::string& name, boost::shared_ptr<Wallet>& wallet);
+    
+    WalletManager& _manager;
+    Factory _factory;
+    method_ptr _default;
+    
+    /// The methods constructed pr wallet name - replaced if the wallet of the name has been reloaded, and dropped once
+    /// it has been unloaded.
+    struct Instance {
+        boost::weak_ptr<Wallet> wallet;
+        method_ptr method;
+    };
+    boost::mutex _mutex;
+    std::map<std::string, Instance> _instances;
+};
+
+/// Base class for the rpc methods managing the wallets of a WalletManager.
+class COINWALLET_EXPORT WalletManagerMethod : public Method {
+public:
+    WalletManagerMethod(WalletManager& manager) : _manager(manager) {}
+    virtual const std::string group() const { return "wallet"; }
+protected:
+    WalletManager& _manager;
+};
+
+/// List the wallets loaded.
+class COINWALLET_EXPORT ListWallets : public WalletManagerMethod {
+public:
+    ListWallets(WalletManager& manager) : WalletManagerMethod(manager) {}
+    virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+};
+
+/// Load, or create, a wallet.
+class COINWALLET_EXPORT WalletLoad : public WalletManagerMethod {
+public:
+    WalletLoad(WalletManager& manager) : WalletManagerMethod(manager) { setName("loadwallet"); }
+    virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+};
+
+/// Unload a wallet.
+class COINWALLET_EXPORT WalletUnload : public WalletManagerMethod {
+public:
+    WalletUnload(WalletManager& manager) : WalletManagerMethod(manager) { setName("unloadwallet"); }
+    virtual json_spirit::Value operator() (const json_spirit::Array& params, bool fHelp);
+};
+
 #endif
@@ -0,0 +1,106 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETSCANNER_H_
+#define _WALLETSCANNER_H_
+
+#include <coin/Address.h>
+#include <coin/Block.h>
+#include <coin/Script.h>
+
+#include <coinWallet/Export.h>
+
+#include <set>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_set.hpp>
+
+class Wallet;
+class BlockChain;
+class CBlockIndex;
+
+/// ScriptMatcher holds the byte patterns of the scripts of a wallet - the hashes of its keys and of its scripts - and
+/// matches raw scripts against them without solving them. The match is conservative: any output IsMine accepts is
+/// matched, but a match, e.g. of a multisig output with only one of our keys, need not be the wallet's.
+class COINWALLET_EXPORT ScriptMatcher {
+public:
+    void addKey(const PubKeyHash& hash) { _keys.insert(hash); }
+    void addScript(const ScriptHash& hash) { _scripts.insert(hash); }
+    
+    /// True if the output script could pay to the wallet.
+    bool match(const Script& script) const;
+    
+    /// True if the input signature reveals a key or a script of the wallet, e.g. the pubkey of a pay to pubkey hash spend.
+    bool matchSignature(const Script& signature) const;
+    
+    /// True if any output, or input signature, of the transaction matches.
+    bool match(const Transaction& tx) const;
+    
+    size_t size() const { return _keys.size() + _scripts.size(); }
+    
+    /// The hashes an output script is matched on - of the keys and the scripts it could pay to. A pushed 20 byte hash
+    /// of a nonstandard script could be either, and is listed as both.
+    static void patterns(const Script& script, std::vector<uint160>& keys, std::vector<uint160>& scripts);
+    
+    /// The hashes an input signature is matched on - of the keys, and the redeem script, it reveals.
+    static void signaturePatterns(const Script& signature, std::vector<uint160>& keys, std::vector<uint160>& scripts);
+    
+    /// Hash of uniformly distributed hashes, for unordered containers keyed by them.
+    struct Hash {
+        size_t operator()(const uint160& hash) const;
+        size_t operator()(const uint256& hash) const;
+    };
+    
+private:
+    static void dataPatterns(const std::vector<unsigned char>& data, std::vector<uint160>& keys, std::vector<uint160>& scripts);
+    
+    bool matches(const std::vector<uint160>& keys, const std::vector<uint160>& scripts) const;
+    
+    typedef boost::unordered_set<uint160, Hash> Hashes;
+    Hashes _keys;
+    Hashes _scripts;
+};
+
+/// WalletScanner rescans the block chain for the transactions of a wallet. The blocks are read, and their transactions
+/// prefiltered by a ScriptMatcher of the wallet, on a number of threads, a batch of blocks at a time. The candidates
+/// are then checked in chain order, together with the spends of known transactions, and only those involving the
+/// wallet are added to it - the wallet is only locked to do that.
+class COINWALLET_EXPORT WalletScanner : private boost::noncopyable {
+public:
+    /// Blocks read pr thread in a batch.
+    enum { blocks_per_thread = 16 };
+    
+    /// Construct a scanner running threads threads, pr default one per hardware thread.
+    WalletScanner(Wallet& wallet, const BlockChain& blockChain, size_t threads = 0);
+    
+    /// Scan the main chain from the block, returns the number of transactions added to, or updated in, the wallet.
+    int scan(const CBlockIndex* start, bool update = false);
+    
+private:
+    /// Read every threads'th block of the batch from offset, and find its candidate transactions.
+    void read(const std::vector<const CBlockIndex*>& indices, size_t begin, size_t offset, std::vector<Block>& blocks, std::vector<std::vector<unsigned int> >& candidates) const;
+    
+    Wallet& _wallet;
+    const BlockChain& _blockChain;
+    size_t _threads;
+    ScriptMatcher _matcher;
+    
+    /// The transactions of the wallet, for finding their spends.
+    std::set<uint256> _txes;
+};
+
+#endif // _WALLETSCANNER_H_
@@ -0,0 +1,177 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETSNAPSHOT_H_
+#define _WALLETSNAPSHOT_H_
+
+#include <coin/Address.h>
+#include <coin/Transaction.h>
+
+#include <coinWallet/Export.h>
+#include <coinWallet/Chunked.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+
+class CWalletTx;
+class Wallet;
+
+/// WalletSnapshot is an immutable view of the transactions and the address book of a wallet. The read only queries,
+/// e.g. the balance and list RPC methods, run on a snapshot without the wallet lock, and hence without holding back the
+/// wallet thread. The wallet publishes a new snapshot after each batch of updates - copy on write: only the changed
+/// transactions are rebuilt, the rest are shared with the previous snapshot. The indices are Chunked, so the next
+/// snapshot shares their chunks too, and copying a snapshot, or an aggregate, does not cost in the size of the wallet.
+///
+/// The snapshot also keeps the aggregates queried by the RPC methods: the amounts received pr address and pr account,
+/// bucketed by the height of the confirming block, and the time ordered transactions pr account. They are updated as
+/// transactions and addresses are changed, and shared between snapshots like the transactions, so a query costs in
+/// the size of its result, not of the wallet.
+class COINWALLET_EXPORT WalletSnapshot {
+public:
+    typedef std::list<std::pair<ChainAddress, int64> > Amounts;
+    
+    /// A wallet transaction, and the amounts derived from it when it was last changed. The depth follows from the
+    /// height and the best height as the transaction is queried.
+    struct Tx {
+        Transaction tx;
+        uint256 hash;
+        int64 time;
+        /// The height of the block confirming the transaction, -1 if unconfirmed.
+        int height;
+        bool final;
+        std::map<std::string, std::string> values;
+        /// The outputs spent and received by the wallet - credit includes the immature outputs of a coinbase.
+        int64 debit;
+        int64 credit;
+        int64 fee;
+        std::string sent_account;
+        /// The amounts received and sent as by CWalletTx::GetAmounts, excluding change.
+        Amounts received;
+        Amounts sent;
+        /// All outputs to keys of the wallet, change included.
+        Amounts mine;
+        
+        bool coinbase() const { return tx.isCoinBase(); }
+        bool fromMe() const { return debit > 0; }
+        
+        /// The blocks left until a coinbase at depth can be spent.
+        int blocksToMaturity(int depth) const {
+            return coinbase() ? std::max(0, (COINBASE_MATURITY+20) - depth) : 0;
+        }
+    };
+    typedef boost::shared_ptr<const Tx> tx_ptr;
+    typedef Chunked<std::map<uint256, tx_ptr> > Txes;
+    typedef Chunked<std::map<ChainAddress, std::string> > AddressBook;
+    
+    /// Amounts by the height of the block confirming them - unconfirmed amounts at height -1.
+    typedef Chunked<std::map<int, int64> > Received;
+    
+    /// Transactions ordered by time.
+    typedef Chunked<std::set<std::pair<int64, uint256> > > TxList;
+    
+    /// Addresses of the address book.
+    typedef Chunked<std::set<ChainAddress> > AddressSet;
+    
+    /// The aggregates of an address of the wallet.
+    struct AddressIndex {
+        int64 epoch;
+        /// Paid to the address by final, non coinbase, transactions - as tallied by getreceivedby and listreceivedby.
+        Received received;
+        /// The transactions paying or crediting the address.
+        Chunked<std::set<uint256> > txes;
+    };
+    typedef Chunked<std::map<ChainAddress, boost::shared_ptr<const AddressIndex> > > Addresses;
+    
+    /// The aggregates of an account - as tallied by getbalance and listaccounts.
+    struct AccountIndex {
+        int64 epoch;
+        /// The number of transactions sent from the account - an account sent from is listed, even with no balance.
+        int64 refs;
+        /// Credited the account by final received and generated transactions, and the debited sent amounts and fees.
+        Received credited;
+        Received generated;
+        int64 debited;
+        /// The addresses of the account in the address book.
+        AddressSet addresses;
+        /// The transactions with entries for the account.
+        TxList txes;
+    };
+    typedef Chunked<std::map<std::string, boost::shared_ptr<const AccountIndex> > > Accounts;
+    
+    WalletSnapshot() : _epoch(0) {}
+    
+    /// The transactions by hash.
+    const Txes& txes() const { return _txes; }
+    
+    /// A transaction - NULL if it is not in the wallet.
+    const Tx* tx(const uint256& hash) const;
+    
+    const AddressBook& addressBook() const { return _address_book; }
+    
+    /// The account of an address, and whether it is in the address book.
+    bool account(const ChainAddress& address, std::string& account) const;
+    
+    /// The aggregates pr address and pr account.
+    const Addresses& addresses() const { return _addresses; }
+    const Accounts& accounts() const { return _accounts; }
+    
+    /// The aggregates of an address or an account - NULL if none.
+    const AddressIndex* addressIndex(const ChainAddress& address) const;
+    const AccountIndex* accountIndex(const std::string& account) const;
+    
+    /// The transactions with entries for any account, ordered by time.
+    const TxList& all() const { return _all; }
+    
+    /// Sum the amounts at a depth of at least min_depth - conf is set to the least depth summed, INT_MAX if none.
+    static int64 tally(const Received& received, int best, int min_depth, int* conf = NULL);
+    
+    /// The number of snapshots published before this one.
+    int64 epoch() const { return _epoch; }
+    
+    /// Derive the snapshot of a wallet transaction - called with the wallet lock held.
+    static tx_ptr snapshot(const CWalletTx& wtx, int height, const Wallet& wallet);
+    
+    /// Used by the wallet to build the next snapshot from a copy of the current.
+    void advance() { ++_epoch; }
+    void insert(tx_ptr tx);
+    void erase(const uint256& hash);
+    /// Set the account of an address, or remove it from the address book if account is NULL.
+    void setAccount(const ChainAddress& address, const std::string* account);
+    
+private:
+    /// Add or subtract the amounts of a transaction to the aggregates.
+    void index(const Tx& tx, int64 sign);
+    
+    /// The aggregates of this snapshot to change - copied if shared with an earlier snapshot. The copy shares the chunks
+    /// of the transaction lists and amounts, so it costs in their number of chunks, not in the transactions.
+    AddressIndex& mutableAddress(const ChainAddress& address);
+    AccountIndex& mutableAccount(const std::string& account);
+    
+    Txes _txes;
+    AddressBook _address_book;
+    Addresses _addresses;
+    Accounts _accounts;
+    TxList _all;
+    int64 _epoch;
+};
+
+typedef boost::shared_ptr<const WalletSnapshot> snapshot_ptr;
+
+#endif // _WALLETSNAPSHOT_H_
@@ -181,6 +181,17 @@ public:
         }
     }
 
+    void MarkUnspent(unsigned int nOut)
+    {
+        if (nOut >= _outputs.size())
+            throw std::runtime_error("CWalletTx::MarkUnspent() : nOut out of range");
+        if (nOut < vfSpent.size() && vfSpent[nOut])
+        {
+            vfSpent[nOut] = false;
+            fAvailableCreditCached = false;
+        }
+    }
+
     bool IsSpent(unsigned int nOut) const
     {
         if (nOut >= _outputs.size())
@@ -208,7 +219,8 @@ public:
 
     // IsConfirmed removed - (could call the BlockChain through the wallet though - put it back ?
     
-    bool WriteToDisk();
+    /// Queue the transaction to be written with the next flush of the wallet.
+    void WriteToDisk();
 
     int64 GetTxTime() const;
     int GetRequestCount() const;
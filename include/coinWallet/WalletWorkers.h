@@ -0,0 +1,62 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETWORKERS_H_
+#define _WALLETWORKERS_H_
+
+#include <coinWallet/Export.h>
+#include <coinWallet/KeyPoolGenerator.h>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+/// WalletWorkers are the threads wallets run their work on: a pool processing the event queues, a writer thread
+/// committing the wallet files, and the key pool generator. A standalone wallet has workers of its own, the wallets of
+/// a WalletManager share one set, so the number of threads does not grow with the number of wallets.
+class COINWALLET_EXPORT WalletWorkers : private boost::noncopyable {
+public:
+    /// Construct the workers with a pool of event threads, pr default one pr hardware thread.
+    WalletWorkers(size_t threads = 0);
+    
+    /// Stops the threads - the wallets using the workers are to be destroyed first.
+    ~WalletWorkers();
+    
+    /// The pool the wallet event queues are processed on.
+    boost::asio::io_service& events() { return _events; }
+    
+    /// The thread the wallet files are committed on.
+    boost::asio::io_service& writes() { return _writes; }
+    
+    KeyPoolGenerator& keyGenerator() { return _keyGenerator; }
+    
+private:
+    boost::asio::io_service _events;
+    boost::scoped_ptr<boost::asio::io_service::work> _events_work;
+    boost::thread_group _event_threads;
+    
+    boost::asio::io_service _writes;
+    boost::scoped_ptr<boost::asio::io_service::work> _writes_work;
+    boost::thread_group _write_threads;
+    
+    KeyPoolGenerator _keyGenerator;
+};
+
+typedef boost::shared_ptr<WalletWorkers> workers_ptr;
+
+#endif // _WALLETWORKERS_H_
@@ -0,0 +1,109 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WALLETWRITER_H_
+#define _WALLETWRITER_H_
+
+#include <coin/serialize.h>
+
+#include <coinWallet/Export.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/asio/io_service.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+
+/// The serialized value of a wallet record - it can be a private key, so it is kept in secure memory, wiped on release.
+typedef std::vector<char, secure_allocator<char> > WalletRecord;
+
+/// Serialized wallet records by their serialized key - the value is empty for a record to erase.
+typedef std::map<std::string, std::pair<bool, WalletRecord> > WalletRecords;
+
+/// WalletWriter group commits the writes to a wallet file. Records are serialized as they are written, and queued,
+/// replacing any earlier write of the same record. A flush commits all queued records in one database transaction -
+/// either synchronously, or on the writer thread, leaving the caller, e.g. the Node thread, to go on. The writer thread
+/// can be shared by the writers of several wallets.
+class COINWALLET_EXPORT WalletWriter : private boost::noncopyable {
+public:
+    WalletWriter(const std::string& dataDir, const std::string& file, boost::asio::io_service& writer);
+    
+    /// Waits for a flush scheduled on the writer thread, and flushes the queued records.
+    ~WalletWriter();
+    
+    template<typename K, typename T>
+    void write(const K& key, const T& value) {
+        CDataStream ssValue(SER_DISK);
+        ssValue << value;
+        queue(key, true, WalletRecord(ssValue.begin(), ssValue.end()));
+    }
+    
+    template<typename K>
+    void erase(const K& key) {
+        queue(key, false, WalletRecord());
+    }
+    
+    /// Commit the queued records in one transaction, returns false if the commit failed - the records are then queued
+    /// again, unless written since.
+    bool flush();
+    
+    /// Flush on the writer thread - flushes already scheduled are not repeated.
+    void flushAsync();
+    
+    /// True if the last commit failed - its records are queued again, and retried by the next flush.
+    bool failed() const;
+    
+    /// The number of queued records.
+    size_t pending() const;
+    
+    /// The number of commits, and records committed, since the start.
+    size_t commits() const { return _commits; }
+    size_t committed() const { return _committed; }
+    
+private:
+    template<typename K>
+    void queue(const K& key, bool write, const WalletRecord& value) {
+        CDataStream ssKey(SER_DISK);
+        ssKey << key;
+        boost::mutex::scoped_lock lock(_mutex);
+        _records[std::string(ssKey.begin(), ssKey.end())] = std::make_pair(write, value);
+    }
+    
+    void scheduled();
+    
+    std::string _dataDir;
+    std::string _file;
+    
+    mutable boost::mutex _mutex;
+    WalletRecords _records;
+    bool _scheduled;
+    bool _failed;
+    
+    /// The flushes posted to the writer thread, and not yet returned.
+    size_t _posted;
+    boost::condition_variable _returned;
+    
+    /// Flushes are serialized, so a later flush never commits before an earlier one.
+    boost::mutex _flush;
+    size_t _commits;
+    size_t _committed;
+    
+    boost::asio::io_service& _writer;
+};
+
+#endif // _WALLETWRITER_H_
@@ -55,3 +55,9 @@ bool BasicKeyStore::getScript(const ScriptHash& hash, Script& redeemScript) cons
     }
     return false;
 }
+
+void BasicKeyStore::getScripts(std::set<ScriptHash>& hashes) const {
+    hashes.clear();
+    for (ScriptMap::const_iterator mi = _scripts.begin(); mi != _scripts.end(); ++mi)
+        hashes.insert(mi->first);
+}
@@ -0,0 +1,116 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/BerkeleyStore.h>
+
+using namespace std;
+
+bool BerkeleyStore::read(const Data& key, Data& value) const {
+    if (!pdb)
+        return false;
+    
+    Data k(key);
+    Dbt datKey(&k[0], k.size());
+    Dbt datValue;
+    datValue.set_flags(DB_DBT_MALLOC);
+    int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
+    if (datValue.get_data() == NULL)
+        return false;
+    
+    unsigned char* data = (unsigned char*)datValue.get_data();
+    value.assign(data, data + datValue.get_size());
+    free(datValue.get_data());
+    return (ret == 0);
+}
+
+bool BerkeleyStore::write(const Data& key, const Data& value) {
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Write called on database in read-only mode");
+    
+    Data k(key), v(value);
+    Dbt datKey(&k[0], k.size());
+    Dbt datValue(v.size() ? &v[0] : NULL, v.size());
+    int ret = pdb->put(GetTxn(), &datKey, &datValue, 0);
+    return (ret == 0);
+}
+
+bool BerkeleyStore::erase(const Data& key) {
+    if (!pdb)
+        return false;
+    if (fReadOnly)
+        assert(!"Erase called on database in read-only mode");
+    
+    Data k(key);
+    Dbt datKey(&k[0], k.size());
+    int ret = pdb->del(GetTxn(), &datKey, 0);
+    return (ret == 0 || ret == DB_NOTFOUND);
+}
+
+bool BerkeleyStore::exists(const Data& key) const {
+    if (!pdb)
+        return false;
+    
+    Data k(key);
+    Dbt datKey(&k[0], k.size());
+    int ret = pdb->exists(GetTxn(), &datKey, 0);
+    return (ret == 0);
+}
+
+bool BerkeleyStore::scan(const Data& prefix, Visitor& visitor) const {
+    if (!pdb)
+        return false;
+    Dbc* pcursor = NULL;
+    if (pdb->cursor(NULL, &pcursor, 0) != 0 || !pcursor)
+        return false;
+    
+    // position the cursor at the first key >= prefix and iterate as long as the keys match the prefix
+    Data start(prefix);
+    unsigned int fFlags = DB_SET_RANGE;
+    loop {
+        Dbt datKey;
+        if (fFlags == DB_SET_RANGE) {
+            datKey.set_data(&start[0]);
+            datKey.set_size(start.size());
+        }
+        Dbt datValue;
+        datKey.set_flags(DB_DBT_MALLOC);
+        datValue.set_flags(DB_DBT_MALLOC);
+        int ret = pcursor->get(&datKey, &datValue, fFlags);
+        fFlags = DB_NEXT;
+        if (ret == DB_NOTFOUND)
+            break;
+        else if (ret != 0 || datKey.get_data() == NULL || datValue.get_data() == NULL) {
+            pcursor->close();
+            return false;
+        }
+        
+        unsigned char* k = (unsigned char*)datKey.get_data();
+        unsigned char* v = (unsigned char*)datValue.get_data();
+        Data key(k, k + datKey.get_size());
+        Data value(v, v + datValue.get_size());
+        free(datKey.get_data());
+        free(datValue.get_data());
+        
+        if (key.size() < prefix.size() || !equal(prefix.begin(), prefix.end(), key.begin()))
+            break;
+        if (!visitor(key, value))
+            break;
+    }
+    pcursor->close();
+    return true;
+}
@@ -33,7 +33,7 @@ using namespace boost;
 // BlockChain
 //
 
-BlockChain::BlockChain(const Chain& chain, const string dataDir, const char* pszMode) : CDB(dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir, "blkindex.dat", pszMode), Database((dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir) + "/blockchain.sqlite"), _chain(chain), _blockFile(dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir), _genesisBlockIndex(NULL), _bestChainWork(0), _bestInvalidWork(0), _bestChain(0), _bestIndex(NULL), _bestReceivedTime(0), _transactionsUpdated(0) {
+BlockChain::BlockChain(const Chain& chain, const string dataDir, const char* pszMode, const string storage) : Database((dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir) + "/blockchain.sqlite"), _chain(chain), _store(KeyValueStore::create(storage, dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir, "blkindex", pszMode)), _blockFile(dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir), _genesisBlockIndex(NULL), _bestChainWork(0), _bestInvalidWork(0), _bestChain(0), _bestIndex(NULL), _bestReceivedTime(0), _transactionsUpdated(0) {
     load();
     _acceptBlockTimer = 0;
     _connectInputsTimer = 0;
@@ -192,6 +192,9 @@ bool BlockChain::load(bool allowNew)
     if (!LoadBlockIndex())
         return false;
     
+    if (!MigrateTxIndex())
+        return false;
+    
     //
     // Init with genesis block
     //
@@ -402,6 +405,29 @@ void BlockChain::getBlock(const CBlockIndex* index, Block& block) const {
     _blockFile.readFromDisk(block, index);
 }
 
+bool BlockChain::getRawBlock(const uint256 hash, string& data) const {
+    // lock the pool and chain for reading
+    boost::shared_lock< boost::shared_mutex > lock(_chain_and_pool_access);
+    data.clear();
+    BlockChainIndex::const_iterator index = _blockChainIndex.find(hash);
+    if (index == _blockChainIndex.end())
+        return false;
+    return _blockFile.readRawFromDisk(data, index->second->nFile, index->second->nBlockPos);
+}
+
+bool BlockChain::getBlockHeaders(const uint256 hash, unsigned int count, Blocks& headers) const {
+    // lock the pool and chain for reading
+    boost::shared_lock< boost::shared_mutex > lock(_chain_and_pool_access);
+    headers.clear();
+    BlockChainIndex::const_iterator index = _blockChainIndex.find(hash);
+    if (index == _blockChainIndex.end() || !isInMainChain(index->second))
+        return false;
+    headers.reserve(count);
+    for (const CBlockIndex* pindex = index->second; pindex && headers.size() < count; pindex = pindex->pnext)
+        headers.push_back(pindex->GetBlockHeader());
+    return true;
+}
+
 
 
 const CBlockIndex* BlockChain::getBlockIndex(const CBlockLocator& locator) const
@@ -550,8 +576,8 @@ bool BlockChain::connectInputs(const Transaction& tx, map<uint256, TxIndex>& map
                 _verifySignatureTimer += GetTimeMicros() - t1;
             }
             // Check for conflicts
-            if (!txindex.getSpent(prevout.index).isNull())
-                return fMiner ? false : error("ConnectInputs() : %s prev tx already used at %s", tx.getHash().toString().substr(0,10).c_str(), txindex.getSpent(prevout.index).toString().c_str());
+            if (txindex.isSpent(prevout.index))
+                return fMiner ? false : error("ConnectInputs() : %s prev tx %s output %d already used", tx.getHash().toString().substr(0,10).c_str(), prevout.hash.toString().substr(0,10).c_str(), prevout.index);
             
             // Check for negative or overflow input values
             nValueIn += txPrev.getOutput(prevout.index).value();
@@ -632,7 +658,7 @@ bool BlockChain::isInMainChain(const uint256 hash) const {
     boost::shared_lock< boost::shared_mutex > lock(_chain_and_pool_access);
 
     BlockChainIndex::const_iterator i = _blockChainIndex.find(hash);
-    return i != _blockChainIndex.end();
+    return i != _blockChainIndex.end() && isInMainChain(i->second);
 }
 
 int BlockChain::getHeight(const uint256 hash) const
@@ -671,12 +697,22 @@ int BlockChain::getHeight(const uint256 hash) const
 bool BlockChain::ReadTxIndex(uint256 hash, TxIndex& txindex) const
 {
     txindex.setNull();
-    return Read(make_pair(string("tx"), hash), txindex);
+    return _store->Read(make_pair(string("tx"), hash), txindex);
 }
 
 bool BlockChain::UpdateTxIndex(uint256 hash, const TxIndex& txindex)
 {
-    return Write(make_pair(string("tx"), hash), txindex);
+#ifdef LIBCOIN_SPENT_INDEX
+    // Maintain the spent-by index: coin -> position of the spending transaction
+    const TxIndex::Spenders& spenders = txindex.getSpenders();
+    for (TxIndex::Spenders::const_iterator s = spenders.begin(); s != spenders.end(); ++s) {
+        if (s->second.isNull())
+            _store->Erase(make_pair(string("spent"), Coin(hash, s->first)));
+        else if (!_store->Write(make_pair(string("spent"), Coin(hash, s->first)), s->second))
+            return false;
+    }
+#endif
+    return _store->Write(make_pair(string("tx"), hash), txindex);
 }
 
 bool BlockChain::AddTxIndex(const Transaction& tx, const DiskTxPos& pos, int nHeight)
@@ -693,12 +729,68 @@ bool BlockChain::AddTxIndex(const Transaction& tx, const DiskTxPos& pos, int nHe
 bool BlockChain::EraseTxIndex(const Transaction& tx)
 {
     uint256 hash = tx.getHash();
-    return Erase(make_pair(string("tx"), hash));
+    return _store->Erase(make_pair(string("tx"), hash));
+}
+
+/// Collects the hashes of the txindex records still in the old format.
+class LegacyTxIndexVisitor : public KeyValueStore::Visitor {
+public:
+    typedef vector<uint256> Hashes;
+    LegacyTxIndexVisitor(Hashes& hashes) : _hashes(hashes) {}
+    
+    virtual bool operator()(const KeyValueStore::Data& key, const KeyValueStore::Data& value) {
+        CDataStream ssValue(value, SER_DISK);
+        int marker;
+        ssValue >> marker;
+        if (marker == TxIndex::COMPACT)
+            return true;
+        CDataStream ssKey(key, SER_DISK);
+        string strType;
+        uint256 hash;
+        ssKey >> strType >> hash;
+        _hashes.push_back(hash);
+        return true;
+    }
+private:
+    Hashes& _hashes;
+};
+
+bool BlockChain::MigrateTxIndex()
+{
+    const int format = 1;
+    int stored = 0;
+    if (_store->Read(string("txindexformat"), stored) && stored >= format)
+        return true;
+    
+    // One scan collects the hashes of the old records, which are then rewritten in batches
+    printf("MigrateTxIndex() : rewriting the txindex in the compact format\n");
+    int64 t0 = GetTimeMillis();
+    LegacyTxIndexVisitor::Hashes hashes;
+    LegacyTxIndexVisitor visitor(hashes);
+    if (!_store->scan(KeyValueStore::serialize(string("tx")), visitor))
+        return error("MigrateTxIndex() : scan failed");
+    
+    const size_t batch = 10000;
+    for (size_t b = 0; b < hashes.size(); b += batch) {
+        _store->begin();
+        for (size_t h = b; h < hashes.size() && h < b + batch; ++h) {
+            TxIndex txindex;
+            if (!ReadTxIndex(hashes[h], txindex) || !UpdateTxIndex(hashes[h], txindex)) {
+                _store->abort();
+                return error("MigrateTxIndex() : rewriting %s failed", hashes[h].toString().substr(0,20).c_str());
+            }
+        }
+        if (!_store->commit())
+            return error("MigrateTxIndex() : commit failed");
+    }
+    printf("MigrateTxIndex() : %d records migrated in %" PRI64d "ms\n", (int)hashes.size(), GetTimeMillis() - t0);
+    
+    return _store->Write(string("txindexformat"), format);
 }
 
 bool BlockChain::haveTx(uint256 hash, bool must_be_confirmed) const
 {
-    if(Exists(make_pair(string("tx"), hash)))
+    if(_store->Exists(make_pair(string("tx"), hash)))
         return true;
     else if(!must_be_confirmed && _transactionIndex.count(hash))
         return true;
@@ -728,56 +820,44 @@ bool BlockChain::haveBlock(uint256 hash) const
     return _blockChainIndex.count(hash);
 }
 
+/// Collects the (position, height) of the owner records visited.
+class OwnerTxVisitor : public KeyValueStore::Visitor {
+public:
+    typedef vector<pair<DiskTxPos, int> > Positions;
+    OwnerTxVisitor(Positions& positions) : _positions(positions) {}
+    
+    virtual bool operator()(const KeyValueStore::Data& key, const KeyValueStore::Data& value) {
+        CDataStream ssKey(key, SER_DISK);
+        CDataStream ssValue(value, SER_DISK);
+        string strType;
+        uint160 hashItem;
+        DiskTxPos pos;
+        ssKey >> strType >> hashItem >> pos;
+        int nItemHeight;
+        ssValue >> nItemHeight;
+        _positions.push_back(make_pair(pos, nItemHeight));
+        return true;
+    }
+private:
+    Positions& _positions;
+};
+
 bool BlockChain::ReadOwnerTxes(uint160 hash160, int nMinHeight, vector<Transaction>& vtx)
 {
     vtx.clear();
     
-    // Get cursor
-    Dbc* pcursor = CDB::GetCursor();
-    if (!pcursor)
+    OwnerTxVisitor::Positions positions;
+    OwnerTxVisitor visitor(positions);
+    if (!_store->scan(KeyValueStore::serialize(make_pair(string("owner"), hash160)), visitor))
         return false;
     
-    unsigned int fFlags = DB_SET_RANGE;
-    loop
-    {
-    // Read next record
-    CDataStream ssKey;
-    if (fFlags == DB_SET_RANGE)
-        ssKey << string("owner") << hash160 << DiskTxPos(0, 0, 0);
-    CDataStream ssValue;
-    int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
-    fFlags = DB_NEXT;
-    if (ret == DB_NOTFOUND)
-        break;
-    else if (ret != 0)
-        {
-        pcursor->close();
-        return false;
-        }
-    
-    // Unserialize
-    string strType;
-    uint160 hashItem;
-    DiskTxPos pos;
-    ssKey >> strType >> hashItem >> pos;
-    int nItemHeight;
-    ssValue >> nItemHeight;
-    
-    // Read transaction
-    if (strType != "owner" || hashItem != hash160)
-        break;
-    if (nItemHeight >= nMinHeight)
-        {
+    for (OwnerTxVisitor::Positions::const_iterator p = positions.begin(); p != positions.end(); ++p) {
+        if (p->second < nMinHeight)
+            continue;
         vtx.resize(vtx.size()+1);
-        if (!_blockFile.readFromDisk(vtx.back(), pos))
-            {
-            pcursor->close();
+        if (!_blockFile.readFromDisk(vtx.back(), p->first))
             return false;
-            }
-        }
     }
-    
-    pcursor->close();
     return true;
 }
 
@@ -832,32 +912,47 @@ bool BlockChain::ReadDiskTx(Coin outpoint, Transaction& tx) const
 
 bool BlockChain::WriteBlockIndex(const CDiskBlockIndex& blockindex)
 {
-    return Write(make_pair(string("blockindex"), blockindex.GetBlockHash()), blockindex);
+    return _store->Write(make_pair(string("blockindex"), blockindex.GetBlockHash()), blockindex);
 }
 
 bool BlockChain::EraseBlockIndex(uint256 hash)
 {
-    return Erase(make_pair(string("blockindex"), hash));
+    return _store->Erase(make_pair(string("blockindex"), hash));
+}
+
+bool BlockChain::ReadBlockUndo(uint256 hash, BlockUndo& undo) const
+{
+    return _store->Read(make_pair(string("undo"), hash), undo);
+}
+
+bool BlockChain::WriteBlockUndo(uint256 hash, const BlockUndo& undo)
+{
+    return _store->Write(make_pair(string("undo"), hash), undo);
+}
+
+bool BlockChain::EraseBlockUndo(uint256 hash)
+{
+    return _store->Erase(make_pair(string("undo"), hash));
 }
 
 bool BlockChain::ReadHashBestChain()
 {
-    return Read(string("hashBestChain"), _bestChain);
+    return _store->Read(string("hashBestChain"), _bestChain);
 }
 
 bool BlockChain::WriteHashBestChain(const uint256 bestChain)
 {
-    return Write(string("hashBestChain"), bestChain);
+    return _store->Write(string("hashBestChain"), bestChain);
 }
 
 bool BlockChain::ReadBestInvalidWork()
 {
-    return Read(string("bnBestInvalidWork"), _bestInvalidWork);
+    return _store->Read(string("bnBestInvalidWork"), _bestInvalidWork);
 }
 
 bool BlockChain::WriteBestInvalidWork()
 {
-    return Write(string("bnBestInvalidWork"), _bestInvalidWork);
+    return _store->Write(string("bnBestInvalidWork"), _bestInvalidWork);
 }
 
 CBlockIndex* BlockChain::InsertBlockIndex(uint256 hash)
@@ -880,62 +975,55 @@ CBlockIndex* BlockChain::InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+/// Collects the block index records visited.
+class DiskBlockIndexVisitor : public KeyValueStore::Visitor {
+public:
+    typedef vector<CDiskBlockIndex> DiskBlockIndices;
+    DiskBlockIndexVisitor(DiskBlockIndices& diskindices) : _diskindices(diskindices) {}
+    
+    virtual bool operator()(const KeyValueStore::Data& key, const KeyValueStore::Data& value) {
+        CDataStream ssValue(value, SER_DISK);
+        _diskindices.resize(_diskindices.size()+1);
+        ssValue >> _diskindices.back();
+        return true;
+    }
+private:
+    DiskBlockIndices& _diskindices;
+};
+
 bool BlockChain::LoadBlockIndex()
 {
-    // Get database cursor
-    Dbc* pcursor = CDB::GetCursor();
-    if (!pcursor)
+    // Read the block index records
+    DiskBlockIndexVisitor::DiskBlockIndices diskindices;
+    DiskBlockIndexVisitor visitor(diskindices);
+    if (!_store->scan(KeyValueStore::serialize(string("blockindex")), visitor))
         return false;
     
     // Load _blockChainIndex
-    unsigned int fFlags = DB_SET_RANGE;
-    loop {
-        // Read next record
-        CDataStream ssKey;
-        if (fFlags == DB_SET_RANGE)
-            ssKey << make_pair(string("blockindex"), uint256(0));
-        CDataStream ssValue;
-        int ret = ReadAtCursor(pcursor, ssKey, ssValue, fFlags);
-        fFlags = DB_NEXT;
-        if (ret == DB_NOTFOUND)
-            break;
-        else if (ret != 0)
-            return false;
+    for (DiskBlockIndexVisitor::DiskBlockIndices::const_iterator di = diskindices.begin(); di != diskindices.end(); ++di) {
+        const CDiskBlockIndex& diskindex = *di;
         
-        // Unserialize
-        string strType;
-        ssKey >> strType;
-        if (strType == "blockindex") {
-            CDiskBlockIndex diskindex;
-            ssValue >> diskindex;
-            
-            // Construct block index object
-            CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
-            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
-            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
-            pindexNew->nFile          = diskindex.nFile;
-            pindexNew->nBlockPos      = diskindex.nBlockPos;
-            pindexNew->nHeight        = diskindex.nHeight;
-            pindexNew->nVersion       = diskindex.nVersion;
-            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-            pindexNew->nTime          = diskindex.nTime;
-            pindexNew->nBits          = diskindex.nBits;
-            pindexNew->nNonce         = diskindex.nNonce;
-            
-            // Watch for genesis block
-            if (_genesisBlockIndex == NULL && diskindex.GetBlockHash() == getGenesisHash())
-                _genesisBlockIndex = pindexNew;
-            
-            if (!pindexNew->checkIndex(_chain.proofOfWorkLimit()))
-                throw runtime_error(("LoadBlockIndex() : CheckIndex failed at " + lexical_cast<string>(pindexNew->nHeight)).c_str());
-            //            if (!pindexNew->CheckIndex())
-            //                return error("LoadBlockIndex() : CheckIndex failed at %d", pindexNew->nHeight);
-        }
-        else {
-            break;
-        }
+        // Construct block index object
+        CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+        pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+        pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+        pindexNew->nFile          = diskindex.nFile;
+        pindexNew->nBlockPos      = diskindex.nBlockPos;
+        pindexNew->nHeight        = diskindex.nHeight;
+        pindexNew->nVersion       = diskindex.nVersion;
+        pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+        pindexNew->nTime          = diskindex.nTime;
+        pindexNew->nBits          = diskindex.nBits;
+        pindexNew->nNonce         = diskindex.nNonce;
+        
+        // Watch for genesis block
+        if (_genesisBlockIndex == NULL && diskindex.GetBlockHash() == getGenesisHash())
+            _genesisBlockIndex = pindexNew;
+        
+        if (!pindexNew->checkIndex(_chain.proofOfWorkLimit()))
+            throw runtime_error(("LoadBlockIndex() : CheckIndex failed at " + lexical_cast<string>(pindexNew->nHeight)).c_str());
     }
-    pcursor->close();
+    diskindices.clear();
     
     // Calculate bnChainWork
     vector<pair<int, CBlockIndex*> > vSortedByHeight;
@@ -1038,6 +1126,39 @@ bool BlockChain::disconnectBlock(const Block& block, CBlockIndex* pindex)
     return true;
 }
 
+bool BlockChain::disconnectBlock(const Block& block, const BlockUndo& undo, CBlockIndex* pindex)
+{
+#ifdef LIBCOIN_SPENT_INDEX
+    // Erase the spent-by entries of the inputs of the block - the undo record leaves out the coins spent within the block
+    BOOST_FOREACH(const Transaction& tx, block.getTransactions())
+        if (!tx.isCoinBase())
+            BOOST_FOREACH(const Input& txin, tx.getInputs())
+                _store->Erase(make_pair(string("spent"), txin.prevout()));
+#endif
+    // Restore the txindex of the previous transactions
+    for (BlockUndo::TxIndices::const_iterator p = undo.getPrevouts().begin(); p != undo.getPrevouts().end(); ++p) {
+        if (!UpdateTxIndex(p->first, p->second))
+            return error("DisconnectBlock() : UpdateTxIndex failed");
+    }
+    
+    // Remove the transactions of the block from the index
+    BOOST_FOREACH(const uint256& hash, undo.getTxes())
+        _store->Erase(make_pair(string("tx"), hash));
+    
+    EraseBlockUndo(pindex->GetBlockHash());
+    
+    // Update block index on disk without changing it in memory.
+    // The memory index structure will be changed after the db commits.
+    if (pindex->pprev) {
+        CDiskBlockIndex blockindexPrev(pindex->pprev);
+        blockindexPrev.hashNext = 0;
+        if (!WriteBlockIndex(blockindexPrev))
+            return error("DisconnectBlock() : WriteBlockIndex failed");
+    }
+    
+    return true;
+}
+
 bool BlockChain::connectBlock(const Block& block, CBlockIndex* pindex)
 {
     try {
@@ -1058,10 +1179,8 @@ bool BlockChain::connectBlock(const Block& block, CBlockIndex* pindex)
         if (pindex->nTime > _chain.timeStamp(Chain::BIP0030))
             BOOST_FOREACH(const Transaction& tx, block.getTransactions()) {
                 TxIndex txindexOld;
-                if (ReadTxIndex(tx.getHash(), txindexOld))
-                    BOOST_FOREACH(const DiskTxPos &pos, txindexOld.getSpents())
-                    if (pos.isNull())
-                        return false;
+                if (ReadTxIndex(tx.getHash(), txindexOld) && !txindexOld.allSpent())
+                    return false;
             }
         
         
@@ -1087,6 +1206,40 @@ bool BlockChain::connectBlock(const Block& block, CBlockIndex* pindex)
         if (block.getTransaction(0).getValueOut() > _chain.subsidy(pindex->nHeight) + fees)
             return false;
         
+        // Write the undo record - the previous transactions' txindex before this block spent from them
+        // is the queued txindex with the outputs spent by this block cleared again
+        BlockUndo undo;
+        set<uint256> blockTxes;
+        BOOST_FOREACH(const Transaction& tx, block.getTransactions()) {
+            undo.addTx(tx.getHash());
+            blockTxes.insert(tx.getHash());
+        }
+        map<uint256, TxIndex> prevouts;
+        BOOST_FOREACH(const Transaction& tx, block.getTransactions()) {
+            if (tx.isCoinBase())
+                continue;
+            BOOST_FOREACH(const Input& txin, tx.getInputs()) {
+                Coin prevout = txin.prevout();
+                if (blockTxes.count(prevout.hash))
+                    continue;
+                map<uint256, TxIndex>::iterator p = prevouts.find(prevout.hash);
+                if (p == prevouts.end())
+                    p = prevouts.insert(make_pair(prevout.hash, queuedChanges[prevout.hash])).first;
+                p->second.setNotSpent(prevout.index);
+            }
+        }
+        for (map<uint256, TxIndex>::const_iterator p = prevouts.begin(); p != prevouts.end(); ++p)
+            undo.addPrevout(p->first, p->second);
+        if (!WriteBlockUndo(pindex->GetBlockHash(), undo))
+            return error("ConnectBlock() : WriteBlockUndo failed");
+        
+        // Undo records are kept for the last COINBASE_MATURITY blocks, deeper reorganizations read the blocks instead
+        const CBlockIndex* pindexOld = pindex;
+        for (int i = 0; pindexOld && i < COINBASE_MATURITY; ++i)
+            pindexOld = pindexOld->pprev;
+        if (pindexOld)
+            EraseBlockUndo(pindexOld->GetBlockHash());
+        
         // Update block index on disk without changing it in memory.
         // The memory index structure will be changed after the db commits.
         if (pindex->pprev) {
@@ -1144,7 +1297,14 @@ bool BlockChain::reorganize(const Block& block, CBlockIndex* pindexNew)
             Block block;
             if (!_blockFile.readFromDisk(block, pindex))
                 return error("Reorganize() : ReadFromDisk for disconnect failed");
-            if (!disconnectBlock(block, pindex))
+            
+            // Replay the undo record, or without one (too deep or connected by an earlier version) disconnect from the block itself
+            BlockUndo undo;
+            if (ReadBlockUndo(pindex->GetBlockHash(), undo)) {
+                if (!disconnectBlock(block, undo, pindex))
+                    return error("Reorganize() : DisconnectBlock failed");
+            }
+            else if (!disconnectBlock(block, pindex))
                 return error("Reorganize() : DisconnectBlock failed");
             
             // Queue memory transactions to resurrect
@@ -1162,7 +1322,7 @@ bool BlockChain::reorganize(const Block& block, CBlockIndex* pindexNew)
                 return error("Reorganize() : ReadFromDisk for connect failed");
             if (!connectBlock(block, pindex)) {
                 // Invalid block
-                TxnAbort();
+                _store->abort();
                 return error("Reorganize() : ConnectBlock failed");
             }
             
@@ -1185,7 +1345,7 @@ bool BlockChain::reorganize(const Block& block, CBlockIndex* pindexNew)
     }
     
     // Make sure it's successfully written to disk before changing memory structure
-    if (!TxnCommit())
+    if (!_store->commit())
         return error("Reorganize() : TxnCommit failed");
     
     // Disconnect shorter branch
@@ -1228,12 +1388,12 @@ bool BlockChain::setBestChain(const Block& block, CBlockIndex* pindexNew)
     uint256 hash = block.getHash();
     
     uint256 oldBestChain = _bestChain;
-    TxnBegin();
+    _store->begin();
     if (_genesisBlockIndex == NULL && hash == getGenesisHash()) {
         //        _bestChain = hash;
         WriteHashBestChain(hash);
         _bestChain = oldBestChain;
-        if (!TxnCommit())
+        if (!_store->commit())
             return error("SetBestChain() : TxnCommit failed");
         _genesisBlockIndex = pindexNew;
     }
@@ -1242,7 +1402,7 @@ bool BlockChain::setBestChain(const Block& block, CBlockIndex* pindexNew)
         //        _bestChain = hash;
         if (!connectBlock(block, pindexNew) || !WriteHashBestChain(hash)) {
             _bestChain = oldBestChain;
-            TxnAbort();
+            _store->abort();
             InvalidChainFound(pindexNew);
             return error("SetBestChain() : ConnectBlock failed");
         }
@@ -1251,7 +1411,7 @@ bool BlockChain::setBestChain(const Block& block, CBlockIndex* pindexNew)
         // Hence we lock the mutex.
         boost::unique_lock< boost::shared_mutex > lock(_chain_and_pool_access);
 
-        if (!TxnCommit()) {
+        if (!_store->commit()) {
             _bestChain = oldBestChain;
             return error("SetBestChain() : TxnCommit failed");
         }
@@ -1266,7 +1426,7 @@ bool BlockChain::setBestChain(const Block& block, CBlockIndex* pindexNew)
     else {
         // New best branch
         if (!reorganize(block, pindexNew)) {
-            TxnAbort();
+            _store->abort();
             InvalidChainFound(pindexNew);
             _bestChain = oldBestChain;
             return error("SetBestChain() : Reorganize failed");
@@ -1315,9 +1475,9 @@ bool BlockChain::addToBlockIndex(const Block& block, unsigned int nFile, unsigne
     }
     pindexNew->bnChainWork = (pindexNew->pprev ? pindexNew->pprev->bnChainWork : 0) + pindexNew->GetBlockWork();
     
-    TxnBegin();
+    _store->begin();
     WriteBlockIndex(CDiskBlockIndex(pindexNew));
-    if (!TxnCommit())
+    if (!_store->commit())
         return false;
     
     // --- END addBlock
@@ -1372,12 +1532,11 @@ bool BlockChain::acceptBlock(const Block& block)
     if(!_chain.checkPoints(height, hash))
         return error("AcceptBlock() : rejected by checkpoint lockin at %d", height);
 
-    // Write block to history file
-    if (!_blockFile.checkDiskSpace(::GetSerializeSize(block, SER_DISK)))
-        return error("AcceptBlock() : out of disk space");
+    // Write block to history file - disk space is checked when the block file is extended, and during
+    // the initial block download the block file is synced on group commits only
     unsigned int nFile = -1;
     unsigned int nBlockPos = 0;
-    bool commit = (!isInitialBlockDownload() || (getBestHeight()+1) % 500 == 0);
+    bool commit = !isInitialBlockDownload();
     if (!_blockFile.writeToDisk(_chain, block, nFile, nBlockPos, commit))
         return error("AcceptBlock() : WriteToDisk failed");
     if (!addToBlockIndex(block, nFile, nBlockPos))
@@ -1600,7 +1759,7 @@ bool BlockChain::isSpent(Coin coin) const {
 
     TxIndex index;
     if(ReadTxIndex(coin.hash, index))
-        return !index.getSpent(coin.index).isNull();
+        return index.isSpent(coin.index);
     else
         return false;
 }
@@ -1615,19 +1774,18 @@ int BlockChain::getNumSpent(uint256 hash) const {
         return 0;
 }
 
+#ifdef LIBCOIN_SPENT_INDEX
 uint256 BlockChain::spentIn(Coin coin) const {
     boost::shared_lock< boost::shared_mutex > lock(_chain_and_pool_access);
 
-    TxIndex index;
-    if(ReadTxIndex(coin.hash, index)) {
-        const DiskTxPos& diskpos = index.getSpent(coin.index);
-        Transaction tx;
-        _blockFile.readFromDisk(tx, diskpos);
-        return tx.getHash();
-    }
-    else
-        return 0;    
+    DiskTxPos diskpos;
+    if (!_store->Read(make_pair(string("spent"), coin), diskpos))
+        return 0;
+    Transaction tx;
+    _blockFile.readFromDisk(tx, diskpos);
+    return tx.getHash();
 }
+#endif
 
 int64 BlockChain::value(Coin coin) const {
     // get the transaction, then get the Output of the prevout, then get the value
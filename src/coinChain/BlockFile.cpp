@@ -21,43 +21,145 @@
 #include <coinChain/BlockChain.h>
 #include <coinChain/MessageHeader.h>
 
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 
 #ifdef _WIN32
 #include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 using namespace std;
 using namespace boost;
 
+// FAT32 filesize max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
+static const unsigned int MAX_BLOCKFILE_SIZE = 0x7F000000;
+
+/// Find the end of the blocks in a block file from pos. Each block is preceded by the message start and the block size,
+/// the walk stops at the first record that is not a block, e.g. the zeros of a preallocated tail.
+static unsigned int blocksEnd(FILE* file, const MessageStart& start, unsigned int pos, unsigned int size)
+{
+    loop {
+        if (pos + 8 > size || fseek(file, pos, SEEK_SET) != 0)
+            return pos;
+        unsigned char header[8];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header))
+            return pos;
+        if (memcmp(header, start.elems, sizeof(start.elems)) != 0)
+            return pos;
+        unsigned int blockSize;
+        memcpy(&blockSize, &header[4], sizeof(blockSize));
+        if (blockSize == 0 || blockSize > MAX_BLOCK_SIZE || blockSize > size - pos - 8)
+            return pos;
+        pos += 8 + blockSize;
+    }
+}
+
+BlockFile::BlockFile(const std::string dataDir) : _dataDir(dataDir), _blockFile(NULL), _currentBlockFile(1), _currentPos(0), _allocatedPos(0), _preallocatedFrom(0), _unsynced(0), _firstUnsynced(0), _syncBlocks(500), _syncMillis(30000), _stop(false), _syncThread(boost::bind(&BlockFile::syncer, this))
+{
+}
+
+BlockFile::~BlockFile()
+{
+    {
+        boost::mutex::scoped_lock lock(_access);
+        _stop = true;
+    }
+    _wake.notify_all();
+    _syncThread.join();
+    closeBlockFile();
+}
+
+void BlockFile::setGroupCommit(unsigned int blocks, unsigned int millis)
+{
+    boost::mutex::scoped_lock lock(_access);
+    _syncBlocks = blocks;
+    _syncMillis = millis;
+    _wake.notify_all();
+}
+
+void BlockFile::syncer()
+{
+    boost::mutex::scoped_lock lock(_access);
+    while (!_stop) {
+        if (_unsynced && _syncMillis) {
+            int64 wait = _firstUnsynced + _syncMillis - GetTimeMillis();
+            if (wait > 0)
+                _wake.timed_wait(lock, posix_time::milliseconds(wait));
+            else if (!syncFile())
+                _firstUnsynced = GetTimeMillis(); // retry on the next deadline
+        }
+        else
+            _wake.wait(lock);
+    }
+}
+
 bool BlockFile::writeToDisk(const Chain& chain, const Block& block, unsigned int& nFileRet, unsigned int& nBlockPosRet, bool commit)
 {
-    // Open history file to append
-    CAutoFile fileout = appendBlockFile(nFileRet);
+    // Serialize the index header and the block
+    unsigned int nSize = ::GetSerializeSize(block, SER_DISK);
+    CDataStream ss(SER_DISK);
+    ss.reserve(nSize + 8);
+    ss << FLATDATA(chain.messageStart().elems) << nSize << block;
+    
+    boost::mutex::scoped_lock lock(_access);
+    
+    // Get the file to append to and make room for the block
+    FILE* fileout = appendBlockFile(chain, nFileRet);
     if (!fileout)
         return error("Block::WriteToDisk() : AppendBlockFile failed");
+    if (_currentPos + ss.size() > _allocatedPos && !allocate(ss.size()))
+        return error("Block::WriteToDisk() : allocate failed");
     
-    // Write index header
-    unsigned int nSize = fileout.GetSerializeSize(block);
-    fileout << FLATDATA(chain.messageStart().elems) << nSize;
+    // Write index header and block
+    if (fseek(fileout, _currentPos, SEEK_SET) != 0)
+        return error("Block::WriteToDisk() : fseek failed");
+    if (fwrite(&ss[0], 1, ss.size(), fileout) != ss.size())
+        return error("Block::WriteToDisk() : fwrite failed");
+    nBlockPosRet = _currentPos + ss.size() - nSize;
+    _currentPos += ss.size();
     
-    // Write block
-    nBlockPosRet = ftell(fileout);
-    if (nBlockPosRet == -1)
-        return error("Block::WriteToDisk() : ftell failed");
-    fileout << block;
+    // Flush stdio buffers, so the block can be read back, and commit to disk if requested or on a group commit -
+    // the first unsynced block starts the commit deadline of the syncer
+    if (fflush(fileout) != 0)
+        return error("Block::WriteToDisk() : fflush failed");
+    if (_unsynced++ == 0) {
+        _firstUnsynced = GetTimeMillis();
+        _wake.notify_all();
+    }
+    if (commit || (_syncBlocks && _unsynced >= _syncBlocks))
+        return syncFile();
     
-    // Flush stdio buffers and commit to disk before returning
-    fflush(fileout);
-    if (commit) {
-#ifdef _WIN32
-        _commit(_fileno(fileout));
+    return true;
+}
+
+bool BlockFile::sync()
+{
+    boost::mutex::scoped_lock lock(_access);
+    return syncFile();
+}
+
+bool BlockFile::syncFile()
+{
+    if (!_blockFile)
+        return true;
+    if (fflush(_blockFile) != 0)
+        return error("BlockFile::sync() : fflush failed");
+#if defined(_WIN32)
+    if (_commit(_fileno(_blockFile)) != 0)
+        return error("BlockFile::sync() : _commit failed");
+#elif defined(__linux__)
+    // the file size only changes when a chunk is allocated, so syncing the data is enough
+    if (fdatasync(fileno(_blockFile)) != 0)
+        return error("BlockFile::sync() : fdatasync failed");
 #else
-        fsync(fileno(fileout));
+    if (fsync(fileno(_blockFile)) != 0)
+        return error("BlockFile::sync() : fsync failed");
 #endif
-    }
-    
+    _unsynced = 0;
     return true;
 }
 
@@ -82,6 +184,31 @@ bool BlockFile::readFromDisk(Block& block, unsigned int nFile, unsigned int nBlo
     return true;
 }
 
+bool BlockFile::readRawFromDisk(string& data, unsigned int nFile, unsigned int nBlockPos) const
+{
+    data.clear();
+    if (nBlockPos < sizeof(unsigned int))
+        return error("BlockFile::readRawFromDisk() : invalid block position");
+    
+    // The block is preceded by its size
+    CAutoFile filein = openBlockFile(nFile, nBlockPos - sizeof(unsigned int));
+    if (!filein)
+        return error("BlockFile::readRawFromDisk() : OpenBlockFile failed");
+    
+    unsigned int nSize = 0;
+    filein >> nSize;
+    if (nSize == 0 || nSize > MAX_BLOCK_SIZE)
+        return error("BlockFile::readRawFromDisk() : invalid block size");
+    
+    data.resize(nSize);
+    if (fread(&data[0], 1, nSize, filein) != nSize) {
+        data.clear();
+        return error("BlockFile::readRawFromDisk() : truncated block");
+    }
+    
+    return true;
+}
+
 bool BlockFile::readFromDisk(Block& block, const CBlockIndex* pindex, bool fReadTransactions) const
 {
     if (!fReadTransactions)
@@ -160,6 +287,50 @@ bool BlockFile::checkDiskSpace(uint64 nAdditionalBytes)
     return true;
 }
 
+bool BlockFile::allocate(unsigned int size)
+{
+    // Allocate whole chunks, staying under the max file size if possible
+    unsigned int end = ((_currentPos + size) / CHUNK_SIZE + 1) * CHUNK_SIZE;
+    if (end > MAX_BLOCKFILE_SIZE)
+        end = max(MAX_BLOCKFILE_SIZE, _currentPos + size);
+    if (end <= _allocatedPos)
+        return true;
+    
+    checkDiskSpace(end - _allocatedPos);
+    
+    // Mark the file as having a preallocated tail before there is one
+    if (_allocatedPos == _preallocatedFrom) {
+        FILE* marker = fopen(allocMarker(_currentBlockFile).c_str(), "w");
+        if (!marker)
+            return error("BlockFile::allocate() : can't write %s", allocMarker(_currentBlockFile).c_str());
+        fprintf(marker, "%u\n", _preallocatedFrom);
+        fflush(marker);
+#ifdef _WIN32
+        _commit(_fileno(marker));
+#else
+        fsync(fileno(marker));
+#endif
+        fclose(marker);
+    }
+    
+#if defined(_WIN32)
+    // no preallocation - the file grows as it is written
+#elif defined(__APPLE__)
+    fstore_t store = { F_ALLOCATECONTIG, F_PEOFPOSMODE, 0, end - _allocatedPos, 0 };
+    if (fcntl(fileno(_blockFile), F_PREALLOCATE, &store) == -1) {
+        store.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(_blockFile), F_PREALLOCATE, &store);
+    }
+    if (ftruncate(fileno(_blockFile), end) != 0)
+        return error("BlockFile::allocate() : ftruncate failed");
+#else
+    if (posix_fallocate(fileno(_blockFile), _allocatedPos, end - _allocatedPos) != 0)
+        return error("BlockFile::allocate() : posix_fallocate failed");
+#endif
+    _allocatedPos = end;
+    return true;
+}
+
 FILE* BlockFile::openBlockFile(unsigned int nFile, unsigned int nBlockPos) const {
     const char* pszMode = "rb";
     if (nFile == -1)
@@ -192,21 +363,70 @@ FILE* BlockFile::openBlockFile(unsigned int nFile, unsigned int nBlockPos, const
     return file;
 }
 
-FILE* BlockFile::appendBlockFile(unsigned int& nFileRet)
+string BlockFile::allocMarker(unsigned int nFile) const
+{
+    return strprintf("%s/blk%04d.alloc", _dataDir.c_str(), nFile);
+}
+
+FILE* BlockFile::appendBlockFile(const Chain& chain, unsigned int& nFileRet)
 {
     nFileRet = 0;
     loop {
-        FILE* file = openBlockFile(_currentBlockFile, 0, "ab");
-        if (!file)
-            return NULL;
-        if (fseek(file, 0, SEEK_END) != 0)
-            return NULL;
-        // FAT32 filesize max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
-        if (ftell(file) < 0x7F000000 - MAX_SIZE) {
+        if (!_blockFile) {
+            _blockFile = openBlockFile(_currentBlockFile, 0, "rb+");
+            if (!_blockFile)
+                _blockFile = openBlockFile(_currentBlockFile, 0, "wb+");
+            if (!_blockFile)
+                return NULL;
+            if (fseek(_blockFile, 0, SEEK_END) != 0) {
+                fclose(_blockFile);
+                _blockFile = NULL;
+                return NULL;
+            }
+            _allocatedPos = ftell(_blockFile);
+            _currentPos = _allocatedPos;
+            _preallocatedFrom = _allocatedPos;
+            // a marker is left if the file was not closed properly - only the blocks after it are walked to find the end
+            FILE* marker = fopen(allocMarker(_currentBlockFile).c_str(), "r");
+            if (marker) {
+                unsigned int from;
+                if (fscanf(marker, "%u", &from) == 1 && from <= _allocatedPos) {
+                    _preallocatedFrom = from;
+                    _currentPos = blocksEnd(_blockFile, chain.messageStart(), from, _allocatedPos);
+                }
+                fclose(marker);
+            }
+            _unsynced = 0;
+        }
+        if (_currentPos < MAX_BLOCKFILE_SIZE - MAX_SIZE) {
             nFileRet = _currentBlockFile;
-            return file;
+            return _blockFile;
         }
-        fclose(file);
+        closeBlockFile();
         _currentBlockFile++;
     }
 }
+
+void BlockFile::closeBlockFile()
+{
+    if (!_blockFile)
+        return;
+    
+    // Truncate the preallocated tail, if there is one - the blocks from before it are kept in any case
+    fflush(_blockFile);
+    if (_allocatedPos > _preallocatedFrom) {
+        unsigned int end = max(_currentPos, _preallocatedFrom);
+#ifdef _WIN32
+        bool truncated = (_chsize(_fileno(_blockFile), end) == 0);
+#else
+        bool truncated = (ftruncate(fileno(_blockFile), end) == 0);
+#endif
+        if (truncated && syncFile())
+            filesystem::remove(allocMarker(_currentBlockFile));
+        else
+            printf("BlockFile::closeBlockFile() : truncating the preallocated tail failed\n");
+    }
+    syncFile();
+    fclose(_blockFile);
+    _blockFile = NULL;
+}
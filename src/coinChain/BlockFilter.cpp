@@ -238,12 +238,12 @@ bool BlockFilter::process(const Block& block, Peers peers) {
             if (_blockChain.acceptBlock(*orphan)) {
                 // notify all listeners
                 for(Listeners::iterator listener = _listeners.begin(); listener != _listeners.end(); ++listener)
-                    (*listener->get())(block);
+                    (*listener->get())(*orphan);
 
                 workQueue.push_back(orphan->getHash());
                 // Relay inventory, but don't relay old inventory during initial block download
                 uint256 bestChain = _blockChain.getBestChain();
-                uint256 blockHash = block.getHash();
+                uint256 blockHash = orphan->getHash();
                 if (bestChain == blockHash) {
                     for(Peers::iterator peer = peers.begin(); peer != peers.end(); ++peer)
                         if (_blockChain.getBestHeight() > ((*peer)->getStartingHeight() != -1 ? (*peer)->getStartingHeight() - 2000 : _blockChain.getTotalBlocksEstimate()))
@@ -26,7 +26,7 @@ using namespace std;
 using namespace boost;
 
 EndpointPool::EndpointPool(short defaultPort, const std::string dataDir, const char* pszMode) :
-        Database(dataDir+"/endpoints.sqlite3") /*CDB(dataDir, "addr.dat", pszMode)*/ ,
+        Database(dataDir+"/endpoints.sqlite3", Pragmas::wal_normal()) /*CDB(dataDir, "addr.dat", pszMode)*/ ,
         _defaultPort(defaultPort),
         _localhost("0.0.0.0", defaultPort, false, NODE_NETWORK),
 _lastPurgeTime(0) {
@@ -174,36 +174,37 @@ void EndpointPool::setLastTry(const Endpoint& ep) {
     update_lasttry(now, (int64)ep.getIP(), ep.getPort());
 }
 
+/// Visitor picking the first usable endpoint not in not_in - stops the row iteration once found.
+class CandidateVisitor {
+public:
+    CandidateVisitor(const set<unsigned int>& not_in) : _not_in(not_in) {}
+    
+    bool operator()(const Endpoint& e) {
+        if (_not_in.count(e.getIP()))
+            return true;
+        if (!e.isIPv4() || !e.isValid())
+            return true;
+        candidate = e;
+        return false;
+    }
+    
+    Endpoint candidate;
+private:
+    const set<unsigned int>& _not_in;
+};
+
 Endpoint EndpointPool::getCandidate(const set<unsigned int>& not_in, int64 start_time)
 {
     //
     // Choose an address to connect to based on most recently seen
     //
-    Endpoint candidate;
-    int64 best = INT64_MIN;
-    
     int64 now = GetAdjustedTime();
-    vector<Endpoint> endpoints = candidates(now-60*60);
     
-    // iterate until we get an address not in not_in or in the same class-B network:
-    for (vector<Endpoint>::const_iterator e = endpoints.begin(); e != endpoints.end(); ++e) {
-        bool skip = false;
-        for (set<unsigned int>::const_iterator ep = not_in.begin(); ep != not_in.end(); ++ep) {
-            if (e->getIP() == (*ep)) {
-                skip = true;
-                break;
-            }
-        }
-        if (skip) continue;
-        
-        Endpoint candidate = *e;
-        if (!candidate.isIPv4() || !candidate.isValid())
-            continue;
-        
-        return candidate;
-    }
+    // iterate until we get an address not in not_in - rows are streamed, so only the rows up to the candidate are read
+    CandidateVisitor visitor(not_in);
+    candidates.each(visitor, now-60*60);
     
-    return Endpoint();
+    return visitor.candidate;
 /*
     BOOST_FOREACH(const PAIRTYPE(vector<unsigned char>, Endpoint)& item, _endpoints)
         {
@@ -0,0 +1,32 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/KeyValueStore.h>
+#include <coinChain/BerkeleyStore.h>
+#include <coinChain/LogStore.h>
+
+#include <stdexcept>
+
+using namespace std;
+
+KeyValueStore* KeyValueStore::create(const string& backend, const string& dataDir, const string& name, const char* pszMode) {
+    if (backend == "" || backend == "bdb")
+        return new BerkeleyStore(dataDir, name + ".dat", pszMode);
+    else if (backend == "log")
+        return new LogStore(dataDir + "/" + name + ".log", pszMode);
+    else
+        throw runtime_error("KeyValueStore::create() : unknown storage backend: " + backend);
+}
@@ -0,0 +1,492 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/LogStore.h>
+
+#include <coin/util.h>
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/functional/hash.hpp>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace boost;
+
+// file header: magic, version
+static const unsigned int FILE_MAGIC = 0x474f4c63; // "cLOG"
+static const unsigned int FILE_VERSION = 1;
+static const int64 FILE_HEADER_SIZE = 2*sizeof(unsigned int);
+
+// frame: header (payload size, record count), the records, trailer (checksum, commit marker)
+static const unsigned int COMMIT = 0x54494d43; // "CMIT"
+static const int64 FRAME_HEADER_SIZE = 2*sizeof(unsigned int);
+static const int64 FRAME_TRAILER_SIZE = 2*sizeof(unsigned int);
+
+// record header: key size, value size - a value size of ERASED marks an erase
+static const unsigned int ERASED = 0xffffffff;
+static const int64 HEADER_SIZE = 2*sizeof(unsigned int);
+
+// compaction writes the live records in frames of about this size
+static const size_t COMPACT_FRAME_SIZE = 1024*1024;
+
+static int seek(FILE* file, int64 offset) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, offset, SEEK_SET);
+#endif
+}
+
+static bool syncFile(FILE* file) {
+    if (fflush(file) != 0)
+        return false;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+/// Append a record to the payload of a frame, returns the offset of the value in the payload.
+static size_t record(KeyValueStore::Data& payload, const KeyValueStore::Data& key, const KeyValueStore::Data* value) {
+    unsigned int header[2];
+    header[0] = key.size();
+    header[1] = value ? value->size() : ERASED;
+    const unsigned char* h = (const unsigned char*)header;
+    payload.insert(payload.end(), h, h + HEADER_SIZE);
+    payload.insert(payload.end(), key.begin(), key.end());
+    size_t offset = payload.size();
+    if (value)
+        payload.insert(payload.end(), value->begin(), value->end());
+    return offset;
+}
+
+static unsigned int checksum(const unsigned int header[2], const KeyValueStore::Data& payload) {
+    crc_32_type crc;
+    crc.process_bytes(header, FRAME_HEADER_SIZE);
+    if (payload.size())
+        crc.process_bytes(&payload[0], payload.size());
+    return crc.checksum();
+}
+
+/// Write a frame of records - it is only replayed if all of it, including the commit marker, reached the disk.
+static bool writeFrame(FILE* file, const KeyValueStore::Data& payload, unsigned int records) {
+    unsigned int header[2];
+    header[0] = payload.size();
+    header[1] = records;
+    unsigned int trailer[2];
+    trailer[0] = checksum(header, payload);
+    trailer[1] = COMMIT;
+    if (fwrite(header, sizeof(unsigned int), 2, file) != 2)
+        return false;
+    if (payload.size() && fwrite(&payload[0], 1, payload.size(), file) != payload.size())
+        return false;
+    return fwrite(trailer, sizeof(unsigned int), 2, file) == 2;
+}
+
+size_t LogStore::KeyHash::operator()(const Data& key) const {
+    if (key.size() < sizeof(size_t))
+        return hash_range(key.begin(), key.end());
+    // keys are (type, hash) pairs - the tail of the key is a hash, and hence already uniformly distributed
+    size_t h;
+    memcpy(&h, &key[key.size() - sizeof(size_t)], sizeof(size_t));
+    return h;
+}
+
+LogStore::LogStore(const string& filename, const char* pszMode) : _filename(filename), _file(NULL), _end(0), _stale(0) {
+    _readOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
+    bool create = strchr(pszMode, 'c');
+    
+    if (!filesystem::exists(_filename)) {
+        if (!create || _readOnly)
+            throw runtime_error("LogStore() : can't open " + _filename);
+        _file = fopen(_filename.c_str(), "w+b");
+    }
+    else
+        _file = fopen(_filename.c_str(), _readOnly ? "rb" : "r+b");
+    if (!_file)
+        throw runtime_error("LogStore() : can't open " + _filename);
+    
+    if (!replay())
+        throw runtime_error("LogStore() : error reading " + _filename);
+    
+    printf("LogStore(): loaded %d records from %s, %" PRI64d " stale bytes\n", (int)_index.size(), _filename.c_str(), _stale);
+    
+    if (!_readOnly && _stale > 0 && _stale > _end - _stale)
+        compact();
+}
+
+LogStore::~LogStore() {
+    if (_file) {
+        flushFile(true);
+        fclose(_file);
+    }
+}
+
+void LogStore::update(const Data& key, const Location* loc) {
+    Index::iterator i = _index.find(key);
+    if (i != _index.end())
+        _stale += HEADER_SIZE + key.size() + i->second.size;
+    if (loc)
+        _index[key] = *loc;
+    else {
+        _stale += HEADER_SIZE + key.size();
+        if (i != _index.end())
+            _index.erase(i);
+    }
+}
+
+bool LogStore::replay() {
+#ifdef _WIN32
+    if (_fseeki64(_file, 0, SEEK_END) != 0)
+        return false;
+    int64 size = _ftelli64(_file);
+#else
+    if (fseeko(_file, 0, SEEK_END) != 0)
+        return false;
+    int64 size = ftello(_file);
+#endif
+    if (size == 0) {
+        if (_readOnly)
+            return true;
+        unsigned int header[2];
+        header[0] = FILE_MAGIC;
+        header[1] = FILE_VERSION;
+        if (seek(_file, 0) != 0 || fwrite(header, sizeof(unsigned int), 2, _file) != 2 || !syncFile(_file))
+            return false;
+        _end = FILE_HEADER_SIZE;
+        return true;
+    }
+    
+    unsigned int header[2];
+    if (seek(_file, 0) != 0 || fread(header, sizeof(unsigned int), 2, _file) != 2 || header[0] != FILE_MAGIC)
+        return error("LogStore::replay() : %s is not a log store", _filename.c_str());
+    if (header[1] != FILE_VERSION)
+        return error("LogStore::replay() : %s has unsupported version %d", _filename.c_str(), header[1]);
+    
+    int64 pos = FILE_HEADER_SIZE;
+    Data payload;
+    Data key;
+    loop {
+        unsigned int frame[2];
+        if (seek(_file, pos) != 0 || fread(frame, sizeof(unsigned int), 2, _file) != 2)
+            break;
+        int64 next = pos + FRAME_HEADER_SIZE + frame[0] + FRAME_TRAILER_SIZE;
+        if (next > size)
+            break;
+        payload.resize(frame[0]);
+        if (frame[0] && fread(&payload[0], 1, frame[0], _file) != frame[0])
+            break;
+        unsigned int trailer[2];
+        if (fread(trailer, sizeof(unsigned int), 2, _file) != 2)
+            break;
+        if (trailer[1] != COMMIT || trailer[0] != checksum(frame, payload))
+            break;
+        
+        // check that the records fill the frame before applying any of them
+        size_t offset = 0;
+        unsigned int records = 0;
+        while (records < frame[1] && offset + HEADER_SIZE <= payload.size()) {
+            unsigned int rec[2];
+            memcpy(rec, &payload[offset], HEADER_SIZE);
+            size_t end = offset + HEADER_SIZE + rec[0] + (rec[1] == ERASED ? 0 : rec[1]);
+            if (end > payload.size())
+                break;
+            offset = end;
+            ++records;
+        }
+        if (records != frame[1] || offset != payload.size())
+            break;
+        
+        offset = 0;
+        for (unsigned int r = 0; r < records; ++r) {
+            unsigned int rec[2];
+            memcpy(rec, &payload[offset], HEADER_SIZE);
+            offset += HEADER_SIZE;
+            key.assign(payload.begin() + offset, payload.begin() + offset + rec[0]);
+            offset += rec[0];
+            if (rec[1] == ERASED)
+                update(key, NULL);
+            else {
+                Location loc(pos + FRAME_HEADER_SIZE + offset, rec[1]);
+                update(key, &loc);
+                offset += rec[1];
+            }
+        }
+        
+        pos = next;
+    }
+    _end = pos;
+    
+    // an incomplete commit at the end of the log is cut off, so the next frame is not appended behind it
+    if (_end < size && !_readOnly) {
+        printf("LogStore::replay() : discarding %" PRI64d " bytes of an incomplete commit from %s\n", size - _end, _filename.c_str());
+        fflush(_file);
+#ifdef _WIN32
+        if (_chsize_s(_fileno(_file), _end) != 0)
+#else
+        if (ftruncate(fileno(_file), _end) != 0)
+#endif
+            return error("LogStore::replay() : can't truncate %s", _filename.c_str());
+        if (!syncFile(_file))
+            return false;
+    }
+    return true;
+}
+
+bool LogStore::readAt(const Location& loc, Data& value) const {
+    value.resize(loc.size);
+    if (loc.size == 0)
+        return true;
+    if (seek(_file, loc.offset) != 0)
+        return false;
+    return fread(&value[0], 1, loc.size, _file) == loc.size;
+}
+
+bool LogStore::pending(const Data& key, const Change*& change) const {
+    for (Batches::const_reverse_iterator b = _batches.rbegin(); b != _batches.rend(); ++b) {
+        Batch::const_iterator c = b->find(key);
+        if (c != b->end()) {
+            change = &c->second;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t LogStore::size() const {
+    boost::mutex::scoped_lock lock(_access);
+    return _index.size();
+}
+
+bool LogStore::read(const Data& key, Data& value) const {
+    boost::mutex::scoped_lock lock(_access);
+    const Change* change;
+    if (pending(key, change)) {
+        if (change->first)
+            return false;
+        value = change->second;
+        return true;
+    }
+    Index::const_iterator i = _index.find(key);
+    if (i == _index.end())
+        return false;
+    return readAt(i->second, value);
+}
+
+bool LogStore::exists(const Data& key) const {
+    boost::mutex::scoped_lock lock(_access);
+    const Change* change;
+    if (pending(key, change))
+        return !change->first;
+    return _index.count(key);
+}
+
+bool LogStore::write(const Data& key, const Data& value) {
+    boost::mutex::scoped_lock lock(_access);
+    if (_batches.size()) {
+        _batches.back()[key] = Change(false, value);
+        return true;
+    }
+    Batch batch;
+    batch[key] = Change(false, value);
+    return apply(batch);
+}
+
+bool LogStore::erase(const Data& key) {
+    boost::mutex::scoped_lock lock(_access);
+    if (_batches.size()) {
+        _batches.back()[key] = Change(true, Data());
+        return true;
+    }
+    Batch batch;
+    batch[key] = Change(true, Data());
+    return apply(batch);
+}
+
+static bool has_prefix(const KeyValueStore::Data& key, const KeyValueStore::Data& prefix) {
+    return key.size() >= prefix.size() && equal(prefix.begin(), prefix.end(), key.begin());
+}
+
+bool LogStore::scan(const Data& prefix, Visitor& visitor) const {
+    boost::mutex::scoped_lock lock(_access);
+    Data value;
+    // the hash index has no order, so this is a full scan of the keys - it is meant for loading, not querying
+    for (Index::const_iterator i = _index.begin(); i != _index.end(); ++i) {
+        if (!has_prefix(i->first, prefix))
+            continue;
+        const Change* change;
+        if (pending(i->first, change))
+            continue; // visited below
+        if (!readAt(i->second, value))
+            return false;
+        if (!visitor(i->first, value))
+            return true;
+    }
+    // then the pending changes, newest first
+    set<Data> visited;
+    for (Batches::const_reverse_iterator b = _batches.rbegin(); b != _batches.rend(); ++b) {
+        for (Batch::const_iterator c = b->begin(); c != b->end(); ++c) {
+            if (!has_prefix(c->first, prefix) || !visited.insert(c->first).second)
+                continue;
+            if (c->second.first)
+                continue;
+            if (!visitor(c->first, c->second.second))
+                return true;
+        }
+    }
+    return true;
+}
+
+bool LogStore::begin() {
+    boost::mutex::scoped_lock lock(_access);
+    _batches.push_back(Batch());
+    return true;
+}
+
+bool LogStore::commit() {
+    boost::mutex::scoped_lock lock(_access);
+    if (_batches.empty())
+        return false;
+    if (_batches.size() > 1) {
+        // merge into the enclosing transaction
+        Batch& batch = _batches.back();
+        Batch& parent = _batches[_batches.size() - 2];
+        for (Batch::iterator c = batch.begin(); c != batch.end(); ++c)
+            parent[c->first] = c->second;
+        _batches.pop_back();
+        return true;
+    }
+    Batch batch;
+    batch.swap(_batches.back());
+    _batches.pop_back();
+    return apply(batch);
+}
+
+bool LogStore::abort() {
+    boost::mutex::scoped_lock lock(_access);
+    if (_batches.empty())
+        return false;
+    _batches.pop_back();
+    return true;
+}
+
+bool LogStore::apply(const Batch& batch) {
+    if (_readOnly)
+        assert(!"Write called on LogStore in read-only mode");
+    
+    Data payload;
+    typedef vector<pair<Batch::const_iterator, size_t> > Offsets;
+    Offsets offsets;
+    for (Batch::const_iterator c = batch.begin(); c != batch.end(); ++c) {
+        if (c->second.first && !_index.count(c->first))
+            continue;
+        offsets.push_back(make_pair(c, record(payload, c->first, c->second.first ? NULL : &c->second.second)));
+    }
+    if (offsets.empty())
+        return true;
+    
+    if (seek(_file, _end) != 0 || !writeFrame(_file, payload, offsets.size()) || !flushFile(true))
+        return error("LogStore::apply() : write to %s failed", _filename.c_str());
+    
+    int64 payload_offset = _end + FRAME_HEADER_SIZE;
+    for (Offsets::const_iterator o = offsets.begin(); o != offsets.end(); ++o) {
+        const Change& change = o->first->second;
+        if (change.first)
+            update(o->first->first, NULL);
+        else {
+            Location loc(payload_offset + o->second, change.second.size());
+            update(o->first->first, &loc);
+        }
+    }
+    _end = payload_offset + payload.size() + FRAME_TRAILER_SIZE;
+    return true;
+}
+
+bool LogStore::flushFile(bool sync) {
+    if (sync)
+        return syncFile(_file);
+    return fflush(_file) == 0;
+}
+
+bool LogStore::flush(bool sync) {
+    boost::mutex::scoped_lock lock(_access);
+    return flushFile(sync);
+}
+
+bool LogStore::compact() {
+    boost::mutex::scoped_lock lock(_access);
+    if (_readOnly || _batches.size())
+        return false;
+    
+    string tmpname = _filename + ".compact";
+    FILE* out = fopen(tmpname.c_str(), "wb");
+    if (!out)
+        return error("LogStore::compact() : can't open %s", tmpname.c_str());
+    
+    unsigned int header[2];
+    header[0] = FILE_MAGIC;
+    header[1] = FILE_VERSION;
+    bool ok = (fwrite(header, sizeof(unsigned int), 2, out) == 2);
+    
+    Index index;
+    int64 pos = FILE_HEADER_SIZE;
+    Data payload;
+    Data value;
+    typedef vector<pair<Index::const_iterator, size_t> > Offsets;
+    Offsets offsets;
+    for (Index::const_iterator i = _index.begin(); ok && i != _index.end(); ++i) {
+        if (!readAt(i->second, value)) {
+            fclose(out);
+            return error("LogStore::compact() : read failed");
+        }
+        offsets.push_back(make_pair(i, record(payload, i->first, &value)));
+        Index::const_iterator next = i;
+        if (payload.size() < COMPACT_FRAME_SIZE && ++next != _index.end())
+            continue;
+        ok = writeFrame(out, payload, offsets.size());
+        for (Offsets::const_iterator o = offsets.begin(); o != offsets.end(); ++o)
+            index[o->first->first] = Location(pos + FRAME_HEADER_SIZE + o->second, o->first->second.size);
+        pos += FRAME_HEADER_SIZE + payload.size() + FRAME_TRAILER_SIZE;
+        payload.clear();
+        offsets.clear();
+    }
+    ok = ok && syncFile(out);
+    fclose(out);
+    if (!ok) {
+        filesystem::remove(tmpname);
+        return error("LogStore::compact() : write failed");
+    }
+    
+    fclose(_file);
+    _file = NULL;
+    filesystem::rename(tmpname, _filename);
+    _file = fopen(_filename.c_str(), "r+b");
+    if (!_file)
+        throw runtime_error("LogStore::compact() : can't reopen " + _filename);
+    
+    printf("LogStore::compact(): %s compacted from %" PRI64d " to %" PRI64d " bytes\n", _filename.c_str(), _end, pos);
+    _index.swap(index);
+    _end = pos;
+    _stale = 0;
+    return true;
+}
@@ -30,7 +30,7 @@ using namespace std;
 using namespace boost;
 using namespace asio;
  
-Node::Node(const Chain& chain, std::string dataDir, const string& address, const string& port, ip::tcp::endpoint proxy, unsigned int timeout, const string& irc) : 
+Node::Node(const Chain& chain, std::string dataDir, const string& address, const string& port, ip::tcp::endpoint proxy, unsigned int timeout, const string& irc, const string& storage) : 
     _dataDir(dataDir == "" ? CDB::dataDir(chain.dataDirSuffix()) : dataDir),
     _fileLock(_dataDir + "/.lock"),
     _io_service(),
@@ -39,7 +39,7 @@ Node::Node(const Chain& chain, std::string dataDir, const string& address, const
     _connection_deadline(_io_service),
     _messageHandler(),
     _endpointPool(chain.defaultPort(), _dataDir),
-    _blockChain(chain, _dataDir),
+    _blockChain(chain, _dataDir, "cr+", storage),
     _chatClient(_io_service, bind(&Node::post_accept_or_connect, this), irc, _endpointPool, chain.ircChannel(), chain.ircChannels(), proxy),
     _proxy(proxy),
     _connection_timeout(timeout),
@@ -0,0 +1,159 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinChain/NodeREST.h>
+
+#include <coinHTTP/Client.h>
+#include <coinHTTP/Reply.h>
+#include <coinHTTP/Request.h>
+
+#include <boost/lexical_cast.hpp>
+
+using namespace std;
+using namespace boost;
+
+/// Parse a block or transaction hash - 64 hex digits.
+static bool parseHash(const string& hex, uint256& hash) {
+    if (hex.size() != 64)
+        return false;
+    for (string::const_iterator c = hex.begin(); c != hex.end(); ++c)
+        if (!isxdigit(*c))
+            return false;
+    hash.SetHex(hex);
+    return true;
+}
+
+static void binaryReply(Reply& reply) {
+    reply.status = Reply::ok;
+    reply.headers["Content-Length"] = lexical_cast<string>(reply.content.size());
+    reply.headers["Content-Type"] = "application/octet-stream";
+}
+
+void NodeREST::operator()(const Request& request, const string& path, Reply& reply) {
+    const string suffix = ".bin";
+    if (path.size() <= suffix.size() || path.compare(path.size() - suffix.size(), suffix.size(), suffix) != 0)
+        throw Reply::stock_reply(Reply::not_found);
+    
+    // split in the kind of object, the optional count and the hash
+    size_t slash = path.find('/');
+    size_t last_slash = path.rfind('/');
+    if (slash == string::npos)
+        throw Reply::stock_reply(Reply::not_found);
+    string kind = path.substr(0, slash);
+    uint256 hash;
+    if (!parseHash(path.substr(last_slash + 1, path.size() - suffix.size() - last_slash - 1), hash))
+        throw Reply::stock_reply(Reply::bad_request);
+    
+    const BlockChain& blockChain = _node.blockChain();
+    if (kind == "block" && slash == last_slash) {
+        if (!blockChain.getRawBlock(hash, reply.content))
+            throw Reply::stock_reply(Reply::not_found);
+    }
+    else if (kind == "tx" && slash == last_slash) {
+        Transaction tx;
+        blockChain.getTransaction(hash, tx);
+        if (tx.isNull())
+            throw Reply::stock_reply(Reply::not_found);
+        CDataStream ss(SER_NETWORK);
+        ss << tx;
+        reply.content = ss.str();
+    }
+    else if (kind == "headers" && path.find('/', slash + 1) == last_slash) {
+        unsigned int count = 0;
+        try {
+            count = lexical_cast<unsigned int>(path.substr(slash + 1, last_slash - slash - 1));
+        }
+        catch (bad_lexical_cast&) {
+            throw Reply::stock_reply(Reply::bad_request);
+        }
+        if (count == 0 || count > max_headers)
+            throw Reply::stock_reply(Reply::bad_request);
+        
+        Blocks headers;
+        if (!blockChain.getBlockHeaders(hash, count, headers))
+            throw Reply::stock_reply(Reply::not_found);
+        
+        CDataStream ss(SER_NETWORK|SER_BLOCKHEADERONLY);
+        for (Blocks::const_iterator header = headers.begin(); header != headers.end(); ++header)
+            ss << *header;
+        reply.content = ss.str();
+    }
+    else
+        throw Reply::stock_reply(Reply::not_found);
+    
+    binaryReply(reply);
+}
+
+bool NodeRESTClient::get(const string& path, string& data) {
+    // the Client is single use - it closes the connection after the reply
+    Client client;
+    Reply reply = client.get(_url + "/" + path, _headers);
+    if (reply.status != Reply::ok)
+        return false;
+    data.swap(reply.content);
+    return true;
+}
+
+bool NodeRESTClient::getRawBlock(const uint256& hash, string& data) {
+    return get("block/" + hash.GetHex() + ".bin", data);
+}
+
+bool NodeRESTClient::getBlock(const uint256& hash, Block& block) {
+    string data;
+    if (!getRawBlock(hash, data))
+        return false;
+    try {
+        CDataStream ss(data.data(), data.data() + data.size(), SER_NETWORK);
+        ss >> block;
+    }
+    catch (std::exception&) {
+        return false;
+    }
+    return block.getHash() == hash;
+}
+
+bool NodeRESTClient::getTransaction(const uint256& hash, Transaction& tx) {
+    string data;
+    if (!get("tx/" + hash.GetHex() + ".bin", data))
+        return false;
+    try {
+        CDataStream ss(data.data(), data.data() + data.size(), SER_NETWORK);
+        ss >> tx;
+    }
+    catch (std::exception&) {
+        return false;
+    }
+    return tx.getHash() == hash;
+}
+
+bool NodeRESTClient::getHeaders(const uint256& hash, unsigned int count, vector<Block>& headers) {
+    headers.clear();
+    string data;
+    if (!get("headers/" + lexical_cast<string>(count) + "/" + hash.GetHex() + ".bin", data))
+        return false;
+    try {
+        CDataStream ss(data.data(), data.data() + data.size(), SER_NETWORK|SER_BLOCKHEADERONLY);
+        while (!ss.empty()) {
+            headers.push_back(Block());
+            ss >> headers.back();
+        }
+    }
+    catch (std::exception&) {
+        headers.clear();
+        return false;
+    }
+    return !headers.empty() && headers.front().getHash() == hash;
+}
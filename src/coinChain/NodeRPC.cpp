@@ -38,22 +38,31 @@ Value GetBlockHash::operator()(const Array& params, bool fHelp) {
     return pblockindex->phashBlock->GetHex();
 }        
 
-Value GetBlock::operator()(const Array& params, bool fHelp) {
-    if (fHelp || params.size() != 1)
-        throw RPC::error(RPC::invalid_params, "getblock <hash>\n"
-                            "Returns details of a block with given block-hash.");
+bool GetBlockHash::isImmutable(const Array& params, const Value& result) const {
+    // the block could have been disconnected since it was looked up
+    const BlockChain& blockChain = _node.blockChain();
+    return blockChain.isInMainChain(uint256(result.get_str())) && blockChain.getBestHeight() - params[0].get_int() + 1 >= immutable_depth;
+}
+
+bool GetBlock::lookup(const Array& params, bool fHelp, Block& block, const CBlockIndex*& blockindex) {
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw RPC::error(RPC::invalid_params, "getblock <hash> [verbose=false]\n"
+                            "Returns details of a block with given block-hash. If verbose the transaction details are included, not only their hashes.");
     
     std::string strHash = params[0].get_str();
     uint256 hash(strHash);
     
-    Block block;
     _node.blockChain().getBlock(hash, block);
     
     if (block.isNull())
         throw RPC::error(RPC::invalid_request,  "Block not found");
         
-    const CBlockIndex* blockindex = _node.blockChain().getBlockIndex(hash);
+    blockindex = _node.blockChain().getBlockIndex(hash);
+
+    return params.size() > 1 && params[1].get_bool();
+}
 
+Object GetBlock::summary(const Block& block, const CBlockIndex* blockindex) {
     Object result;
     result.push_back(Pair("hash", block.getHash().GetHex()));
     result.push_back(Pair("blockcount", blockindex->nHeight));
@@ -62,20 +71,68 @@ Value GetBlock::operator()(const Array& params, bool fHelp) {
     result.push_back(Pair("time", (boost::int64_t)block.getBlockTime()));
     result.push_back(Pair("nonce", (boost::uint64_t)block.getNonce()));
     result.push_back(Pair("difficulty", _node.blockChain().getDifficulty(blockindex)));
-    Array txhashes;
-    BOOST_FOREACH (const Transaction&tx, block.getTransactions())
-    txhashes.push_back(tx.getHash().GetHex());
-    
-    result.push_back(Pair("tx", txhashes));
-    
+    return result;
+}
+
+Value GetBlock::tx(const Transaction& tx, const Block& block, const CBlockIndex* blockindex, bool verbose) {
+    if (!verbose)
+        return tx.getHash().GetHex();
+    Transaction txcopy(tx);
+    return tx2json(txcopy, block.getBlockTime(), blockindex->nHeight);
+}
+
+Object GetBlock::links(const CBlockIndex* blockindex) {
+    Object result;
     if (blockindex->pprev)
         result.push_back(Pair("hashprevious", blockindex->pprev->GetBlockHash().GetHex()));
     if (blockindex->pnext)
         result.push_back(Pair("hashnext", blockindex->pnext->GetBlockHash().GetHex()));
+    return result;
+}
+
+Value GetBlock::operator()(const Array& params, bool fHelp) {
+    Block block;
+    const CBlockIndex* blockindex;
+    bool verbose = lookup(params, fHelp, block, blockindex);
+    
+    Object result = summary(block, blockindex);
+    Array txes;
+    BOOST_FOREACH (const Transaction& t, block.getTransactions())
+        txes.push_back(tx(t, block, blockindex, verbose));
+    result.push_back(Pair("tx", txes));
+    
+    Object next = links(blockindex);
+    result.insert(result.end(), next.begin(), next.end());
     
     return result;
 }        
 
+bool GetBlock::isImmutable(const Array& params, const Value& result) const {
+    // the link to the next block is set once the block is this deep - the depth of a block counts side chain blocks
+    // too, so it must be in the main chain
+    const BlockChain& blockChain = _node.blockChain();
+    uint256 hash(find_value(result.get_obj(), "hash").get_str());
+    return blockChain.isInMainChain(hash) && blockChain.getDepthInMainChain(hash) >= immutable_depth;
+}
+
+void GetBlock::operator()(const Array& params, bool fHelp, const Request& request, JSONWriter& writer) {
+    Block block;
+    const CBlockIndex* blockindex;
+    bool verbose = lookup(params, fHelp, block, blockindex);
+    
+    writer.beginObject();
+    BOOST_FOREACH(const Pair& member, summary(block, blockindex))
+        writer.write(member.name_, member.value_);
+    writer.key("tx");
+    writer.beginArray();
+    BOOST_FOREACH (const Transaction& t, block.getTransactions())
+        writer.write(tx(t, block, blockindex, verbose));
+    writer.endArray();
+    BOOST_FOREACH(const Pair& member, links(blockindex))
+        writer.write(member.name_, member.value_);
+    writer.endObject();
+}
+
 Object tx2json(Transaction &tx, int64 timestamp, int64 blockheight)
 {
     Object entry;
@@ -147,6 +204,11 @@ Value GetTransaction::operator()(const Array& params, bool fHelp) {
     return entry;    
 }        
 
+bool GetTransaction::isImmutable(const Array& params, const Value& result) const {
+    // the height of a transaction is only found for transactions in the main chain
+    return _node.blockChain().getDepthInMainChain(uint256(find_value(result.get_obj(), "hash").get_str())) >= immutable_depth;
+}
+
 Value GetPenetration::operator()(const Array& params, bool fHelp) {
     if (fHelp || params.size() < 1)
         throw RPC::error(RPC::invalid_params, "getpenetration <txhash> <penetration fraction> \n"
@@ -233,3 +295,99 @@ Value GetInfo::operator()(const Array& params, bool fHelp) {
     return obj;
 }
 
+
+Object BlockNotifier::event(Node& node, const Block& block) {
+    uint256 hash = block.getHash();
+    const CBlockIndex* blockindex = node.blockChain().getBlockIndex(hash);
+    Object event;
+    event.push_back(Pair("hash", hash.GetHex()));
+    event.push_back(Pair("blockcount", blockindex ? blockindex->nHeight : -1));
+    event.push_back(Pair("time", (boost::int64_t)block.getBlockTime()));
+    event.push_back(Pair("tx", (int)block.getTransactions().size()));
+    event.push_back(Pair("best", node.blockChain().getBestChain() == hash));
+    return event;
+}
+
+void BlockNotifier::operator()(const Block& block) {
+    _notifier.notify(event(_node, block));
+}
+
+void TransactionNotifier::operator()(const Transaction& tx) {
+    Array addresses;
+    for (unsigned int n = 0; n < tx.getNumOutputs(); n++) {
+        PubKeyHash address = tx.getOutput(n).getAddress();
+        if (address != 0)
+            addresses.push_back(_node.blockChain().chain().getAddress(address).toString());
+    }
+    Object event;
+    event.push_back(Pair("hash", tx.getHash().GetHex()));
+    event.push_back(Pair("addresses", addresses));
+    _notifier.notify(event);
+}
+
+void ResponseCacheInvalidator::operator()(const Block& block) {
+    const CBlockIndex* best = _node.blockChain().getBestIndex();
+    if (best == _best)
+        return;
+    // find the fork of the old best chain - the blocks above it are disconnected, and the block at it gets a new next
+    const CBlockIndex* fork = _best;
+    while (fork && !_node.blockChain().isInMainChain(fork->GetBlockHash()))
+        fork = fork->pprev;
+    if (!fork || _best->nHeight - fork->nHeight + 1 >= immutable_depth)
+        _server.clearResponseCache();
+    _best = best;
+}
+
+/// The timeout parameter of the long-poll methods in seconds.
+static posix_time::time_duration timeout(const Array& params, size_t index) {
+    int seconds = params.size() > index ? params[index].get_int() : 60;
+    if (seconds < 0 || seconds > 3600)
+        throw RPC::error(RPC::invalid_params, "timeout must be between 0 and 3600 seconds");
+    return posix_time::seconds(seconds);
+}
+
+static bool bestBlock(const Value& event) {
+    return find_value(event.get_obj(), "best") == Value(true);
+}
+
+void WaitForBlock::operator()(const Array& params, bool fHelp, MethodDone onDone) {
+    if (fHelp || params.size() > 2)
+        throw RPC::error(RPC::invalid_params, "waitforblock [timeout=60] [hash]\n"
+                         "Waits for the next block of the best chain and returns it as {hash, blockcount, time, tx, best}, or null on timeout.\n"
+                         "If hash is given, and is not the best block, the best block is returned at once.");
+    
+    posix_time::time_duration duration = timeout(params, 0);
+    uint256 known = params.size() > 1 ? uint256(params[1].get_str()) : uint256(0);
+    
+    // Wait before looking at the best block - a block accepted in between is then not missed
+    Notifier::wait_ptr wait = _blocks.wait(onDone, &bestBlock, duration);
+    uint256 best = _node.blockChain().getBestChain();
+    if (params.size() > 1 && known != best) {
+        Block block;
+        _node.blockChain().getBlock(best, block);
+        _blocks.complete(wait, BlockNotifier::event(_node, block));
+    }
+}
+
+static bool paysAddress(const set<string>& addresses, const Value& event) {
+    BOOST_FOREACH(const Value& address, find_value(event.get_obj(), "addresses").get_array())
+        if (addresses.count(address.get_str()))
+            return true;
+    return false;
+}
+
+void WaitForTx::operator()(const Array& params, bool fHelp, MethodDone onDone) {
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw RPC::error(RPC::invalid_params, "waitfortx <addresses> [timeout=60]\n"
+                         "Waits for the next transaction paying one of the addresses (an array) and returns it as {hash, addresses}, or null on timeout.");
+    
+    set<string> addresses;
+    BOOST_FOREACH(const Value& param, params[0].get_array()) {
+        ChainAddress address = _node.blockChain().chain().getAddress(param.get_str());
+        if (!address.isValid())
+            throw RPC::error(RPC::invalid_params, "Invalid address: " + param.get_str());
+        addresses.insert(address.toString());
+    }
+    
+    _txs.wait(onDone, bind(&paysAddress, addresses, _1), timeout(params, 1));
+}
@@ -64,31 +64,80 @@ void StatementBase::get(blob& arg, int col) {
 }
 
 
-Database::Database(const string filename) {
+void StatementBase::check(int ret) {
+    if (ret != SQLITE_DONE)
+        throw runtime_error("StatementBase::check() : error " + lexical_cast<string>(ret) + " executing statement: " + sqlite3_errmsg(sqlite3_db_handle(_stmt)));
+}
+
+
+Database::Database(const string filename, const Pragmas& pragmas) : _savepoints(0) {
     _db = NULL;
     
     int ret = sqlite3_open(filename.c_str(), &_db);
     if (ret != SQLITE_OK)
         throw runtime_error("Database() : error " + lexical_cast<string>(ret) + " opening database environment");
+    
+    pragma(pragmas);
 }
 
 Database::~Database() {
-    for (Statements::iterator s = _statements.begin(); s != _statements.end(); ++s) sqlite3_finalize(s->_stmt);
-    if (_db) sqlite3_close(_db);
+    // statements still held elsewhere are finalized with their last copy, and keep the connection open until then
+    _statements.clear();
+    if (_db) sqlite3_close_v2(_db);
     _db = NULL;
 }
 
-StatementBase Database::prepare(string stmt) {
+StatementBase Database::compile(const string& stmt) {
     StatementBase s;
     int ret = sqlite3_prepare_v2(_db, stmt.c_str(), -1, &s._stmt, NULL) ;
     if (ret != SQLITE_OK)
         throw runtime_error("Database::prepare() : error " + lexical_cast<string>(ret) + " preparing statement: " + stmt);
-    _statements.push_back(s);
+    s._handle = boost::shared_ptr<sqlite3_stmt>(s._stmt, sqlite3_finalize);
+    return s;
+}
+
+StatementBase Database::prepare(string stmt) {
+    Statements::iterator cached = _statements.find(stmt);
+    if (cached != _statements.end()) {
+        // a statement held by someone else could be stepped by both - hand out a private one instead
+        if (!cached->second._handle.unique())
+            return compile(stmt);
+        // hand out the statement in a clean state
+        sqlite3_reset(cached->second._stmt);
+        sqlite3_clear_bindings(cached->second._stmt);
+        return cached->second;
+    }
+    StatementBase s = compile(stmt);
+    _statements[stmt] = s;
     return s;
 }
 
 void Database::execute(string stmt) {
-    StatementVoid s = prepare(stmt);
+    StatementVoid s = compile(stmt);
+    s();
+}
+
+void Database::pragma(const Pragmas& pragmas) {
+    // journal_mode returns a row, so it is run as a statement and not through sqlite3_exec
+    execute(string("PRAGMA journal_mode = ") + (pragmas.wal ? "WAL" : "DELETE"));
+    execute("PRAGMA synchronous = " + lexical_cast<string>((int)pragmas.synchronous));
+    execute("PRAGMA mmap_size = " + lexical_cast<string>(pragmas.mmap_size));
+    if (pragmas.cache_size)
+        execute("PRAGMA cache_size = " + lexical_cast<string>(pragmas.cache_size));
+}
+
+void Database::begin() {
+    StatementVoid s = prepare("BEGIN");
+    s();
+}
+
+void Database::commit() {
+    StatementVoid s = prepare("COMMIT");
+    s();
+}
+
+void Database::rollback() {
+    StatementVoid s = prepare("ROLLBACK");
     s();
 }
 
@@ -96,6 +145,35 @@ const int64 Database::last_id() const {
     return sqlite3_last_insert_rowid(_db);
 }
 
+Database::Savepoint::Savepoint(Database& db) : _db(db), _name("sp" + lexical_cast<string>(db._savepoints)), _active(true) {
+    _db.execute("SAVEPOINT " + _name);
+    ++_db._savepoints;
+}
+
+Database::Savepoint::~Savepoint() {
+    try {
+        rollback();
+    }
+    catch (std::exception& e) {
+        printf("Database::Savepoint::~Savepoint() : %s\n", e.what());
+    }
+}
+
+void Database::Savepoint::release() {
+    if (!_active) return;
+    _active = false;
+    --_db._savepoints;
+    _db.execute("RELEASE " + _name);
+}
+
+void Database::Savepoint::rollback() {
+    if (!_active) return;
+    _active = false;
+    --_db._savepoints;
+    _db.execute("ROLLBACK TO " + _name);
+    _db.execute("RELEASE " + _name);
+}
+
 
 //
 // CDB
@@ -130,6 +130,9 @@ void Client::async_get(std::string url, ClientCompletionHandler& handler, Header
     string path = "/";
     if(slash != string::npos)
         path = url.substr(slash);
+    // the reply has failed until its status line is read
+    _reply.status = Reply::service_unavailable;
+    
     std::ostream request_stream(&_request);
     request_stream << "GET " << path << " HTTP/1.0\r\n";
     request_stream << "Host: " << server << "\r\n";
@@ -15,23 +15,35 @@
  */
 
 #include <coinHTTP/Connection.h>
+#include <sstream>
 #include <vector>
 #include <coinHTTP/ConnectionManager.h>
 #include <coinHTTP/RequestHandler.h>
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <boost/date_time/posix_time/posix_time.hpp>
 
+#include <algorithm>
+#include <cerrno>
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
 using namespace boost;
 using namespace asio;
 using namespace std;
 
 
-Connection::Connection(io_service& io_service, ConnectionManager& manager, RequestHandler& handler, std::ostream& access_log) : _ctx(io_service, ssl::context::sslv23), _socket(io_service), _ssl_socket(io_service, _ctx), _secure(false), _keep_alive(io_service), _exec_postpone(io_service), _connectionManager(manager), _requestHandler(handler), _access_log(access_log), _max_request_duration(boost::posix_time::milliseconds(10000)) , _exec_retry_duration(boost::posix_time::milliseconds(1000)) {
+Connection::Connection(io_service& io_service, ConnectionManager& manager, RequestHandler& handler, std::ostream& access_log) : _io_service(io_service), _ctx(io_service, ssl::context::sslv23), _socket(io_service), _ssl_socket(io_service, _ctx), _secure(false), _keep_alive(io_service), _strand(io_service), _connectionManager(manager), _requestHandler(handler), _retry_after(0), _reading(false), _writing(false), _closing(false), _file_sent(0), _access_log(access_log), _max_request_duration(boost::posix_time::milliseconds(10000)) , _exec_retry_duration(boost::posix_time::milliseconds(1000)) {
+    _buffer_iterator = _buffer_end = _buffer.begin();
 }
 
-Connection::Connection(io_service& io_service, ssl::context& context, ConnectionManager& manager, RequestHandler& handler, std::ostream& access_log) : _ctx(io_service, ssl::context::sslv23), _socket(io_service), _ssl_socket(io_service, context), _secure(true), _keep_alive(io_service), _exec_postpone(io_service), _connectionManager(manager), _requestHandler(handler), _access_log(access_log), _max_request_duration(boost::posix_time::milliseconds(10000)) , _exec_retry_duration(boost::posix_time::milliseconds(1000)) {
+Connection::Connection(io_service& io_service, ssl::context& context, ConnectionManager& manager, RequestHandler& handler, std::ostream& access_log) : _io_service(io_service), _ctx(io_service, ssl::context::sslv23), _socket(io_service), _ssl_socket(io_service, context), _secure(true), _keep_alive(io_service), _strand(io_service), _connectionManager(manager), _requestHandler(handler), _retry_after(0), _reading(false), _writing(false), _closing(false), _file_sent(0), _access_log(access_log), _max_request_duration(boost::posix_time::milliseconds(10000)) , _exec_retry_duration(boost::posix_time::milliseconds(1000)) {
+    _buffer_iterator = _buffer_end = _buffer.begin();
 }
 
 
@@ -50,190 +62,428 @@ const ip::tcp::socket& Connection::socket() const {
         return _socket;
 }
 
-void Connection::start() {
+const ip::address& Connection::remote() {
+    if (_remote.is_unspecified()) {
+        boost::system::error_code ec;
+        ip::tcp::endpoint remote = socket().remote_endpoint(ec);
+        if (!ec)
+            _remote = remote.address();
+    }
+    return _remote;
+}
+
+void Connection::start(unsigned int retry_after) {
+    _retry_after = retry_after;
     if(_secure)
         _ssl_socket.async_handshake(boost::asio::ssl::stream_base::server,
-                                    boost::bind(&Connection::handle_handshake, this,
-                                                boost::asio::placeholders::error));    
-    else {
-        _buffer_iterator = _buffer.begin();
-        _socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-    }
+                                    _strand.wrap(boost::bind(&Connection::handle_handshake, shared_from_this(),
+                                                boost::asio::placeholders::error)));    
+    else
+        read();
 }
 
 void Connection::stop() {
     socket().close();
 }
 
+Connection::exchange_ptr Connection::acquire() {
+    if (_pool.empty())
+        return exchange_ptr(new Exchange(_io_service));
+    exchange_ptr exchange = _pool.back();
+    _pool.pop_back();
+    return exchange;
+}
+
+void Connection::release(exchange_ptr exchange) {
+    exchange->reset();
+    if (_pool.size() < _connectionManager.maxPipelined())
+        _pool.push_back(exchange);
+}
+
 void Connection::handle_handshake(const boost::system::error_code& error) {
-    if (!error) {        
-        _buffer_iterator = _buffer.begin();
-        _ssl_socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-    }
-    else {
-        _connectionManager.stop(shared_from_this());;
-    }
+    if (!error)
+        read();
+    else
+        _connectionManager.stop(shared_from_this());
 }
 
-void Connection::log_request() const {
+/// Connections on different threads share the access log.
+static boost::mutex access_log_mutex;
+
+void Connection::log_request(const Request& request, const Reply& reply) const {
     // 127.0.0.1 - frank [10/Oct/2000:13:55:36 -0700] "GET /apache_pb.gif HTTP/1.0" 200 2326 "http://www.example.com/start.html" "Mozilla/4.08 [en] (Win98; I ;Nav)"
 
+    _connectionManager.replied(request, reply);
+    
     boost::system::error_code ec;
     ip::tcp::endpoint remote = socket().remote_endpoint(ec);
     if(ec) // unbound requests are artefacts (result from write calling read, e.g. when trying ssl on non ssl conn)
         return;
-    _access_log << remote.address() << " - ";
-    Headers::const_iterator header = _request.headers.find("Authorization");
+    // format the line first, with the time facet of the log, and log it in one write
+    ostringstream line;
+    line.imbue(_access_log.getloc());
+    line << remote.address() << " - ";
+    Headers::const_iterator header = request.headers.find("Authorization");
     std::string basic_auth;
-    if (header != _request.headers.end())
+    if (header != request.headers.end())
         basic_auth = header->second;
     if (basic_auth.length() < 9)
-        _access_log << "- ";
+        line << "- ";
     else if (basic_auth.substr(0,6) != "Basic ")
-        _access_log << "- ";
+        line << "- ";
     else {
         Auth auth(basic_auth.substr(6));
         if(auth.username() == "")
-            _access_log << "- ";
+            line << "- ";
         else
-            _access_log << auth.username() << " ";
+            line << auth.username() << " ";
     }
-    _access_log << posix_time::second_clock::local_time() << " ";
-    _access_log << "\"" << _request.method << " ";
-    _access_log << _request.uri << " ";
-    _access_log << "HTTP/" << _request.http_version_major << "." << _request.http_version_minor << "\" ";
-    _access_log << _reply.status << " ";
-    _access_log << _reply.content.size() << " ";
-    header = _request.headers.find("Referer");
-    if (header != _request.headers.end())
-        _access_log << "\"" << header->second << "\" ";
+    line << posix_time::second_clock::local_time() << " ";
+    line << "\"" << request.method << " ";
+    line << request.uri << " ";
+    line << "HTTP/" << request.http_version_major << "." << request.http_version_minor << "\" ";
+    line << reply.status << " ";
+    line << reply.size() << " ";
+    header = request.headers.find("Referer");
+    if (header != request.headers.end())
+        line << "\"" << header->second << "\" ";
     else 
-        _access_log << "- ";
-    header = _request.headers.find("User-Agent");
-    if (header != _request.headers.end())
-        _access_log << "\"" << header->second << "\"";
+        line << "- ";
+    header = request.headers.find("User-Agent");
+    if (header != request.headers.end())
+        line << "\"" << header->second << "\"";
     else
-        _access_log << "-";
+        line << "-";
     //    _access_log << " " << hex << (long) this << dec;
-    _access_log << endl;
+    line << "\n";
+    boost::mutex::scoped_lock lock(access_log_mutex);
+    _access_log << line.str() << flush;
+}
+
+void Connection::read() {
+    if (_reading || _closing || _buffer_iterator != _buffer_end || _exchanges.size() >= _connectionManager.maxPipelined())
+        return;
+    _reading = true;
+    if(_secure)
+        _ssl_socket.async_read_some(buffer(_buffer), _strand.wrap(bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
+    else
+        _socket.async_read_some(buffer(_buffer), _strand.wrap(bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
 }
 
 void Connection::handle_read(const system::error_code& e, std::size_t bytes_transferred) {
+    _reading = false;
     _keep_alive.cancel();
     if (!e) {
+        _connectionManager.received(remote(), bytes_transferred);
+        _buffer_iterator = _buffer.begin();
+        _buffer_end = _buffer.begin() + bytes_transferred;
+        parse();
+    }
+    else if (e != error::operation_aborted) {
+        // the client is done sending - reply the requests in flight before closing
+        _closing = true;
+        if (_exchanges.empty())
+            _connectionManager.stop(shared_from_this());
+    }
+}
+
+void Connection::parse() {
+    while (_buffer_iterator != _buffer_end && !_closing && _exchanges.size() < _connectionManager.maxPipelined()) {
+        if (!_parsing)
+            _parsing = acquire();
         tribool result;
-        // loop over all this to get all the data...
-        _bytes_read = bytes_transferred;
-        tie(result, _buffer_iterator) = _requestParser.parse(_request, _buffer_iterator, _buffer.begin() + bytes_transferred);
+        tie(result, _buffer_iterator) = _requestParser.parse(_parsing->request, _buffer_iterator, _buffer_end);
         
         if (result) {
+            exchange_ptr exchange = _parsing;
+            _parsing.reset();
+            Request& request = exchange->request;
+            
             // fill in the extra field of the Request
-            boost::system::error_code ec;
-            ip::tcp::endpoint remote = socket().remote_endpoint(ec);
-            if(!ec) // unbound requests are artefacts (result from write calling read, e.g. when trying ssl on non ssl conn)
-                _request.remote = remote.address();
-            _request.timestamp = boost::posix_time::microsec_clock::local_time();
-            _reply.reset();
-
-            // handle_exec: try get/post, if done call async write, else do a async_wait(handle_exec);
-            handle_wait(e);            
+            request.remote = remote();
+            request.timestamp = boost::posix_time::microsec_clock::local_time();
+            
+            // keep alive is default for HTTP 1.1 and not for HTTP 1.0 - if a Connection field is supplied, use it
+            bool keep_alive = !(request.http_version_major == 1 && request.http_version_minor == 0);
+            Headers::const_iterator header = request.headers.find("Connection");
+            if (header != request.headers.end())
+                keep_alive = (header->second != "close");
+            exchange->close = !keep_alive;
+            if (exchange->close)
+                _closing = true;
+            
+            _exchanges.push_back(exchange);
+            
+            // refused connections and requests over the rate limit are replied without being executed
+            unsigned int retry_after = _retry_after ? _retry_after : _connectionManager.admit(request, _requestHandler.isAuthenticated(request));
+            if (retry_after) {
+                exchange->reply = Reply::stock_reply(Reply::service_unavailable);
+                exchange->reply.headers["Retry-After"] = lexical_cast<string>(retry_after);
+                if (_retry_after)
+                    exchange->close = _closing = true;
+                exchange->started = true;
+                handle_exec(exchange);
+            }
+            else
+                execute();
         }
         else if (!result) {
-            _reply = Reply::stock_reply(Reply::bad_request);
-            log_request();
-            _request.reset();
-            if(_secure)
-                async_write(_ssl_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-            else
-                async_write(_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
+            exchange_ptr exchange = _parsing;
+            _parsing.reset();
+            _requestParser.reset();
+            exchange->reply = Reply::stock_reply(Reply::bad_request);
+            exchange->close = true;
+            exchange->started = true;
+            exchange->done = true;
+            _closing = true;
+            _exchanges.push_back(exchange);
+            write();
         }
-        else {
-            _buffer_iterator = _buffer.begin();
-            if(_secure)
-                _ssl_socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-            else
-                _socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
+    }
+    read();
+}
+
+void Connection::handle_wait(exchange_ptr exchange, const system::error_code& e) {
+    if (e != boost::asio::error::operation_aborted) {
+        if (exchange->request.method != "GET" && exchange->request.method != "POST") {
+            exchange->reply = Reply::stock_reply(Reply::not_implemented);
+            handle_exec(exchange);
+        }
+        else if (boost::posix_time::microsec_clock::local_time() - exchange->request.timestamp > _max_request_duration) {
+            exchange->reply = Reply::stock_reply(Reply::gateway_timeout);
+            exchange->request.pending = false;
+            handle_exec(exchange);
+        }
+        else { // the request is handled by a worker thread, the connection continues in handle_exec
+            parseMethod(*exchange);
+            _requestHandler.dispatch(exchange->request, exchange->reply, _strand.wrap(bind(&Connection::handle_exec, shared_from_this(), exchange)), exchange->method, exchange->payload);
         }
     }
-    else if (e != error::operation_aborted) {
-        _connectionManager.stop(shared_from_this());
+}
+
+void Connection::handle_exec(exchange_ptr exchange) {
+    if (exchange->request.pending) {
+        // wait a short amount of time and try the exec again
+        if (exchange->request.method == "GET")
+            exchange->postpone.expires_from_now(_exec_retry_duration);
+        else
+            exchange->postpone.expires_from_now(boost::posix_time::milliseconds(1));
+        exchange->postpone.async_wait(_strand.wrap(bind(&Connection::handle_wait, shared_from_this(), exchange, placeholders::error)));
+    }
+    else {
+        exchange->done = true;
+        execute();
+        write();
     }
 }
 
-void Connection::handle_wait(const system::error_code& e) {
-    if (e != boost::asio::error::operation_aborted) {
-        if (_request.method == "GET") {
-            if (boost::posix_time::microsec_clock::local_time() - _request.timestamp > _max_request_duration) {
-                _reply = Reply::stock_reply(Reply::gateway_timeout);
-                _request.pending = false;
+void Connection::execute() {
+    bool executing = false;
+    for (Exchanges::iterator exchange = _exchanges.begin(); exchange != _exchanges.end(); ++exchange) {
+        if (!(*exchange)->started) {
+            // a request waits unless it and every request before it still executing are read-only - the requests
+            // are only classified when pipelined
+            if (executing) {
+                if (!isReadOnly(**exchange))
+                    return;
+                for (Exchanges::iterator earlier = _exchanges.begin(); earlier != exchange; ++earlier)
+                    if (!(*earlier)->done && !isReadOnly(**earlier))
+                        return;
             }
+            (*exchange)->started = true;
+            handle_wait(*exchange, system::error_code());
+        }
+        if (!(*exchange)->done)
+            executing = true;
+    }
+}
+
+void Connection::parseMethod(Exchange& exchange) {
+    if (exchange.parsed)
+        return;
+    exchange.method = _requestHandler.methodName(exchange.request, exchange.payload);
+    exchange.parsed = true;
+}
+
+bool Connection::isReadOnly(Exchange& exchange) {
+    if (indeterminate(exchange.read_only)) {
+        parseMethod(exchange);
+        exchange.read_only = _requestHandler.isReadOnly(exchange.method, exchange.payload);
+    }
+    return exchange.read_only;
+}
+
+void Connection::write() {
+    if (_writing || _exchanges.empty() || !_exchanges.front()->done)
+        return;
+    _writing = true;
+    Exchange& exchange = *_exchanges.front();
+    if (exchange.reply.file) {
+        _file = exchange.reply.file;
+        _file_sent = 0;
+        // send the headers - the content follows from the file
+        if(_secure)
+            async_write(_ssl_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_file, shared_from_this(), placeholders::error)));
+        else
+            async_write(_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_file, shared_from_this(), placeholders::error)));
+    }
+    else if (exchange.reply.stream) {
+        // send the headers - the content follows in chunks
+        if(_secure)
+            async_write(_ssl_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_chunk, shared_from_this(), placeholders::error)));
+        else
+            async_write(_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_chunk, shared_from_this(), placeholders::error)));
+    }
+    else {
+        log_request(exchange.request, exchange.reply);
+        if(_secure)
+            async_write(_ssl_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
+        else
+            async_write(_socket, exchange.reply.to_buffers(), _strand.wrap(bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
+    }
+}
+
+void Connection::handle_chunk(const system::error_code& e) {
+    if (_exchanges.empty())
+        return;
+    Reply& reply = _exchanges.front()->reply;
+    if (!reply.stream)
+        return;
+    if (e) {
+        // the producer fails on its next write and releases the exchange
+        reply.stream->cancel();
+        reply.stream.reset();
+        if (e != error::operation_aborted)
+            _connectionManager.stop(shared_from_this());
+        return;
+    }
+
+    static const string crlf = "\r\n";
+    static const string last_chunk = "0\r\n\r\n";
+    vector<const_buffer> buffers;
+    switch (reply.stream->read(_chunk, _strand.wrap(bind(&Connection::handle_chunk, shared_from_this(), system::error_code())))) {
+        case ContentStream::waiting: // called again once the next chunk is written
+            return;
+        case ContentStream::data: {
+            ostringstream size;
+            size << hex << _chunk.size() << crlf;
+            _chunk_size = size.str();
+            buffers.push_back(buffer(_chunk_size));
+            buffers.push_back(buffer(_chunk));
+            buffers.push_back(buffer(crlf));
+            if(_secure)
+                async_write(_ssl_socket, buffers, _strand.wrap(bind(&Connection::handle_chunk, shared_from_this(), placeholders::error)));
             else
-                _requestHandler.handleGET(_request, _reply);
-            if (_request.pending) {            
-                // wait a short amount of time and try the exec again
-                _exec_postpone.expires_from_now(_exec_retry_duration);
-                _exec_postpone.async_wait(bind(&Connection::handle_wait, shared_from_this(), placeholders::error));
-            }
-            else {
-                log_request();
-                _request.reset();
-                if(_secure)
-                    async_write(_ssl_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-                else
-                    async_write(_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-            }
+                async_write(_socket, buffers, _strand.wrap(bind(&Connection::handle_chunk, shared_from_this(), placeholders::error)));
+            return;
         }
-        else if(_request.method == "POST") {
-            if (boost::posix_time::microsec_clock::local_time() - _request.timestamp > _max_request_duration) {
-                _reply = Reply::stock_reply(Reply::gateway_timeout);
-                _request.pending = false;
-            }
+        case ContentStream::closed:
+            log_request(_exchanges.front()->request, reply);
+            reply.stream.reset();
+            _chunk.clear();
+            if(_secure)
+                async_write(_ssl_socket, buffer(last_chunk), _strand.wrap(bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
             else
-                _requestHandler.handlePOST(_request, _reply);
-            if(_request.pending) {            
-                // wait a short amount of time and try the exec again
-                _exec_postpone.expires_from_now(boost::posix_time::milliseconds(1));
-                _exec_postpone.async_wait(bind(&Connection::handle_wait, shared_from_this(), placeholders::error));
-            }
-            else {
-                log_request();
-                _request.reset();
-                if(_secure)
-                    async_write(_ssl_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-                else
-                    async_write(_socket, _reply.to_buffers(), bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
+                async_write(_socket, buffer(last_chunk), _strand.wrap(bind(&Connection::handle_write, shared_from_this(), placeholders::error, placeholders::bytes_transferred)));
+            return;
+        case ContentStream::aborted: {
+            // the content is incomplete - closing the connection without the last chunk tells the client
+            log_request(_exchanges.front()->request, reply);
+            reply.stream.reset();
+            _chunk.clear();
+            _closing = true;
+            system::error_code ignored_ec;
+            socket().shutdown(ip::tcp::socket::shutdown_both, ignored_ec);
+            _connectionManager.stop(shared_from_this());
+            return;
+        }
+    }
+}
+
+void Connection::handle_file(const system::error_code& e) {
+    if (_exchanges.empty() || !_file)
+        return;
+    Reply& reply = _exchanges.front()->reply;
+    if (!e && _file_sent < reply.file_size) {
+#if defined(__linux__)
+        if (!_secure) {
+            // zero-copy - the socket is non-blocking, and sendfile continues when it is writable again
+            system::error_code ec;
+            _socket.native_non_blocking(true, ec);
+            while (!ec && _file_sent < reply.file_size) {
+                off_t offset = _file_sent;
+                ssize_t sent = ::sendfile(_socket.native_handle(), fileno(_file.get()), &offset, reply.file_size - _file_sent);
+                if (sent > 0)
+                    _file_sent += sent;
+                else if (sent < 0 && errno == EINTR)
+                    continue;
+                else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    _socket.async_write_some(null_buffers(), _strand.wrap(bind(&Connection::handle_file, shared_from_this(), placeholders::error)));
+                    return;
+                }
+                else // an error, or the file got shorter
+                    ec = system::error_code(sent < 0 ? errno : EIO, system::system_category());
             }
+            handle_file(ec);
+            return;
         }
+#endif
+        _chunk.resize(std::min(reply.file_size - _file_sent, (size_t)0x10000));
+        _requestHandler.post(bind(&Connection::read_file, shared_from_this(), _file));
+        return;
+    }
+    
+    _file.reset();
+    _chunk.clear();
+    log_request(_exchanges.front()->request, reply);
+    if (e) { // the Content-Length cannot be met - close the connection
+        if (e != error::operation_aborted)
+            _connectionManager.stop(shared_from_this());
+        return;
     }
+    handle_write(e, 0);
+}
+
+void Connection::read_file(boost::shared_ptr<FILE> file) {
+    // the chunk is not touched by the strand until the read is handled
+    system::error_code e;
+    if (fread(&_chunk[0], 1, _chunk.size(), file.get()) != _chunk.size()) // an error, or the file got shorter
+        e = system::error_code(EIO, system::system_category());
+    _strand.post(bind(&Connection::handle_file_read, shared_from_this(), e));
+}
+
+void Connection::handle_file_read(const system::error_code& e) {
+    if (e) {
+        handle_file(e);
+        return;
+    }
+    _file_sent += _chunk.size();
+    if(_secure)
+        async_write(_ssl_socket, buffer(_chunk), _strand.wrap(bind(&Connection::handle_file, shared_from_this(), placeholders::error)));
+    else
+        async_write(_socket, buffer(_chunk), _strand.wrap(bind(&Connection::handle_file, shared_from_this(), placeholders::error)));
 }
 
 void Connection::handle_write(const system::error_code& e, size_t bytes_transferred) {
-    bool keep_alive = true; // assuming HTTP 1.1
-    if (_request.http_version_major == 1 && _request.http_version_minor == 0)
-        keep_alive = false; // keep alive is false for HTTP 1.0
-    Headers::const_iterator header = _request.headers.find("Connection");
-    if (header != _request.headers.end()) // if A Connection field is supplied - use it
-        keep_alive = (header->second != "close");
-    
+    _writing = false;
     if (!e) {
-        if (keep_alive) { // read again, start deadline timer
-            _keep_alive.expires_from_now(_exec_retry_duration); // 2 seconds
-            _keep_alive.async_wait(bind(&Connection::handle_timeout, this, placeholders::error));
-            // we need to enpty the buffer first:
-            if (_buffer_iterator < _buffer.begin() + _bytes_read) { // call handle_read again
-                handle_read(e, _bytes_read); 
-            }
-            else {
-                _buffer_iterator = _buffer.begin();
-                if(_secure)
-                    _ssl_socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));
-                else
-                    _socket.async_read_some(buffer(_buffer), bind(&Connection::handle_read, shared_from_this(), placeholders::error, placeholders::bytes_transferred));   
-            }
-        }
-        else { // Initiate graceful connection closure.
+        exchange_ptr exchange = _exchanges.front();
+        _exchanges.pop_front();
+        bool close = exchange->close;
+        release(exchange);
+        
+        if (close || (_closing && _exchanges.empty())) { // Initiate graceful connection closure.
             system::error_code ignored_ec;
             socket().shutdown(ip::tcp::socket::shutdown_both, ignored_ec);
+            _connectionManager.stop(shared_from_this());
+            return;
+        }
+        
+        write();
+        parse(); // continue parsing, or reading, if the pipeline was full
+        if (_exchanges.empty()) { // idle - start deadline timer
+            _keep_alive.expires_from_now(_exec_retry_duration);
+            _keep_alive.async_wait(_strand.wrap(bind(&Connection::handle_timeout, shared_from_this(), placeholders::error)));
         }
     }
     else if (e != error::operation_aborted) {
@@ -245,7 +495,7 @@ void Connection::handle_timeout(const boost::system::error_code& e) {
     if(!e) {
         // Check whether the timeout has passed. We compare the deadline against
         // the current time.
-        if (_keep_alive.expires_at() <= deadline_timer::traits_type::now()) {
+        if (_keep_alive.expires_at() <= deadline_timer::traits_type::now() && _exchanges.empty()) {
             // The deadline has passed. Do a graceful shutdown
             system::error_code ignored_ec;
             socket().shutdown(ip::tcp::socket::shutdown_both, ignored_ec);
@@ -255,4 +505,3 @@ void Connection::handle_timeout(const boost::system::error_code& e) {
         printf("Possible boost keep_alive timer error in Server: %s\n", e.message().c_str());
     }
 }
-
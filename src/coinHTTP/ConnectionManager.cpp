@@ -16,21 +16,196 @@
 
 #include <coinHTTP/ConnectionManager.h>
 #include <algorithm>
+#include <cmath>
 #include <boost/bind.hpp>
 
+using namespace std;
+using namespace boost;
+using namespace json_spirit;
+
+ConnectionManager::ConnectionManager() : _max_connections(0), _max_pipelined(Connection::max_pipelined), _rate(0), _burst(0) {
+}
+
 void ConnectionManager::start(connection_ptr c) {
-    _connections.insert(c);
-    c->start();
+    unsigned int retry_after = 0;
+    {
+        boost::mutex::scoped_lock lock(_connections_mutex);
+        const asio::ip::address& remote = c->remote();
+        _connections[c] = remote;
+        Client& client = _clients[remote];
+        client.connections++;
+        if (_max_connections && client.connections > _max_connections) {
+            client.refused++;
+            retry_after = 1;
+        }
+        else
+            client.accepted++;
+    }
+    c->start(retry_after);
 }
 
 void ConnectionManager::stop(connection_ptr c) {
-    _connections.erase(c);
+    {
+        boost::mutex::scoped_lock lock(_connections_mutex);
+        Connections::iterator connection = _connections.find(c);
+        if (connection != _connections.end()) {
+            Clients::iterator client = _clients.find(connection->second);
+            if (client != _clients.end() && --client->second.connections == 0 && _clients.size() > max_idle)
+                _clients.erase(client);
+            _connections.erase(connection);
+        }
+    }
     c->stop();
 }
 
 void ConnectionManager::stop_all() {
+    Connections connections;
+    {
+        boost::mutex::scoped_lock lock(_connections_mutex);
+        connections.swap(_connections);
+        for (Clients::iterator client = _clients.begin(); client != _clients.end(); ++client)
+            client->second.connections = 0;
+    }
     //    std::for_each(_connections.begin(), _connections.end(), boost::bind(&Connection::stop, _1));
-    for(std::set<connection_ptr>::iterator c = _connections.begin(); c != _connections.end(); ++c)
-        (*c)->stop();
-    _connections.clear();
+    for(Connections::iterator c = connections.begin(); c != connections.end(); ++c)
+        c->first->stop();
+}
+
+void ConnectionManager::setMaxConnectionsPerClient(size_t connections) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    _max_connections = connections;
+}
+
+void ConnectionManager::setMaxPipelined(size_t requests) {
+    _max_pipelined = std::max(requests, (size_t)1);
+}
+
+void ConnectionManager::setRateLimit(double rate, double burst) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    _rate = std::max(rate, 0.);
+    _burst = std::max(burst, 1.);
+    _buckets.clear();
+}
+
+unsigned int ConnectionManager::admit(const Request& request, bool authenticated) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    if (_rate == 0)
+        return 0;
+    
+    // the bucket is that of the credentials once they are verified, so a wrong password cannot drain the bucket of
+    // the user, and made up credentials cannot be used to get new buckets
+    string key = request.remote.to_string();
+    Headers::const_iterator authorization = request.headers.find("Authorization");
+    if (authenticated && authorization != request.headers.end())
+        key = authorization->second;
+    
+    posix_time::ptime now = posix_time::microsec_clock::universal_time();
+    Buckets::iterator bucket = _buckets.find(key);
+    if (bucket == _buckets.end()) {
+        if (_buckets.size() > max_idle) {
+            // forget the buckets that have refilled
+            posix_time::time_duration refill = posix_time::microseconds((boost::int64_t)(1000000 * _burst / _rate));
+            for (Buckets::iterator b = _buckets.begin(); b != _buckets.end();) {
+                if (now - b->second.updated > refill)
+                    _buckets.erase(b++);
+                else
+                    ++b;
+            }
+        }
+        if (_buckets.size() >= max_buckets) {
+            // still too many - forget the least recently used bucket
+            Buckets::iterator oldest = _buckets.begin();
+            for (Buckets::iterator b = _buckets.begin(); b != _buckets.end(); ++b)
+                if (b->second.updated < oldest->second.updated)
+                    oldest = b;
+            _buckets.erase(oldest);
+        }
+        bucket = _buckets.insert(make_pair(key, Bucket())).first;
+        bucket->second.tokens = _burst;
+        bucket->second.updated = now;
+        if (authenticated && authorization != request.headers.end() && authorization->second.substr(0, 6) == "Basic ")
+            bucket->second.user = Auth(authorization->second.substr(6)).username();
+        else
+            bucket->second.user = key;
+    }
+    
+    Bucket& b = bucket->second;
+    b.tokens = std::min(_burst, b.tokens + _rate * (now - b.updated).total_microseconds() / 1000000.);
+    b.updated = now;
+    b.requests++;
+    if (b.tokens >= 1) {
+        b.tokens -= 1;
+        return 0;
+    }
+    b.limited++;
+    _clients[request.remote].limited++;
+    return (unsigned int)ceil((1 - b.tokens) / _rate);
+}
+
+void ConnectionManager::received(const asio::ip::address& client, size_t bytes) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    _clients[client].bytes_in += bytes;
+}
+
+void ConnectionManager::replied(const Request& request, const Reply& reply) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    Client& client = _clients[request.remote];
+    client.requests++;
+    client.bytes_out += reply.size();
+    client.busy += request.busy.total_microseconds();
+}
+
+Value ConnectionManager::getStats(int level) {
+    boost::mutex::scoped_lock lock(_connections_mutex);
+    Client total;
+    Array clients;
+    for (Clients::const_iterator c = _clients.begin(); c != _clients.end(); ++c) {
+        const Client& client = c->second;
+        total.connections += client.connections;
+        total.accepted += client.accepted;
+        total.refused += client.refused;
+        total.requests += client.requests;
+        total.limited += client.limited;
+        total.bytes_in += client.bytes_in;
+        total.bytes_out += client.bytes_out;
+        total.busy += client.busy;
+        if (level > 0) {
+            Object entry;
+            entry.push_back(Pair("address", c->first.to_string()));
+            entry.push_back(Pair("connections", (boost::int64_t)client.connections));
+            entry.push_back(Pair("accepted", (boost::int64_t)client.accepted));
+            entry.push_back(Pair("refused", (boost::int64_t)client.refused));
+            entry.push_back(Pair("requests", (boost::int64_t)client.requests));
+            entry.push_back(Pair("limited", (boost::int64_t)client.limited));
+            entry.push_back(Pair("bytesin", (boost::int64_t)client.bytes_in));
+            entry.push_back(Pair("bytesout", (boost::int64_t)client.bytes_out));
+            entry.push_back(Pair("busyms", (boost::int64_t)(client.busy / 1000)));
+            clients.push_back(entry);
+        }
+    }
+    
+    Object stats;
+    stats.push_back(Pair("connections", (boost::int64_t)total.connections));
+    stats.push_back(Pair("accepted", (boost::int64_t)total.accepted));
+    stats.push_back(Pair("refused", (boost::int64_t)total.refused));
+    stats.push_back(Pair("requests", (boost::int64_t)total.requests));
+    stats.push_back(Pair("limited", (boost::int64_t)total.limited));
+    stats.push_back(Pair("bytesin", (boost::int64_t)total.bytes_in));
+    stats.push_back(Pair("bytesout", (boost::int64_t)total.bytes_out));
+    stats.push_back(Pair("busyms", (boost::int64_t)(total.busy / 1000)));
+    if (level > 0) {
+        stats.push_back(Pair("clients", clients));
+        
+        Array users;
+        for (Buckets::const_iterator b = _buckets.begin(); b != _buckets.end(); ++b) {
+            Object entry;
+            entry.push_back(Pair("user", b->second.user));
+            entry.push_back(Pair("requests", (boost::int64_t)b->second.requests));
+            entry.push_back(Pair("limited", (boost::int64_t)b->second.limited));
+            entry.push_back(Pair("tokens", b->second.tokens));
+            users.push_back(entry);
+        }
+        stats.push_back(Pair("users", users));
+    }
+    return stats;
 }
@@ -0,0 +1,101 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/ContentStream.h>
+
+using namespace std;
+using namespace boost;
+
+ContentStream::ContentStream(Notify ready, size_t capacity) : _ready(ready), _capacity(capacity), _pending(0), _size(0), _end(waiting), _cancelled(false) {
+}
+
+bool ContentStream::write(const string& chunk, bool block) {
+    if (chunk.empty())
+        return true;
+    Notify notify;
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        while (!_cancelled && _pending && _pending + chunk.size() > _capacity) {
+            if (!block)
+                return false;
+            _drained.wait(lock);
+        }
+        if (_cancelled)
+            return false;
+        _chunks.push_back(chunk);
+        _pending += chunk.size();
+        _size += chunk.size();
+        notify.swap(_listener);
+    }
+    if (_ready) {
+        Notify ready;
+        ready.swap(_ready);
+        ready();
+    }
+    if (notify)
+        notify();
+    return true;
+}
+
+void ContentStream::close() {
+    Notify notify;
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _end = closed;
+        notify.swap(_listener);
+    }
+    if (notify)
+        notify();
+}
+
+void ContentStream::abort() {
+    Notify notify;
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _end = aborted;
+        notify.swap(_listener);
+    }
+    if (notify)
+        notify();
+}
+
+ContentStream::State ContentStream::read(string& chunk, Notify listener) {
+    boost::mutex::scoped_lock lock(_mutex);
+    if (_chunks.empty()) {
+        if (_end == waiting)
+            _listener = listener;
+        return _end;
+    }
+    chunk.swap(_chunks.front());
+    _chunks.pop_front();
+    _pending -= chunk.size();
+    _drained.notify_all();
+    return data;
+}
+
+void ContentStream::cancel() {
+    boost::mutex::scoped_lock lock(_mutex);
+    _cancelled = true;
+    _chunks.clear();
+    _pending = 0;
+    _listener.clear();
+    _drained.notify_all();
+}
+
+size_t ContentStream::size() const {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _size;
+}
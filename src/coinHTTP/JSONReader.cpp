@@ -0,0 +1,385 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/JSONReader.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include <boost/cstdint.hpp>
+
+using namespace std;
+using namespace json_spirit;
+
+bool JSONReader::read(const std::string& text, Value& value) {
+    JSONReader reader(text.data(), text.data() + text.size());
+    if (!reader.count())
+        return false;
+    reader.whitespace();
+    if (!reader.value(value))
+        return false;
+    reader.whitespace();
+    return reader._pos == reader._end;
+}
+
+/// The states of the structural scan - what may come next in the innermost container.
+enum Expect {
+    separator, // a ',' or the end of the container
+    element, // a value counted as an element - or the end of an empty array
+    member, // a key counted as a member - or the end of an empty object
+    colon, // the ':' following a key
+    member_value // the value of a member
+};
+
+bool JSONReader::count() {
+    // json_spirit Values are deep copied when a vector grows, so the size of each object and array is counted
+    // up front in a quick structural scan - the counts are in the order the containers are opened, as they are
+    // parsed. Only elements and members actually present are counted, and a misplaced bracket, comma or colon
+    // fails the scan, hence nothing is reserved for malformed text, e.g. a long run of commas
+    std::vector<size_t> open;
+    std::string closing;
+    Expect expect = element;
+    for (const char* c = _pos; c != _end; ++c) {
+        switch (*c) {
+            case ' ': case '\t': case '\n': case '\r':
+                continue;
+            case '"':
+                if (expect == separator || expect == colon)
+                    return false;
+                if (expect != member_value && !open.empty())
+                    ++_counts[open.back()];
+                for (++c; c != _end && *c != '"'; ++c)
+                    if (*c == '\\' && c + 1 != _end)
+                        ++c;
+                if (c == _end)
+                    return false;
+                expect = expect == member ? colon : separator;
+                continue;
+            case '{': case '[':
+                if (expect != element && expect != member_value)
+                    return false;
+                if (expect == element && !open.empty())
+                    ++_counts[open.back()];
+                open.push_back(_counts.size());
+                _counts.push_back(0);
+                closing += *c == '{' ? '}' : ']';
+                expect = *c == '{' ? member : element;
+                continue;
+            case '}': case ']':
+                if (open.empty() || closing[closing.size() - 1] != *c)
+                    return false;
+                if (expect == colon || expect == member_value || (expect != separator && _counts[open.back()]))
+                    return false;
+                open.pop_back();
+                closing.erase(closing.size() - 1);
+                expect = separator;
+                continue;
+            case ',':
+                if (open.empty() || expect != separator)
+                    return false;
+                expect = closing[closing.size() - 1] == '}' ? member : element;
+                continue;
+            case ':':
+                if (expect != colon)
+                    return false;
+                expect = member_value;
+                continue;
+        }
+        // a number or literal - its text is checked by the parser
+        if (expect != element && expect != member_value)
+            return false;
+        if (expect == element && !open.empty())
+            ++_counts[open.back()];
+        while (c + 1 != _end && (isalnum((unsigned char)c[1]) || c[1] == '.' || c[1] == '+' || c[1] == '-'))
+            ++c;
+        expect = separator;
+    }
+    return open.empty() && expect == separator;
+}
+
+size_t JSONReader::size() {
+    if (_next < _counts.size())
+        return _counts[_next++];
+    return 0;
+}
+
+void JSONReader::whitespace() {
+    while (_pos != _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\n' || *_pos == '\r'))
+        ++_pos;
+}
+
+bool JSONReader::value(Value& value) {
+    if (_pos == _end)
+        return false;
+    switch (*_pos) {
+        case '{':
+            return object(value);
+        case '[':
+            return array(value);
+        case '"': {
+            std::string str;
+            if (!string(str))
+                return false;
+            value = str;
+            return true;
+        }
+        case 't':
+            if (!literal("true"))
+                return false;
+            value = true;
+            return true;
+        case 'f':
+            if (!literal("false"))
+                return false;
+            value = false;
+            return true;
+        case 'n':
+            if (!literal("null"))
+                return false;
+            value = Value::null;
+            return true;
+        default:
+            return number(value);
+    }
+}
+
+bool JSONReader::object(Value& value) {
+    if (++_depth > max_depth)
+        return false;
+    ++_pos; // '{'
+    value = Object();
+    Object& obj = value.get_obj();
+    obj.reserve(size());
+    whitespace();
+    if (_pos != _end && *_pos == '}') {
+        ++_pos;
+        --_depth;
+        return true;
+    }
+    for (;;) {
+        obj.push_back(Pair("", Value()));
+        if (_pos == _end || *_pos != '"' || !string(obj.back().name_))
+            return false;
+        whitespace();
+        if (_pos == _end || *_pos != ':')
+            return false;
+        ++_pos;
+        whitespace();
+        if (!JSONReader::value(obj.back().value_))
+            return false;
+        whitespace();
+        if (_pos == _end)
+            return false;
+        if (*_pos == '}')
+            break;
+        if (*_pos != ',')
+            return false;
+        ++_pos;
+        whitespace();
+    }
+    ++_pos;
+    --_depth;
+    return true;
+}
+
+bool JSONReader::array(Value& value) {
+    if (++_depth > max_depth)
+        return false;
+    ++_pos; // '['
+    value = Array();
+    Array& arr = value.get_array();
+    arr.reserve(size());
+    whitespace();
+    if (_pos != _end && *_pos == ']') {
+        ++_pos;
+        --_depth;
+        return true;
+    }
+    for (;;) {
+        arr.push_back(Value());
+        if (!JSONReader::value(arr.back()))
+            return false;
+        whitespace();
+        if (_pos == _end)
+            return false;
+        if (*_pos == ']')
+            break;
+        if (*_pos != ',')
+            return false;
+        ++_pos;
+        whitespace();
+    }
+    ++_pos;
+    --_depth;
+    return true;
+}
+
+bool JSONReader::hex(unsigned int& code) {
+    if (_end - _pos < 4)
+        return false;
+    code = 0;
+    for (int i = 0; i < 4; ++i, ++_pos) {
+        char c = *_pos;
+        code <<= 4;
+        if (c >= '0' && c <= '9')
+            code |= c - '0';
+        else if (c >= 'a' && c <= 'f')
+            code |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            code |= c - 'A' + 10;
+        else
+            return false;
+    }
+    return true;
+}
+
+bool JSONReader::string(std::string& str) {
+    ++_pos; // '"'
+    str.clear();
+    for (;;) {
+        // copy the run of plain characters in one go
+        const char* run = _pos;
+        while (_pos != _end && *_pos != '"' && *_pos != '\\' && (unsigned char)*_pos >= 0x20)
+            ++_pos;
+        str.append(run, _pos);
+        if (_pos == _end || (unsigned char)*_pos < 0x20)
+            return false;
+        if (*_pos++ == '"')
+            return true;
+        // escape
+        if (_pos == _end)
+            return false;
+        switch (*_pos++) {
+            case '"': str += '"'; break;
+            case '\\': str += '\\'; break;
+            case '/': str += '/'; break;
+            case 'b': str += '\b'; break;
+            case 'f': str += '\f'; break;
+            case 'n': str += '\n'; break;
+            case 'r': str += '\r'; break;
+            case 't': str += '\t'; break;
+            case 'u': {
+                unsigned int code;
+                if (!hex(code))
+                    return false;
+                if (code >= 0xD800 && code < 0xDC00) { // high surrogate - must be followed by the low
+                    unsigned int low;
+                    if (_end - _pos < 6 || _pos[0] != '\\' || _pos[1] != 'u')
+                        return false;
+                    _pos += 2;
+                    if (!hex(low) || low < 0xDC00 || low >= 0xE000)
+                        return false;
+                    code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                }
+                // encode as UTF-8
+                if (code < 0x80)
+                    str += (char)code;
+                else if (code < 0x800) {
+                    str += (char)(0xC0 | (code >> 6));
+                    str += (char)(0x80 | (code & 0x3F));
+                }
+                else if (code < 0x10000) {
+                    str += (char)(0xE0 | (code >> 12));
+                    str += (char)(0x80 | ((code >> 6) & 0x3F));
+                    str += (char)(0x80 | (code & 0x3F));
+                }
+                else {
+                    str += (char)(0xF0 | (code >> 18));
+                    str += (char)(0x80 | ((code >> 12) & 0x3F));
+                    str += (char)(0x80 | ((code >> 6) & 0x3F));
+                    str += (char)(0x80 | (code & 0x3F));
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+}
+
+bool JSONReader::number(Value& value) {
+    const char* begin = _pos;
+    bool negative = false;
+    if (_pos != _end && *_pos == '-') {
+        negative = true;
+        ++_pos;
+    }
+    // integer part - no leading zeros
+    if (_pos == _end || *_pos < '0' || *_pos > '9')
+        return false;
+    boost::uint64_t magnitude = 0;
+    bool overflow = false;
+    if (*_pos == '0')
+        ++_pos;
+    else {
+        while (_pos != _end && *_pos >= '0' && *_pos <= '9') {
+            unsigned int digit = *_pos++ - '0';
+            if (magnitude > (~(boost::uint64_t)0 - digit) / 10)
+                overflow = true;
+            magnitude = magnitude * 10 + digit;
+        }
+    }
+    bool real = false;
+    if (_pos != _end && *_pos == '.') {
+        real = true;
+        ++_pos;
+        if (_pos == _end || *_pos < '0' || *_pos > '9')
+            return false;
+        while (_pos != _end && *_pos >= '0' && *_pos <= '9')
+            ++_pos;
+    }
+    if (_pos != _end && (*_pos == 'e' || *_pos == 'E')) {
+        real = true;
+        ++_pos;
+        if (_pos != _end && (*_pos == '+' || *_pos == '-'))
+            ++_pos;
+        if (_pos == _end || *_pos < '0' || *_pos > '9')
+            return false;
+        while (_pos != _end && *_pos >= '0' && *_pos <= '9')
+            ++_pos;
+    }
+    
+    // integers are int64 if they fit, otherwise uint64, as json_spirit reads them
+    const boost::uint64_t int64_max = 0x7FFFFFFFFFFFFFFFULL;
+    if (!real && !overflow) {
+        if (!negative && magnitude <= int64_max) {
+            value = (boost::int64_t)magnitude;
+            return true;
+        }
+        if (negative && magnitude <= int64_max + 1) {
+            value = (boost::int64_t)(0 - magnitude);
+            return true;
+        }
+        if (!negative) {
+            value = magnitude;
+            return true;
+        }
+    }
+    
+    // strtod needs a terminated string - numbers are short
+    std::string text(begin, _pos);
+    value = strtod(text.c_str(), NULL);
+    return true;
+}
+
+bool JSONReader::literal(const char* text) {
+    size_t length = strlen(text);
+    if ((size_t)(_end - _pos) < length || memcmp(_pos, text, length) != 0)
+        return false;
+    _pos += length;
+    return true;
+}
@@ -0,0 +1,96 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/JSONWriter.h>
+#include <coinHTTP/ContentStream.h>
+
+#include <stdexcept>
+
+using namespace std;
+using namespace json_spirit;
+
+JSONWriter::JSONWriter(ContentStream* stream, size_t flush_size) : _stream(stream), _flush_size(flush_size), _member(false), _flushed(false) {
+    if (_stream)
+        _buffer.reserve(_flush_size + _flush_size/4);
+}
+
+void JSONWriter::beginObject() {
+    separate();
+    _buffer += '{';
+    _first.push_back(true);
+}
+
+void JSONWriter::endObject() {
+    _first.pop_back();
+    _buffer += '}';
+    written();
+}
+
+void JSONWriter::beginArray() {
+    separate();
+    _buffer += '[';
+    _first.push_back(true);
+}
+
+void JSONWriter::endArray() {
+    _first.pop_back();
+    _buffer += ']';
+    written();
+}
+
+void JSONWriter::key(const string& name) {
+    separate();
+    _buffer += json_spirit::write(Value(name));
+    _buffer += ':';
+    _member = true;
+}
+
+void JSONWriter::write(const Value& value) {
+    separate();
+    _buffer += json_spirit::write(value);
+    written();
+}
+
+void JSONWriter::raw(const string& text) {
+    _buffer += text;
+    written();
+}
+
+void JSONWriter::flush() {
+    if (!_stream || _buffer.empty())
+        return;
+    if (!_stream->write(_buffer))
+        throw runtime_error("Reply stream cancelled");
+    _buffer.clear();
+    _flushed = true;
+}
+
+void JSONWriter::separate() {
+    if (_member) { // the value of a member follows its key
+        _member = false;
+        return;
+    }
+    if (_first.empty())
+        return;
+    if (!_first.back())
+        _buffer += ',';
+    _first.back() = false;
+}
+
+void JSONWriter::written() {
+    if (_stream && _buffer.size() >= _flush_size)
+        flush();
+}
@@ -21,6 +21,10 @@
 #include <string>
 #include <algorithm>
 
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 using namespace std;
 using namespace boost;
 using namespace json_spirit;
@@ -34,6 +38,45 @@ Value Stop::operator()(const Array& params, bool fHelp) {
     return "Node and Server is stopping";
 }    
 
+Value ConnectionStats::operator()(const Array& params, bool fHelp) {
+    if (fHelp || params.size() > 1)
+        throw RPC::error(RPC::invalid_params, "connectionstats [level=1]\n"
+                         "Returns the connection and request counters of the server, with level 1 also pr client and pr user.");
+    
+    return _server.getConnectionStats(params.size() ? params[0].get_int() : 1);
+}
+
+/// The result of an asynchronous method called synchronously.
+class SyncResult : private boost::noncopyable {
+public:
+    SyncResult() : _done(false) {}
+    
+    void set(Value result) {
+        boost::mutex::scoped_lock lock(_mutex);
+        _result = result;
+        _done = true;
+        _cond.notify_all();
+    }
+    
+    Value get() {
+        boost::mutex::scoped_lock lock(_mutex);
+        while (!_done)
+            _cond.wait(lock);
+        return _result;
+    }
+private:
+    boost::mutex _mutex;
+    boost::condition_variable _cond;
+    Value _result;
+    bool _done;
+};
+
+Value AsyncMethod::operator()(const Array& params, bool fHelp) {
+    boost::shared_ptr<SyncResult> result(new SyncResult);
+    operator()(params, fHelp, bind(&SyncResult::set, result, _1));
+    return result->get();
+}
+
 const std::string Method::extractName() const {
     string n = typeid(*this).name();
     // remove trailing numbers from the typeid
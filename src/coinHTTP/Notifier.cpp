@@ -0,0 +1,118 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinHTTP/Notifier.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace boost;
+using namespace json_spirit;
+
+Notifier::wait_ptr Notifier::wait(Waiter waiter, Match match, posix_time::time_duration timeout) {
+    wait_ptr wait(new Wait(_io_service, waiter, match));
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        _waits.insert(wait);
+    }
+    wait->timer.expires_from_now(timeout);
+    wait->timer.async_wait(bind(&Notifier::handle_timeout, this, wait, asio::placeholders::error));
+    return wait;
+}
+
+bool Notifier::complete(wait_ptr wait, const Value& result) {
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        if (wait->done)
+            return false;
+        wait->done = true;
+        _waits.erase(wait);
+    }
+    system::error_code ignored_ec;
+    wait->timer.cancel(ignored_ec);
+    wait->waiter(result);
+    return true;
+}
+
+void Notifier::handle_timeout(wait_ptr wait, const system::error_code& e) {
+    if (e != asio::error::operation_aborted)
+        complete(wait, Value::null);
+}
+
+void Notifier::subscribe(boost::shared_ptr<ContentStream> stream, Match match) {
+    boost::mutex::scoped_lock lock(_mutex);
+    _subscribers.push_back(make_pair(stream, match));
+}
+
+void Notifier::notify(const Value& event) {
+    vector<wait_ptr> matched;
+    Subscribers subscribers;
+    {
+        boost::mutex::scoped_lock lock(_mutex);
+        for (Waits::iterator wait = _waits.begin(); wait != _waits.end();) {
+            if ((*wait)->match.empty() || (*wait)->match(event)) {
+                (*wait)->done = true;
+                matched.push_back(*wait);
+                _waits.erase(wait++);
+            }
+            else
+                ++wait;
+        }
+        subscribers = _subscribers;
+    }
+    
+    BOOST_FOREACH(wait_ptr wait, matched) {
+        system::error_code ignored_ec;
+        wait->timer.cancel(ignored_ec);
+        wait->waiter(event);
+    }
+    
+    if (subscribers.empty())
+        return;
+    string data = "data: " + write(event) + "\n\n";
+    vector<boost::shared_ptr<ContentStream> > ended;
+    for (Subscribers::iterator subscriber = subscribers.begin(); subscriber != subscribers.end(); ++subscriber) {
+        if (!subscriber->second.empty() && !subscriber->second(event))
+            continue;
+        if (!subscriber->first->write(data, false)) { // cancelled, or too far behind
+            subscriber->first->abort();
+            ended.push_back(subscriber->first);
+        }
+    }
+    
+    if (ended.empty())
+        return;
+    boost::mutex::scoped_lock lock(_mutex);
+    for (Subscribers::iterator subscriber = _subscribers.begin(); subscriber != _subscribers.end();) {
+        if (find(ended.begin(), ended.end(), subscriber->first) != ended.end())
+            subscriber = _subscribers.erase(subscriber);
+        else
+            ++subscriber;
+    }
+}
+
+size_t Notifier::waiting() const {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _waits.size();
+}
+
+size_t Notifier::subscribed() const {
+    boost::mutex::scoped_lock lock(_mutex);
+    return _subscribers.size();
+}
@@ -16,6 +16,7 @@
 
 #include <coinHTTP/RPC.h>
 #include <coinHTTP/Method.h>
+#include <coinHTTP/JSONReader.h>
 
 #include <sstream>
 #include <string>
@@ -82,15 +83,17 @@ Object RPC::reply(string content) {
     return val.get_obj();
 }
 
-RPC::RPC(const Request& request) : _id(Value::null), _error(Value::null), _request(request) {}
+RPC::RPC(const Request& request) : _id(Value::null), _notification(false), _error(Value::null), _request(request) {}
 
 void RPC::parse(string payload) {
     // Parse request
     Value parsed_req;
-    if (!json_spirit::read(payload, parsed_req) || parsed_req.type() != obj_type)
+    if (!JSONReader::read(payload, parsed_req) || parsed_req.type() != obj_type)
         throw error(parse_error);
-    const Object& request = parsed_req.get_obj();
-    
+    parse(parsed_req.get_obj());
+}
+
+void RPC::parse(const Object& request) {
     // Parse id now so errors from here on will have the id
     _id = find_value(request, "id");
     
@@ -110,6 +113,12 @@ void RPC::parse(string payload) {
         _params = Array();
     else
         throw error(parse_error, "Params must be an array");        
+    
+    // A valid request without an id member is a notification - null is a valid id
+    _notification = true;
+    BOOST_FOREACH(const Pair& member, request)
+        if (member.name_ == "id")
+            _notification = false;
 }
 
 void RPC::parse(std::string action, std::string payload) {
@@ -145,7 +154,7 @@ void RPC::setContent(string& content) {
 }
 */
 
-string& RPC::getContent() {
+Object RPC::getReply() {
     // Generate JSON RPC 2.0 reply
     Object reply;
     reply.push_back(Pair("jsonrpc", "2.0"));
@@ -153,9 +162,19 @@ string& RPC::getContent() {
         reply.push_back(Pair("error", _error));
     else // if no error, always return the result - also if null
         reply.push_back(Pair("result", _result));
-    if (!_id.is_null())
-        reply.push_back(Pair("id", _id));
-    _content = write(Value(reply)) + "\n";
+    // the id is always returned, null if it could not be determined
+    reply.push_back(Pair("id", _id));
+    return reply;
+}
+
+string& RPC::getContent() {
+    _content = write(Value(getReply())) + "\n";
+    return _content;
+}
+
+string& RPC::getContent(const string& result) {
+    // Same envelope as getReply - the result is spliced in as is
+    _content = "{\"jsonrpc\":\"2.0\",\"result\":" + result + ",\"id\":" + write(_id) + "}\n";
     return _content;
 }
 
@@ -189,3 +208,21 @@ const string& RPC::method() { return _method; }
 void RPC::execute(Method& method) {
     _result = method(_params, false, _request);
 }
+
+void RPC::execute(Method& method, JSONWriter& writer) {
+    writer.beginObject();
+    writer.write("jsonrpc", "2.0");
+    writer.key("result");
+    method(_params, false, _request, writer);
+    writer.write("id", _id);
+    writer.endObject();
+    writer.raw("\n");
+}
+
+void RPC::execute(Method& method, Method::MethodDone onDone) {
+    method(_params, false, onDone);
+}
+
+void RPC::setResult(const Value& result) {
+    _result = result;
+}
@@ -119,7 +119,10 @@ vector<const_buffer> Reply::to_buffers() {
         buffers.push_back(buffer(misc_strings::crlf));
     }
     buffers.push_back(buffer(misc_strings::crlf));
-    buffers.push_back(buffer(content));
+    if (shared_content)
+        buffers.push_back(buffer(*shared_content));
+    else
+        buffers.push_back(buffer(content));
     return buffers;
 }
 
@@ -20,18 +20,31 @@
 #include <coinHTTP/Request.h>
 #include <coinHTTP/Method.h>
 #include <coinHTTP/RPC.h>
+#include <coinHTTP/JSONReader.h>
+#include <coinHTTP/JSONWriter.h>
+#include <coinHTTP/ContentStream.h>
+#include <coinHTTP/Notifier.h>
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <set>
 #include <sstream>
 #include <string>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <openssl/buffer.h>
 #include <openssl/bio.h>
 #include <openssl/evp.h>
 
+#include <zlib.h>
+
 using namespace std;
 using namespace boost;
 using namespace json_spirit;
@@ -51,6 +64,23 @@ private:
     RequestHandler& _delegate;
 };
 
+// This method, "responsecachestats", reports the size and hit rate of the response cache.
+class ResponseCacheStats : public Method
+{
+public:
+    ResponseCacheStats(RequestHandler& delegate) : _delegate(delegate) {}
+    virtual Value operator()(const Array& params, bool fHelp) {
+        if (fHelp || params.size() > 1)
+            throw RPC::error(RPC::invalid_params, "responsecachestats [level=1]\n"
+                             "Returns the size and hit rate of the response cache, with level 2 also the cached calls.");
+        
+        return _delegate.getResponseCacheStats(params.size() ? params[0].get_int() : 1);
+    }
+    virtual bool isReadOnly() const { return true; }
+private:
+    RequestHandler& _delegate;
+};
+
 class Help : public Method{
 public:
     Help(RequestHandler& delegate) : _delegate(delegate) {}
@@ -101,8 +131,9 @@ static inline bool is_base64(unsigned char c) {
 }
 
 Auth::Auth(std::string base64auth) {
-    // check that the string is indeed a base64 string    
-    if(find_if(base64auth.begin(), base64auth.end(), !boost::bind(is_base64, _1)) == base64auth.end())
+    // check that the string is indeed a base64 string, allowing for its padding
+    string::iterator padding = find(base64auth.begin(), base64auth.end(), '=');
+    if(find_if(base64auth.begin(), padding, !boost::bind(is_base64, _1)) == padding && count(padding, base64auth.end(), '=') == base64auth.end() - padding)
         _base64auth = base64auth;
     else
         _base64auth = "";
@@ -256,9 +287,38 @@ string Auth::decode64(string s) {
 }
 */
 
-RequestHandler::RequestHandler(const string& doc_root) : _doc_root(doc_root) {
+/// Documents larger than this fraction of the document cache budget are sent from their files.
+static const size_t doc_cache_fraction = 64;
+
+/// The slot of the methods executed one at a time - suffixed by the method group, each group has its own slot.
+static const string serialized_slot = " serialized";
+
+RequestHandler::RequestHandler(const string& doc_root, size_t workers) : _doc_root(doc_root), _doc_cache(0x1000000, doc_cache_fraction), _response_cache(0x2000000), _work(new asio::io_service::work(_workers)), _request_work(new asio::io_service::work(_request_workers)), _stream_work(new asio::io_service::work(_stream_workers)) {
     registerMethod(method_ptr(new DirtyDocCache(*this)));
     registerMethod(method_ptr(new Help(*this)));
+    registerMethod(method_ptr(new ResponseCacheStats(*this)));
+    
+    if (workers == 0)
+        workers = std::max(thread::hardware_concurrency(), 1U);
+    typedef size_t (asio::io_service::*Run)();
+    Run run = &asio::io_service::run;
+    for (size_t i = 0; i < workers; ++i) {
+        _worker_threads.create_thread(bind(run, &_workers));
+        _request_threads.create_thread(bind(run, &_request_workers));
+        _stream_threads.create_thread(bind(run, &_stream_workers));
+    }
+}
+
+RequestHandler::~RequestHandler() {
+    _stream_work.reset();
+    _stream_workers.stop();
+    _stream_threads.join_all();
+    _request_work.reset();
+    _request_workers.stop();
+    _request_threads.join_all();
+    _work.reset();
+    _workers.stop();
+    _worker_threads.join_all();
 }
 
 void RequestHandler::registerMethod(method_ptr method, Auth auth) {
@@ -271,7 +331,7 @@ void RequestHandler::unregisterMethod(const string name) {
     _auths.erase(name);
 }
 
-void RequestHandler::handleGET(const Request& req, Reply& rep) {
+void RequestHandler::handleGET(const Request& req, Reply& rep, Completion* done) {
     // Decode url to path.
     string request_path;
     if (!urlDecode(req.uri, request_path)) {
@@ -293,6 +353,28 @@ void RequestHandler::handleGET(const Request& req, Reply& rep) {
         return;
     }
     
+    // Event streams
+    Events::iterator events = _events.find(request_path);
+    if (events != _events.end()) {
+        handleEvents(req, events->first.substr(1), *events->second, rep, done);
+        return;
+    }
+    
+    // Resources - looked up by the first segment of the path
+    size_t prefix_end = request_path.find("/", 1);
+    if (prefix_end != string::npos) {
+        Resources::iterator resource = _resources.find(request_path.substr(0, prefix_end));
+        if (resource != _resources.end()) {
+            try {
+                (*resource->second)(req, request_path.substr(prefix_end + 1), rep);
+            }
+            catch (Reply err) {
+                rep = err;
+            }
+            return;
+        }
+    }
+    
     // If path ends in slash (i.e. is a directory) then add "index.html".
     if (request_path[request_path.size() - 1] == '/') {
         request_path += "index.html";
@@ -364,57 +446,196 @@ void RequestHandler::handleGET(const Request& req, Reply& rep) {
     }
     
     // First check the cache.
-    string& content = _doc_cache[request_path];
+    document_ptr doc;
+    if (_doc_cache.find(request_path, doc)) {
+        replyDocument(req, *doc, rep);
+        return;
+    }
+    
     // We support one simple alternative - if the _doc_root begins with a "<" we assume it is not a 
     // path but a html document it selves - then we simple return this!
-    if (_doc_root.size() > 0 && _doc_root[0] == '<')
-        content = _doc_root;
-
-    // Not cached - load and cache it
-    if(content.size() == 0) {
-        // Open the file to send back.
-        string full_path = _doc_root + request_path;
-        ifstream is(full_path.c_str(), ios::in | ios::binary);
-        if (is) {
-            char buf[512];
-            while (is.read(buf, sizeof(buf)).gcount() > 0)
-                content.append(buf, is.gcount());            
+    if (_doc_root.size() > 0 && _doc_root[0] == '<') {
+        doc = document(_doc_root, extension);
+        _doc_cache.insert(request_path, doc, _doc_root.size());
+        replyDocument(req, *doc, rep);
+        return;
+    }
+    
+    // Not cached - large files are sent from the file, others are loaded and cached
+    string full_path = _doc_root + request_path;
+    string content;
+    system::error_code ec;
+    uintmax_t size = filesystem::file_size(full_path, ec);
+    if (!ec && size > _doc_cache.budget() / doc_cache_fraction) {
+        // weak ETag from the size and modification time - the content is not read
+        time_t modified = filesystem::last_write_time(full_path, ec);
+        ostringstream etag;
+        etag << "W/\"" << hex << size << "-" << modified << "\"";
+        rep.headers["ETag"] = etag.str();
+        if (notModified(req, etag.str())) {
+            rep.status = Reply::not_modified;
+            return;
         }
-        else {
-            // Check if the requested resource is stored as a collection of files - we encode collections by adding a trailing _ to the extension
-            string collection_name = full_path + "_";
-            ifstream collection(collection_name.c_str(), ios::in | ios::binary);
-            if(!collection) {
-                _doc_cache.erase(request_path);
-                rep = Reply::stock_reply(Reply::not_found);
-                return;
-            }
+        FILE* file = fopen(full_path.c_str(), "rb");
+        if (!file) {
+            rep = Reply::stock_reply(Reply::not_found);
+            return;
+        }
+        rep.status = Reply::ok;
+        rep.file.reset(file, fclose);
+        rep.file_size = size;
+        rep.headers["Content-Length"] = lexical_cast<string>(size);
+        rep.headers["Content-Type"] = MimeTypes::extension_to_type(extension);
+        return;
+    }
+    ifstream is(full_path.c_str(), ios::in | ios::binary);
+    if (is) {
+        char buf[4096];
+        while (is.read(buf, sizeof(buf)).gcount() > 0)
+            content.append(buf, is.gcount());            
+    }
+    else {
+        // Check if the requested resource is stored as a collection of files - we encode collections by adding a trailing _ to the extension
+        string collection_name = full_path + "_";
+        ifstream collection(collection_name.c_str(), ios::in | ios::binary);
+        if(!collection) {
+            rep = Reply::stock_reply(Reply::not_found);
+            return;
+        }
+        
+        // "collection" points to a set of files that should be concatenated
+        while (!collection.eof()) {
+            string path_name = "";
+            getline(collection, path_name);
             
-            // "collection" points to a set of files that should be concatenated
-            while (!collection.eof()) {
-                string path_name = "";
-                getline(collection, path_name);
-                
-                // Construct file name.
-                string full_path = _doc_root + request_path.substr(0, last_slash_pos+1) + path_name;
-                ifstream part(full_path.c_str(), ios::in | ios::binary);
-                if (part) {
-                    char buf[512];
-                    while (part.read(buf, sizeof(buf)).gcount() > 0)
-                        content.append(buf, part.gcount());        
-                }
-                else
-                    cerr << "Encountered no such file: " << full_path << ", In trying to read file collection: " << request_path << " - Ignoring" << endl;
+            // Construct file name.
+            string full_path = _doc_root + request_path.substr(0, last_slash_pos+1) + path_name;
+            ifstream part(full_path.c_str(), ios::in | ios::binary);
+            if (part) {
+                char buf[4096];
+                while (part.read(buf, sizeof(buf)).gcount() > 0)
+                    content.append(buf, part.gcount());        
             }
-            
+            else
+                cerr << "Encountered no such file: " << full_path << ", In trying to read file collection: " << request_path << " - Ignoring" << endl;
         }
+        
+    }
+    doc = document(content, extension);
+    _doc_cache.insert(request_path, doc, doc->content->size() + (doc->gzipped ? doc->gzipped->size() : 0));
+    replyDocument(req, *doc, rep);
+}
+
+/// FNV-1a, for the ETags of the cached documents.
+static boost::uint64_t fnv1a(const string& data) {
+    boost::uint64_t hash = 0xcbf29ce484222325ULL;
+    for (string::const_iterator c = data.begin(); c != data.end(); ++c) {
+        hash ^= (unsigned char)*c;
+        hash *= 0x100000001b3ULL;
     }
+    return hash;
+}
+
+/// Compress to the gzip format - returns false if it fails.
+static bool gzip(const string& data, string& gzipped) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) // +16: gzip header
+        return false;
+    gzipped.resize(deflateBound(&stream, data.size()) + 32);
+    stream.next_in = (Bytef*)data.data();
+    stream.avail_in = data.size();
+    stream.next_out = (Bytef*)&gzipped[0];
+    stream.avail_out = gzipped.size();
+    int result = deflate(&stream, Z_FINISH);
+    gzipped.resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+RequestHandler::document_ptr RequestHandler::document(const string& content, const string& extension) {
+    boost::shared_ptr<Document> doc(new Document);
+    doc->content.reset(new string(content));
+    ostringstream etag;
+    etag << "\"" << hex << content.size() << "-" << fnv1a(content) << "\"";
+    doc->etag = etag.str();
+    string type = MimeTypes::extension_to_type(extension);
+    doc->headers["Content-Type"] = type;
+    doc->headers["Content-Length"] = lexical_cast<string>(content.size());
+    doc->headers["ETag"] = doc->etag;
     
-    // Fill out the reply to be sent to the client.
+    // text compresses well - keep the gzip variant if it saves at least a tenth
+    if (type.compare(0, 5, "text/") == 0 || type == "application/javascript" || type == "application/json" || type == "application/xml") {
+        doc->headers["Vary"] = "Accept-Encoding";
+        string gzipped;
+        if (gzip(content, gzipped) && gzipped.size() < content.size() - content.size() / 10) {
+            doc->gzip_etag = doc->etag.substr(0, doc->etag.size() - 1) + "-gz\"";
+            doc->gzip_headers = doc->headers;
+            doc->gzip_headers["ETag"] = doc->gzip_etag;
+            doc->gzip_headers["Content-Length"] = lexical_cast<string>(gzipped.size());
+            doc->gzip_headers["Content-Encoding"] = "gzip";
+            doc->gzipped.reset(new string(gzipped));
+        }
+    }
+    return doc;
+}
+
+bool RequestHandler::notModified(const Request& req, const string& etag) {
+    Headers::const_iterator header = req.headers.find("If-None-Match");
+    if (header == req.headers.end())
+        return false;
+    // a list of ETags or *, the comparison is weak
+    string weak = etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag;
+    vector<string> tags;
+    split(tags, header->second, is_any_of(","));
+    BOOST_FOREACH(string tag, tags) {
+        trim(tag);
+        if (tag.compare(0, 2, "W/") == 0)
+            tag = tag.substr(2);
+        if (tag == "*" || tag == weak)
+            return true;
+    }
+    return false;
+}
+
+/// True if the Accept-Encoding of the request accepts gzip - by name, or by "*" if gzip is not named, with a q-value
+/// above 0, e.g. not for "gzip;q=0".
+static bool acceptsGzip(const Request& req) {
+    Headers::const_iterator header = req.headers.find("Accept-Encoding");
+    if (header == req.headers.end())
+        return false;
+    vector<string> codings;
+    split(codings, header->second, is_any_of(","));
+    int gzip = -1, any = -1; // -1: not named, otherwise if accepted
+    BOOST_FOREACH(const string& coding, codings) {
+        vector<string> params;
+        split(params, coding, is_any_of(";"));
+        string name = to_lower_copy(trim_copy(params[0]));
+        bool accepted = true;
+        for (size_t i = 1; i < params.size(); ++i) {
+            string param = trim_copy(params[i]);
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                accepted = atof(param.c_str() + 2) > 0;
+        }
+        if (name == "gzip" || name == "x-gzip")
+            gzip = accepted;
+        else if (name == "*")
+            any = accepted;
+    }
+    return gzip < 0 ? any > 0 : gzip > 0;
+}
+
+void RequestHandler::replyDocument(const Request& req, const Document& doc, Reply& rep) {
+    bool gzipped = doc.gzipped && acceptsGzip(req);
+    const string& etag = gzipped ? doc.gzip_etag : doc.etag;
+    if (notModified(req, etag)) {
+        rep.status = Reply::not_modified;
+        rep.headers["ETag"] = etag;
+        return;
+    }
     rep.status = Reply::ok;
-    rep.content = content;
-    rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
-    rep.headers["Content-Type"] = MimeTypes::extension_to_type(extension);
+    rep.headers = gzipped ? doc.gzip_headers : doc.headers;
+    rep.shared_content = gzipped ? doc.gzipped : doc.content;
 }
 
 void RequestHandler::handlePOST(const Request& req, Reply& rep) {
@@ -424,50 +645,10 @@ void RequestHandler::handlePOST(const Request& req, Reply& rep) {
         if(mime.find("application/json") != string::npos) {
             // This is a JSON RPC call - parse and execute!
 
-            RPC rpc(req);
-            try {
-                rpc.parse(req.payload);
-
-                // Check if the method requires authorization
-                if(_auths.count(rpc.method())) {
-                    if(req.headers.count("Authorization") == 0)
-                        throw Reply::stock_reply(Reply::unauthorized);
-                    string basic_auth = req.headers.find("Authorization")->second;
-                    if (basic_auth.length() > 9 && basic_auth.substr(0,6) != "Basic ")
-                        throw Reply::stock_reply(Reply::unauthorized);
-                    if(!_auths[rpc.method()].valid(basic_auth.substr(6)))
-                        throw Reply::stock_reply(Reply::unauthorized);                    
-                }
-                    
-                // Find method
-                Methods::iterator m = _methods.find(rpc.method());
-                if (m == _methods.end())
-                    throw RPC::error(RPC::method_not_found);
-                
-                try {
-                    // Execute
-                    rpc.execute(*(m->second));                    
-                }
-                catch (std::exception& e) {
-                    rpc.setError(RPC::error(RPC::unknown_error, e.what()));
-                }
-            }
-            catch (Object& err) {
-                rpc.setError(err);
-            }
-            catch (std::exception& e) {
-                rpc.setError(RPC::error(RPC::parse_error, e.what()));
-            }
-            catch (Reply err) {
-                rep = err;
-                return;
-            }
-            // Form reply header and content
-            rep.content = rpc.getContent();
-            // rpc.setContent(rep.content);                    
-            rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
-            rep.headers["Content-Type"] = "application/json";
-            rep.status = rpc.getStatus();
+            Value payload;
+            if (!JSONReader::read(req.payload, payload))
+                payload = Value::null;
+            handleJSON(req, payload, rep);
             return;
         }
         else if(mime.find("text/plain") != string::npos) {
@@ -528,38 +709,551 @@ void RequestHandler::handlePOST(const Request& req, Reply& rep) {
     rep = Reply::stock_reply(Reply::bad_request);
 }
 
+/// Counts the calls of a batch request pending on the worker pool.
+class PendingCalls : private boost::noncopyable {
+public:
+    PendingCalls() : _pending(0) {}
+    
+    void add() {
+        boost::mutex::scoped_lock lock(_mutex);
+        ++_pending;
+    }
+    
+    void done() {
+        boost::mutex::scoped_lock lock(_mutex);
+        if (--_pending == 0)
+            _done.notify_all();
+    }
+    
+    /// Wait for all pending calls to finish.
+    void wait() {
+        boost::mutex::scoped_lock lock(_mutex);
+        while (_pending)
+            _done.wait(lock);
+    }
+private:
+    boost::mutex _mutex;
+    boost::condition_variable _done;
+    size_t _pending;
+};
+
+static void executeCall(RPC& rpc, Method& method) {
+    try {
+        rpc.execute(method);
+    }
+    catch (Object& err) {
+        rpc.setError(err);
+    }
+    catch (std::exception& e) {
+        rpc.setError(RPC::error(RPC::unknown_error, e.what()));
+    }
+    catch (...) {
+        rpc.setError(RPC::error(RPC::unknown_error));
+    }
+}
+
+static void executePendingCall(RPC* rpc, Method* method, PendingCalls* pending) {
+    executeCall(*rpc, *method);
+    pending->done();
+}
+
+void RequestHandler::handleBatch(const Request& req, const Array& calls, Reply& rep) {
+    typedef vector<boost::shared_ptr<RPC> > RPCs;
+    RPCs rpcs;
+    vector<Method*> methods;
+    
+    if (calls.empty()) {
+        RPC rpc(req);
+        rpc.setError(RPC::error(RPC::invalid_request));
+        rep.content = rpc.getContent();
+        rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+        rep.headers["Content-Type"] = "application/json";
+        rep.status = rpc.getStatus();
+        return;
+    }
+    
+    // Parse the calls and look up the methods
+    BOOST_FOREACH(const Value& call, calls) {
+        boost::shared_ptr<RPC> rpc(new RPC(req));
+        Method* method = NULL;
+        try {
+            if (call.type() != obj_type)
+                throw RPC::error(RPC::invalid_request);
+            rpc->parse(call.get_obj());
+            checkAuthorization(req, rpc->method());
+            Methods::iterator m = _methods.find(rpc->method());
+            if (m == _methods.end())
+                throw RPC::error(RPC::method_not_found);
+            method = m->second.get();
+        }
+        catch (Object& err) {
+            rpc->setError(err);
+        }
+        catch (std::exception& e) {
+            rpc->setError(RPC::error(RPC::parse_error, e.what()));
+        }
+        catch (Reply err) {
+            rep = err;
+            return;
+        }
+        rpcs.push_back(rpc);
+        methods.push_back(method);
+    }
+    
+    // Execute - read-only calls are run on the worker pool, any other call waits for the calls before it
+    // and is executed inline, hence it sees the same state as if the calls were executed in order
+    PendingCalls pending;
+    for (size_t i = 0; i < rpcs.size(); ++i) {
+        if (!methods[i])
+            continue;
+        if (methods[i]->isReadOnly()) {
+            pending.add();
+            _workers.post(bind(&executePendingCall, rpcs[i].get(), methods[i], &pending));
+        }
+        else {
+            pending.wait();
+            executeCall(*rpcs[i], *methods[i]);
+        }
+    }
+    pending.wait();
+    
+    // Form reply header and content - the replies are in the order of the calls, notifications are not replied,
+    // and if all calls were notifications nothing is
+    Array replies;
+    BOOST_FOREACH(boost::shared_ptr<RPC> rpc, rpcs)
+        if (!rpc->isNotification())
+            replies.push_back(rpc->getReply());
+    if (replies.empty()) {
+        rep.content.clear();
+        rep.headers["Content-Length"] = "0";
+        rep.status = Reply::no_content;
+        return;
+    }
+    rep.content = write(Value(replies)) + "\n";
+    rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+    rep.headers["Content-Type"] = "application/json";
+    rep.status = Reply::ok;
+}
+
+bool RequestHandler::isAuthenticated(const Request& req) const {
+    Headers::const_iterator header = req.headers.find("Authorization");
+    if (header == req.headers.end() || header->second.length() <= 6 || header->second.substr(0,6) != "Basic ")
+        return false;
+    string credentials = header->second.substr(6);
+    for (Auths::const_iterator auth = _auths.begin(); auth != _auths.end(); ++auth)
+        if (!auth->second.isNone() && auth->second.valid(credentials))
+            return true;
+    return false;
+}
+
+void RequestHandler::checkAuthorization(const Request& req, const string& method) {
+    if(_auths.count(method)) {
+        if(req.headers.count("Authorization") == 0)
+            throw Reply::stock_reply(Reply::unauthorized);
+        string basic_auth = req.headers.find("Authorization")->second;
+        if (basic_auth.length() > 9 && basic_auth.substr(0,6) != "Basic ")
+            throw Reply::stock_reply(Reply::unauthorized);
+        if(!_auths.find(method)->second.valid(basic_auth.substr(6)))
+            throw Reply::stock_reply(Reply::unauthorized);                    
+    }
+}
+
+/// Reply the result of an asynchronous method, and complete the request.
+static void deferredReply(boost::shared_ptr<RPC> rpc, Reply* rep, RequestHandler::Completion done, Value result) {
+    rpc->setResult(result);
+    rep->content = rpc->getContent();
+    rep->headers["Content-Length"] = lexical_cast<string>(rep->content.size());
+    rep->headers["Content-Type"] = "application/json";
+    rep->status = rpc->getStatus();
+    done();
+}
+
+void RequestHandler::handleJSON(const Request& req, const Value& payload, Reply& rep, Completion* done) {
+    RPC rpc(req);
+    try {
+        if (payload.type() == array_type) {
+            handleBatch(req, payload.get_array(), rep);
+            return;
+        }
+        if (payload.type() != obj_type)
+            throw RPC::error(RPC::parse_error);
+        rpc.parse(payload.get_obj());
+        
+        // Check if the method requires authorization
+        checkAuthorization(req, rpc.method());
+        
+        // Find method
+        Methods::iterator m = _methods.find(rpc.method());
+        if (m == _methods.end())
+            throw RPC::error(RPC::method_not_found);
+        
+        // Immutable results are served from the response cache - on a miss a cacheable method is executed
+        // unstreamed to get the result for the cache. The result is cached in the generation of the cache it was
+        // computed in, hence it is dropped if the cache was cleared meanwhile, e.g. by a reorganization
+        string key;
+        size_t generation = _response_cache.generation();
+        if (m->second->isCacheable()) {
+            key = rpc.method() + write(Value(rpc.params()));
+            string result;
+            if (_response_cache.find(key, result)) {
+                rep.content = rpc.getContent(result);
+                rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+                rep.headers["Content-Type"] = "application/json";
+                rep.status = Reply::ok;
+                return;
+            }
+        }
+        
+        if (m->second->isStreaming() && key.empty()) {
+            handleStreaming(req, rpc, m->second, rep, done);
+            return;
+        }
+        
+        // Asynchronous methods take over the completion and reply when their result is ready
+        if (m->second->isAsync() && done && *done) {
+            boost::shared_ptr<RPC> deferred(new RPC(rpc));
+            Completion complete;
+            complete.swap(*done);
+            try {
+                deferred->execute(*(m->second), bind(&deferredReply, deferred, &rep, complete, _1));
+            }
+            catch (...) { // the method failed before it passed on onDone - the reply is formed here
+                done->swap(complete);
+                throw;
+            }
+            return;
+        }
+        
+        try {
+            // Execute
+            rpc.execute(*(m->second));                    
+            if (!key.empty() && m->second->isImmutable(rpc.params(), rpc.result())) {
+                string result = write(rpc.result());
+                _response_cache.insert(key, result, result.size(), generation);
+                rep.content = rpc.getContent(result);
+                rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+                rep.headers["Content-Type"] = "application/json";
+                rep.status = Reply::ok;
+                return;
+            }
+        }
+        catch (std::exception& e) {
+            rpc.setError(RPC::error(RPC::unknown_error, e.what()));
+        }
+    }
+    catch (Object& err) {
+        rpc.setError(err);
+    }
+    catch (std::exception& e) {
+        rpc.setError(RPC::error(RPC::parse_error, e.what()));
+    }
+    catch (Reply err) {
+        rep = err;
+        return;
+    }
+    // Form reply header and content
+    rep.content = rpc.getContent();
+    rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+    rep.headers["Content-Type"] = "application/json";
+    rep.status = rpc.getStatus();
+}
+
+/// Chunked transfer encoding requires HTTP/1.1.
+static bool chunked(const Request& req) {
+    return req.http_version_major > 1 || (req.http_version_major == 1 && req.http_version_minor > 0);
+}
+
+void RequestHandler::handleStreaming(const Request& req, RPC& rpc, method_ptr method, Reply& rep, Completion* done) {
+    // The headers are set up front as the reply is handed over on the first chunk
+    boost::shared_ptr<ContentStream> stream;
+    if (done && *done && chunked(req)) {
+        stream.reset(new ContentStream(*done));
+        rep.stream = stream;
+        rep.headers["Transfer-Encoding"] = "chunked";
+        rep.headers["Content-Type"] = "application/json";
+        rep.status = Reply::ok;
+        
+        // A read-only method is produced on the stream workers - the request worker and slots are released at once,
+        // and the producer keeps the completion, and hence the connection, until it is done
+        if (method->isReadOnly()) {
+            Completion complete;
+            complete.swap(*done);
+            _stream_workers.post(bind(&RequestHandler::produceAsync, this, boost::shared_ptr<RPC>(new RPC(rpc)), method, stream, &rep, complete));
+            return;
+        }
+    }
+    
+    if (produce(rpc, *method, stream, rep))
+        done->clear();
+}
+
+void RequestHandler::produceAsync(boost::shared_ptr<RPC> rpc, method_ptr method, boost::shared_ptr<ContentStream> stream, Reply* rep, Completion done) {
+    if (!produce(*rpc, *method, stream, *rep))
+        done();
+}
+
+bool RequestHandler::produce(RPC& rpc, Method& method, boost::shared_ptr<ContentStream> stream, Reply& rep) {
+    JSONWriter writer(stream.get());
+    try {
+        rpc.execute(method, writer);
+        if (writer.flushed()) {
+            writer.flush();
+            stream->close();
+            return true;
+        }
+    }
+    catch (Object& err) {
+        rpc.setError(err);
+    }
+    catch (std::exception& e) {
+        rpc.setError(RPC::error(RPC::unknown_error, e.what()));
+    }
+    catch (...) {
+        rpc.setError(RPC::error(RPC::unknown_error));
+    }
+    if (writer.flushed()) { // too late for an error reply - the client sees the content end without the last chunk
+        stream->abort();
+        return true;
+    }
+    
+    // Nothing has been sent - the reply is formed as for any other call
+    rep.stream.reset();
+    rep.headers.erase("Transfer-Encoding");
+    if (rpc.getStatus() == Reply::ok)
+        rep.content.swap(writer.content());
+    else
+        rep.content = rpc.getContent();
+    rep.headers["Content-Length"] = lexical_cast<string>(rep.content.size());
+    rep.headers["Content-Type"] = "application/json";
+    rep.status = rpc.getStatus();
+    return false;
+}
+
+void RequestHandler::handleEvents(const Request& req, const string& name, Notifier& notifier, Reply& rep, Completion* done) {
+    // An event stream is an endless chunked reply - it is handed over on the comment line opening it
+    if (!done || !*done || !chunked(req)) {
+        rep = Reply::stock_reply(Reply::not_implemented);
+        return;
+    }
+    boost::shared_ptr<ContentStream> stream(new ContentStream(*done));
+    done->clear();
+    rep.status = Reply::ok;
+    rep.stream = stream;
+    rep.headers["Content-Type"] = "text/event-stream";
+    rep.headers["Cache-Control"] = "no-cache";
+    rep.headers["Transfer-Encoding"] = "chunked";
+    stream->write(": " + name + "\n\n");
+    notifier.subscribe(stream);
+}
+
+/// The method name of a call of a batch - empty if the call is malformed.
+static string callName(const Value& call) {
+    if (call.type() != obj_type)
+        return "";
+    Value name = find_value(call.get_obj(), "method");
+    if (name.type() != str_type)
+        return "";
+    return name.get_str();
+}
+
+string RequestHandler::methodName(const Request& req, boost::shared_ptr<Value>& payload) const {
+    // JSON RPC calls are parsed to find the method, the payload is kept for their execution
+    Headers::const_iterator content_type = req.headers.find("Content-Type");
+    if (req.method == "POST" && content_type != req.headers.end() && content_type->second.find("application/json") != string::npos) {
+        payload.reset(new Value);
+        if (!JSONReader::read(req.payload, *payload))
+            *payload = Value::null;
+        return callName(*payload);
+    }
+    // GET requests and form posts name the method by the last segment of the path
+    size_t slash = req.uri.rfind("/");
+    if (slash != string::npos)
+        return req.uri.substr(slash + 1, req.uri.find("?", slash) - slash - 1);
+    return "";
+}
+
+bool RequestHandler::isReadOnly(const string& method, const boost::shared_ptr<Value>& payload) const {
+    if (payload && payload->type() == array_type) {
+        BOOST_FOREACH(const Value& call, payload->get_array()) {
+            Methods::const_iterator m = _methods.find(callName(call));
+            if (m != _methods.end() && !m->second->isReadOnly())
+                return false;
+        }
+        return true;
+    }
+    Methods::const_iterator m = _methods.find(method);
+    return m == _methods.end() || m->second->isReadOnly();
+}
+
+void RequestHandler::dispatch(const Request& req, Reply& rep, Completion done) {
+    // Determine the method - JSON RPC calls are parsed here to find it, and are not parsed again
+    boost::shared_ptr<Value> payload;
+    string method = methodName(req, payload);
+    dispatch(req, rep, done, method, payload);
+}
+
+void RequestHandler::dispatch(const Request& req, Reply& rep, Completion done, const string& method, boost::shared_ptr<Value> payload) {
+    // Methods that are not read-only are executed one at a time within the group of the call unless the method has its
+    // own limit, and a batch holds the group slots of the calls in it that are not read-only
+    set<string> slots;
+    if (payload && payload->type() == array_type) {
+        BOOST_FOREACH(const Value& call, payload->get_array()) {
+            Methods::const_iterator m = _methods.find(callName(call));
+            if (m != _methods.end() && !m->second->isReadOnly())
+                slots.insert(serialized_slot + m->second->group(req));
+        }
+    }
+    else {
+        Methods::const_iterator m = _methods.find(method);
+        if (m != _methods.end() && !m->second->isReadOnly()) {
+            boost::mutex::scoped_lock lock(_dispatch_mutex);
+            if (_limits.count(method))
+                slots.insert(method);
+            else
+                slots.insert(serialized_slot + m->second->group(req));
+        }
+        else
+            slots.insert(method);
+    }
+    
+    Slots ordered(slots.begin(), slots.end());
+    schedule(ordered, bind(&RequestHandler::execute, this, boost::cref(req), boost::ref(rep), payload, done, ordered));
+}
+
+void RequestHandler::setMethodLimit(const string& method, size_t limit) {
+    boost::mutex::scoped_lock lock(_dispatch_mutex);
+    if (limit)
+        _limits[method] = limit;
+    else
+        _limits.erase(method);
+}
+
+void RequestHandler::post(Completion job) {
+    _stream_workers.post(job);
+}
+
+void RequestHandler::registerEvents(const string& name, Notifier& notifier) {
+    _events["/" + name] = &notifier;
+}
+
+void RequestHandler::registerResource(const string& prefix, resource_ptr resource) {
+    _resources["/" + prefix] = resource;
+}
+
+void RequestHandler::execute(const Request& req, Reply& rep, boost::shared_ptr<Value> payload, Completion done, Slots slots) {
+    // Streamed, asynchronous and event stream replies take over the completion, and clear it - from then on the
+    // reply belongs to the connection
+    Completion complete = done;
+    boost::posix_time::ptime started = boost::posix_time::microsec_clock::universal_time();
+    try {
+        if (payload)
+            handleJSON(req, *payload, rep, &complete);
+        else if (req.method == "GET")
+            handleGET(req, rep, &complete);
+        else if (req.method == "POST")
+            handlePOST(req, rep);
+        else
+            rep = Reply::stock_reply(Reply::not_implemented);
+    }
+    catch (...) {
+        if (complete)
+            rep = Reply::stock_reply(Reply::internal_server_error);
+    }
+    finished(slots);
+    if (complete) {
+        // account the execution time - a request taken over can be replied, and reused, already
+        req.busy += boost::posix_time::microsec_clock::universal_time() - started;
+        complete();
+    }
+}
+
+void RequestHandler::schedule(const Slots& slots, Job job) {
+    boost::mutex::scoped_lock lock(_dispatch_mutex);
+    acquire(slots, 0, job);
+}
+
+void RequestHandler::acquire(const Slots& slots, size_t next, Job job) {
+    for (; next < slots.size(); ++next) {
+        const string& slot = slots[next];
+        size_t limit = slot.compare(0, serialized_slot.size(), serialized_slot) == 0 ? 1 : 0;
+        Limits::const_iterator l = _limits.find(slot);
+        if (l != _limits.end())
+            limit = l->second;
+        if (limit && _running[slot] >= limit) {
+            Waiting waiting = { slots, next + 1, job };
+            _queued[slot].push_back(waiting);
+            return;
+        }
+        _running[slot]++;
+    }
+    _request_workers.post(job);
+}
+
+void RequestHandler::finished(const Slots& slots) {
+    boost::mutex::scoped_lock lock(_dispatch_mutex);
+    BOOST_FOREACH(const string& slot, slots) {
+        Queued::iterator queued = _queued.find(slot);
+        if (queued != _queued.end() && !queued->second.empty()) {
+            // hand over the slot to the next queued execution waiting for it
+            Waiting waiting = queued->second.front();
+            queued->second.pop_front();
+            if (queued->second.empty())
+                _queued.erase(queued);
+            acquire(waiting.slots, waiting.next, waiting.job);
+            continue;
+        }
+        if (--_running[slot] == 0)
+            _running.erase(slot);
+    }
+}
+
+void RequestHandler::setDocCacheSize(size_t bytes) {
+    _doc_cache.budget(bytes);
+}
+
 void RequestHandler::clearDocCache() {
     _doc_cache.clear();
 }
 
-std::string RequestHandler::getDocCacheStats(int level) {
-    string stats;
-    long size = 0;
-    int entries = 0;
+/// Format cache statistics - level 2 lists the entries, level 1 sums them up with the hit rate, level 0 is the size.
+template <typename T>
+static string cacheStats(const LRUCache<T>& cache, int level) {
     ostringstream oss;
-    for(DocCache::iterator i = _doc_cache.begin(); i != _doc_cache.end(); ++i) {
-        oss << i->first << " : " << i->second.size() << "\n";
-        size += i->second.size();
-        entries++;
-    }
     switch (level) {
-        case 2:
-            stats.append(oss.str());
-        case 1:
-            oss.clear();
-            oss << "Entries: " << entries << " Total Size: " << size << "\n";
-            stats.append(oss.str()); 
+        case 2: {
+            vector<pair<string, size_t> > keys = cache.keys();
+            for (vector<pair<string, size_t> >::const_iterator key = keys.begin(); key != keys.end(); ++key)
+                oss << key->first << " : " << key->second << "\n";
+        }
+        case 1: {
+            size_t hits = cache.hits();
+            size_t lookups = hits + cache.misses();
+            oss << "Entries: " << cache.entries() << " Total Size: " << cache.size() << " Budget: " << cache.budget() << "\n";
+            oss << "Hits: " << hits << " Misses: " << cache.misses() << " Hit Rate: " << (lookups ? 100. * hits / lookups : 0.) << "%\n";
             break;
+        }
         default:
-            oss.clear();
-            oss << size;
-            stats.append(oss.str()); 
+            oss << cache.size();
             break;
     }
-    return stats;
+    return oss.str();
+}
+
+std::string RequestHandler::getDocCacheStats(int level) {
+    return cacheStats(_doc_cache, level);
 }
 
+void RequestHandler::setResponseCacheSize(size_t bytes) {
+    _response_cache.budget(bytes);
+}
+
+void RequestHandler::clearResponseCache() {
+    _response_cache.clear();
+}
 
+string RequestHandler::getResponseCacheStats(int level) {
+    return cacheStats(_response_cache, level);
+}
 
 bool RequestHandler::urlDecode(const string& in, string& out) {
     out.clear();
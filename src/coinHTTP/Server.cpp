@@ -16,6 +16,7 @@
 
 #include <coinHTTP/Server.h>
 #include <boost/bind.hpp>
+#include <boost/thread.hpp>
 #include <signal.h>
 
 using namespace std;
@@ -26,15 +27,16 @@ using namespace asio;
 boost__asio__signal_set* __signal_set = NULL;
 #endif
 
-Server::Server(const string address, const string port, const string doc_root, const string log_dir) : 
+Server::Server(const string address, const string port, const string doc_root, const string log_dir, const size_t threads, const size_t workers) : 
 _io_service(),
+_threads(std::max(threads, (size_t)1)),
 _context(_io_service, boost::asio::ssl::context::sslv23),
 _secure(false),
 _signals(_io_service),
 _acceptor(_io_service),
 _connectionManager(),
 _new_connection(),
-_requestHandler(doc_root),
+_requestHandler(doc_root, workers),
 _logger(log_dir) {
     // Register to handle the signals that indicate when the server should exit.
     // It is safe to register for the same signal multiple times in a program,
@@ -86,7 +88,15 @@ void Server::run() {
     // asynchronous operation outstanding: the asynchronous accept call waiting
     // for new incoming connections.
     start_accept();
+    
+    // The calling thread is one of the threads running the io_service.
+    thread_group threads;
+    typedef size_t (io_service::*Run)();
+    Run run = &io_service::run;
+    for (size_t i = 1; i < _threads; ++i)
+        threads.create_thread(bind(run, &_io_service));
     _io_service.run();
+    threads.join_all();
 }
 
 void Server::shutdown(){
@@ -26,7 +26,38 @@ using namespace std;
 using namespace boost;
 using namespace json_spirit;
 
-Value GetDebit::operator()(const Array& params, bool fHelp) {
+static Object coin2json(const Coin& coin) {
+    Object obj;
+    obj.push_back(Pair("hash", coin.hash.toString()));
+    obj.push_back(Pair("n", boost::uint64_t(coin.index)));
+    return obj;
+}
+
+Value CoinListMethod::operator()(const Array& params, bool fHelp) {
+    Coins coins;
+    
+    listCoins(params, fHelp, coins);
+    
+    Array list;
+    
+    for(Coins::iterator coin = coins.begin(); coin != coins.end(); ++coin)
+        list.push_back(coin2json(*coin));
+    
+    return list;
+}
+
+void CoinListMethod::operator()(const Array& params, bool fHelp, const Request& request, JSONWriter& writer) {
+    Coins coins;
+    
+    listCoins(params, fHelp, coins);
+    
+    writer.beginArray();
+    for(Coins::iterator coin = coins.begin(); coin != coins.end(); ++coin)
+        writer.write(coin2json(*coin));
+    writer.endArray();
+}
+
+void GetDebit::listCoins(const Array& params, bool fHelp, Coins& coins) {
     if (fHelp || params.size() != 1)
         throw RPC::error(RPC::invalid_params, "getdebit <btcaddr>\n"
                          "Get debit coins of <btcaddr>");
@@ -38,24 +69,10 @@ Value GetDebit::operator()(const Array& params, bool fHelp) {
     
     PubKeyHash address = addr.getPubKeyHash();
     
-    Coins coins;
-    
     _explorer.getDebit(address, coins);
-    
-    Array list;
-    
-    for(Coins::iterator coin = coins.begin(); coin != coins.end(); ++coin) {
-        Object obj;
-        obj.clear();
-        obj.push_back(Pair("hash", coin->hash.toString()));
-        obj.push_back(Pair("n", boost::uint64_t(coin->index)));
-        list.push_back(obj);
-    }
-    
-    return list;
 }
 
-Value GetCredit::operator()(const Array& params, bool fHelp) {        
+void GetCredit::listCoins(const Array& params, bool fHelp, Coins& coins) {        
     if (fHelp || params.size() != 1)
         throw RPC::error(RPC::invalid_params, "getcredit <btcaddr>\n"
                          "Get credit coins of <btcaddr>");
@@ -67,24 +84,10 @@ Value GetCredit::operator()(const Array& params, bool fHelp) {
     
     PubKeyHash address = addr.getPubKeyHash();
     
-    Coins coins;
-    
     _explorer.getCredit(address, coins);
-    
-    Array list;
-    
-    for(Coins::iterator coin = coins.begin(); coin != coins.end(); ++coin) {
-        Object obj;
-        obj.clear();
-        obj.push_back(Pair("hash", coin->hash.toString()));
-        obj.push_back(Pair("n", boost::uint64_t(coin->index)));
-        list.push_back(obj);
-    }
-    
-    return list;
 }
 
-Value GetCoins::operator()(const Array& params, bool fHelp) {        
+void GetCoins::listCoins(const Array& params, bool fHelp, Coins& coins) {        
     if (fHelp || params.size() != 1)
         throw RPC::error(RPC::invalid_params, "getcoins <btcaddr>/<PubKeyHash>\n"
                          "Get un spent coins of <btcaddr>/<PubKeyHash>");
@@ -103,21 +106,7 @@ Value GetCoins::operator()(const Array& params, bool fHelp) {
     else
         address = addr.getPubKeyHash();
 
-    Coins coins;
-    
     _explorer.getCoins(address, coins);
-    
-    Array list;
-    
-    for(Coins::iterator coin = coins.begin(); coin != coins.end(); ++coin) {
-        Object obj;
-        obj.clear();
-        obj.push_back(Pair("hash", coin->hash.toString()));
-        obj.push_back(Pair("n", boost::uint64_t(coin->index)));
-        list.push_back(obj);
-    }
-    
-    return list;
 }
 
 Value GetAddressBalance::operator()(const Array& params, bool fHelp) {        
@@ -0,0 +1,96 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/CoinIndex.h>
+#include <coinWallet/WalletTx.h>
+
+using namespace std;
+
+static bool matured(int height, int best) {
+    return best - height + 1 >= COINBASE_MATURITY + 20;
+}
+
+void CoinIndex::insert(const CWalletTx& tx, unsigned int n, int64 value, int height, bool from_me) {
+    Coin coin(tx.getHash(), n);
+    if (_coins.count(coin))
+        return;
+    Entry entry;
+    entry.coin = coin;
+    entry.tx = &tx;
+    entry.height = height;
+    entry.from_me = from_me;
+    entry.coinbase = tx.isCoinBase();
+    _coins[coin] = _by_value.insert(make_pair(value, entry));
+    
+    if (height < 0) {
+        _unconfirmed += value;
+        _unconfirmed_txes[&tx] += value;
+    }
+    else if (entry.coinbase)
+        _immature.insert(make_pair(height, coin));
+    else
+        _confirmed += value;
+}
+
+void CoinIndex::erase(const uint256& hash) {
+    Coins::iterator c = _coins.lower_bound(Coin(hash, 0));
+    while (c != _coins.end() && c->first.hash == hash) {
+        int64 value = c->second->first;
+        const Entry& entry = c->second->second;
+        if (entry.height < 0) {
+            _unconfirmed -= value;
+            Unconfirmed::iterator u = _unconfirmed_txes.find(entry.tx);
+            if (u != _unconfirmed_txes.end() && (u->second -= value) == 0)
+                _unconfirmed_txes.erase(u);
+        }
+        else if (!entry.coinbase || !_immature.erase(make_pair(entry.height, entry.coin)))
+            _confirmed -= value;
+        _by_value.erase(c->second);
+        _coins.erase(c++);
+    }
+}
+
+void CoinIndex::clear() {
+    _by_value.clear();
+    _coins.clear();
+    _immature.clear();
+    _unconfirmed_txes.clear();
+    _confirmed = 0;
+    _unconfirmed = 0;
+}
+
+void CoinIndex::mature(int best) {
+    while (!_immature.empty() && matured(_immature.begin()->first, best)) {
+        _confirmed += _coins[_immature.begin()->second]->first;
+        _immature.erase(_immature.begin());
+    }
+}
+
+bool CoinIndex::spendable(const Entry& entry, int best, int conf_mine, int conf_theirs) {
+    if (entry.height < 0)
+        return false;
+    if (entry.coinbase && !matured(entry.height, best))
+        return false;
+    return depth(entry, best) >= (entry.from_me ? conf_mine : conf_theirs);
+}
+
+int64 CoinIndex::balance(int best) const {
+    int64 balance = _confirmed;
+    // coinbases matured since the last call of mature
+    for (Immature::const_iterator i = _immature.begin(); i != _immature.end() && matured(i->first, best); ++i)
+        balance += _coins.find(i->second)->second->first;
+    return balance;
+}
@@ -0,0 +1,243 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/CoinSelector.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+using namespace std;
+
+selector_ptr createCoinSelector(const string& name, int64 fee_rate) {
+    if (name == "bnb")
+        return selector_ptr(new BranchAndBound(selector_ptr(new Knapsack)));
+    if (name == "knapsack")
+        return selector_ptr(new Knapsack);
+    if (name == "largest")
+        return selector_ptr(new LargestFirst);
+    if (name == "consolidate")
+        return selector_ptr(new Consolidation(50, fee_rate));
+    return selector_ptr();
+}
+
+bool BranchAndBound::operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const {
+    selection.clear();
+    value = 0;
+    
+    // search the largest coins first. Coins above the window are never part of a selection without change.
+    typedef CoinCandidates::const_iterator Iterator;
+    vector<Iterator> coins;
+    vector<int64> values;
+    for (Iterator c = candidates.upper_bound(target + _window); c != candidates.begin();) {
+        --c;
+        if (c->first <= 0)
+            break;
+        if (!candidates.accepts(c->second))
+            continue;
+        coins.push_back(c);
+        values.push_back(c->first);
+    }
+    
+    // the value of the coins from each coin on bounds what a branch can reach
+    size_t n = values.size();
+    vector<int64> tail(n + 1, 0);
+    for (size_t i = n; i > 0; --i)
+        tail[i - 1] = tail[i] + values[i - 1];
+    
+    vector<size_t> branch;
+    vector<size_t> best;
+    int64 best_surplus = _window + 1;
+    int64 sum = 0;
+    size_t i = 0;
+    for (size_t tries = 0; tries < max_tries; ++tries) {
+        // skip the coins that would exceed the window
+        if (sum < target)
+            i = lower_bound(values.begin() + i, values.end(), target + _window - sum, greater<int64>()) - values.begin();
+        
+        bool backtrack = false;
+        if (sum + tail[i] < target)
+            backtrack = true;
+        else if (sum >= target) {
+            backtrack = true;
+            if (sum - target < best_surplus) {
+                best = branch;
+                best_surplus = sum - target;
+                if (best_surplus == 0)
+                    break;
+            }
+        }
+        
+        if (backtrack) {
+            if (branch.empty())
+                break;
+            // try the branch without the last coin included - and without the coins of the same value
+            i = branch.back();
+            sum -= values[i];
+            branch.pop_back();
+            for (++i; i < n && values[i] == values[i - 1]; ++i);
+        }
+        else {
+            branch.push_back(i);
+            sum += values[i++];
+        }
+    }
+    
+    if (best.empty())
+        return _fallback && (*_fallback)(candidates, target, selection, value);
+    
+    for (vector<size_t>::const_iterator b = best.begin(); b != best.end(); ++b)
+        CoinCandidates::select(*coins[*b], selection, value);
+    return true;
+}
+
+bool Knapsack::operator()(const CoinCandidates& candidates, int64 nTargetValue, CoinSelection& setCoinsRet, int64& nValueRet) const {
+    setCoinsRet.clear();
+    nValueRet = 0;
+    
+    // List of values less than target - only the coins below the target plus a cent are walked
+    typedef CoinCandidates::const_iterator Iterator;
+    vector<Iterator> vValue;
+    int64 nTotalLower = 0;
+    
+    Iterator lower = candidates.lower_bound(nTargetValue + CENT);
+    for (Iterator coin = candidates.upper_bound(0); coin != lower; ++coin) {
+        if (!candidates.accepts(coin->second))
+            continue;
+        if (coin->first == nTargetValue) {
+            CoinCandidates::select(*coin, setCoinsRet, nValueRet);
+            return true;
+        }
+        vValue.push_back(coin);
+        nTotalLower += coin->first;
+    }
+    
+    // the lowest larger coin is the first accepted one from there
+    Iterator coinLowestLarger = lower;
+    while (coinLowestLarger != candidates.end() && !candidates.accepts(coinLowestLarger->second))
+        ++coinLowestLarger;
+    bool fLowestLarger = (coinLowestLarger != candidates.end());
+    
+    if (nTotalLower == nTargetValue || nTotalLower == nTargetValue + CENT) {
+        for (int i = 0; i < vValue.size(); ++i)
+            CoinCandidates::select(*vValue[i], setCoinsRet, nValueRet);
+        return true;
+    }
+    
+    if (nTotalLower < nTargetValue + (fLowestLarger ? CENT : 0)) {
+        if (!fLowestLarger)
+            return false;
+        CoinCandidates::select(*coinLowestLarger, setCoinsRet, nValueRet);
+        return true;
+    }
+    
+    if (nTotalLower >= nTargetValue + CENT)
+        nTargetValue += CENT;
+    
+    // Solve subset sum by stochastic approximation - the values are walked largest first
+    reverse(vValue.begin(), vValue.end());
+    vector<char> vfIncluded;
+    vector<char> vfBest(vValue.size(), true);
+    int64 nBest = nTotalLower;
+    
+    for (int nRep = 0; nRep < iterations && nBest != nTargetValue; nRep++) {
+        vfIncluded.assign(vValue.size(), false);
+        int64 nTotal = 0;
+        bool fReachedTarget = false;
+        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++) {
+            for (int i = 0; i < vValue.size(); i++) {
+                if (nPass == 0 ? rand() % 2 : !vfIncluded[i]) {
+                    nTotal += vValue[i]->first;
+                    vfIncluded[i] = true;
+                    if (nTotal >= nTargetValue) {
+                        fReachedTarget = true;
+                        if (nTotal < nBest) {
+                            nBest = nTotal;
+                            vfBest = vfIncluded;
+                        }
+                        nTotal -= vValue[i]->first;
+                        vfIncluded[i] = false;
+                    }
+                }
+            }
+        }
+    }
+    
+    // If the next larger is still closer, return it
+    if (fLowestLarger && coinLowestLarger->first - nTargetValue <= nBest - nTargetValue)
+        CoinCandidates::select(*coinLowestLarger, setCoinsRet, nValueRet);
+    else {
+        for (int i = 0; i < vValue.size(); i++)
+            if (vfBest[i])
+                CoinCandidates::select(*vValue[i], setCoinsRet, nValueRet);
+    }
+    
+    return true;
+}
+
+bool LargestFirst::operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const {
+    selection.clear();
+    value = 0;
+    for (CoinCandidates::const_reverse_iterator c = candidates.rbegin(); c != candidates.rend() && value < target; ++c) {
+        if (c->first <= 0)
+            break;
+        if (candidates.accepts(c->second))
+            CoinCandidates::select(*c, selection, value);
+    }
+    return value >= target;
+}
+
+/// Advance to the next accepted coin.
+static CoinCandidates::const_iterator nextAccepted(const CoinCandidates& candidates, CoinCandidates::const_iterator c) {
+    while (c != candidates.end() && !candidates.accepts(c->second))
+        ++c;
+    return c;
+}
+
+bool Consolidation::operator()(const CoinCandidates& candidates, int64 target, CoinSelection& selection, int64& value) const {
+    selection.clear();
+    value = 0;
+    if (_max_inputs == 0)
+        return false;
+    
+    // skip the coins worth less than the fee of spending them
+    int64 cost = _fee_rate * input_size / 1000;
+    typedef CoinCandidates::const_iterator Iterator;
+    Iterator first = nextAccepted(candidates, candidates.upper_bound(max(cost, (int64)0)));
+    
+    // the window of coins [lo, hi) starts at the smallest
+    Iterator lo = first;
+    Iterator hi = first;
+    size_t inputs = 0;
+    for (; hi != candidates.end() && inputs < _max_inputs; hi = nextAccepted(candidates, ++hi), ++inputs)
+        value += hi->first;
+    
+    // slide the window up, replacing the smallest coin by the next larger one, until the target is reached
+    while (value < target && hi != candidates.end()) {
+        value -= lo->first;
+        lo = nextAccepted(candidates, ++lo);
+        value += hi->first;
+        hi = nextAccepted(candidates, ++hi);
+    }
+    if (value < target) {
+        value = 0;
+        return false;
+    }
+    
+    for (Iterator c = lo; c != hi; c = nextAccepted(candidates, ++c))
+        selection.insert(make_pair(c->second.tx, c->second.coin.index));
+    return true;
+}
@@ -66,6 +66,49 @@ bool CCryptoKeyStore::addKey(const CKey& key)
 }
 
 
+bool CCryptoKeyStore::addKeys(const std::vector<CKey>& keys, const std::vector<std::vector<unsigned char> >& cryptedSecrets)
+{
+    CRITICAL_BLOCK(cs_KeyStore)
+    {
+    if (!IsCrypted()) {
+        BOOST_FOREACH(const CKey& key, keys)
+            if (!BasicKeyStore::addKey(key))
+                return false;
+        return true;
+    }
+    
+    if (cryptedSecrets.size() != keys.size())
+        return false;
+    for (size_t i = 0; i < keys.size(); ++i)
+        if (!CCryptoKeyStore::addCryptedKey(keys[i].GetPubKey(), cryptedSecrets[i]))
+            return false;
+    }
+    return true;
+}
+
+bool CCryptoKeyStore::getMasterKey(CKeyingMaterial& vMasterKeyOut) const
+{
+    CRITICAL_BLOCK(cs_KeyStore)
+    {
+    if (!IsCrypted() || IsLocked())
+        return false;
+    vMasterKeyOut = vMasterKey;
+    }
+    return true;
+}
+
+bool CCryptoKeyStore::encryptKey(const CKeyingMaterial& vMasterKey, const CKey& key, std::vector<unsigned char>& vchCryptedSecret)
+{
+    PubKey vchPubKey = key.GetPubKey();
+    uint256 nIV = Hash(vchPubKey.begin(), vchPubKey.end());
+    std::vector<unsigned char> chIV(WALLET_CRYPTO_KEY_SIZE);
+    memcpy(&chIV[0], &nIV, WALLET_CRYPTO_KEY_SIZE);
+    bool fCompressed;
+    CSecret vchSecret = key.GetSecret(fCompressed);
+    CCrypter crypter;
+    return crypter.SetKey(vMasterKey, chIV) && crypter.Encrypt((CKeyingMaterial)vchSecret, vchCryptedSecret);
+}
+
 bool CCryptoKeyStore::addCryptedKey(const PubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
     CRITICAL_BLOCK(cs_KeyStore)
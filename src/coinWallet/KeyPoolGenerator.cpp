@@ -0,0 +1,122 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/KeyPoolGenerator.h>
+
+#include <coin/util.h>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+
+KeyPoolGenerator::KeyPoolGenerator(size_t workers) : _workers(workers ? workers : std::max(thread::hardware_concurrency(), 1u)), _pending(0), _failed(false), _refilling(NULL), _generated(0), _generators_work(new asio::io_service::work(_generators)), _refills_work(new asio::io_service::work(_refills)) {
+    typedef size_t (asio::io_service::*Run)();
+    Run run = &asio::io_service::run;
+    for (size_t i = 0; i < _workers; ++i)
+        _generator_threads.create_thread(bind(run, &_generators));
+    _refill_threads.create_thread(bind(run, &_refills));
+}
+
+KeyPoolGenerator::~KeyPoolGenerator() {
+    // the refill thread first, as a refill uses the generators
+    _refills_work.reset();
+    _refill_threads.join_all();
+    _generators_work.reset();
+    _generator_threads.join_all();
+}
+
+void KeyPoolGenerator::generate(size_t n, vector<CKey>& keys) {
+    vector<vector<unsigned char> > cryptedSecrets;
+    generate(n, keys, Encrypt(), cryptedSecrets);
+}
+
+void KeyPoolGenerator::generate(size_t n, vector<CKey>& keys, Encrypt encrypt, vector<vector<unsigned char> >& cryptedSecrets) {
+    keys.resize(n);
+    cryptedSecrets.resize(encrypt ? n : 0);
+    if (n == 0)
+        return;
+    
+    RandAddSeedPerfmon();
+    
+    // one generation at a time, as they share the pending count
+    mutex::scoped_lock generate(_generate);
+    
+    // one range pr worker - the ranges differ by at most one key
+    size_t ranges = std::min(_workers, n);
+    mutex::scoped_lock lock(_mutex);
+    _pending = ranges;
+    _failed = false;
+    for (size_t i = 0; i < ranges; ++i)
+        _generators.post(bind(&KeyPoolGenerator::generateRange, this, ref(keys), encrypt, ref(cryptedSecrets), n*i/ranges, n*(i+1)/ranges));
+    while (_pending)
+        _done.wait(lock);
+    if (_failed)
+        throw key_error("KeyPoolGenerator::generate() : key generation or encryption failed");
+    _generated += n;
+}
+
+void KeyPoolGenerator::generateRange(vector<CKey>& keys, Encrypt encrypt, vector<vector<unsigned char> >& cryptedSecrets, size_t begin, size_t end) {
+    bool failed = false;
+    try {
+        for (size_t i = begin; i < end && !failed; ++i) {
+            keys[i].MakeNewKey();
+            if (encrypt && !encrypt(keys[i], cryptedSecrets[i]))
+                failed = true;
+        }
+    }
+    catch (key_error& e) {
+        failed = true;
+    }
+    
+    mutex::scoped_lock lock(_mutex);
+    _failed = _failed || failed;
+    if (--_pending == 0)
+        _done.notify_all();
+}
+
+void KeyPoolGenerator::refill(Refill refill, const void* owner) {
+    mutex::scoped_lock lock(_mutex);
+    if (!_scheduled.insert(owner).second)
+        return;
+    _refills.post(bind(&KeyPoolGenerator::scheduled, this, refill, owner));
+}
+
+void KeyPoolGenerator::cancel(const void* owner) {
+    mutex::scoped_lock lock(_mutex);
+    _scheduled.erase(owner);
+    while (_refilling == owner)
+        _refilled.wait(lock);
+}
+
+void KeyPoolGenerator::scheduled(Refill refill, const void* owner) {
+    {
+        mutex::scoped_lock lock(_mutex);
+        // cancelled
+        if (!_scheduled.erase(owner))
+            return;
+        _refilling = owner;
+    }
+    try {
+        refill();
+    }
+    catch (std::exception& e) {
+        printf("KeyPoolGenerator::scheduled() : refill failed: %s\n", e.what());
+    }
+    mutex::scoped_lock lock(_mutex);
+    _refilling = NULL;
+    _refilled.notify_all();
+}
@@ -6,6 +6,7 @@
 #include <coinWallet/Wallet.h>
 #include <coinWallet/WalletDB.h>
 #include <coinWallet/WalletTx.h>
+#include <coinWallet/WalletScanner.h>
 //#include <coinChain/db.h>
 #include <coinWallet/Crypter.h>
 #include <coinWallet/CryptoKeyStore.h>
@@ -23,10 +24,18 @@ using namespace std;
 // mapWallet
 //
 
+void Wallet::keyAdded(const PubKeyHash& hash)
+{
+    CRITICAL_BLOCK(cs_wallet)
+        if (_keyAdded)
+            _keyAdded(hash);
+}
+
 bool Wallet::addKey(const CKey& key)
 {
     if (!CCryptoKeyStore::addKey(key))
         return false;
+    keyAdded(toPubKeyHash(key.GetPubKey()));
     if (!fFileBacked)
         return true;
     if (!IsCrypted())
@@ -38,6 +47,7 @@ bool Wallet::addCryptedKey(const vector<unsigned char> &vchPubKey, const vector<
 {
     if (!CCryptoKeyStore::addCryptedKey(vchPubKey, vchCryptedSecret))
         return false;
+    keyAdded(toPubKeyHash(vchPubKey));
     if (!fFileBacked)
         return true;
     CRITICAL_BLOCK(cs_wallet)
@@ -49,6 +59,16 @@ bool Wallet::addCryptedKey(const vector<unsigned char> &vchPubKey, const vector<
     }
 }
 
+bool Wallet::addScript(const Script& redeemScript)
+{
+    if (!CCryptoKeyStore::addScript(redeemScript))
+        return false;
+    CRITICAL_BLOCK(cs_wallet)
+        if (_scriptAdded)
+            _scriptAdded(toScriptHash(redeemScript));
+    return true;
+}
+
 bool Wallet::Unlock(const SecureString& strWalletPassphrase)
 {
     if (!IsLocked())
@@ -217,6 +237,7 @@ void Wallet::WalletUpdateSpent(const Transaction &tx)
                     printf("WalletUpdateSpent found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.getHash().toString().c_str());
                     wtx.MarkSpent(txin.prevout().index);
                     wtx.WriteToDisk();
+                    IndexCoins(wtx);
                     vWalletUpdated.push_back(txin.prevout().hash);
                 }
             }
@@ -234,8 +255,11 @@ bool Wallet::AddToWallet(const CWalletTx& wtxIn)
         CWalletTx& wtx = (*ret.first).second;
         wtx.pwallet = this;
         bool fInsertedNew = ret.second;
-        if (fInsertedNew)
+        if (fInsertedNew) {
             wtx.nTimeReceived = GetAdjustedTime();
+            if (_txChecked)
+                _txChecked(hash, true);
+        }
 
         bool fUpdated = false;
         if (!fInsertedNew)
@@ -264,9 +288,11 @@ bool Wallet::AddToWallet(const CWalletTx& wtxIn)
         printf("AddToWallet %s  %s%s\n", wtxIn.getHash().toString().substr(0,10).c_str(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
         // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk())
-                return false;
+        if (fInsertedNew || fUpdated) {
+            wtx.WriteToDisk();
+            IndexCoins(wtx);
+            _snapshotTxes.insert(hash);
+        }
 
         // If default receiving address gets used, replace it with a new one
         Script scriptDefaultKey;
@@ -311,8 +337,11 @@ bool Wallet::AddToWalletIfInvolvingMe(const Transaction& tx, const Block* pblock
                 wtx.setMerkleBranch(*pblock, _blockChain);
             return AddToWallet(wtx);
         }
-        else
+        else {
             WalletUpdateSpent(tx);
+            if (_txChecked)
+                _txChecked(hash, false);
+        }
     }
     return false;
 }
@@ -323,9 +352,13 @@ bool Wallet::EraseFromWallet(uint256 hash)
         return false;
     CRITICAL_BLOCK(cs_wallet)
     {
+        _coins.erase(hash);
+        UnscheduleResend(hash);
         if (mapWallet.erase(hash))
-            CWalletDB(_dataDir, strWalletFile).EraseTx(hash);
+            _writer->erase(make_pair(string("tx"), hash));
+        _snapshotTxes.insert(hash);
     }
+    PublishSnapshot();
     return true;
 }
 
@@ -437,140 +470,97 @@ void Wallet::Sync() // sync from the start!
 
 int Wallet::ScanForWalletTransactions(const CBlockIndex* pindexStart, bool fUpdate)
 {
-    int ret = 0;
-
     const CBlockIndex* pindex = (pindexStart == NULL) ? _blockChain.getBlockIndex(_blockChain.getGenesisHash()) : pindexStart;
-    CRITICAL_BLOCK(cs_wallet) {
-        while (pindex) {
-            Block block;
-            _blockChain.getBlock(pindex, block);
-        
-            TransactionList txes = block.getTransactions();
-            for(TransactionList::const_iterator tx = txes.begin(); tx != txes.end(); ++tx) {
-                if (AddToWalletIfInvolvingMe(*tx, &block, fUpdate))
-                    ret++;
-            }
-            pindex = pindex->pnext;
-        }
-    }
+    WalletScanner scanner(*this, _blockChain);
+    int ret = scanner.scan(pindex, fUpdate);
+    Flush();
+    PublishSnapshot();
     return ret;
 }
 
 
-void Wallet::ReacceptWalletTransactions()
+// the resend schedule of an unconfirmed transaction: first after a few minutes, at a random delay to avoid giving away
+// that it is ours, then at doubling intervals
+static const int64 RESEND_DELAY = 5 * 60;
+static const int64 RESEND_MAX_INTERVAL = 4 * 60 * 60;
+
+// the longest the resend timer waits, so transactions scheduled meanwhile are not held back
+static const int64 RESEND_POLL = 5 * 60;
+
+void Wallet::ScheduleResend(const CWalletTx& wtx, int height)
 {
-    //    CTxDB txdb("r");
-    bool fRepeat = true;
-    while (fRepeat) CRITICAL_BLOCK(cs_wallet) {
-        fRepeat = false;
-        vector<uint256> vMissingTx;
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
-            CWalletTx& wtx = item.second;
-            if (wtx.isCoinBase() && wtx.IsSpent(0))
-                continue;
-
-            uint256 hash = wtx.getHash();
-            // figure out if this tx has been spend from somewhere else - so ask the blockChain if it is spent
-        
-            bool fUpdated = false;
-            
-            int spents = _blockChain.getNumSpent(hash);
-            if(spents >= 0) {
-                if(spents != wtx.getNumOutputs()) {
-                    printf("ERROR: ReacceptWalletTransactions() : txindex.vSpent.size() %d != wtx.vout.size() %d\n", spents, wtx.getNumOutputs());
-                    continue;
-                }
-            
-                for (int i = 0; i < spents; i++) {
-                    if (wtx.IsSpent(i))
-                        continue;
-                    Coin coin(hash, i);
-                    if (!_blockChain.isSpent(coin) && IsMine(wtx.getOutput(i))) {
-                        wtx.MarkSpent(i);
-                        fUpdated = true;
-                        vMissingTx.push_back(_blockChain.spentIn(coin));
-                    }
-                }
-                if (fUpdated) {
-                    printf("ReacceptWalletTransactions found spent coin %sbc %s\n", FormatMoney(wtx.GetCredit()).c_str(), wtx.getHash().toString().c_str());
-                    wtx.MarkDirty();
-                    wtx.WriteToDisk();
-                }
-            
-            }
-            else {
-                // Reaccept any txes of ours that aren't already in a block
-                if (!wtx.isCoinBase()) {
-                    const Transaction tx(wtx);
-                    acceptTransaction(tx);                
-                }
-                //                    _blockChain.acceptTransaction(wtx);
-                //                    wtx.AcceptWalletTransaction(txdb, false);
-            }
-        }
-        if (!vMissingTx.empty())
-        {
-            // TODO: optimize this to scan just part of the block chain?
-            if (ScanForWalletTransactions(_blockChain.getBlockIndex(_blockChain.chain().genesisHash())))
-                fRepeat = true;  // Found missing transactions: re-do Reaccept.
-        }
+    uint256 hash = wtx.getHash();
+    if (wtx.isCoinBase() || height >= 0) {
+        UnscheduleResend(hash);
+        return;
     }
+    if (_unconfirmed.count(hash))
+        return;
+    Resend& resend = _unconfirmed[hash];
+    resend.next = (int64)wtx.nTimeReceived + RESEND_DELAY + GetRand(30 * 60);
+    resend.count = 0;
+    _resends.insert(make_pair(resend.next, hash));
 }
 
-// This will be polled from the TransactionFilter infrequently
-void Wallet::resend() {
-    // Only do it if there's been a new block since last time
-    static int64 nLastTime;
-    if (_blockChain.getBestReceivedTime() < nLastTime)
+void Wallet::UnscheduleResend(const uint256& hash)
+{
+    Unconfirmed::iterator it = _unconfirmed.find(hash);
+    if (it == _unconfirmed.end())
         return;
-    nLastTime = GetTime();
+    _resends.erase(make_pair(it->second.next, hash));
+    _unconfirmed.erase(it);
+}
+
+void Wallet::resendTimeout(guard_ptr guard, const boost::system::error_code& error)
+{
+    if (error == boost::asio::error::operation_aborted)
+        return;
+    boost::mutex::scoped_lock lock(guard->mutex);
+    if (guard->wallet)
+        guard->wallet->resend();
+}
 
-    // Rebroadcast any of our txes that aren't in a block yet
-    printf("ResendWalletTransactions()\n");
+// This will be polled from the TransactionFilter infrequently
+void Wallet::resend() {
+    int64 nNow = GetTime();
+    int64 nWait = RESEND_POLL;
+    
+    // Rebroadcast the txes of ours that aren't in a block yet, and are due
+    multimap<unsigned int, Transaction> mapSorted;
     CRITICAL_BLOCK(cs_wallet) {
-        // Sort them in chronological order
-        multimap<unsigned int, CWalletTx*> mapSorted;
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
-            CWalletTx& wtx = item.second;
-            // Don't rebroadcast until it's had plenty of time that
-            // it should have gotten in already by now.
-            if (_blockChain.getBestReceivedTime() - (int64)wtx.nTimeReceived > 5 * 60)
-                mapSorted.insert(make_pair(wtx.nTimeReceived, &wtx));
-        }
-        BOOST_FOREACH(PAIRTYPE(const unsigned int, CWalletTx*)& item, mapSorted) {
-            CWalletTx& wtx = *item.second;
-            _emit(wtx);
-            /*
-             BOOST_FOREACH(const CMerkleTx& tx, vtxPrev)
-             {
-             if (!tx.IsCoinBase())
-             {
-             uint256 hash = tx.GetHash();
-             if (!txdb.ContainsTx(hash))
-             RelayMessage(Inventory(MSG_TX, hash), (Transaction)tx);
-             }
-             }
-             if (!IsCoinBase())
-             {
-             uint256 hash = GetHash();
-             if (!txdb.ContainsTx(hash))
-             {
-             printf("Relaying wtx %s\n", hash.toString().substr(0,10).c_str());
-             RelayMessage(Inventory(MSG_TX, hash), (Transaction)*this);
-             }
-             }
-             */
-            //            const uint256 hash = wtx.getHash();
-            //hashes.insert(hash);
-            //            wtx.RelayWalletTransaction(txdb);
+        while (!_resends.empty() && _resends.begin()->first <= nNow) {
+            uint256 hash = _resends.begin()->second;
+            _resends.erase(_resends.begin());
+            
+            const CWalletTx& wtx = mapWallet[hash];
+            Resend& resend = _unconfirmed[hash];
+            ++resend.count;
+            resend.next = nNow + std::min(RESEND_DELAY << std::min(resend.count, 16u), RESEND_MAX_INTERVAL) + GetRand(RESEND_DELAY);
+            _resends.insert(make_pair(resend.next, hash));
+            
+            mapSorted.insert(make_pair(wtx.nTimeReceived, (Transaction)wtx));
         }
+        if (!_resends.empty())
+            nWait = std::max((int64)1, std::min(nWait, _resends.begin()->first - nNow));
     }
-    _resend_timer.expires_from_now(boost::posix_time::seconds(GetRand(30 * 60)));
-    _resend_timer.async_wait(boost::bind(&Wallet::resend, this));
+    
+    // Sort them in chronological order, so the transactions spending others follow them
+    if (!mapSorted.empty())
+        printf("ResendWalletTransactions() : %d transactions\n", (int)mapSorted.size());
+    for (multimap<unsigned int, Transaction>::const_iterator it = mapSorted.begin(); it != mapSorted.end(); ++it)
+        _emit(it->second);
+    
+    _resend_timer.expires_from_now(boost::posix_time::seconds(nWait));
+    _resend_timer.async_wait(boost::bind(&Wallet::resendTimeout, _guard, boost::asio::placeholders::error));
 }
 
-bool Wallet::WriteToDisk(const CWalletTx& wtx) {
-    return CWalletDB(_dataDir, strWalletFile).WriteTx(wtx.getHash(), wtx);
+void Wallet::WriteToDisk(const CWalletTx& wtx) {
+    if (_writer)
+        _writer->write(make_pair(string("tx"), wtx.getHash()), wtx);
+}
+
+bool Wallet::Flush() {
+    return !_writer || _writer->flush();
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -579,169 +569,207 @@ bool Wallet::WriteToDisk(const CWalletTx& wtx) {
 //
 
 
-int64 Wallet::GetBalance(bool confirmed) const
+int Wallet::GetHeight(const CWalletTx& wtx) const
+{
+    int height = (wtx._blockHash != 0) ? _blockChain.getHeight(wtx._blockHash) : -1;
+    if (height < 0)
+        height = _blockChain.getHeight(wtx.getHash());
+    return height;
+}
+
+void Wallet::IndexCoins(const CWalletTx& wtx)
+{
+    uint256 hash = wtx.getHash();
+    _coins.erase(hash);
+
+    int height = GetHeight(wtx);
+    ScheduleResend(wtx, height);
+    // a coinbase not in the main chain will never be spendable
+    if (wtx.isCoinBase() && height < 0)
+        return;
+
+    bool fromMe = wtx.IsFromMe();
+    for (unsigned int i = 0; i < wtx.getNumOutputs(); i++) {
+        const Output& txout = wtx.getOutput(i);
+        if (!wtx.IsSpent(i) && txout.value() > 0 && IsMine(txout))
+            _coins.insert(wtx, i, txout.value(), height, fromMe);
+    }
+}
+
+void Wallet::ReindexCoins()
 {
-    int64 nTotal = 0;
     CRITICAL_BLOCK(cs_wallet)
     {
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-        {
-            const CWalletTx* pcoin = &(*it).second;
-            if (confirmed && !IsConfirmed(*pcoin))
-                continue;
-            nTotal += pcoin->GetAvailableCredit(false);
+        _coins.clear();
+        _coinsBest = _blockChain.getBestChain();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it) {
+            IndexCoins(it->second);
+            // the snapshot aggregates by the confirming heights too
+            _snapshotTxes.insert(it->first);
         }
+        _coins.mature(_blockChain.getBestHeight());
     }
-
-    return nTotal;
 }
 
-
-bool Wallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
+void Wallet::PublishSnapshot()
 {
-    setCoinsRet.clear();
-    nValueRet = 0;
-
-    // List of values less than target
-    pair<int64, pair<const CWalletTx*,unsigned int> > coinLowestLarger;
-    coinLowestLarger.first = INT64_MAX;
-    coinLowestLarger.second.first = NULL;
-    vector<pair<int64, pair<const CWalletTx*,unsigned int> > > vValue;
-    int64 nTotalLower = 0;
-
     CRITICAL_BLOCK(cs_wallet)
     {
-       vector<const CWalletTx*> vCoins;
-       vCoins.reserve(mapWallet.size());
-       for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
-           vCoins.push_back(&(*it).second);
-       random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
-
-       BOOST_FOREACH(const CWalletTx* pcoin, vCoins)
-       {
-            if (!_blockChain.isFinal(*pcoin) || !IsConfirmed(*pcoin))
-                continue;
-
-            if (pcoin->isCoinBase() && _blockChain.getBlocksToMaturity(*pcoin) > 0)
-                continue;
-
-       int nDepth = _blockChain.getDepthInMainChain(pcoin->getHash());
-            if (nDepth < (pcoin->IsFromMe() ? nConfMine : nConfTheirs))
-                continue;
-
-            for (int i = 0; i < pcoin->getNumOutputs(); i++)
-            {
-                if (pcoin->IsSpent(i) || !IsMine(pcoin->getOutput(i)))
-                    continue;
-
-                int64 n = pcoin->getOutput(i).value();
-
-                if (n <= 0)
-                    continue;
-
-                pair<int64,pair<const CWalletTx*,unsigned int> > coin = make_pair(n,make_pair(pcoin,i));
-
-                if (n == nTargetValue)
-                {
-                    setCoinsRet.insert(coin.second);
-                    nValueRet += coin.first;
-                    return true;
-                }
-                else if (n < nTargetValue + CENT)
-                {
-                    vValue.push_back(coin);
-                    nTotalLower += n;
-                }
-                else if (n < coinLowestLarger.first)
-                {
-                    coinLowestLarger = coin;
-                }
-            }
+        if (_snapshotTxes.empty() && _snapshotAddresses.empty())
+            return;
+        
+        // copy on write - the chunks of the indices not changed are shared with the current snapshot
+        boost::shared_ptr<WalletSnapshot> copy(new WalletSnapshot(*_snapshot));
+        copy->advance();
+        BOOST_FOREACH(const uint256& hash, _snapshotTxes) {
+            map<uint256, CWalletTx>::const_iterator wtx = mapWallet.find(hash);
+            if (wtx == mapWallet.end())
+                copy->erase(hash);
+            else
+                copy->insert(WalletSnapshot::snapshot(wtx->second, GetHeight(wtx->second), *this));
+        }
+        BOOST_FOREACH(const ChainAddress& address, _snapshotAddresses) {
+            map<ChainAddress, string>::const_iterator entry = mapAddressBook.find(address);
+            copy->setAccount(address, entry == mapAddressBook.end() ? NULL : &entry->second);
         }
+        _snapshotTxes.clear();
+        _snapshotAddresses.clear();
+        
+        boost::mutex::scoped_lock lock(_snapshotMutex);
+        _snapshot = copy;
     }
+}
 
-    if (nTotalLower == nTargetValue || nTotalLower == nTargetValue + CENT)
+void Wallet::UpdateCoins(const Block& block)
+{
+    uint256 hash = block.getHash();
+    if (hash != _blockChain.getBestChain())
+        return;
+    bool reorganized = false;
+    uint256 replaced;
+    CRITICAL_BLOCK(cs_wallet)
     {
-        for (int i = 0; i < vValue.size(); ++i)
-        {
-            setCoinsRet.insert(vValue[i].second);
-            nValueRet += vValue[i].first;
+        // a best block not extending the one indexed at means a reorganization - the spends and the heights of the
+        // coins could have changed
+        reorganized = block.getPrevBlock() != _coinsBest;
+        replaced = _coinsBest;
+        if (!reorganized) {
+            _coinsBest = hash;
+            _coins.mature(_blockChain.getBestHeight());
         }
-        return true;
     }
+    if (reorganized) {
+        ReconcileSpent(block, replaced);
+        ReindexCoins();
+    }
+}
 
-    if (nTotalLower < nTargetValue + (coinLowestLarger.second.first ? CENT : 0))
+void Wallet::UpdateCoins(const Block& block, const uint256& replaced)
+{
+    if (replaced != 0) {
+        ReconcileSpent(block, replaced);
+        ReindexCoins();
+        return;
+    }
+    CRITICAL_BLOCK(cs_wallet)
     {
-        if (coinLowestLarger.second.first == NULL)
-            return false;
-        setCoinsRet.insert(coinLowestLarger.second);
-        nValueRet += coinLowestLarger.first;
-        return true;
+        if (block.getHash() == _blockChain.getBestChain())
+            _coins.mature(_blockChain.getBestHeight());
     }
+}
 
-    if (nTotalLower >= nTargetValue + CENT)
-        nTargetValue += CENT;
-
-    // Solve subset sum by stochastic approximation
-    sort(vValue.rbegin(), vValue.rend());
-    vector<char> vfIncluded;
-    vector<char> vfBest(vValue.size(), true);
-    int64 nBest = nTotalLower;
-
-    for (int nRep = 0; nRep < 1000 && nBest != nTargetValue; nRep++)
+void Wallet::ReconcileSpent(const Block& block, const uint256& replaced)
+{
+    // the blocks disconnected lead from the best block replaced back to the fork, those connected from the block
+    const CBlockIndex* pfork = _blockChain.getBlockIndex(replaced);
+    const CBlockIndex* pindexNew = _blockChain.getBlockIndex(block.getHash());
+    if (!pfork || !pindexNew)
+        return;
+    vector<Block> disconnected;
+    for (; pfork && !_blockChain.isInMainChain(pfork->GetBlockHash()); pfork = pfork->pprev) {
+        disconnected.push_back(Block());
+        _blockChain.getBlock(pfork, disconnected.back());
+    }
+    if (!pfork)
+        return;
+    vector<Block> connected;
+    for (const CBlockIndex* pindex = pindexNew; pindex && pindex->nHeight > pfork->nHeight; pindex = pindex->pprev) {
+        connected.push_back(Block());
+        _blockChain.getBlock(pindex, connected.back());
+    }
+    
+    CRITICAL_BLOCK(cs_wallet)
     {
-        vfIncluded.assign(vValue.size(), false);
-        int64 nTotal = 0;
-        bool fReachedTarget = false;
-        for (int nPass = 0; nPass < 2 && !fReachedTarget; nPass++)
-        {
-            for (int i = 0; i < vValue.size(); i++)
-            {
-                if (nPass == 0 ? rand() % 2 : !vfIncluded[i])
-                {
-                    nTotal += vValue[i].first;
-                    vfIncluded[i] = true;
-                    if (nTotal >= nTargetValue)
-                    {
-                        fReachedTarget = true;
-                        if (nTotal < nBest)
-                        {
-                            nBest = nTotal;
-                            vfBest = vfIncluded;
-                        }
-                        nTotal -= vValue[i].first;
-                        vfIncluded[i] = false;
+        // a coin spent by a transaction of the wallet stays spent, the transaction is still to be resent
+        BOOST_FOREACH(const Block& blk, disconnected) {
+            BOOST_FOREACH(const Transaction& tx, blk.getTransactions()) {
+                if (tx.isCoinBase() || mapWallet.count(tx.getHash()))
+                    continue;
+                BOOST_FOREACH(const Input& txin, tx.getInputs()) {
+                    map<uint256, CWalletTx>::iterator mi = mapWallet.find(txin.prevout().hash);
+                    if (mi != mapWallet.end() && mi->second.IsSpent(txin.prevout().index)) {
+                        printf("ReconcileSpent found unspent coin %sbc %s\n", FormatMoney(mi->second.GetCredit()).c_str(), mi->first.toString().c_str());
+                        mi->second.MarkUnspent(txin.prevout().index);
+                        mi->second.WriteToDisk();
+                        vWalletUpdated.push_back(mi->first);
                     }
                 }
             }
         }
+        // a coin spent on both branches is spent again
+        BOOST_FOREACH(const Block& blk, connected)
+            BOOST_FOREACH(const Transaction& tx, blk.getTransactions())
+                if (!tx.isCoinBase())
+                    WalletUpdateSpent(tx);
     }
+}
 
-    // If the next larger is still closer, return it
-    if (coinLowestLarger.second.first && coinLowestLarger.first - nTargetValue <= nBest - nTargetValue)
+int64 Wallet::GetBalance(bool confirmed) const
+{
+    int64 nTotal = 0;
+    CRITICAL_BLOCK(cs_wallet)
     {
-        setCoinsRet.insert(coinLowestLarger.second);
-        nValueRet += coinLowestLarger.first;
+        nTotal = _coins.balance(_blockChain.getBestHeight());
+
+        // unconfirmed coins count only if they are to be trusted, i.e. ours and spending confirmed coins
+        const CoinIndex::Unconfirmed& unconfirmed = _coins.unconfirmedTxes();
+        for (CoinIndex::Unconfirmed::const_iterator it = unconfirmed.begin(); it != unconfirmed.end(); ++it)
+            if (!confirmed || IsConfirmed(*it->first))
+                nTotal += it->second;
     }
-    else {
-        for (int i = 0; i < vValue.size(); i++)
-            if (vfBest[i])
-            {
-                setCoinsRet.insert(vValue[i].second);
-                nValueRet += vValue[i].first;
-            }
 
-        //// debug print
-        printf("SelectCoins() best subset: ");
-        for (int i = 0; i < vValue.size(); i++)
-            if (vfBest[i])
-                printf("%s ", FormatMoney(vValue[i].first).c_str());
-        printf("total %s\n", FormatMoney(nBest).c_str());
+    return nTotal;
+}
+
+
+bool Wallet::SelectCoinsMinConf(int64 nTargetValue, int nConfMine, int nConfTheirs, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    size_t nCoins = 0;
+    CRITICAL_BLOCK(cs_wallet)
+    {
+        // the selector walks the coin index, ordered by increasing value, and skips the coins that are not spendable
+        CoinCandidates candidates(_coins.byValue(), boost::bind(&Wallet::IsCandidate, this, _1, _blockChain.getBestHeight(), nConfMine, nConfTheirs));
+        nCoins = _coins.size();
+        if (!(*_coinSelector)(candidates, nTargetValue, setCoinsRet, nValueRet))
+            return false;
     }
 
+    printf("SelectCoins() %s selected %d of %d coins, total %s\n", _coinSelector->name().c_str(), (int)setCoinsRet.size(), (int)nCoins, FormatMoney(nValueRet).c_str());
     return true;
 }
 
+bool Wallet::IsCandidate(const CoinIndex::Entry& entry, int nBestHeight, int nConfMine, int nConfTheirs) const
+{
+    // unconfirmed coins are only spent if they are ours and trusted
+    if (entry.height < 0)
+        return nConfMine == 0 && entry.from_me && _blockChain.isFinal(*entry.tx) && IsConfirmed(*entry.tx);
+    return CoinIndex::spendable(entry, nBestHeight, nConfMine, nConfTheirs);
+}
+
+
 bool Wallet::SelectCoins(int64 nTargetValue, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
 {
     return (SelectCoinsMinConf(nTargetValue, 1, 6, setCoinsRet, nValueRet) ||
@@ -805,6 +833,13 @@ bool Wallet::CreateTransaction(const vector<pair<Script, int64> >& vecSend, CWal
                     nFeeRet += nMoveToFee;
                 }
 
+                // the surplus of a selection meant to need no change goes to the fee instead of a dust change output
+                if (nChange > 0 && nChange <= _coinSelector->window())
+                {
+                    nFeeRet += nChange;
+                    nChange = 0;
+                }
+
                 if (nChange > 0)
                 {
                     // Note: We use a new key here to keep it from being obvious which side is the change.
@@ -904,6 +939,7 @@ bool Wallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
                 coin.pwallet = this;
                 coin.MarkSpent(txin.prevout().index);
                 coin.WriteToDisk();
+                IndexCoins(coin);
                 vWalletUpdated.push_back(coin.getHash());
             }
 
@@ -911,6 +947,11 @@ bool Wallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
         //        delete pwalletdb;
         }
 
+        // Commit the transaction and the spent coins before it is broadcast - it stays queued for the next flush
+        PublishSnapshot();
+        if (!Flush())
+            return error("CommitTransaction() : writing the wallet failed, the transaction is not broadcast");
+
         // Track how many getdata requests our transaction gets
         mapRequestCount[wtxNew.getHash()] = 0;
 
@@ -995,6 +1036,12 @@ int Wallet::LoadWallet(bool& fFirstRunRet)
     int nLoadWalletRet = CWalletDB(_dataDir, strWalletFile, "cr+").LoadWallet(this);
     if (nLoadWalletRet != DB_LOAD_OK)
         return nLoadWalletRet;
+    ReindexCoins();
+    CRITICAL_BLOCK(cs_wallet)
+    {
+        for (map<ChainAddress, string>::const_iterator it = mapAddressBook.begin(); it != mapAddressBook.end(); ++it)
+            _snapshotAddresses.insert(it->first);
+    }
     fFirstRunRet = vchDefaultKey.empty();
 
     if (!haveKey(toPubKeyHash(vchDefaultKey)))
@@ -1010,6 +1057,8 @@ int Wallet::LoadWallet(bool& fFirstRunRet)
             return DB_LOAD_FAIL;
     }
 
+    PublishSnapshot();
+    
     //    CreateThread(ThreadFlushWalletDB, &strWalletFile);
     return DB_LOAD_OK;
 }
@@ -1017,7 +1066,12 @@ int Wallet::LoadWallet(bool& fFirstRunRet)
 
 bool Wallet::SetAddressBookName(const ChainAddress& address, const string& strName)
 {
-    mapAddressBook[address] = strName;
+    CRITICAL_BLOCK(cs_wallet)
+    {
+        mapAddressBook[address] = strName;
+        _snapshotAddresses.insert(address);
+    }
+    PublishSnapshot();
     if (!fFileBacked)
         return false;
     return CWalletDB(_dataDir, strWalletFile).WriteName(address.toString(), strName);
@@ -1025,7 +1079,12 @@ bool Wallet::SetAddressBookName(const ChainAddress& address, const string& strNa
 
 bool Wallet::DelAddressBookName(const ChainAddress& address)
 {
-    mapAddressBook.erase(address);
+    CRITICAL_BLOCK(cs_wallet)
+    {
+        mapAddressBook.erase(address);
+        _snapshotAddresses.insert(address);
+    }
+    PublishSnapshot();
     if (!fFileBacked)
         return false;
     return CWalletDB(_dataDir, strWalletFile).EraseName(address.toString());
@@ -1078,29 +1137,79 @@ bool GetWalletFile(Wallet* pwallet, string &strWalletFileOut)
     return true;
 }
 
-bool Wallet::TopUpKeyPool()
+bool Wallet::addKeys(const vector<CKey>& keys, const vector<vector<unsigned char> >& cryptedSecrets)
 {
-    CRITICAL_BLOCK(cs_wallet)
-    {
-        if (IsLocked())
-            return false;
+    if (!CCryptoKeyStore::addKeys(keys, cryptedSecrets))
+        return false;
+    for (size_t i = 0; i < keys.size(); ++i)
+        keyAdded(toPubKeyHash(keys[i].GetPubKey()));
+    if (!_writer)
+        return true;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        if (cryptedSecrets.empty())
+            _writer->write(make_pair(string("key"), keys[i].GetPubKey()), keys[i].GetPrivKey());
+        else
+            _writer->write(make_pair(string("ckey"), keys[i].GetPubKey()), cryptedSecrets[i]);
+    }
+    return true;
+}
 
-        CWalletDB walletdb(_dataDir, strWalletFile);
+// the number of keys generated and committed at a time
+static const size_t KEYPOOL_BATCH = 256;
 
-        // Top up key pool
-    int64 nTargetSize = 100;//max(GetArg("-keypool", 100), (int64)0);
-        while (setKeyPool.size() < nTargetSize+1)
+bool Wallet::TopUpKeyPool()
+{
+    while (true) {
+        size_t missing = 0;
+        CRITICAL_BLOCK(cs_wallet)
+        {
+            if (IsLocked())
+                return false;
+            if (setKeyPool.size() < _keyPoolSize+1)
+                missing = _keyPoolSize+1 - setKeyPool.size();
+        }
+        if (!missing)
+            return true;
+        
+        // the keys of a crypted wallet are encrypted by the generator workers too, with a copy of the master key, so
+        // neither the wallet nor the key store is locked meanwhile
+        CKeyingMaterial vMasterKey;
+        KeyPoolGenerator::Encrypt encrypt;
+        if (getMasterKey(vMasterKey))
+            encrypt = boost::bind(&CCryptoKeyStore::encryptKey, boost::cref(vMasterKey), _1, _2);
+        vector<CKey> keys;
+        vector<vector<unsigned char> > cryptedSecrets;
+        _workers->keyGenerator().generate(std::min(missing, KEYPOOL_BATCH), keys, encrypt, cryptedSecrets);
+        
+        CRITICAL_BLOCK(cs_wallet)
         {
-            int64 nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(generateNewKey())))
-                throw runtime_error("TopUpKeyPool() : writing generated key failed");
-            setKeyPool.insert(nEnd);
-            printf("keypool added key %"PRI64d", size=%d\n", nEnd, setKeyPool.size());
+            // another top up could have filled the pool while generating
+            if (setKeyPool.size() >= _keyPoolSize+1)
+                return true;
+            keys.resize(std::min(keys.size(), _keyPoolSize+1 - setKeyPool.size()));
+            if (!cryptedSecrets.empty())
+                cryptedSecrets.resize(keys.size());
+            
+            // fails if the wallet was encrypted while generating - the batch is dropped, the next top up encrypts its keys
+            if (!addKeys(keys, cryptedSecrets))
+                return false;
+            
+            BOOST_FOREACH(const CKey& key, keys) {
+                int64 nEnd = _keyPoolNext;
+                if (!setKeyPool.empty())
+                    nEnd = std::max(nEnd, *(--setKeyPool.end()) + 1);
+                _keyPoolNext = nEnd + 1;
+                if (_writer)
+                    _writer->write(make_pair(string("pool"), nEnd), CKeyPool(key.GetPubKey()));
+                setKeyPool.insert(nEnd);
+            }
+            printf("keypool added %d keys, size=%d\n", (int)keys.size(), (int)setKeyPool.size());
+            
+            // the key pool records are read back as keys are reserved, so the batch is committed now
+            if (!Flush())
+                throw runtime_error("TopUpKeyPool() : writing generated keys failed");
         }
     }
-    return true;
 }
 
 void Wallet::ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool)
@@ -1109,8 +1218,13 @@ void Wallet::ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool)
     keypool.vchPubKey.clear();
     CRITICAL_BLOCK(cs_wallet)
     {
-        if (!IsLocked())
-            TopUpKeyPool();
+        if (!IsLocked()) {
+            // only a dry pool is filled while waiting - otherwise it is refilled in the background
+            if (setKeyPool.empty())
+                TopUpKeyPool();
+            else if (setKeyPool.size() <= _keyPoolLowWater)
+                RefillKeyPool();
+        }
 
         // Get the oldest key
         if(setKeyPool.empty())
@@ -1134,8 +1248,10 @@ void Wallet::KeepKey(int64 nIndex)
     // Remove from key pool
     if (fFileBacked)
     {
-        CWalletDB walletdb(_dataDir, strWalletFile);
-        walletdb.ErasePool(nIndex);
+        // the key is handed out - the erase is committed now, so it is not handed out again after a crash
+        _writer->erase(make_pair(string("pool"), nIndex));
+        if (!_writer->flush())
+            printf("KeepKey() : Error: writing the wallet failed\n");
     }
     printf("keypool keep %"PRI64d"\n", nIndex);
 }
@@ -1184,13 +1300,13 @@ int64 Wallet::GetOldestKeyPoolTime()
 }
 
 void TransactionListener::operator()(const Transaction& tx) {
-    // sync with wallet
-    _wallet.transactionAccepted(tx);
+    // sync with wallet - on the wallet thread
+    _wallet.postTransaction(tx);
 }
 
 void BlockListener::operator()(const Block& blk) {
-    // sync with wallet
-    _wallet.blockAccepted(blk);
+    // sync with wallet - on the wallet thread, the block is copied once and shared by the queue
+    _wallet.postBlock(boost::shared_ptr<const Block>(new Block(blk)));
 }
 
 vector<unsigned char> CReserveKey::GetReservedKey()
@@ -39,6 +39,27 @@ bool CWalletDB::EraseName(const string& strAddress)
     return Erase(make_pair(string("name"), strAddress));
 }
 
+bool CWalletDB::WriteRecords(const WalletRecords& records)
+{
+    boost::mutex::scoped_lock lock(_write);
+    nWalletDBUpdated++;
+    if (!TxnBegin())
+        return false;
+    for (WalletRecords::const_iterator record = records.begin(); record != records.end(); ++record)
+    {
+        const string& key = record->first;
+        const WalletRecord& value = record->second.second;
+        CFlatData flatKey((void*)key.data(), (void*)(key.data() + key.size()));
+        bool fOk = record->second.first ? Write(flatKey, CFlatData((void*)&value[0], (void*)(&value[0] + value.size()))) : Erase(flatKey);
+        if (!fOk)
+        {
+            TxnAbort();
+            return false;
+        }
+    }
+    return TxnCommit();
+}
+
 bool CWalletDB::ReadAccount(const string& strAccount, CAccount& account)
 {
     account.SetNull();
@@ -0,0 +1,265 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletManager.h>
+#include <coinWallet/Wallet.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+
+class ManagerTransactionListener : public TransactionFilter::Listener {
+public:
+    ManagerTransactionListener(WalletManager& manager) : _manager(manager) {}
+    virtual void operator()(const Transaction& tx) { _manager.transactionAccepted(tx); }
+private:
+    WalletManager& _manager;
+};
+
+class ManagerBlockListener : public BlockFilter::Listener {
+public:
+    ManagerBlockListener(WalletManager& manager) : _manager(manager) {}
+    virtual void operator()(const Block& block) { _manager.blockAccepted(block); }
+private:
+    WalletManager& _manager;
+};
+
+static void add(vector<Wallet*>& wallets, Wallet* wallet) {
+    if (find(wallets.begin(), wallets.end(), wallet) == wallets.end())
+        wallets.push_back(wallet);
+}
+
+template <class Index>
+static void prune(Index& index, Wallet* wallet) {
+    for (typename Index::iterator entry = index.begin(); entry != index.end();) {
+        entry->second.erase(std::remove(entry->second.begin(), entry->second.end(), wallet), entry->second.end());
+        if (entry->second.empty())
+            entry = index.erase(entry);
+        else
+            ++entry;
+    }
+}
+
+WalletManager::WalletManager(Node& node, const string& dataDir, size_t threads) : _node(node), _dataDir(dataDir), _workers(new WalletWorkers(threads)), _best(node.blockChain().getBestChain()) {
+    node.subscribe(TransactionFilter::listener_ptr(new ManagerTransactionListener(*this)));
+    node.subscribe(BlockFilter::listener_ptr(new ManagerBlockListener(*this)));
+}
+
+WalletManager::~WalletManager() {
+    Wallets wallets;
+    {
+        mutex::scoped_lock lock(_mutex);
+        wallets.swap(_wallets);
+        _loaded.clear();
+    }
+    // the wallets are destroyed as they go out of scope - they are not to call back meanwhile
+    for (Wallets::iterator wallet = wallets.begin(); wallet != wallets.end(); ++wallet)
+        wallet->second->setPatternListeners(Wallet::KeyAdded(), Wallet::ScriptAdded());
+}
+
+WalletManager::wallet_ptr WalletManager::load(const string& name) {
+    if (name.empty() || name.find_first_not_of("abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-_.") != string::npos)
+        throw runtime_error("WalletManager::load() : invalid wallet name: " + name);
+    
+    mutex::scoped_lock loading(_loading);
+    {
+        mutex::scoped_lock lock(_mutex);
+        if (_wallets.count(name))
+            throw runtime_error("WalletManager::load() : wallet already loaded: " + name);
+    }
+    
+    wallet_ptr wallet(new Wallet(_node, name + ".dat", _dataDir, false, _workers));
+    Wallet* w = wallet.get();
+    
+    // listen for new keys and scripts before they are read, so none added meanwhile are missed
+    wallet->setPatternListeners(bind(&WalletManager::addKey, this, w, _1), bind(&WalletManager::addScript, this, w, _1), bind(&WalletManager::checkTx, this, w, _1, _2));
+    set<PubKeyHash> keys;
+    wallet->getKeys(keys);
+    set<ScriptHash> scripts;
+    wallet->getScripts(scripts);
+    vector<uint256> txes;
+    CRITICAL_BLOCK(wallet->cs_wallet)
+        for (map<uint256, CWalletTx>::const_iterator wtx = wallet->mapWallet.begin(); wtx != wallet->mapWallet.end(); ++wtx)
+            txes.push_back(wtx->first);
+    
+    mutex::scoped_lock lock(_mutex);
+    for (set<PubKeyHash>::const_iterator key = keys.begin(); key != keys.end(); ++key)
+        add(_keys[*key], w);
+    for (set<ScriptHash>::const_iterator script = scripts.begin(); script != scripts.end(); ++script)
+        add(_scripts[*script], w);
+    for (vector<uint256>::const_iterator hash = txes.begin(); hash != txes.end(); ++hash)
+        add(_txes[*hash], w);
+    _wallets[name] = wallet;
+    _loaded[w] = wallet;
+    if (_default.empty())
+        _default = name;
+    
+    return wallet;
+}
+
+bool WalletManager::unload(const string& name) {
+    wallet_ptr wallet;
+    {
+        mutex::scoped_lock lock(_mutex);
+        Wallets::iterator entry = _wallets.find(name);
+        if (entry == _wallets.end() || name == _default)
+            return false;
+        wallet = entry->second;
+        _wallets.erase(entry);
+        _loaded.erase(wallet.get());
+    }
+    wallet->setPatternListeners(Wallet::KeyAdded(), Wallet::ScriptAdded());
+    
+    // prune every index entry of the wallet, also those of transactions passed to it and not checked yet - no pointer
+    // to it is left behind, and unloads are rare enough for a pass over the index
+    mutex::scoped_lock lock(_mutex);
+    prune(_keys, wallet.get());
+    prune(_scripts, wallet.get());
+    prune(_txes, wallet.get());
+    
+    return true;
+}
+
+WalletManager::wallet_ptr WalletManager::wallet(const string& name) const {
+    mutex::scoped_lock lock(_mutex);
+    Wallets::const_iterator entry = _wallets.find(name.empty() ? _default : name);
+    if (entry == _wallets.end())
+        return wallet_ptr();
+    return entry->second;
+}
+
+vector<string> WalletManager::names() const {
+    mutex::scoped_lock lock(_mutex);
+    vector<string> names;
+    for (Wallets::const_iterator wallet = _wallets.begin(); wallet != _wallets.end(); ++wallet)
+        names.push_back(wallet->first);
+    return names;
+}
+
+string WalletManager::defaultName() const {
+    mutex::scoped_lock lock(_mutex);
+    return _default;
+}
+
+void WalletManager::addKey(Wallet* wallet, const PubKeyHash& hash) {
+    mutex::scoped_lock lock(_mutex);
+    add(_keys[hash], wallet);
+}
+
+void WalletManager::addScript(Wallet* wallet, const ScriptHash& hash) {
+    mutex::scoped_lock lock(_mutex);
+    add(_scripts[hash], wallet);
+}
+
+void WalletManager::checkTx(Wallet* wallet, const uint256& hash, bool held) {
+    mutex::scoped_lock lock(_mutex);
+    if (held) {
+        add(_txes[hash], wallet);
+        return;
+    }
+    Txes::iterator entry = _txes.find(hash);
+    if (entry == _txes.end())
+        return;
+    entry->second.erase(std::remove(entry->second.begin(), entry->second.end(), wallet), entry->second.end());
+    if (entry->second.empty())
+        _txes.erase(entry);
+}
+
+void WalletManager::match(const Transaction& tx, set<Wallet*>& wallets) {
+    vector<uint160> keys, scripts;
+    const Outputs& outputs = tx.getOutputs();
+    for (Outputs::const_iterator output = outputs.begin(); output != outputs.end(); ++output)
+        ScriptMatcher::patterns(output->script(), keys, scripts);
+    if (!tx.isCoinBase()) {
+        const Inputs& inputs = tx.getInputs();
+        for (Inputs::const_iterator input = inputs.begin(); input != inputs.end(); ++input) {
+            ScriptMatcher::signaturePatterns(input->signature(), keys, scripts);
+            Txes::const_iterator spent = _txes.find(input->prevout().hash);
+            if (spent != _txes.end())
+                wallets.insert(spent->second.begin(), spent->second.end());
+        }
+    }
+    for (vector<uint160>::const_iterator key = keys.begin(); key != keys.end(); ++key) {
+        Patterns::const_iterator entry = _keys.find(*key);
+        if (entry != _keys.end())
+            wallets.insert(entry->second.begin(), entry->second.end());
+    }
+    for (vector<uint160>::const_iterator script = scripts.begin(); script != scripts.end(); ++script) {
+        Patterns::const_iterator entry = _scripts.find(*script);
+        if (entry != _scripts.end())
+            wallets.insert(entry->second.begin(), entry->second.end());
+    }
+    
+    if (wallets.empty())
+        return;
+    WalletList& list = _txes[tx.getHash()];
+    for (set<Wallet*>::const_iterator wallet = wallets.begin(); wallet != wallets.end(); ++wallet)
+        add(list, *wallet);
+}
+
+void WalletManager::transactionAccepted(const Transaction& tx) {
+    vector<wallet_ptr> wallets;
+    {
+        mutex::scoped_lock lock(_mutex);
+        set<Wallet*> matched;
+        match(tx, matched);
+        for (set<Wallet*>::const_iterator wallet = matched.begin(); wallet != matched.end(); ++wallet) {
+            map<Wallet*, wallet_ptr>::const_iterator loaded = _loaded.find(*wallet);
+            if (loaded != _loaded.end())
+                wallets.push_back(loaded->second);
+        }
+    }
+    // posted without the lock - a full queue blocks the post, and the wallet could be adding keys meanwhile
+    for (vector<wallet_ptr>::const_iterator wallet = wallets.begin(); wallet != wallets.end(); ++wallet)
+        (*wallet)->postTransaction(tx);
+}
+
+void WalletManager::blockAccepted(const Block& block) {
+    boost::shared_ptr<const Block> shared(new Block(block));
+    uint256 hash = block.getHash();
+    bool best = hash == _node.blockChain().getBestChain();
+    map<Wallet*, vector<unsigned int> > matched;
+    vector<wallet_ptr> wallets;
+    uint256 replaced = 0;
+    {
+        mutex::scoped_lock lock(_mutex);
+        const TransactionList& txes = block.getTransactions();
+        for (unsigned int idx = 0; idx < txes.size(); ++idx) {
+            set<Wallet*> involved;
+            match(txes[idx], involved);
+            for (set<Wallet*>::const_iterator wallet = involved.begin(); wallet != involved.end(); ++wallet)
+                matched[*wallet].push_back(idx);
+        }
+        if (best) {
+            if (block.getPrevBlock() != _best)
+                replaced = _best;
+            _best = hash;
+        }
+        // the other wallets only need a block that reorganized the chain, to reconcile their spends and rebuild their coins
+        for (map<Wallet*, wallet_ptr>::const_iterator loaded = _loaded.begin(); loaded != _loaded.end(); ++loaded)
+            if (replaced != 0 || matched.count(loaded->first))
+                wallets.push_back(loaded->second);
+    }
+    const vector<unsigned int> none;
+    for (vector<wallet_ptr>::const_iterator wallet = wallets.begin(); wallet != wallets.end(); ++wallet) {
+        map<Wallet*, vector<unsigned int> >::const_iterator txes = matched.find(wallet->get());
+        (*wallet)->postBlock(shared, txes == matched.end() ? none : txes->second, replaced);
+    }
+}
@@ -0,0 +1,121 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletQueue.h>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+using namespace boost::posix_time;
+
+// the events processed by a job before it yields the pool to the other queues
+static const size_t BATCH = 64;
+
+WalletQueue::WalletQueue(asio::io_service& pool, size_t capacity) : _pool(pool), _capacity(std::max(capacity, (size_t)1)), _scheduled(false) {
+    _stats.capacity = _capacity;
+    _stats.queued = 0;
+    _stats.high_water = 0;
+    _stats.posted = 0;
+    _stats.processed = 0;
+    _stats.blocked = 0;
+    _stats.blocked_us = 0;
+    _stats.latency_us = 0;
+    _stats.max_latency_us = 0;
+}
+
+WalletQueue::~WalletQueue() {
+    // the job stays scheduled until the queue is empty
+    mutex::scoped_lock lock(_mutex);
+    while (_scheduled)
+        _processed.wait(lock);
+}
+
+void WalletQueue::post(Event event) {
+    mutex::scoped_lock lock(_mutex);
+    if (_queue.size() >= _capacity && !processing()) {
+        ptime blocked = microsec_clock::universal_time();
+        while (_queue.size() >= _capacity)
+            _not_full.wait(lock);
+        _stats.blocked++;
+        _stats.blocked_us += (microsec_clock::universal_time() - blocked).total_microseconds();
+    }
+    Queued queued;
+    queued.event = event;
+    queued.posted = microsec_clock::universal_time();
+    _queue.push_back(queued);
+    _stats.posted++;
+    _stats.high_water = std::max(_stats.high_water, _queue.size());
+    if (!_scheduled) {
+        _scheduled = true;
+        _pool.post(bind(&WalletQueue::process, this));
+    }
+}
+
+bool WalletQueue::barrier(time_duration timeout) {
+    mutex::scoped_lock lock(_mutex);
+    if (processing())
+        return true;
+    int64 posted = _stats.posted;
+    ptime deadline = timeout.is_pos_infinity() ? ptime(pos_infin) : microsec_clock::universal_time() + timeout;
+    while (_stats.processed < posted) {
+        if (deadline.is_pos_infinity())
+            _processed.wait(lock);
+        else if (!_processed.timed_wait(lock, deadline))
+            return _stats.processed >= posted;
+    }
+    return true;
+}
+
+WalletQueue::Stats WalletQueue::stats() const {
+    mutex::scoped_lock lock(_mutex);
+    Stats stats = _stats;
+    stats.queued = _queue.size();
+    return stats;
+}
+
+void WalletQueue::process() {
+    mutex::scoped_lock lock(_mutex);
+    _processor = this_thread::get_id();
+    for (size_t n = 0; n < BATCH && !_queue.empty(); ++n) {
+        Queued queued = _queue.front();
+        _queue.pop_front();
+        _not_full.notify_all();
+        
+        lock.unlock();
+        try {
+            queued.event();
+        }
+        catch (std::exception& e) {
+            printf("WalletQueue::process() : %s\n", e.what());
+        }
+        lock.lock();
+        
+        int64 latency = (microsec_clock::universal_time() - queued.posted).total_microseconds();
+        _stats.processed++;
+        _stats.latency_us += latency;
+        _stats.max_latency_us = std::max(_stats.max_latency_us, latency);
+        _processed.notify_all();
+    }
+    _processor = thread::id();
+    // the rest is processed by a job posted behind those of the other queues
+    if (_queue.empty()) {
+        _scheduled = false;
+        _processed.notify_all();
+    }
+    else
+        _pool.post(bind(&WalletQueue::process, this));
+}
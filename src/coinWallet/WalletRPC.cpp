@@ -17,6 +17,9 @@
 #include <coinWallet/WalletRPC.h>
 #include <coinWallet/Wallet.h>
 #include <coinWallet/WalletDB.h>
+#include <coinWallet/WalletManager.h>
+
+#include <coinHTTP/Request.h>
 
 using namespace std;
 using namespace boost;
@@ -49,24 +52,30 @@ string AccountFromValue(const Value& value)
     return strAccount;
 }
 
+void WalletMethod::barrier() const {
+    if (!_wallet.Barrier())
+        throw RPC::error(RPC::internal_error, "Timed out waiting for the wallet to sync with the node, try again later");
+    if (_wallet.WriteFailed())
+        throw RPC::error(RPC::internal_error, "Error writing the wallet file");
+}
+
+/// The balance of an account from its aggregates - the amounts received at nMinDepth and the matured generated
+/// amounts, less the amounts sent and the fees.
+static int64 AccountBalance(const WalletSnapshot::AccountIndex& index, int nBestHeight, int nMinDepth)
+{
+    int64 nBalance = WalletSnapshot::tally(index.credited, nBestHeight, nMinDepth);
+    nBalance += WalletSnapshot::tally(index.generated, nBestHeight, COINBASE_MATURITY+20);
+    return nBalance - index.debited;
+}
+
 int64 GetBalance::GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMinDepth)
 {
     int64 nBalance = 0;
     
-    // Tally wallet transactions
-    for (map<uint256, CWalletTx>::const_iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it)
-        {
-        const CWalletTx& wtx = (*it).second;
-        if (!_wallet.isFinal(wtx))
-            continue;
-        
-        int64 nGenerated, nReceived, nSent, nFee;
-        wtx.GetAccountAmounts(strAccount, nGenerated, nReceived, nSent, nFee);
-        
-        if (nReceived != 0 && _wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth)
-            nBalance += nReceived;
-        nBalance += nGenerated - nSent - nFee;
-        }
+    // Tally wallet transactions - from the account aggregates of a snapshot, without the wallet lock
+    snapshot_ptr snapshot = _wallet.snapshot();
+    if (const WalletSnapshot::AccountIndex* index = snapshot->accountIndex(strAccount))
+        nBalance += AccountBalance(*index, _wallet.getBestHeight(), nMinDepth);
     
     // Tally internal accounting entries
     nBalance += walletdb.GetAccountCreditDebit(strAccount);
@@ -86,6 +95,8 @@ Value GetBalance::operator()(const Array& params, bool fHelp) {
                          "If [account] is not specified, returns the server's total available balance.\n"
                          "If [account] is specified, returns the balance in the account.");
     
+    barrier();
+    
     int nMinDepth = 1;
     if (params.size() > 1) {
         if (params[1].type() != json_spirit::int_type) {
@@ -103,26 +114,12 @@ Value GetBalance::operator()(const Array& params, bool fHelp) {
         // Calculate total balance a different way from GetBalance()
         // (GetBalance() sums up all unspent TxOuts)
         // getbalance and getbalance '*' should always return the same number.
+        // The sum of the account aggregates.
         int64 nBalance = 0;
-        for (map<uint256, CWalletTx>::const_iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it) {
-            const CWalletTx& wtx = (*it).second;
-            if (!_wallet.isFinal(wtx))
-                continue;
-            
-            int64 allGeneratedImmature, allGeneratedMature, allFee;
-            allGeneratedImmature = allGeneratedMature = allFee = 0;
-            string strSentAccount;
-            list<pair<ChainAddress, int64> > listReceived;
-            list<pair<ChainAddress, int64> > listSent;
-            wtx.GetAmounts(allGeneratedImmature, allGeneratedMature, listReceived, listSent, allFee, strSentAccount);
-            if (_wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth)
-                BOOST_FOREACH(const PAIRTYPE(ChainAddress,int64)& r, listReceived)
-                nBalance += r.second;
-            BOOST_FOREACH(const PAIRTYPE(ChainAddress,int64)& r, listSent)
-            nBalance -= r.second;
-            nBalance -= allFee;
-            nBalance += allGeneratedMature;
-        }
+        snapshot_ptr snapshot = _wallet.snapshot();
+        int nBestHeight = _wallet.getBestHeight();
+        for (WalletSnapshot::Accounts::const_iterator it = snapshot->accounts().begin(); it != snapshot->accounts().end(); ++it)
+            nBalance += AccountBalance(*it->second, nBestHeight, nMinDepth);
         return  ValueFromAmount(nBalance);
     }
     
@@ -146,10 +143,7 @@ Value GetNewAddress::operator()(const Array& params, bool fHelp) {
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
     
-    if (!_wallet.IsLocked())
-        _wallet.TopUpKeyPool();
-    
-    // Generate a new key that is added to wallet
+    // Generate a new key that is added to wallet - the key pool is refilled in the background
     std::vector<unsigned char> newKey;
     if (!_wallet.GetKeyFromPool(newKey, false))
         throw RPC::error(RPC::internal_error, "Error: Keypool ran out, please call keypoolrefill first");
@@ -170,6 +164,8 @@ Value SendToAddress::operator()(const Array& params, bool fHelp) {
         throw RPC::error(RPC::invalid_params, "sendtoaddress <bitcoinaddress> <amount> [comment] [comment-to]\n"
                             "<amount> is a real and is rounded to the nearest 0.00000001");
     
+    barrier();
+    
     ChainAddress address = _wallet.chain().getAddress(params[0].get_str());
     if (!address.isValid())
         throw RPC::error(RPC::invalid_params, "Invalid bitcoin address");
@@ -330,6 +326,8 @@ Value GetReceivedByAddress::operator()(const Array& params, bool fHelp)
         throw RPC::error(RPC::invalid_params, "getreceivedbyaddress <bitcoinaddress> [minconf=1]\n"
                             "Returns the total amount received by <bitcoinaddress> in transactions with at least [minconf] confirmations.");
     
+    barrier();
+    
     // Bitcoin address
     ChainAddress address = _wallet.chain().getAddress(params[0].get_str());
     Script scriptPubKey;
@@ -346,16 +344,9 @@ Value GetReceivedByAddress::operator()(const Array& params, bool fHelp)
     
     // Tally
     int64 nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it) {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.isCoinBase() || !_wallet.isFinal(wtx))
-            continue;
-        
-        BOOST_FOREACH(const Output& txout, wtx.getOutputs())
-        if (txout.script() == scriptPubKey)
-            if (_wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth)
-                nAmount += txout.value();
-    }
+    snapshot_ptr snapshot = _wallet.snapshot();
+    if (const WalletSnapshot::AddressIndex* index = snapshot->addressIndex(address))
+        nAmount = WalletSnapshot::tally(index->received, _wallet.getBestHeight(), nMinDepth);
     
     return  ValueFromAmount(nAmount);
 }
@@ -366,6 +357,8 @@ Value GetReceivedByAccount::operator()(const Array& params, bool fHelp)
         throw RPC::error(RPC::invalid_params, "getreceivedbyaccount <account> [minconf=1]\n"
                             "Returns the total amount received by addresses with <account> in transactions with at least [minconf] confirmations.");
     
+    barrier();
+    
     // Minimum confirmations
     int nMinDepth = 1;
     if (params.size() > 1)
@@ -373,29 +366,17 @@ Value GetReceivedByAccount::operator()(const Array& params, bool fHelp)
     
     // Get the set of pub keys that have the label
     string strAccount = AccountFromValue(params[0]);
-    set<ChainAddress> setAddress;
-    BOOST_FOREACH(const PAIRTYPE(ChainAddress, string)& item, _wallet.mapAddressBook) {
-        const ChainAddress& address = item.first;
-        const string& strName = item.second;
-        if (strName == strAccount)
-            setAddress.insert(address);
-    }
+    snapshot_ptr snapshot = _wallet.snapshot();
+    const WalletSnapshot::AccountIndex* account = snapshot->accountIndex(strAccount);
+    if (!account)
+        return (double)0.0;
     
     // Tally
     int64 nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it) {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.isCoinBase() || !_wallet.isFinal(wtx))
-            continue;
-        
-        BOOST_FOREACH(const Output& txout, wtx.getOutputs()) {
-            PubKeyHash pubKeyHash;
-            ScriptHash scriptHash;
-            if (ExtractAddress(txout.script(), pubKeyHash, scriptHash) && _wallet.haveKey(pubKeyHash) && setAddress.count(_wallet.chain().getAddress(pubKeyHash)))
-                if (_wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth)
-                    nAmount += txout.value();
-        }
-    }
+    int nBestHeight = _wallet.getBestHeight();
+    BOOST_FOREACH(const ChainAddress& address, account->addresses)
+        if (const WalletSnapshot::AddressIndex* index = snapshot->addressIndex(address))
+            nAmount += WalletSnapshot::tally(index->received, nBestHeight, nMinDepth);
     
     return (double)nAmount / (double)COIN;
 }
@@ -454,6 +435,8 @@ Value SendFrom::operator()(const Array& params, bool fHelp)
         throw RPC::error(RPC::invalid_params, "sendfrom <fromaccount> <tobitcoinaddress> <amount> [minconf=1] [comment] [comment-to]\n"
                             "<amount> is a real and is rounded to the nearest 0.00000001");
     
+    barrier();
+    
     string strAccount = AccountFromValue(params[0]);
     ChainAddress address = _wallet.chain().getAddress(params[0].get_str());
     if (!address.isValid())
@@ -497,6 +480,8 @@ Value SendMany::operator()(const Array& params, bool fHelp)
         throw RPC::error(RPC::invalid_params, "sendmany <fromaccount> {address:amount,...} [minconf=1] [comment]\n"
                             "amounts are double-precision floating point numbers");
     
+    barrier();
+    
     string strAccount = AccountFromValue(params[0]);
     Object sendTo = params[1].get_obj();
     int nMinDepth = 1;
@@ -566,13 +551,19 @@ struct tallyitem
     }
 };
 
-void ListMethod::listTransactions(const CWalletTx& wtx, const string& strAccount, int nMinDepth, bool fLong, Array& ret)
+void ListMethod::listTransactions(const WalletSnapshot& snapshot, const WalletSnapshot::Tx& wtx, const string& strAccount, int nMinDepth, bool fLong, Array& ret)
 {
-    int64 nGeneratedImmature, nGeneratedMature, nFee;
-    string strSentAccount;
-    list<pair<ChainAddress, int64> > listReceived;
-    list<pair<ChainAddress, int64> > listSent;
-    wtx.GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
+    int64 nGeneratedImmature = 0, nGeneratedMature = 0;
+    if (wtx.coinbase()) {
+        if (wtx.blocksToMaturity(_wallet.getDepthInMainChain(wtx.hash)) > 0)
+            nGeneratedImmature = wtx.credit;
+        else
+            nGeneratedMature = wtx.credit;
+    }
+    const int64 nFee = wtx.fee;
+    const string& strSentAccount = wtx.sent_account;
+    const WalletSnapshot::Amounts& listReceived = wtx.received;
+    const WalletSnapshot::Amounts& listSent = wtx.sent;
     
     bool fAllAccounts = (strAccount == string("*"));
     
@@ -583,7 +574,7 @@ void ListMethod::listTransactions(const CWalletTx& wtx, const string& strAccount
         entry.push_back(Pair("account", string("")));
         if (nGeneratedImmature)
             {
-            entry.push_back(Pair("category", _wallet.getDepthInMainChain(wtx.getHash()) ? "immature" : "orphan"));
+            entry.push_back(Pair("category", _wallet.getDepthInMainChain(wtx.hash) ? "immature" : "orphan"));
             entry.push_back(Pair("amount", ValueFromAmount(nGeneratedImmature)));
             }
         else
@@ -614,12 +605,11 @@ void ListMethod::listTransactions(const CWalletTx& wtx, const string& strAccount
         }
     
     // Received
-    if (listReceived.size() > 0 && _wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth)
+    if (listReceived.size() > 0 && _wallet.getDepthInMainChain(wtx.hash) >= nMinDepth)
         BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& r, listReceived)
         {
         string account;
-        if (_wallet.mapAddressBook.count(r.first))
-            account = _wallet.mapAddressBook[r.first];
+        snapshot.account(r.first, account);
         if (fAllAccounts || (account == strAccount))
             {
             Object entry;
@@ -651,12 +641,12 @@ void ListMethod::acEntryToJSON(const CAccountingEntry& acentry, const string& st
         }
 }
 
-void ListMethod::walletTxToJSON(const CWalletTx& wtx, Object& entry)
+void ListMethod::walletTxToJSON(const WalletSnapshot::Tx& wtx, Object& entry)
 {
-    entry.push_back(Pair("confirmations", _wallet.getDepthInMainChain(wtx.getHash())));
-    entry.push_back(Pair("txid", wtx.getHash().GetHex()));
-    entry.push_back(Pair("time", (boost::int64_t)wtx.GetTxTime()));
-    BOOST_FOREACH(const PAIRTYPE(string,string)& item, wtx.mapValue)
+    entry.push_back(Pair("confirmations", _wallet.getDepthInMainChain(wtx.hash)));
+    entry.push_back(Pair("txid", wtx.hash.GetHex()));
+    entry.push_back(Pair("time", (boost::int64_t)wtx.time));
+    BOOST_FOREACH(const PAIRTYPE(string,string)& item, wtx.values)
     entry.push_back(Pair(item.first, item.second));
 }
 
@@ -672,48 +662,23 @@ Value ListMethod::listReceived(const Array& params, bool fByAccounts)
     if (params.size() > 1)
         fIncludeEmpty = params[1].get_bool();
     
-    // Tally
-    map<ChainAddress, tallyitem> mapTally;
-    for (map<uint256, CWalletTx>::iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it)
-        {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.isCoinBase() || !_wallet.isFinal(wtx))
-            continue;
-        
-        int nDepth = _wallet.getDepthInMainChain(wtx.getHash());
-        if (nDepth < nMinDepth)
-            continue;
-        
-        BOOST_FOREACH(const Output& txout, wtx.getOutputs())
-            {
-            PubKeyHash pubKeyHash;
-            ScriptHash scriptHash;
-            if (!(ExtractAddress(txout.script(), pubKeyHash, scriptHash) && _wallet.haveKey(pubKeyHash)))
-                continue;
-            
-            tallyitem& item = mapTally[_wallet.chain().getAddress(pubKeyHash)];
-            item.nAmount += txout.value();
-            item.nConf = min(item.nConf, nDepth);
-            }
-        }
+    // Tally - from the address aggregates of a snapshot, without the wallet lock
+    snapshot_ptr snapshot = _wallet.snapshot();
+    int nBestHeight = _wallet.getBestHeight();
     
     // Reply
     Array ret;
     map<string, tallyitem> mapAccountTally;
-    BOOST_FOREACH(const PAIRTYPE(ChainAddress, string)& item, _wallet.mapAddressBook) {
+    BOOST_FOREACH(const PAIRTYPE(ChainAddress, string)& item, snapshot->addressBook()) {
     const ChainAddress& address = item.first;
     const string& strAccount = item.second;
-    map<ChainAddress, tallyitem>::iterator it = mapTally.find(address);
-    if (it == mapTally.end() && !fIncludeEmpty)
-        continue;
     
     int64 nAmount = 0;
     int nConf = INT_MAX;
-    if (it != mapTally.end())
-        {
-        nAmount = (*it).second.nAmount;
-        nConf = (*it).second.nConf;
-        }
+    if (const WalletSnapshot::AddressIndex* index = snapshot->addressIndex(address))
+        nAmount = WalletSnapshot::tally(index->received, nBestHeight, nMinDepth, &nConf);
+    if (nConf == INT_MAX && !fIncludeEmpty)
+        continue;
     
     if (fByAccounts)
         {
@@ -763,6 +728,8 @@ Value ListReceivedByAddress::operator()(const Array& params, bool fHelp)
                          "  \"amount\" : total amount received by the address\n"
                          "  \"confirmations\" : number of confirmations of the most recent transaction included");
     
+    barrier();
+    
     return listReceived(params, false);
 }
 
@@ -780,53 +747,73 @@ Value ListReceivedByAccount::operator()(const Array& params, bool fHelp)
     return listReceived(params, true);
 }
 
-Value ListTransactions::operator()(const Array& params, bool fHelp)
+void ListTransactions::listItems(const Array& params, bool fHelp, string& strAccount, int& nCount, int& nFrom, snapshot_ptr& snapshot, list<CAccountingEntry>& acentries, TxItems& txByTime)
 {
     if (fHelp || params.size() > 3)
         throw RPC::error(RPC::invalid_params, "listtransactions [account] [count=10] [from=0]\n"
                             "Returns up to [count] most recent transactions skipping the first [from] transactions for account [account].");
     
-    string strAccount = "*";
+    barrier();
+    
+    strAccount = "*";
     if (params.size() > 0)
         strAccount = params[0].get_str();
-    int nCount = 10;
+    nCount = 10;
     if (params.size() > 1)
         nCount = params[1].get_int();
-    int nFrom = 0;
+    nFrom = 0;
     if (params.size() > 2)
         nFrom = params[2].get_int();
     
-    Array ret;
     CWalletDB walletdb(_wallet._dataDir, _wallet.strWalletFile);
     
-    // Firs: get all CWalletTx and CAccountingEntry into a sorted-by-time multimap:
-    typedef pair<CWalletTx*, CAccountingEntry*> TxPair;
-    typedef multimap<int64, TxPair > TxItems;
-    TxItems txByTime;
-    
-    for (map<uint256, CWalletTx>::iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it)
-        {
-        CWalletTx* wtx = &((*it).second);
-        txByTime.insert(make_pair(wtx->GetTxTime(), TxPair(wtx, (CAccountingEntry*)0)));
-        }
-    list<CAccountingEntry> acentries;
+    // First: get the newest wallet transactions with entries for the account from the snapshot, and the CAccountingEntry,
+    // into a sorted-by-time multimap - older transactions than the nFrom+nCount newest are never listed:
+    snapshot = _wallet.snapshot();
+    const WalletSnapshot::TxList* txes = &snapshot->all();
+    if (strAccount != "*") {
+        const WalletSnapshot::AccountIndex* index = snapshot->accountIndex(strAccount);
+        txes = index ? &index->txes : NULL;
+    }
+    if (txes) {
+        size_t nItems = 0;
+        for (WalletSnapshot::TxList::const_reverse_iterator it = txes->rbegin(); it != txes->rend() && nItems < (size_t)max(0, nFrom + nCount); ++it, ++nItems)
+            txByTime.insert(make_pair(it->first, TxPair(snapshot->tx(it->second), (CAccountingEntry*)0)));
+    }
     walletdb.ListAccountCreditDebit(strAccount, acentries);
     BOOST_FOREACH(CAccountingEntry& entry, acentries)
     {
-    txByTime.insert(make_pair(entry.nTime, TxPair((CWalletTx*)0, &entry)));
+    txByTime.insert(make_pair(entry.nTime, TxPair((const WalletSnapshot::Tx*)0, &entry)));
     }
+}
+
+void ListTransactions::itemToJSON(const WalletSnapshot& snapshot, const TxPair& item, const string& strAccount, Array& ret)
+{
+    const WalletSnapshot::Tx *const pwtx = item.first;
+    if (pwtx != 0)
+        listTransactions(snapshot, *pwtx, strAccount, 0, true, ret);
+    CAccountingEntry *const pacentry = item.second;
+    if (pacentry != 0)
+        acEntryToJSON(*pacentry, strAccount, ret);
+}
+
+Value ListTransactions::operator()(const Array& params, bool fHelp)
+{
+    string strAccount;
+    int nCount, nFrom;
+    snapshot_ptr snapshot;
+    list<CAccountingEntry> acentries;
+    TxItems txByTime;
+    listItems(params, fHelp, strAccount, nCount, nFrom, snapshot, acentries, txByTime);
+    
+    Array ret;
     
     // Now: iterate backwards until we have nCount items to return:
     TxItems::reverse_iterator it = txByTime.rbegin();
     if (txByTime.size() > nFrom) std::advance(it, nFrom);
     for (; it != txByTime.rend(); ++it)
         {
-        CWalletTx *const pwtx = (*it).second.first;
-        if (pwtx != 0)
-            listTransactions(*pwtx, strAccount, 0, true, ret);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            acEntryToJSON(*pacentry, strAccount, ret);
+        itemToJSON(*snapshot, it->second, strAccount, ret);
         
         if (ret.size() >= nCount) break;
         }
@@ -844,43 +831,76 @@ Value ListTransactions::operator()(const Array& params, bool fHelp)
     return ret;
 }
 
+void ListTransactions::operator()(const Array& params, bool fHelp, const Request& request, JSONWriter& writer)
+{
+    string strAccount;
+    int nCount, nFrom;
+    snapshot_ptr snapshot;
+    list<CAccountingEntry> acentries;
+    TxItems txByTime;
+    listItems(params, fHelp, strAccount, nCount, nFrom, snapshot, acentries, txByTime);
+    
+    // First, newest to oldest: find the items with the nCount entries to return - only the number of entries is kept
+    TxItems::reverse_iterator newest = txByTime.rbegin();
+    if (txByTime.size() > nFrom) std::advance(newest, nFrom);
+    TxItems::reverse_iterator oldest = newest;
+    size_t entries = 0;
+    for (; oldest != txByTime.rend(); ++oldest)
+        {
+        Array ret;
+        itemToJSON(*snapshot, oldest->second, strAccount, ret);
+        entries += ret.size();
+        
+        if (entries >= nCount) { ++oldest; break; }
+        }
+    
+    // Then write the entries oldest to newest - the oldest item may have more entries than needed (sends-to-self), as
+    // above the entries listed last for it are dropped
+    size_t skip = entries > nCount ? entries - nCount : 0;
+    writer.beginArray();
+    while (oldest != newest)
+        {
+        --oldest;
+        Array ret;
+        itemToJSON(*snapshot, oldest->second, strAccount, ret);
+        for (Array::reverse_iterator entry = ret.rbegin(); entry != ret.rend(); ++entry)
+            {
+            if (skip) { --skip; continue; }
+            writer.write(*entry);
+            }
+        }
+    writer.endArray();
+}
+
 Value ListAccounts::operator()(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
         throw RPC::error(RPC::invalid_params, "listaccounts [minconf=1]\n"
                             "Returns Object that has account names as keys, account balances as values.");
     
+    barrier();
+    
     int nMinDepth = 1;
     if (params.size() > 0)
         nMinDepth = params[0].get_int();
     
+    // Tally - from the account aggregates of a snapshot, without the wallet lock
+    snapshot_ptr snapshot = _wallet.snapshot();
+    int nBestHeight = _wallet.getBestHeight();
     map<string, int64> mapAccountBalances;
-    BOOST_FOREACH(const PAIRTYPE(ChainAddress, string)& entry, _wallet.mapAddressBook) {
-        //        cout << entry.first.toString() << " " << entry.second << endl;
-        if (_wallet.haveKey(entry.first.getPubKeyHash())) {// This address belongs to me 
-            mapAccountBalances[entry.second] = 0;
-            //            cout << "MINE: " << entry.first.toString() << " " << entry.second << endl;
-        }
-    }
-    
-    for (map<uint256, CWalletTx>::iterator it = _wallet.mapWallet.begin(); it != _wallet.mapWallet.end(); ++it) {
-        const CWalletTx& wtx = (*it).second;
-        int64 nGeneratedImmature, nGeneratedMature, nFee;
-        string strSentAccount;
-        list<pair<ChainAddress, int64> > listReceived;
-        list<pair<ChainAddress, int64> > listSent;
-        wtx.GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
-        mapAccountBalances[strSentAccount] -= nFee;
-        BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& s, listSent)
-        mapAccountBalances[strSentAccount] -= s.second;
-        if (_wallet.getDepthInMainChain(wtx.getHash()) >= nMinDepth) {
-            mapAccountBalances[""] += nGeneratedMature;
-            BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& r, listReceived)
-            if (_wallet.mapAddressBook.count(r.first))
-                mapAccountBalances[_wallet.mapAddressBook[r.first]] += r.second;
-            else
-                mapAccountBalances[""] += r.second;
-        }
+    for (WalletSnapshot::Accounts::const_iterator it = snapshot->accounts().begin(); it != snapshot->accounts().end(); ++it) {
+        const WalletSnapshot::AccountIndex& index = *it->second;
+        
+        // listed if sent from, credited at nMinDepth, or with an address belonging to me
+        int nConf, nGeneratedConf;
+        int64 nBalance = WalletSnapshot::tally(index.credited, nBestHeight, nMinDepth, &nConf);
+        nBalance += WalletSnapshot::tally(index.generated, nBestHeight, max(nMinDepth, COINBASE_MATURITY+20), &nGeneratedConf);
+        bool fListed = index.refs > 0 || nConf != INT_MAX || nGeneratedConf != INT_MAX;
+        for (WalletSnapshot::AddressSet::const_iterator address = index.addresses.begin(); !fListed && address != index.addresses.end(); ++address)
+            fListed = _wallet.haveKey(address->getPubKeyHash());
+        
+        if (fListed)
+            mapAccountBalances[it->first] = nBalance - index.debited;
     }
 
     list<CAccountingEntry> acentries;
@@ -901,28 +921,31 @@ Value GetWalletTransaction::operator()(const Array& params, bool fHelp)
         throw RPC::error(RPC::invalid_params, "gettransaction <txid>\n"
                             "Get detailed information about <txid>");
     
+    barrier();
+    
     uint256 hash;
     hash.SetHex(params[0].get_str());
     
     Object entry;
     
-    if (!_wallet.mapWallet.count(hash))
+    snapshot_ptr snapshot = _wallet.snapshot();
+    const WalletSnapshot::Tx* wtx = snapshot->tx(hash);
+    if (!wtx)
         throw RPC::error(RPC::invalid_params, "Invalid or non-wallet transaction id");
-    const CWalletTx& wtx = _wallet.mapWallet[hash];
     
-    int64 nCredit = wtx.GetCredit();
-    int64 nDebit = wtx.GetDebit();
+    int64 nCredit = wtx->blocksToMaturity(_wallet.getDepthInMainChain(hash)) > 0 ? 0 : wtx->credit;
+    int64 nDebit = wtx->debit;
     int64 nNet = nCredit - nDebit;
-    int64 nFee = (wtx.IsFromMe() ? wtx.getValueOut() - nDebit : 0);
+    int64 nFee = (wtx->fromMe() ? wtx->tx.getValueOut() - nDebit : 0);
     
     entry.push_back(Pair("amount", ValueFromAmount(nNet - nFee)));
-    if (wtx.IsFromMe())
+    if (wtx->fromMe())
         entry.push_back(Pair("fee", ValueFromAmount(nFee)));
     
-    walletTxToJSON(_wallet.mapWallet[hash], entry);
+    walletTxToJSON(*wtx, entry);
     
     Array details;
-    listTransactions(_wallet.mapWallet[hash], "*", 0, false, details);
+    listTransactions(*snapshot, *wtx, "*", 0, false, details);
     entry.push_back(Pair("details", details));
     
     return entry;
@@ -935,6 +958,7 @@ Value BackupWallet::operator()(const Array& params, bool fHelp)
                             "Safely copies wallet.dat to destination, which can be a directory or a path with filename.");
     
     string strDest = params[0].get_str();
+    _wallet.Flush();
     ::BackupWallet(_wallet, strDest);
     
     return Value::null;
@@ -960,6 +984,36 @@ Value KeypoolRefill::operator()(const Array& params, bool fHelp)
     return Value::null;
 }
 
+Value WalletQueueStats::operator()(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 0)
+        throw RPC::error(RPC::invalid_params, "walletqueuestats\n"
+                            "Returns statistics of the queue feeding accepted blocks and transactions to the wallet.");
+    
+    WalletQueue::Stats stats = _wallet.queueStats();
+    
+    Object ret;
+    ret.push_back(Pair("capacity", (boost::int64_t)stats.capacity));
+    ret.push_back(Pair("queued", (boost::int64_t)stats.queued));
+    ret.push_back(Pair("highwater", (boost::int64_t)stats.high_water));
+    ret.push_back(Pair("posted", (boost::int64_t)stats.posted));
+    ret.push_back(Pair("processed", (boost::int64_t)stats.processed));
+    ret.push_back(Pair("blocked", (boost::int64_t)stats.blocked));
+    ret.push_back(Pair("blockedms", stats.blocked_us/1000.));
+    ret.push_back(Pair("latencyms", stats.processed ? stats.latency_us/1000./stats.processed : 0.));
+    ret.push_back(Pair("maxlatencyms", stats.max_latency_us/1000.));
+    return ret;
+}
+
+/// Lock the wallet on the timer, unless it was cancelled, or the wallet has been unloaded meanwhile.
+static void relock(Wallet::guard_ptr guard, const boost::system::error_code& error) {
+    if (error == boost::asio::error::operation_aborted)
+        return;
+    boost::mutex::scoped_lock lock(guard->mutex);
+    if (guard->wallet)
+        guard->wallet->Lock();
+}
+
 Value WalletPassphrase::operator()(const Array& params, bool fHelp)
 {
     if (_wallet.IsCrypted() && (fHelp || params.size() != 2))
@@ -1007,7 +1061,7 @@ Value WalletPassphrase::operator()(const Array& params, bool fHelp)
     //    CreateThread(ThreadCleanWalletPassphrase, pnSleepTime);
     
     _lock_timer.expires_from_now(boost::posix_time::seconds(timeout));
-    _lock_timer.async_wait(boost::bind(&Wallet::Lock, &_wallet));
+    _lock_timer.async_wait(boost::bind(&relock, _wallet.guard(), boost::asio::placeholders::error));
     
     return Value::null;
 }
@@ -1120,3 +1174,105 @@ Value ValidateAddress::operator()(const Array& params, bool fHelp)
     }
     return ret;
 }
+
+WalletRoute::WalletRoute(WalletManager& manager, Factory factory) : _manager(manager), _factory(factory) {
+    boost::shared_ptr<Wallet> wallet;
+    _default = method(_manager.defaultName(), wallet);
+    setName(_default->name());
+}
+
+string WalletRoute::walletName(const string& uri) {
+    const string prefix = "/wallet/";
+    if (uri.compare(0, prefix.size(), prefix) != 0)
+        return "";
+    return uri.substr(prefix.size(), uri.find_first_of("/?", prefix.size()) - prefix.size());
+}
+
+const string WalletRoute::group(const Request& request) const {
+    string name = walletName(request.uri);
+    return _default->group() + "/" + (name.empty() ? _manager.defaultName() : name);
+}
+
+method_ptr WalletRoute::method(const string& name, boost::shared_ptr<Wallet>& wallet) {
+    wallet = _manager.wallet(name);
+    if (!wallet) {
+        if (name.empty())
+            throw runtime_error("WalletRoute::method() : no default wallet");
+        throw RPC::error(RPC::invalid_params, "Wallet not loaded: " + name);
+    }
+    
+    mutex::scoped_lock lock(_mutex);
+    // drop the methods of the wallets unloaded - and with them their timers, e.g. to relock the wallet
+    for (map<string, Instance>::iterator entry = _instances.begin(); entry != _instances.end();) {
+        if (entry->second.wallet.expired())
+            _instances.erase(entry++);
+        else
+            ++entry;
+    }
+    Instance& instance = _instances[name.empty() ? _manager.defaultName() : name];
+    if (instance.wallet.lock() != wallet) {
+        instance.wallet = wallet;
+        instance.method = _factory(*wallet);
+    }
+    return instance.method;
+}
+
+Value WalletRoute::operator()(const Array& params, bool fHelp) {
+    boost::shared_ptr<Wallet> wallet;
+    return (*method("", wallet))(params, fHelp);
+}
+
+Value WalletRoute::operator()(const Array& params, bool fHelp, const Request& request) {
+    boost::shared_ptr<Wallet> wallet;
+    return (*method(walletName(request.uri), wallet))(params, fHelp, request);
+}
+
+void WalletRoute::operator()(const Array& params, bool fHelp, const Request& request, JSONWriter& writer) {
+    boost::shared_ptr<Wallet> wallet;
+    (*method(walletName(request.uri), wallet))(params, fHelp, request, writer);
+}
+
+Value ListWallets::operator()(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw RPC::error(RPC::invalid_params, "listwallets\n"
+                            "Returns the names of the wallets loaded - call a wallet method on /wallet/<name> for the wallet <name>.");
+    
+    string strDefault = _manager.defaultName();
+    Array ret;
+    BOOST_FOREACH(const string& name, _manager.names()) {
+        Object obj;
+        obj.push_back(Pair("name", name));
+        obj.push_back(Pair("default", name == strDefault));
+        ret.push_back(obj);
+    }
+    return ret;
+}
+
+Value WalletLoad::operator()(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw RPC::error(RPC::invalid_params, "loadwallet <name>\n"
+                            "Load the wallet <name>, or create it.");
+    
+    string strName = params[0].get_str();
+    try {
+        _manager.load(strName);
+    }
+    catch (std::runtime_error& e) {
+        throw RPC::error(RPC::invalid_params, e.what());
+    }
+    return strName;
+}
+
+Value WalletUnload::operator()(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw RPC::error(RPC::invalid_params, "unloadwallet <name>\n"
+                            "Unload the wallet <name> - the default wallet cannot be unloaded.");
+    
+    string strName = params[0].get_str();
+    if (!_manager.unload(strName))
+        throw RPC::error(RPC::invalid_params, "Wallet not loaded, or the default wallet: " + strName);
+    return Value::null;
+}
@@ -0,0 +1,213 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletScanner.h>
+#include <coinWallet/Wallet.h>
+
+#include <coinChain/BlockChain.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+using namespace std;
+using namespace boost;
+
+size_t ScriptMatcher::Hash::operator()(const uint160& hash) const {
+    // the hashes are uniformly distributed - any of their bits will do
+    size_t h;
+    memcpy(&h, hash.begin(), sizeof(h));
+    return h;
+}
+
+size_t ScriptMatcher::Hash::operator()(const uint256& hash) const {
+    size_t h;
+    memcpy(&h, hash.begin(), sizeof(h));
+    return h;
+}
+
+void ScriptMatcher::dataPatterns(const vector<unsigned char>& data, vector<uint160>& keys, vector<uint160>& scripts) {
+    if (data.size() == 20) {
+        uint160 hash;
+        memcpy(hash.begin(), &data[0], 20);
+        keys.push_back(hash);
+        scripts.push_back(hash);
+    }
+    else if (data.size() == 33 || data.size() == 65)
+        keys.push_back(toPubKeyHash(data));
+}
+
+void ScriptMatcher::patterns(const Script& script, vector<uint160>& keys, vector<uint160>& scripts) {
+    // pay to pubkey hash: OP_DUP OP_HASH160 <20 bytes> OP_EQUALVERIFY OP_CHECKSIG
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 && script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        uint160 hash;
+        memcpy(hash.begin(), &script[3], 20);
+        keys.push_back(hash);
+        return;
+    }
+    
+    // pay to script hash: OP_HASH160 <20 bytes> OP_EQUAL
+    if (script.size() == 23 && script[0] == OP_HASH160 && script[1] == 20 && script[22] == OP_EQUAL) {
+        uint160 hash;
+        memcpy(hash.begin(), &script[2], 20);
+        scripts.push_back(hash);
+        return;
+    }
+    
+    // pay to pubkey, multisig and other scripts - look for any pushed key or hash
+    Script::const_iterator pc = script.begin();
+    opcodetype opcode;
+    vector<unsigned char> data;
+    while (pc < script.end()) {
+        if (!script.getOp(pc, opcode, data))
+            break;
+        dataPatterns(data, keys, scripts);
+    }
+}
+
+void ScriptMatcher::signaturePatterns(const Script& signature, vector<uint160>& keys, vector<uint160>& scripts) {
+    Script::const_iterator pc = signature.begin();
+    opcodetype opcode;
+    vector<unsigned char> data;
+    while (pc < signature.end()) {
+        if (!signature.getOp(pc, opcode, data))
+            break;
+        dataPatterns(data, keys, scripts);
+        // the redeem script of a pay to script hash spend
+        if (data.size() > 65)
+            scripts.push_back(toScriptHash(Script(data.begin(), data.end())));
+    }
+}
+
+bool ScriptMatcher::matches(const vector<uint160>& keys, const vector<uint160>& scripts) const {
+    for (vector<uint160>::const_iterator key = keys.begin(); key != keys.end(); ++key)
+        if (_keys.count(*key))
+            return true;
+    for (vector<uint160>::const_iterator script = scripts.begin(); script != scripts.end(); ++script)
+        if (_scripts.count(*script))
+            return true;
+    return false;
+}
+
+bool ScriptMatcher::match(const Script& script) const {
+    vector<uint160> keys, scripts;
+    patterns(script, keys, scripts);
+    return matches(keys, scripts);
+}
+
+bool ScriptMatcher::matchSignature(const Script& signature) const {
+    vector<uint160> keys, scripts;
+    signaturePatterns(signature, keys, scripts);
+    return matches(keys, scripts);
+}
+
+bool ScriptMatcher::match(const Transaction& tx) const {
+    const Outputs& outputs = tx.getOutputs();
+    for (Outputs::const_iterator output = outputs.begin(); output != outputs.end(); ++output)
+        if (match(output->script()))
+            return true;
+    if (tx.isCoinBase())
+        return false;
+    const Inputs& inputs = tx.getInputs();
+    for (Inputs::const_iterator input = inputs.begin(); input != inputs.end(); ++input)
+        if (matchSignature(input->signature()))
+            return true;
+    return false;
+}
+
+WalletScanner::WalletScanner(Wallet& wallet, const BlockChain& blockChain, size_t threads) : _wallet(wallet), _blockChain(blockChain), _threads(threads) {
+    if (_threads == 0)
+        _threads = std::max(thread::hardware_concurrency(), 1U);
+    
+    // snapshot the patterns and the transactions of the wallet
+    CRITICAL_BLOCK(_wallet.cs_wallet) {
+        set<PubKeyHash> keys;
+        _wallet.getKeys(keys);
+        for (set<PubKeyHash>::const_iterator key = keys.begin(); key != keys.end(); ++key)
+            _matcher.addKey(*key);
+        set<ScriptHash> scripts;
+        _wallet.getScripts(scripts);
+        for (set<ScriptHash>::const_iterator script = scripts.begin(); script != scripts.end(); ++script)
+            _matcher.addScript(*script);
+        for (map<uint256, CWalletTx>::const_iterator wtx = _wallet.mapWallet.begin(); wtx != _wallet.mapWallet.end(); ++wtx)
+            _txes.insert(wtx->first);
+    }
+}
+
+void WalletScanner::read(const vector<const CBlockIndex*>& indices, size_t begin, size_t offset, vector<Block>& blocks, vector<vector<unsigned int> >& candidates) const {
+    for (size_t i = offset; i < blocks.size(); i += _threads) {
+        _blockChain.getBlock(indices[begin + i], blocks[i]);
+        const TransactionList& txes = blocks[i].getTransactions();
+        for (unsigned int idx = 0; idx < txes.size(); ++idx)
+            if (_matcher.match(txes[idx]))
+                candidates[i].push_back(idx);
+    }
+}
+
+int WalletScanner::scan(const CBlockIndex* start, bool update) {
+    vector<const CBlockIndex*> indices;
+    for (const CBlockIndex* pindex = start; pindex; pindex = pindex->pnext)
+        indices.push_back(pindex);
+    
+    printf("WalletScanner::scan() : scanning %d blocks for %d keys and scripts on %d threads\n", (int)indices.size(), (int)_matcher.size(), (int)_threads);
+    int64 started = GetTimeMillis();
+    int64 reported = started;
+    int ret = 0;
+    size_t batch = _threads * blocks_per_thread;
+    for (size_t begin = 0; begin < indices.size(); begin += batch) {
+        size_t count = std::min(batch, indices.size() - begin);
+        vector<Block> blocks(count);
+        vector<vector<unsigned int> > candidates(count);
+        thread_group readers;
+        for (size_t t = 0; t < std::min(_threads, count); ++t)
+            readers.create_thread(bind(&WalletScanner::read, this, cref(indices), begin, t, ref(blocks), ref(candidates)));
+        readers.join_all();
+        
+        // check the transactions in chain order - a spend can only be recognized once the spent transaction is known
+        CRITICAL_BLOCK(_wallet.cs_wallet) {
+            for (size_t i = 0; i < count; ++i) {
+                const TransactionList& txes = blocks[i].getTransactions();
+                vector<unsigned int>::const_iterator candidate = candidates[i].begin();
+                for (unsigned int idx = 0; idx < txes.size(); ++idx) {
+                    const Transaction& tx = txes[idx];
+                    bool involved = (candidate != candidates[i].end() && *candidate == idx);
+                    if (involved)
+                        ++candidate;
+                    else if (_txes.count(tx.getHash()))
+                        involved = true;
+                    else if (!tx.isCoinBase()) {
+                        const Inputs& inputs = tx.getInputs();
+                        for (Inputs::const_iterator input = inputs.begin(); input != inputs.end() && !involved; ++input)
+                            involved = _txes.count(input->prevout().hash);
+                    }
+                    if (involved && _wallet.AddToWalletIfInvolvingMe(tx, &blocks[i], update)) {
+                        _txes.insert(tx.getHash());
+                        ret++;
+                    }
+                }
+            }
+        }
+        
+        int64 now = GetTimeMillis();
+        if (now - reported > 10000 || begin + count == indices.size()) {
+            printf("WalletScanner::scan() : %d of %d blocks, %d transactions found, %"PRI64d"s\n", (int)(begin + count), (int)indices.size(), ret, (now - started)/1000);
+            reported = now;
+        }
+    }
+    return ret;
+}
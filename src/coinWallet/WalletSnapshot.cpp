@@ -0,0 +1,254 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletSnapshot.h>
+#include <coinWallet/Wallet.h>
+
+#include <climits>
+
+#include <boost/foreach.hpp>
+
+using namespace std;
+using namespace boost;
+
+const WalletSnapshot::Tx* WalletSnapshot::tx(const uint256& hash) const {
+    Txes::const_iterator tx = _txes.find(hash);
+    if (tx == _txes.end())
+        return NULL;
+    return tx->second.get();
+}
+
+bool WalletSnapshot::account(const ChainAddress& address, string& account) const {
+    AddressBook::const_iterator entry = _address_book.find(address);
+    if (entry == _address_book.end())
+        return false;
+    account = entry->second;
+    return true;
+}
+
+const WalletSnapshot::AddressIndex* WalletSnapshot::addressIndex(const ChainAddress& address) const {
+    Addresses::const_iterator index = _addresses.find(address);
+    if (index == _addresses.end())
+        return NULL;
+    return index->second.get();
+}
+
+const WalletSnapshot::AccountIndex* WalletSnapshot::accountIndex(const string& account) const {
+    Accounts::const_iterator index = _accounts.find(account);
+    if (index == _accounts.end())
+        return NULL;
+    return index->second.get();
+}
+
+int64 WalletSnapshot::tally(const Received& received, int best, int min_depth, int* conf) {
+    int64 amount = 0;
+    if (conf)
+        *conf = INT_MAX;
+    // the heights are ascending, so the depths are descending - but for the unconfirmed amounts first
+    for (Received::const_iterator r = received.begin(); r != received.end(); ++r) {
+        int depth = r->first < 0 ? 0 : best - r->first + 1;
+        if (depth < min_depth) {
+            if (r->first < 0)
+                continue;
+            break;
+        }
+        amount += r->second;
+        if (conf)
+            *conf = std::min(*conf, depth);
+    }
+    return amount;
+}
+
+WalletSnapshot::tx_ptr WalletSnapshot::snapshot(const CWalletTx& wtx, int height, const Wallet& wallet) {
+    shared_ptr<Tx> tx(new Tx);
+    tx->tx = wtx;
+    tx->hash = wtx.getHash();
+    tx->time = wtx.GetTxTime();
+    tx->height = height;
+    tx->final = wallet.isFinal(wtx);
+    tx->values = wtx.mapValue;
+    tx->debit = wallet.GetDebit(wtx);
+    tx->credit = wallet.GetCredit(wtx);
+    tx->fee = 0;
+    tx->sent_account = wtx.strFromAccount;
+    if (!wtx.isCoinBase()) {
+        int64 generatedImmature, generatedMature;
+        wtx.GetAmounts(generatedImmature, generatedMature, tx->received, tx->sent, tx->fee, tx->sent_account);
+    }
+    
+    BOOST_FOREACH(const Output& txout, wtx.getOutputs()) {
+        PubKeyHash pubKeyHash;
+        ScriptHash scriptHash;
+        if (ExtractAddress(txout.script(), pubKeyHash, scriptHash) && wallet.haveKey(pubKeyHash))
+            tx->mine.push_back(make_pair(wallet.chain().getAddress(pubKeyHash), txout.value()));
+    }
+    
+    return tx;
+}
+
+void WalletSnapshot::insert(tx_ptr tx) {
+    Txes::iterator old = _txes.find(tx->hash);
+    if (old != _txes.end())
+        index(*old->second, -1);
+    _txes[tx->hash] = tx;
+    index(*tx, 1);
+}
+
+void WalletSnapshot::erase(const uint256& hash) {
+    Txes::iterator old = _txes.find(hash);
+    if (old == _txes.end())
+        return;
+    index(*old->second, -1);
+    _txes.erase(hash);
+}
+
+void WalletSnapshot::setAccount(const ChainAddress& address, const string* account) {
+    // the transactions of the address are taken out of the aggregates of its old account and added to the new
+    vector<tx_ptr> txes;
+    if (const AddressIndex* index = addressIndex(address))
+        BOOST_FOREACH(const uint256& hash, index->txes)
+            txes.push_back(_txes.find(hash)->second);
+    BOOST_FOREACH(const tx_ptr& tx, txes)
+        index(*tx, -1);
+    
+    AddressBook::iterator entry = _address_book.find(address);
+    if (entry != _address_book.end()) {
+        string old = entry->second;
+        _address_book.erase(address);
+        AccountIndex& index = mutableAccount(old);
+        index.addresses.erase(address);
+        if (index.refs == 0 && index.addresses.empty() && index.txes.empty())
+            _accounts.erase(old);
+    }
+    if (account) {
+        _address_book[address] = *account;
+        mutableAccount(*account).addresses.insert(address);
+    }
+    
+    BOOST_FOREACH(const tx_ptr& tx, txes)
+        index(*tx, 1);
+}
+
+static void add(WalletSnapshot::Received& received, int height, int64 value) {
+    int64& amount = received[height];
+    amount += value;
+    if (amount == 0)
+        received.erase(height);
+}
+
+void WalletSnapshot::index(const Tx& tx, int64 sign) {
+    pair<int64, uint256> item(tx.time, tx.hash);
+    
+    // the addresses paid or credited
+    set<ChainAddress> addresses;
+    if (!tx.coinbase() && tx.final) {
+        BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& output, tx.mine) {
+            add(mutableAddress(output.first).received, tx.height, sign*output.second);
+            addresses.insert(output.first);
+        }
+    }
+    BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& r, tx.received)
+        addresses.insert(r.first);
+    BOOST_FOREACH(const ChainAddress& address, addresses) {
+        AddressIndex& index = mutableAddress(address);
+        if (sign > 0)
+            index.txes.insert(tx.hash);
+        else {
+            index.txes.erase(tx.hash);
+            if (index.txes.empty() && index.received.empty())
+                _addresses.erase(address);
+        }
+    }
+    
+    // the accounts with entries for the transaction - only final transactions are tallied, as by getbalance
+    set<string> listed;
+    if (tx.coinbase()) {
+        if (tx.credit) {
+            add(mutableAccount("").generated, tx.height, sign*tx.credit);
+            listed.insert("");
+        }
+    }
+    else {
+        if (!tx.sent.empty())
+            listed.insert(tx.sent_account);
+        BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& r, tx.received) {
+            string name;
+            account(r.first, name);
+            if (tx.final)
+                add(mutableAccount(name).credited, tx.height, sign*r.second);
+            listed.insert(name);
+        }
+    }
+    AccountIndex& sender = mutableAccount(tx.sent_account);
+    sender.refs += sign;
+    if (tx.final && !tx.coinbase()) {
+        int64 debited = tx.fee;
+        BOOST_FOREACH(const PAIRTYPE(ChainAddress, int64)& s, tx.sent)
+            debited += s.second;
+        sender.debited += sign*debited;
+    }
+    
+    BOOST_FOREACH(const string& name, listed) {
+        AccountIndex& index = mutableAccount(name);
+        if (sign > 0)
+            index.txes.insert(item);
+        else
+            index.txes.erase(item);
+    }
+    if (sign < 0) {
+        listed.insert(tx.sent_account);
+        BOOST_FOREACH(const string& name, listed) {
+            const AccountIndex* index = accountIndex(name);
+            if (index && index->refs == 0 && index->addresses.empty() && index->txes.empty())
+                _accounts.erase(name);
+        }
+    }
+    
+    if (listed.empty())
+        return;
+    if (sign > 0)
+        _all.insert(item);
+    else
+        _all.erase(item);
+}
+
+WalletSnapshot::AddressIndex& WalletSnapshot::mutableAddress(const ChainAddress& address) {
+    shared_ptr<const AddressIndex>& index = _addresses[address];
+    if (!index || index->epoch != _epoch) {
+        shared_ptr<AddressIndex> copy(index ? new AddressIndex(*index) : new AddressIndex);
+        copy->epoch = _epoch;
+        index = copy;
+    }
+    // owned by this snapshot, which is not yet published
+    return const_cast<AddressIndex&>(*index);
+}
+
+WalletSnapshot::AccountIndex& WalletSnapshot::mutableAccount(const string& account) {
+    shared_ptr<const AccountIndex>& index = _accounts[account];
+    if (!index || index->epoch != _epoch) {
+        shared_ptr<AccountIndex> copy;
+        if (index)
+            copy.reset(new AccountIndex(*index));
+        else {
+            copy.reset(new AccountIndex);
+            copy->refs = 0;
+            copy->debited = 0;
+        }
+        copy->epoch = _epoch;
+        index = copy;
+    }
+    return const_cast<AccountIndex&>(*index);
+}
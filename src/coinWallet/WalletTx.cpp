@@ -265,9 +265,9 @@ void CWalletTx::AddSupportingTransactions(const BlockChain& blockChain)
     reverse(vtxPrev.begin(), vtxPrev.end());
 }
 
-bool CWalletTx::WriteToDisk()
+void CWalletTx::WriteToDisk()
 {
-    return pwallet->WriteToDisk(*this);
+    pwallet->WriteToDisk(*this);
 }
 /*
 bool CWalletTx::AcceptWalletTransaction(CTxDB& txdb, bool fCheckInputs)
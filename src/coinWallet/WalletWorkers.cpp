@@ -0,0 +1,39 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletWorkers.h>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+
+WalletWorkers::WalletWorkers(size_t threads) : _events_work(new asio::io_service::work(_events)), _writes_work(new asio::io_service::work(_writes)) {
+    typedef size_t (asio::io_service::*Run)();
+    Run run = &asio::io_service::run;
+    size_t count = threads ? threads : std::max(thread::hardware_concurrency(), 1u);
+    for (size_t i = 0; i < count; ++i)
+        _event_threads.create_thread(bind(run, &_events));
+    _write_threads.create_thread(bind(run, &_writes));
+}
+
+WalletWorkers::~WalletWorkers() {
+    // the events first, as they flush through the writer
+    _events_work.reset();
+    _event_threads.join_all();
+    _writes_work.reset();
+    _write_threads.join_all();
+}
@@ -0,0 +1,91 @@
+/* -*-c++-*- libcoin - Copyright (C) 2012 Michael Gronager
+ *
+ * libcoin is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libcoin is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with libcoin.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <coinWallet/WalletWriter.h>
+#include <coinWallet/WalletDB.h>
+
+#include <boost/bind.hpp>
+
+using namespace std;
+using namespace boost;
+
+WalletWriter::WalletWriter(const string& dataDir, const string& file, asio::io_service& writer) : _dataDir(dataDir), _file(file), _scheduled(false), _failed(false), _posted(0), _commits(0), _committed(0), _writer(writer) {
+}
+
+WalletWriter::~WalletWriter() {
+    {
+        mutex::scoped_lock lock(_mutex);
+        while (_posted)
+            _returned.wait(lock);
+    }
+    flush();
+}
+
+bool WalletWriter::flush() {
+    mutex::scoped_lock flush(_flush);
+    WalletRecords records;
+    {
+        mutex::scoped_lock lock(_mutex);
+        records.swap(_records);
+    }
+    if (records.empty())
+        return true;
+    
+    if (CWalletDB(_dataDir, _file).WriteRecords(records)) {
+        _commits++;
+        _committed += records.size();
+        mutex::scoped_lock lock(_mutex);
+        _failed = false;
+        return true;
+    }
+    
+    printf("WalletWriter::flush() : commit of %d records failed\n", (int)records.size());
+    mutex::scoped_lock lock(_mutex);
+    _failed = true;
+    // insert keeps the records written since
+    _records.insert(records.begin(), records.end());
+    return false;
+}
+
+bool WalletWriter::failed() const {
+    mutex::scoped_lock lock(_mutex);
+    return _failed;
+}
+
+void WalletWriter::flushAsync() {
+    mutex::scoped_lock lock(_mutex);
+    if (_scheduled || _records.empty())
+        return;
+    _scheduled = true;
+    _posted++;
+    _writer.post(bind(&WalletWriter::scheduled, this));
+}
+
+void WalletWriter::scheduled() {
+    {
+        mutex::scoped_lock lock(_mutex);
+        _scheduled = false;
+    }
+    flush();
+    mutex::scoped_lock lock(_mutex);
+    if (--_posted == 0)
+        _returned.notify_all();
+}
+
+size_t WalletWriter::pending() const {
+    mutex::scoped_lock lock(_mutex);
+    return _records.size();
+}